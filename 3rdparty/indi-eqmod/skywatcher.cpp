@@ -865,7 +865,7 @@ bool Skywatcher::dispatch_command(SkywatcherCommand cmd, SkywatcherAxis axis, ch
 #ifdef WITH_SIMULATOR
   if (!isSimulation()) {
 #endif
-  tcflush(fd, TCIOFLUSH);
+  tty_flush(fd, TCIOFLUSH);
   
   if  ( (err_code = tty_write_string(fd, command, &nbytes_written) != TTY_OK))
     {
@@ -729,7 +729,7 @@ bool SpectraCyber::dispatch_command(SpectrometerCommand command_type)
    INumberVectorProperty *nProp = NULL;
    ISwitchVectorProperty *sProp = NULL;
 
-   tcflush(fd, TCIOFLUSH);
+   tty_flush(fd, TCIOFLUSH);
 
    switch (command_type)
    {
@@ -20,8 +20,15 @@
 #endif
 
 /* Pair of functions to convert to/from base64.
- * Also can be used to build a standalone utility and a loopback test.
+ * Also can be used to build a standalone utility, a loopback test, an
+ * equivalence test and a benchmark.
  * see http://www.faqs.org/rfcs/rfc3548.html
+ *
+ * On x86 the bulk of the work is done 16 or 32 characters at a time with
+ * SSSE3 or AVX2 if the cpu has them, chosen at the first call. The portable
+ * scalar code is kept for everything else and for the odd bytes at the ends.
+ * The vector kernels follow W. Mula and D. Lemire, "Faster Base64 Encoding
+ * and Decoding using AVX2 Instructions".
  */
 
 /** \file base64.c
@@ -30,8 +37,33 @@
 */
 
 #include <ctype.h>
+#include <string.h>
 #include "base64.h"
 
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__clang__) || \
+	__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define	BASE64_X86
+#include <immintrin.h>
+#endif
+
+typedef int (*ToFunc)(unsigned char *out, const unsigned char *in, int inlen);
+typedef int (*FromFunc)(char *out, const char *in);
+
+/* a function that decodes size plain base64 digits at once */
+typedef struct {
+    int (*fn)(char *out, const char *in);
+    int size;
+} Block;
+
+static int to64scalar (unsigned char *out, const unsigned char *in, int inlen);
+static int from64scalar (char *out, const char *in);
+static int from64blocks (char *out, const char *in, const Block *blocks);
+static void pickImpl (void);
+
+/* implementations in use, set by pickImpl() on first call */
+static ToFunc to64impl;
+static FromFunc from64impl;
+
 static const char base64digits[] =
    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
@@ -54,6 +86,78 @@ static const char base64val[] = {
  */
 int
 to64frombits(unsigned char *out, const unsigned char *in, int inlen)
+{
+    if (!to64impl)
+	pickImpl();
+    return ((*to64impl)(out, in, inlen));
+}
+
+/* convert base64 at in to raw bytes out, returning count or <0 on error.
+ * base64 may contain any embedded whitespace.
+ * out should be at least 3/4 the length of in.
+ */
+int
+from64tobits(char *out, const char *in)
+{
+    if (!from64impl)
+	pickImpl();
+    return ((*from64impl)(out, in));
+}
+
+/* start encoding to base64 in pieces */
+void
+to64init(To64Stream *sp)
+{
+    sp->nfrag = 0;
+}
+
+/* encode inlen more raw bytes at in to base64 at out, as far as whole groups
+ * of 3 allow, saving the rest in sp for next time.
+ * out size should be at least 4*inlen/3 + 4.
+ * return length of out (sans trailing NUL).
+ */
+int
+to64chunk(To64Stream *sp, unsigned char *out, const unsigned char *in,
+int inlen)
+{
+    int n = 0;
+
+    /* finish any fragment left from last time */
+    if (sp->nfrag > 0) {
+	while (sp->nfrag < 3 && inlen > 0) {
+	    sp->frag[sp->nfrag++] = *in++;
+	    inlen--;
+	}
+	if (sp->nfrag < 3) {
+	    *out = '\0';
+	    return (0);
+	}
+	n = to64scalar (out, sp->frag, 3);
+	sp->nfrag = 0;
+    }
+
+    /* encode all whole groups, save the rest */
+    sp->nfrag = inlen % 3;
+    memcpy (sp->frag, in + inlen - sp->nfrag, sp->nfrag);
+    return (n + to64frombits (out + n, in, inlen - sp->nfrag));
+}
+
+/* finish encoding to base64 in pieces, writing any final padded group to out.
+ * out size should be at least 5.
+ * return length of out (sans trailing NUL).
+ */
+int
+to64flush(To64Stream *sp, unsigned char *out)
+{
+    int n = to64scalar (out, sp->frag, sp->nfrag);
+
+    sp->nfrag = 0;
+    return (n);
+}
+
+/* portable version of to64frombits() */
+static int
+to64scalar(unsigned char *out, const unsigned char *in, int inlen)
 {
     unsigned char *out0 = out;
 
@@ -82,17 +186,51 @@ to64frombits(unsigned char *out, const unsigned char *in, int inlen)
     return (out-out0);
 }
 
-/* convert base64 at in to raw bytes out, returning count or <0 on error.
- * base64 may contain any embedded whitespace.
- * out should be at least 3/4 the length of in.
+/* portable version of from64tobits() */
+static int
+from64scalar(char *out, const char *in)
+{
+    return (from64blocks (out, in, NULL));
+}
+
+/* from64tobits() with the help of block functions, largest first, ending
+ * with a NULL fn. each returns 0 if its digits are not all plain digits.
+ * everything else is done one group of 4 at a time.
  */
-int
-from64tobits(char *out, const char *in)
+static int
+from64blocks(char *out, const char *in, const Block *blocks)
 {
+    const char *end = blocks ? in + strlen(in) : NULL;
     int len = 0;
     register unsigned char digit1, digit2, digit3, digit4;
 
-    do {
+    for (;;) {
+	/* as many blocks as possible, they always end on a group boundary */
+	if (blocks) {
+	    const Block *bp = blocks;
+	    int len0 = len;
+
+	    while (bp->fn) {
+		if (end - in >= bp->size && (*bp->fn)(out, in)) {
+		    in += bp->size;
+		    out += 3*bp->size/4;
+		    len += 3*bp->size/4;
+		    bp = blocks;
+		} else if (isspace(*in)) {
+		    in++;
+		    bp = blocks;
+		} else
+		    bp++;
+	    }
+	    if (len > len0) {
+		while (isspace(*in))
+		    in++;
+		if (!*in)
+		    break;
+		continue;
+	    }
+	}
+
 	do {digit1 = *in++;} while (isspace(digit1));
         if (DECODE64(digit1) == BAD)
             return(-1);
@@ -119,11 +257,234 @@ from64tobits(char *out, const char *in)
         }
 	while (isspace(*in))
 	    in++;
-    } while (*in && digit4 != '=');
+	if (!*in || digit4 == '=')
+	    break;
+    }
 
     return (len);
 }
 
+#ifdef BASE64_X86
+
+/* SSSE3 to64frombits(), 12 bytes to 16 digits at a time */
+__attribute__((target("ssse3")))
+static int
+to64ssse3(unsigned char *out, const unsigned char *in, int inlen)
+{
+    const __m128i shuf = _mm_setr_epi8(1,0,2,1, 4,3,5,4, 7,6,8,7, 10,9,11,10);
+    const __m128i shift = _mm_setr_epi8('a'-26, '0'-52, '0'-52, '0'-52,
+	'0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '+'-62,
+	'/'-63, 'A', 0, 0);
+    int n = 0;
+
+    /* each load reads 16 but uses 12 */
+    for (; inlen >= 16; inlen -= 12) {
+	__m128i v = _mm_loadu_si128 ((const __m128i *)in);
+	__m128i lo, hi, r;
+
+	/* spread each 3 bytes into 4 sextets, one per byte */
+	v = _mm_shuffle_epi8 (v, shuf);
+	hi = _mm_mulhi_epu16 (_mm_and_si128 (v, _mm_set1_epi32(0x0fc0fc00)),
+						_mm_set1_epi32(0x04000040));
+	lo = _mm_mullo_epi16 (_mm_and_si128 (v, _mm_set1_epi32(0x003f03f0)),
+						_mm_set1_epi32(0x01000010));
+	v = _mm_or_si128 (hi, lo);
+
+	/* map 0..63 to their digits by adding an offset per range */
+	r = _mm_subs_epu8 (v, _mm_set1_epi8(51));
+	r = _mm_or_si128 (r, _mm_and_si128 (_mm_cmpgt_epi8 (_mm_set1_epi8(26),
+						v), _mm_set1_epi8(13)));
+	v = _mm_add_epi8 (v, _mm_shuffle_epi8 (shift, r));
+
+	_mm_storeu_si128 ((__m128i *)(out+n), v);
+	in += 12;
+	n += 16;
+    }
+
+    return (n + to64scalar (out+n, in, inlen));
+}
+
+/* AVX2 to64frombits(), 24 bytes to 32 digits at a time */
+__attribute__((target("avx2")))
+static int
+to64avx2(unsigned char *out, const unsigned char *in, int inlen)
+{
+    const __m256i shuf = _mm256_setr_epi8(1,0,2,1, 4,3,5,4, 7,6,8,7, 10,9,11,10,
+				      1,0,2,1, 4,3,5,4, 7,6,8,7, 10,9,11,10);
+    const __m256i shift = _mm256_setr_epi8('a'-26, '0'-52, '0'-52, '0'-52,
+	'0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '+'-62,
+	'/'-63, 'A', 0, 0, 'a'-26, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52,
+	'0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '+'-62, '/'-63, 'A', 0, 0);
+    int n = 0;
+
+    /* each lane reads 16 but uses 12, the second starts at 12 */
+    for (; inlen >= 28; inlen -= 24) {
+	__m256i v = _mm256_inserti128_si256 (_mm256_castsi128_si256 (
+		_mm_loadu_si128 ((const __m128i *)in)),
+		_mm_loadu_si128 ((const __m128i *)(in+12)), 1);
+	__m256i lo, hi, r;
+
+	v = _mm256_shuffle_epi8 (v, shuf);
+	hi = _mm256_mulhi_epu16 (_mm256_and_si256 (v,
+		_mm256_set1_epi32(0x0fc0fc00)), _mm256_set1_epi32(0x04000040));
+	lo = _mm256_mullo_epi16 (_mm256_and_si256 (v,
+		_mm256_set1_epi32(0x003f03f0)), _mm256_set1_epi32(0x01000010));
+	v = _mm256_or_si256 (hi, lo);
+
+	r = _mm256_subs_epu8 (v, _mm256_set1_epi8(51));
+	r = _mm256_or_si256 (r, _mm256_and_si256 (_mm256_cmpgt_epi8 (
+		_mm256_set1_epi8(26), v), _mm256_set1_epi8(13)));
+	v = _mm256_add_epi8 (v, _mm256_shuffle_epi8 (shift, r));
+
+	_mm256_storeu_si256 ((__m256i *)(out+n), v);
+	in += 24;
+	n += 32;
+    }
+
+    return (n + to64ssse3 (out+n, in, inlen));
+}
+
+/* decode the first n, 8 or 16, digits in v to 3*n/4 bytes at out with SSSE3.
+ * return 1 if ok, 0 if any is not a plain digit and out is untouched.
+ */
+__attribute__((target("ssse3")))
+static inline int
+from64sse(char *out, __m128i v, int n)
+{
+    /* bit sets of valid low nibbles per high nibble class, and the offset
+     * from digit to value for each high nibble, with '/' moved to 1.
+     */
+    const __m128i lutlo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11,
+	0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+    const __m128i luthi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08,
+	0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lutroll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+	0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i nib = _mm_set1_epi8(0x0f);
+    __m128i hin = _mm_and_si128 (_mm_srli_epi32 (v, 4), nib);
+    __m128i bad = _mm_and_si128 (_mm_shuffle_epi8 (lutlo, _mm_and_si128(v,nib)),
+				 _mm_shuffle_epi8 (luthi, hin));
+    int good = (1 << n) - 1;
+    char tmp[16];
+
+    if ((_mm_movemask_epi8 (_mm_cmpeq_epi8 (bad, _mm_setzero_si128())) & good)
+								    != good)
+	return (0);
+
+    v = _mm_add_epi8 (v, _mm_shuffle_epi8 (lutroll, _mm_add_epi8 (hin,
+			    _mm_cmpeq_epi8 (v, _mm_set1_epi8('/')))));
+
+    /* pack 4 sextets into 3 bytes, big-endian */
+    v = _mm_maddubs_epi16 (v, _mm_set1_epi32(0x01400140));
+    v = _mm_madd_epi16 (v, _mm_set1_epi32(0x00011000));
+    v = _mm_shuffle_epi8 (v, _mm_setr_epi8(2,1,0, 6,5,4, 10,9,8, 14,13,12,
+							    -1,-1,-1,-1));
+    _mm_storeu_si128 ((__m128i *)tmp, v);
+    memcpy (out, tmp, 3*n/4);
+    return (1);
+}
+
+/* decode 16 plain digits at in to 12 bytes at out */
+__attribute__((target("ssse3")))
+static int
+from64block16(char *out, const char *in)
+{
+    return (from64sse (out, _mm_loadu_si128 ((const __m128i *)in), 16));
+}
+
+/* decode 8 plain digits at in to 6 bytes at out, such as the end of a line */
+__attribute__((target("ssse3")))
+static int
+from64block8(char *out, const char *in)
+{
+    return (from64sse (out, _mm_loadl_epi64 ((const __m128i *)in), 8));
+}
+
+/* decode 32 plain digits at in to 24 bytes at out with AVX2.
+ * return 1 if ok, 0 if any is not a plain digit and out is untouched.
+ */
+__attribute__((target("avx2")))
+static int
+from64block32(char *out, const char *in)
+{
+    const __m256i lutlo = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11,
+	0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a,
+	0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a,
+	0x1b, 0x1b, 0x1b, 0x1a);
+    const __m256i luthi = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08,
+	0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+	0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10,
+	0x10, 0x10, 0x10, 0x10);
+    const __m256i lutroll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 16, 19, 4, -65, -65, -71, -71,
+	0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i nib = _mm256_set1_epi8(0x0f);
+    __m256i v = _mm256_loadu_si256 ((const __m256i *)in);
+    __m256i hin = _mm256_and_si256 (_mm256_srli_epi32 (v, 4), nib);
+    __m256i bad = _mm256_and_si256 (_mm256_shuffle_epi8 (lutlo,
+		_mm256_and_si256 (v, nib)), _mm256_shuffle_epi8 (luthi, hin));
+    char tmp[32];
+
+    if (!_mm256_testz_si256 (bad, bad))
+	return (0);
+
+    v = _mm256_add_epi8 (v, _mm256_shuffle_epi8 (lutroll, _mm256_add_epi8 (hin,
+			    _mm256_cmpeq_epi8 (v, _mm256_set1_epi8('/')))));
+
+    /* pack each lane to 12 bytes, then close the gap between them */
+    v = _mm256_maddubs_epi16 (v, _mm256_set1_epi32(0x01400140));
+    v = _mm256_madd_epi16 (v, _mm256_set1_epi32(0x00011000));
+    v = _mm256_shuffle_epi8 (v, _mm256_setr_epi8(2,1,0, 6,5,4, 10,9,8,
+	14,13,12, -1,-1,-1,-1, 2,1,0, 6,5,4, 10,9,8, 14,13,12, -1,-1,-1,-1));
+    v = _mm256_permutevar8x32_epi32 (v, _mm256_setr_epi32(0,1,2,4,5,6,3,7));
+    _mm256_storeu_si256 ((__m256i *)tmp, v);
+    memcpy (out, tmp, 24);
+    return (1);
+}
+
+static int
+from64ssse3(char *out, const char *in)
+{
+    static const Block blocks[] = {
+	{from64block16, 16}, {from64block8, 8}, {NULL, 0}
+    };
+
+    return (from64blocks (out, in, blocks));
+}
+
+static int
+from64avx2(char *out, const char *in)
+{
+    static const Block blocks[] = {
+	{from64block32, 32}, {from64block16, 16}, {from64block8, 8}, {NULL, 0}
+    };
+
+    return (from64blocks (out, in, blocks));
+}
+
+#endif /* BASE64_X86 */
+
+/* choose the fastest implementations this cpu supports */
+static void
+pickImpl (void)
+{
+#ifdef BASE64_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports ("avx2")) {
+	from64impl = from64avx2;
+	to64impl = to64avx2;
+	return;
+    }
+    if (__builtin_cpu_supports ("ssse3")) {
+	from64impl = from64ssse3;
+	to64impl = to64ssse3;
+	return;
+    }
+#endif
+    from64impl = from64scalar;
+    to64impl = to64scalar;
+}
+
 #ifdef BASE64_PROGRAM
 /* standalone program that converts to/from base64.
  * cc -o base64 -DBASE64_PROGRAM base64.c
@@ -244,5 +605,218 @@ main (int ac, char *av[])
 	return (0);
 }
 #endif
+
+#if defined(EQUIVALENCE_TEST) || defined(BASE64_BENCH)
+/* implementations to compare, scalar first */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static struct {
+    const char *name;
+    ToFunc to;
+    FromFunc from;
+    int level;				/* 0 any, 1 ssse3, 2 avx2 */
+} impls[] = {
+    {"scalar", to64scalar, from64scalar, 0},
+#ifdef BASE64_X86
+    {"ssse3", to64ssse3, from64ssse3, 1},
+    {"avx2", to64avx2, from64avx2, 2},
+#endif
+};
+#define	NIMPLS	((int)(sizeof(impls)/sizeof(impls[0])))
+
+/* return 1 if this cpu can run impls[i] */
+static int
+canRun (int i)
+{
+    int level = 0;
+
+#ifdef BASE64_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports ("avx2"))
+	level = 2;
+    else if (__builtin_cpu_supports ("ssse3"))
+	level = 1;
+#endif
+    return (impls[i].level <= level);
+}
+
+#endif
+
+#ifdef EQUIVALENCE_TEST
+/* standalone test that checks each vector implementation gets the same result
+ * as the scalar code, for random data and random corruptions of its base64.
+ * cc -O2 -o base64test -DEQUIVALENCE_TEST base64.c
+ * exit 0 if all agree else 1
+ */
+
+#define	MAXRAW	1000
+
+/* insert whitespace and bad characters at random into b64 */
+static void
+mangle (char *b64)
+{
+    static const char junk[] = " \n\t\r=*-_.\x80\xff";
+    int l = strlen (b64);
+    int n = rand() % 4;
+
+    while (n-- > 0) {
+	int at = l > 0 ? rand() % (l+1) : 0;
+	switch (rand() % 3) {
+	case 0:	/* insert */
+	    memmove (b64+at+1, b64+at, l-at+1);
+	    b64[at] = junk[rand() % (sizeof(junk)-1)];
+	    l++;
+	    break;
+	case 1:	/* replace */
+	    if (at < l)
+		b64[at] = junk[rand() % (sizeof(junk)-1)];
+	    break;
+	case 2:	/* truncate */
+	    b64[at] = '\0';
+	    l = at;
+	    break;
+	}
+    }
+}
+
+int
+main (int ac, char *av[])
+{
+	unsigned char raw[MAXRAW], b64[2*MAXRAW], b64v[2*MAXRAW];
+	char back[MAXRAW+64], backv[MAXRAW+64];
+	int iter, i, j, nbad = 0;
+	int niter = ac > 1 ? atoi(av[1]) : 200000;
+
+	srand (1);
+
+	for (iter = 0; iter < niter; iter++) {
+	    int nraw = rand() % MAXRAW;
+	    int nb64, nback;
+	    To64Stream st;
+
+	    for (j = 0; j < nraw; j++)
+		raw[j] = rand();
+	    nb64 = to64scalar (b64, raw, nraw);
+
+	    /* encode with each, whole and in random pieces */
+	    for (i = 1; i < NIMPLS; i++) {
+		if (!canRun(i))
+		    continue;
+		if ((*impls[i].to)(b64v, raw, nraw) != nb64
+					    || memcmp (b64v, b64, nb64+1)) {
+		    fprintf (stderr, "%s: encode %d differs\n", impls[i].name,
+									nraw);
+		    nbad++;
+		}
+	    }
+	    to64init (&st);
+	    for (j = 0, i = 0; j < nraw; ) {
+		int n = rand() % (nraw - j + 1);
+		i += to64chunk (&st, b64v+i, raw+j, n);
+		j += n;
+	    }
+	    i += to64flush (&st, b64v+i);
+	    if (i != nb64 || memcmp (b64v, b64, nb64+1)) {
+		fprintf (stderr, "stream: encode %d differs\n", nraw);
+		nbad++;
+	    }
+
+	    /* wrap like IDSetBLOB, then maybe spoil it */
+	    for (i = j = 0; i < nb64; i++) {
+		b64v[j++] = b64[i];
+		if (i % 72 == 71)
+		    b64v[j++] = '\n';
+	    }
+	    b64v[j] = '\0';
+	    if (iter & 1)
+		mangle ((char *)b64v);
+
+	    /* decode with each */
+	    nback = from64scalar (back, (char *)b64v);
+	    if (!(iter & 1) && nraw > 0 && (nback != nraw || memcmp (back, raw, nraw))) {
+		fprintf (stderr, "scalar: loopback %d fails\n", nraw);
+		nbad++;
+	    }
+	    for (i = 1; i < NIMPLS; i++) {
+		if (!canRun(i))
+		    continue;
+		j = (*impls[i].from)(backv, (char *)b64v);
+		if (j != nback || (j > 0 && memcmp (backv, back, j))) {
+		    fprintf (stderr, "%s: decode of %s gives %d not %d\n",
+					    impls[i].name, b64v, j, nback);
+		    nbad++;
+		}
+	    }
+	}
+
+	printf ("%d iterations, %d differences\n", niter, nbad);
+	return (nbad ? 1 : 0);
+}
+#endif
+
+#ifdef BASE64_BENCH
+/* standalone program that reports the speed of each implementation.
+ * cc -O2 -o base64bench -DBASE64_BENCH base64.c
+ */
+
+#include <sys/time.h>
+
+static double
+now (void)
+{
+	struct timeval tv;
+
+	gettimeofday (&tv, NULL);
+	return (tv.tv_sec + tv.tv_usec/1e6);
+}
+
+int
+main (int ac, char *av[])
+{
+	int nraw = (ac > 1 ? atoi(av[1]) : 64) << 20;
+	unsigned char *raw = malloc (nraw);
+	unsigned char *b64 = malloc (4*nraw/3 + 4);
+	unsigned char *lines = malloc (4*nraw/3*73/72 + 4);
+	char *back = malloc (nraw + 64);
+	int i, j, nb64;
+
+	for (i = 0; i < nraw; i++)
+	    raw[i] = rand();
+
+	for (i = 0; i < NIMPLS; i++) {
+	    double tenc, tdec;
+
+	    if (!canRun(i))
+		continue;
+
+	    tenc = now();
+	    nb64 = (*impls[i].to)(b64, raw, nraw);
+	    tenc = now() - tenc;
+
+	    /* decode as it arrives from IDSetBLOB, 72 per line */
+	    for (j = 0, nb64 = 0; b64[j]; j += 72)
+		nb64 += sprintf ((char *)lines+nb64, "%.72s\n", b64+j);
+	    tdec = now();
+	    if ((*impls[i].from)(back, (char *)lines) != nraw) {
+		fprintf (stderr, "%s: loopback fails\n", impls[i].name);
+		return (1);
+	    }
+	    tdec = now() - tdec;
+	    if (memcmp (back, raw, nraw)) {
+		fprintf (stderr, "%s: loopback fails\n", impls[i].name);
+		return (1);
+	    }
+
+	    printf ("%-8s encode %7.1f MB/s  decode %7.1f MB/s\n",
+			impls[i].name, nraw/1e6/tenc, nraw/1e6/tdec);
+	}
+
+	return (0);
+}
+#endif
+
 /* For RCS Only -- Do Not Edit */
 static char *rcsid[2] = {(char *)rcsid, "@(#) $RCSfile$ $Date: 2006-09-30 14:19:41 +0300 (Sat, 30 Sep 2006) $ $Revision: 590506 $ $Name:  $"};
@@ -47,6 +47,34 @@ extern int to64frombits(unsigned char *out, const unsigned char *in,
 
 extern int from64tobits(char *out, const char *in);
 
+/** \brief State of a conversion to base64 done in pieces. */
+typedef struct {
+    unsigned char frag[3];	/* raw bytes not yet converted */
+    int nfrag;			/* number of bytes in frag */
+} To64Stream;
+
+/** \brief Start a conversion to base64 in pieces.
+    \param sp conversion state to initialize.
+ */
+extern void to64init(To64Stream *sp);
+
+/** \brief Convert more bytes to base64, as far as complete groups of 3 bytes allow. The rest are kept in sp for the next call.
+    \param sp conversion state started with to64init().
+    \param out output buffer in base64. The buffer size must be at least (4 * inlen / 3 + 4) bytes long.
+    \param in input binary buffer
+    \param inlen number of bytes to convert
+    \return number of base64 characters written to out, which is NUL-terminated.
+ */
+extern int to64chunk(To64Stream *sp, unsigned char *out,
+    const unsigned char *in, int inlen);
+
+/** \brief Finish a conversion to base64 in pieces. The output of all calls to to64chunk() then this one is the same as to64frombits() of all the input at once.
+    \param sp conversion state started with to64init().
+    \param out output buffer in base64. The buffer size must be at least 5 bytes long.
+    \return number of base64 characters written to out, which is NUL-terminated.
+ */
+extern int to64flush(To64Stream *sp, unsigned char *out);
+
 /*@}*/
 
 #ifdef __cplusplus
@@ -1,6 +1,15 @@
 /* Define to 1 if you have the <linux/videodev2.h> header file. */
 #cmakedefine HAVE_LINUX_VIDEODEV2_H 1
 
+/* Define to 1 if you have the <sys/epoll.h> header file. */
+#cmakedefine HAVE_SYS_EPOLL_H 1
+
+/* Define to 1 if you have the <sys/timerfd.h> header file. */
+#cmakedefine HAVE_SYS_TIMERFD_H 1
+
+/* Define to 1 if you have the <sys/eventfd.h> header file. */
+#cmakedefine HAVE_SYS_EVENTFD_H 1
+
 /* The symbol timezone is an int, not a function */
 #define TIMEZONE_IS_INT 1
 
@@ -13,6 +22,12 @@
 /* Define if you have libnova.h */
 #cmakedefine   HAVE_NOVA_H 1
 
+/* Define if you have lz4.h */
+#cmakedefine   HAVE_LZ4_H 1
+
+/* Define if you have zstd.h */
+#cmakedefine   HAVE_ZSTD_H 1
+
 /* Set INDI Library version */
 #cmakedefine CMAKE_INDI_VERSION_STRING "@CMAKE_INDI_VERSION_STRING@"
 
@@ -0,0 +1,400 @@
+/*******************************************************************************
+ CCD Simulator star catalog
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+
+ Define CCD_SIM_CATALOG_TOOL for indi_simulator_catalog, which writes an
+ index from gsc output or "ra dec mag" lines, for example
+     gsc -c 0 +0 -r 10800 -m 0 14 -n 10000000 | indi_simulator_catalog stars.idx
+*******************************************************************************/
+
+#include "ccd_sim_catalog.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <string>
+
+/*  The index file, in the byte order of the machine that wrote it:
+    the header, NZONES+1 offsets where the zones start in the star table,
+    then the stars. Zone i holds declinations from -90+i*ZONEHEIGHT, sorted
+    by right ascension. */
+#define INDEX_MAGIC     "INDISTAR"
+#define INDEX_VERSION   1
+#define NZONES          360
+#define ZONEHEIGHT      (180.0/NZONES)
+
+//  how much wider than asked a lookup goes, so the next frames hit the cache
+#define QUERY_MARGIN    1.25
+#define QUERY_SLACK     1.0     //  arcminutes
+
+#define DEG2RAD         0.0174532925199433
+
+namespace
+{
+
+struct Header
+{
+    char magic[8];
+    unsigned int version;
+    unsigned int nzones;
+    unsigned int nstars;
+    unsigned int reserved;
+};
+
+int zoneOf(double dec)
+{
+    int z=(int)floor((dec+90.0)/ZONEHEIGHT);
+    if (z < 0) z=0;
+    if (z >= NZONES) z=NZONES-1;
+    return z;
+}
+
+bool zoneOrder(const CCDSimCatalog::Star &a, const CCDSimCatalog::Star &b)
+{
+    int za=zoneOf(a.dec), zb=zoneOf(b.dec);
+    if (za != zb) return za < zb;
+    if (a.ra != b.ra) return a.ra < b.ra;
+    if (a.dec != b.dec) return a.dec < b.dec;
+    return a.mag < b.mag;
+}
+
+bool sameStar(const CCDSimCatalog::Star &a, const CCDSimCatalog::Star &b)
+{
+    return a.ra == b.ra && a.dec == b.dec && a.mag == b.mag;
+}
+
+bool raBelow(const CCDSimCatalog::Star &s, double ra)
+{
+    return s.ra < ra;
+}
+
+//  angle between two positions, degrees
+double separation(double ra1, double dec1, double ra2, double dec2)
+{
+    double sd=sin((dec2-dec1)*DEG2RAD/2);
+    double sr=sin((ra2-ra1)*DEG2RAD/2);
+    double h=sd*sd+cos(dec1*DEG2RAD)*cos(dec2*DEG2RAD)*sr*sr;
+    if (h > 1) h=1;
+    return 2*asin(sqrt(h))/DEG2RAD;
+}
+
+}
+
+CCDSimCatalog::CCDSimCatalog()
+{
+    queries=0;
+    map=NULL;
+    mapsize=0;
+    zones=NULL;
+    stars=NULL;
+    for (int i=0; i<NCACHE; i++)
+        cache[i].valid=false;
+}
+
+CCDSimCatalog::~CCDSimCatalog()
+{
+    close();
+}
+
+bool CCDSimCatalog::open(const char *path)
+{
+    struct stat st;
+    const Header *hp;
+    int fd;
+
+    close();
+
+    fd=::open(path,O_RDONLY);
+    if (fd < 0)
+        return false;
+    if (fstat(fd,&st) < 0 || (size_t)st.st_size < sizeof(Header))
+    {
+        ::close(fd);
+        return false;
+    }
+
+    mapsize=st.st_size;
+    map=mmap(NULL,mapsize,PROT_READ,MAP_SHARED,fd,0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+    {
+        map=NULL;
+        return false;
+    }
+
+    hp=(const Header *)map;
+    zones=(const unsigned int *)(hp+1);
+    if (memcmp(hp->magic,INDEX_MAGIC,8) != 0 || hp->version != INDEX_VERSION || hp->nzones != NZONES ||
+        mapsize != sizeof(Header)+(NZONES+1)*sizeof(unsigned int)+(size_t)hp->nstars*sizeof(Star) ||
+        zones[0] != 0 || zones[NZONES] != hp->nstars)
+    {
+        close();
+        return false;
+    }
+    for (int i=0; i<NZONES; i++)
+        if (zones[i] > zones[i+1])
+        {
+            close();
+            return false;
+        }
+
+    stars=(const Star *)(zones+NZONES+1);
+
+    //  answers from gsc may differ from the index
+    for (int i=0; i<NCACHE; i++)
+        cache[i].valid=false;
+
+    return true;
+}
+
+void CCDSimCatalog::close()
+{
+    if (map)
+        munmap(map,mapsize);
+    map=NULL;
+    mapsize=0;
+    zones=NULL;
+    stars=NULL;
+    for (int i=0; i<NCACHE; i++)
+        cache[i].valid=false;
+}
+
+const std::vector<CCDSimCatalog::Star> *CCDSimCatalog::query(double ra, double dec, double radius, double maglimit)
+{
+    Cached *c=NULL;
+
+    queries++;
+
+    ra=fmod(ra,360.0);
+    if (ra < 0) ra+=360.0;
+
+    for (int i=0; i<NCACHE; i++)
+    {
+        Cached *e=&cache[i];
+        if (e->valid && fabs(e->maglimit-maglimit) < 0.005 &&
+            separation(ra,dec,e->ra,e->dec)*60+radius <= e->radius)
+        {
+            e->used=queries;
+            return &e->stars;
+        }
+        if (c == NULL || !e->valid || (c->valid && e->used < c->used))
+            c=e;
+    }
+
+    c->ra=ra;
+    c->dec=dec;
+    c->radius=radius*QUERY_MARGIN+QUERY_SLACK;
+    c->maglimit=maglimit;
+    c->used=queries;
+    c->stars.clear();
+    c->valid=isOpen() ? fetchIndex(c) : fetchGsc(c);
+
+    return c->valid ? &c->stars : NULL;
+}
+
+bool CCDSimCatalog::fetchIndex(Cached *c)
+{
+    double r=c->radius/60;
+    double cosr=cos(r*DEG2RAD);
+    double sind0=sin(c->dec*DEG2RAD), cosd0=cos(c->dec*DEG2RAD);
+    double ralo[2], rahi[2];
+    int nranges;
+
+    //  right ascensions the circle spans, all of them around a pole
+    if (sin(r*DEG2RAD) >= cosd0)
+    {
+        ralo[0]=0;
+        rahi[0]=360;
+        nranges=1;
+    } else
+    {
+        double w=asin(sin(r*DEG2RAD)/cosd0)/DEG2RAD;
+        ralo[0]=c->ra-w;
+        rahi[0]=c->ra+w;
+        nranges=1;
+        if (ralo[0] < 0)
+        {
+            ralo[1]=ralo[0]+360;
+            rahi[1]=360;
+            ralo[0]=0;
+            nranges=2;
+        } else if (rahi[0] >= 360)
+        {
+            ralo[1]=0;
+            rahi[1]=rahi[0]-360;
+            rahi[0]=360;
+            nranges=2;
+        }
+    }
+
+    for (int z=zoneOf(c->dec-r); z<=zoneOf(c->dec+r); z++)
+    {
+        const Star *first=stars+zones[z], *last=stars+zones[z+1];
+
+        for (int i=0; i<nranges; i++)
+        {
+            const Star *s=std::lower_bound(first,last,ralo[i],raBelow);
+
+            for (; s<last && s->ra<=rahi[i]; s++)
+            {
+                if (s->mag > c->maglimit)
+                    continue;
+                double sdec=s->dec*DEG2RAD;
+                if (sin(sdec)*sind0+cos(sdec)*cosd0*cos((s->ra-c->ra)*DEG2RAD) >= cosr)
+                    c->stars.push_back(*s);
+            }
+        }
+    }
+
+    return true;
+}
+
+bool CCDSimCatalog::fetchGsc(Cached *c)
+{
+    char gsccmd[250];
+    char line[256];
+    FILE *pp;
+
+    snprintf(gsccmd,sizeof(gsccmd),"gsc -c %8.6f %+8.6f -r %4.1f -m 0 %4.2f -n 5000",c->ra,c->dec,c->radius,c->maglimit);
+    pp=popen(gsccmd,"r");
+    if (pp == NULL)
+        return false;
+
+    while (fgets(line,sizeof(line),pp) != NULL)
+    {
+        Star s;
+        if (parseLine(line,&s))
+            c->stars.push_back(s);
+    }
+    pclose(pp);
+
+    return true;
+}
+
+bool CCDSimCatalog::parseLine(const char *line, Star *s)
+{
+    char id[20];
+    char plate[6];
+    char ob[6];
+    float mage;
+    float pose;
+    int band;
+    float dist;
+    int dir;
+    int c;
+
+    if (sscanf(line,"%10s %f %f %f %f %f %d %d %4s %2s %f %d",
+               id,&s->ra,&s->dec,&pose,&s->mag,&mage,&band,&c,plate,ob,&dist,&dir) != 12 &&
+        sscanf(line,"%f %f %f",&s->ra,&s->dec,&s->mag) != 3)
+        return false;
+
+    return s->ra >= 0 && s->ra < 360 && s->dec >= -90 && s->dec <= 90;
+}
+
+bool CCDSimCatalog::write(std::vector<Star> &list, const char *path)
+{
+    unsigned int zonestart[NZONES+1];
+    Header h;
+    std::string tmp=std::string(path)+".tmp";
+    FILE *fp;
+    bool ok;
+
+    //  the same star from overlapping gsc lookups is kept once
+    std::sort(list.begin(),list.end(),zoneOrder);
+    list.erase(std::unique(list.begin(),list.end(),sameStar),list.end());
+
+    for (int z=0, i=0; z<=NZONES; z++)
+    {
+        while (i < (int)list.size() && zoneOf(list[i].dec) < z)
+            i++;
+        zonestart[z]=i;
+    }
+    zonestart[NZONES]=list.size();
+
+    memset(&h,0,sizeof(h));
+    memcpy(h.magic,INDEX_MAGIC,8);
+    h.version=INDEX_VERSION;
+    h.nzones=NZONES;
+    h.nstars=list.size();
+
+    fp=fopen(tmp.c_str(),"wb");
+    if (fp == NULL)
+        return false;
+    ok=fwrite(&h,sizeof(h),1,fp) == 1 &&
+       fwrite(zonestart,sizeof(zonestart),1,fp) == 1 &&
+       (list.empty() || fwrite(&list[0],sizeof(Star),list.size(),fp) == list.size());
+    ok=(fclose(fp) == 0) && ok;
+
+    //  a simulator mapping the old file keeps it until it opens the new one
+    if (ok && rename(tmp.c_str(),path) != 0)
+        ok=false;
+    if (!ok)
+        unlink(tmp.c_str());
+    return ok;
+}
+
+#if defined(CCD_SIM_CATALOG_TOOL)
+
+int main(int argc, char *argv[])
+{
+    std::vector<CCDSimCatalog::Star> list;
+    char line[256];
+    long lines=0;
+
+    if (argc < 2 || argv[1][0] == '-')
+    {
+        fprintf(stderr,"usage: %s index-file [text-file...]\n",argv[0]);
+        fprintf(stderr,"Writes the stars of gsc output or \"ra dec mag\" lines (J2000 degrees),\n");
+        fprintf(stderr,"read from the files or the standard input, to an index for the CCD simulator.\n");
+        return 1;
+    }
+
+    for (int i=2; i<argc || (argc == 2 && i == 2); i++)
+    {
+        FILE *fp=argc == 2 ? stdin : fopen(argv[i],"r");
+        if (fp == NULL)
+        {
+            perror(argv[i]);
+            return 1;
+        }
+        while (fgets(line,sizeof(line),fp) != NULL)
+        {
+            CCDSimCatalog::Star s;
+            lines++;
+            if (CCDSimCatalog::parseLine(line,&s))
+                list.push_back(s);
+        }
+        if (fp != stdin)
+            fclose(fp);
+    }
+
+    if (!CCDSimCatalog::write(list,argv[1]))
+    {
+        perror(argv[1]);
+        return 1;
+    }
+
+    fprintf(stderr,"%ld lines, %lu stars in %s\n",lines,(unsigned long)list.size(),argv[1]);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,93 @@
+/*******************************************************************************
+ CCD Simulator star catalog
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef CCDSIMCATALOG_H
+#define CCDSIMCATALOG_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <vector>
+
+/*  Stars for the simulator. With an index open, a file of stars sorted in
+    declination zones and by right ascension within each zone, queries are
+    answered in process from the mapped file. Without one, they go to the
+    gsc program as they always did.
+    Either way the last few answers are kept, fetched a little wider than
+    asked, so a guider or a mount tracking with periodic error does not
+    look the same stars up again on every frame. */
+
+class CCDSimCatalog
+{
+    public:
+
+        //  J2000, degrees
+        struct Star
+        {
+            float ra;
+            float dec;
+            float mag;
+        };
+
+        CCDSimCatalog();
+        ~CCDSimCatalog();
+
+        //  map an index written by write(), false if it is not one
+        bool open(const char *path);
+        void close();
+        bool isOpen() const { return stars != NULL; }
+
+        /*  The stars within radius arcminutes of ra,dec (degrees, J2000) and
+            no fainter than maglimit, and maybe a few more around them.
+            NULL if gsc could not be run. The list is good until the next
+            query. */
+        const std::vector<Star> *query(double ra, double dec, double radius, double maglimit);
+
+        //  one star from a line of gsc output, or a "ra dec mag" line
+        static bool parseLine(const char *line, Star *s);
+        //  sort the stars into an index file
+        static bool write(std::vector<Star> &list, const char *path);
+
+    private:
+
+        struct Cached
+        {
+            double ra;
+            double dec;
+            double radius;
+            double maglimit;
+            unsigned long used;
+            bool valid;
+            std::vector<Star> stars;
+        };
+
+        enum { NCACHE=4 };
+
+        bool fetchIndex(Cached *c);
+        bool fetchGsc(Cached *c);
+
+        Cached cache[NCACHE];
+        unsigned long queries;
+
+        //  the mapped index
+        void *map;
+        size_t mapsize;
+        const unsigned int *zones;
+        const Star *stars;
+};
+
+#endif // CCDSIMCATALOG_H
@@ -0,0 +1,462 @@
+/*******************************************************************************
+ CCD Simulator frame rendering
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+
+ Define CCD_SIM_RENDER_BENCH for a stand-alone program that checks the
+ SIMD rows against the scalar ones and times them against the old
+ per pixel loops.
+*******************************************************************************/
+
+#include "ccd_sim_render.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__clang__) || \
+	__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define CCD_SIM_RENDER_X86
+#include <immintrin.h>
+#endif
+
+#define MAXTHREADS  16
+#define MINBAND     (64*1024)   //  fewest pixels worth a thread
+#define LANES       8           //  noise generators per row
+
+namespace
+{
+
+struct Params
+{
+    bool glow;
+    float skyflux;
+    float fmaxval;
+    int bias;
+    int maxnoise;
+    int maxval;
+};
+
+/*  One row. Pixel x takes its noise from generator x%LANES, a xorshift32;
+    the SIMD versions leave the last few pixels to the scalar one and give
+    the same frame bit for bit. */
+typedef void (*RowFunc)(unsigned short *p, int from, int n, const float *colvig, float rowvig,
+                        const Params *pp, unsigned int *state);
+
+RowFunc rowimpl;
+int ncpu;
+
+void rowScalar(unsigned short *p, int from, int n, const float *colvig, float rowvig,
+               const Params *pp, unsigned int *state)
+{
+    for (int x=from; x<n; x++)
+    {
+        unsigned int s=state[x%LANES];
+        int v=p[x];
+
+        s^=s<<13;
+        s^=s>>17;
+        s^=s<<5;
+        state[x%LANES]=s;
+
+        if (pp->glow)
+        {
+            float fa=colvig[x]*rowvig;
+            float fp=fa*((float)v+pp->skyflux);
+            if (fp > pp->fmaxval) fp=pp->fmaxval;
+            v=(int)fp;
+        }
+
+        //  the top 16 bits scaled to [0,maxnoise)
+        v+=pp->bias+(((s>>16)*pp->maxnoise)>>16);
+        if (v > pp->maxval) v=pp->maxval;
+        p[x]=v;
+    }
+}
+
+#ifdef CCD_SIM_RENDER_X86
+
+__attribute__((target("sse2")))
+inline __m128i xorshiftSSE2(__m128i s)
+{
+    s=_mm_xor_si128(s,_mm_slli_epi32(s,13));
+    s=_mm_xor_si128(s,_mm_srli_epi32(s,17));
+    return _mm_xor_si128(s,_mm_slli_epi32(s,5));
+}
+
+__attribute__((target("sse2")))
+void rowSSE2(unsigned short *p, int from, int n, const float *colvig, float rowvig,
+             const Params *pp, unsigned int *state)
+{
+    const __m128i zero=_mm_setzero_si128();
+    const __m128i bias=_mm_set1_epi32(pp->bias);
+    const __m128i maxnoise=_mm_set1_epi32(pp->maxnoise);
+    const __m128i maxval=_mm_set1_epi32(pp->maxval);
+    const __m128i off32=_mm_set1_epi32(32768);
+    const __m128i off16=_mm_set1_epi16(-32768);
+    const __m128 row=_mm_set1_ps(rowvig);
+    const __m128 sky=_mm_set1_ps(pp->skyflux);
+    const __m128 fmax=_mm_set1_ps(pp->fmaxval);
+    __m128i s0=_mm_loadu_si128((const __m128i *)state);
+    __m128i s1=_mm_loadu_si128((const __m128i *)(state+4));
+    int x=from;
+
+    for (; x+8<=n; x+=8)
+    {
+        __m128i pix=_mm_loadu_si128((const __m128i *)(p+x));
+        __m128i v0=_mm_unpacklo_epi16(pix,zero);
+        __m128i v1=_mm_unpackhi_epi16(pix,zero);
+        __m128i gt;
+
+        s0=xorshiftSSE2(s0);
+        s1=xorshiftSSE2(s1);
+
+        if (pp->glow)
+        {
+            __m128 f0=_mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(colvig+x),row),_mm_add_ps(_mm_cvtepi32_ps(v0),sky));
+            __m128 f1=_mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(colvig+x+4),row),_mm_add_ps(_mm_cvtepi32_ps(v1),sky));
+            v0=_mm_cvttps_epi32(_mm_min_ps(f0,fmax));
+            v1=_mm_cvttps_epi32(_mm_min_ps(f1,fmax));
+        }
+
+        //  the 16 bit multiply leaves ((s>>16)*maxnoise)>>16 in each lane
+        v0=_mm_add_epi32(v0,_mm_add_epi32(bias,_mm_mulhi_epu16(_mm_srli_epi32(s0,16),maxnoise)));
+        v1=_mm_add_epi32(v1,_mm_add_epi32(bias,_mm_mulhi_epu16(_mm_srli_epi32(s1,16),maxnoise)));
+        gt=_mm_cmpgt_epi32(v0,maxval);
+        v0=_mm_or_si128(_mm_and_si128(gt,maxval),_mm_andnot_si128(gt,v0));
+        gt=_mm_cmpgt_epi32(v1,maxval);
+        v1=_mm_or_si128(_mm_and_si128(gt,maxval),_mm_andnot_si128(gt,v1));
+
+        //  no unsigned 32 to 16 bit pack before SSE4.1, offset through the signed one
+        pix=_mm_packs_epi32(_mm_sub_epi32(v0,off32),_mm_sub_epi32(v1,off32));
+        _mm_storeu_si128((__m128i *)(p+x),_mm_xor_si128(pix,off16));
+    }
+
+    _mm_storeu_si128((__m128i *)state,s0);
+    _mm_storeu_si128((__m128i *)(state+4),s1);
+    rowScalar(p,x,n,colvig,rowvig,pp,state);
+}
+
+__attribute__((target("avx2")))
+void rowAVX2(unsigned short *p, int from, int n, const float *colvig, float rowvig,
+             const Params *pp, unsigned int *state)
+{
+    const __m256i bias=_mm256_set1_epi32(pp->bias);
+    const __m256i maxnoise=_mm256_set1_epi32(pp->maxnoise);
+    const __m256i maxval=_mm256_set1_epi32(pp->maxval);
+    const __m256 row=_mm256_set1_ps(rowvig);
+    const __m256 sky=_mm256_set1_ps(pp->skyflux);
+    const __m256 fmax=_mm256_set1_ps(pp->fmaxval);
+    __m256i s=_mm256_loadu_si256((const __m256i *)state);
+    int x=from;
+
+    for (; x+8<=n; x+=8)
+    {
+        __m256i v=_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(p+x)));
+
+        s=_mm256_xor_si256(s,_mm256_slli_epi32(s,13));
+        s=_mm256_xor_si256(s,_mm256_srli_epi32(s,17));
+        s=_mm256_xor_si256(s,_mm256_slli_epi32(s,5));
+
+        if (pp->glow)
+        {
+            __m256 f=_mm256_mul_ps(_mm256_mul_ps(_mm256_loadu_ps(colvig+x),row),_mm256_add_ps(_mm256_cvtepi32_ps(v),sky));
+            v=_mm256_cvttps_epi32(_mm256_min_ps(f,fmax));
+        }
+
+        v=_mm256_add_epi32(v,_mm256_add_epi32(bias,_mm256_srli_epi32(_mm256_mullo_epi32(_mm256_srli_epi32(s,16),maxnoise),16)));
+        v=_mm256_min_epi32(v,maxval);
+
+        //  the pack works within 128 bit lanes, gather the two low quadwords
+        v=_mm256_permute4x64_epi64(_mm256_packus_epi32(v,v),0x08);
+        _mm_storeu_si128((__m128i *)(p+x),_mm256_castsi256_si128(v));
+    }
+
+    _mm256_storeu_si256((__m256i *)state,s);
+    rowScalar(p,x,n,colvig,rowvig,pp,state);
+}
+
+#endif
+
+//  choose the fastest implementation this cpu supports
+void pickImpl()
+{
+    ncpu=sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpu < 1) ncpu=1;
+
+#ifdef CCD_SIM_RENDER_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        rowimpl=rowAVX2;
+        return;
+    }
+    if (__builtin_cpu_supports("sse2"))
+    {
+        rowimpl=rowSSE2;
+        return;
+    }
+#endif
+    rowimpl=rowScalar;
+}
+
+//  the generators of a row, from the frame seed and the row number
+void seedRow(unsigned int seed, int y, unsigned int *state)
+{
+    for (int l=0; l<LANES; l++)
+    {
+        unsigned int h=seed^(y*0x9e3779b9u)^(l*0x85ebca6bu);
+        h^=h>>16;
+        h*=0x7feb352du;
+        h^=h>>15;
+        h*=0x846ca68bu;
+        h^=h>>16;
+        //  xorshift never leaves zero
+        state[l]=h ? h : 0x6d2b79f5u;
+    }
+}
+
+struct Band
+{
+    unsigned short *frame;
+    int width;
+    int miny;
+    int maxy;
+    const float *colvig;
+    const float *rowvig;
+    const Params *pp;
+    unsigned int seed;
+};
+
+void *renderBand(void *arg)
+{
+    Band *bp=(Band *)arg;
+    unsigned int state[LANES];
+
+    for (int y=bp->miny; y<bp->maxy; y++)
+    {
+        seedRow(bp->seed,y,state);
+        (*rowimpl)(bp->frame+(long)y*bp->width,0,bp->width,bp->colvig,bp->rowvig ? bp->rowvig[y] : 0,bp->pp,state);
+    }
+    return NULL;
+}
+
+}
+
+void CCDSimRender::skyAndNoise(unsigned short *frame, int width, int height,
+                               const float *colvig, const float *rowvig, float skyflux,
+                               int bias, int maxnoise, int maxval, unsigned int seed,
+                               int nthreads)
+{
+    pthread_t threads[MAXTHREADS];
+    Band bands[MAXTHREADS];
+    bool started[MAXTHREADS];
+    Params params;
+
+    if (!rowimpl)
+        pickImpl();
+
+    if (width <= 0 || height <= 0)
+        return;
+
+    //  the kernels work on 16 bit pixels and noise
+    if (maxval < 0) maxval=0;
+    if (maxval > 65535) maxval=65535;
+    if (maxnoise < 0) maxnoise=0;
+    if (maxnoise > 65535) maxnoise=65535;
+    if (bias < 0) bias=0;
+    if (bias > 65535) bias=65535;
+
+    params.glow=(colvig != NULL && rowvig != NULL);
+    params.skyflux=skyflux;
+    params.fmaxval=maxval;
+    params.bias=bias;
+    params.maxnoise=maxnoise;
+    params.maxval=maxval;
+
+    if (nthreads <= 0)
+    {
+        nthreads=(long)width*height/MINBAND;
+        if (nthreads > ncpu) nthreads=ncpu;
+    }
+    if (nthreads > MAXTHREADS) nthreads=MAXTHREADS;
+    if (nthreads > height) nthreads=height;
+    if (nthreads < 1) nthreads=1;
+
+    //  split the rows evenly, this thread takes the bands that did not start
+    for (int i=0; i<nthreads; i++)
+    {
+        Band *bp=&bands[i];
+        bp->frame=frame;
+        bp->width=width;
+        bp->miny=(long)height*i/nthreads;
+        bp->maxy=(long)height*(i+1)/nthreads;
+        bp->colvig=params.glow ? colvig : NULL;
+        bp->rowvig=params.glow ? rowvig : NULL;
+        bp->pp=&params;
+        bp->seed=seed;
+        started[i]=i > 0 && pthread_create(&threads[i],NULL,renderBand,bp) == 0;
+    }
+    for (int i=0; i<nthreads; i++)
+        if (!started[i])
+            renderBand(&bands[i]);
+    for (int i=0; i<nthreads; i++)
+        if (started[i])
+            pthread_join(threads[i],NULL);
+}
+
+#if defined(CCD_SIM_RENDER_BENCH)
+
+/*  g++ -O2 -DCCD_SIM_RENDER_BENCH ccd_sim_render.cpp -lpthread */
+
+#include <stdio.h>
+#include <math.h>
+#include <sys/time.h>
+
+static double now()
+{
+    struct timeval tv;
+    gettimeofday(&tv,NULL);
+    return tv.tv_sec*1000.0+tv.tv_usec/1000.0;
+}
+
+//  the loops DrawCcdFrame had, vignetting then column major noise
+static void oldLoops(unsigned short *pt, int nwidth, int nheight, float ImageScalex, float ImageScaley,
+                     float skyflux, int bias, int maxnoise, int maxval)
+{
+    unsigned short *p=pt;
+    for(int y=0; y< nheight; y++)
+    {
+        for(int x=0; x< nwidth; x++)
+        {
+            float sx=nwidth/2-x;
+            float sy=nheight/2-y;
+            float vig=nwidth;
+            vig=vig*ImageScalex;
+            float dc=sqrt(sx*sx*ImageScalex*ImageScalex+sy*sy*ImageScaley*ImageScaley);
+            float fa=exp(-2.0*0.7*(dc*dc)/vig/vig);
+            float fp=p[0];
+            fp+=skyflux;
+            fp=fa*fp;
+            if(fp > maxval) fp=maxval;
+            p[0]=fp;
+            p++;
+        }
+    }
+    for(int x=0; x<nwidth; x++)
+    {
+        for(int y=0; y<nheight; y++)
+        {
+            int newval=pt[y*nwidth+x]+bias+random()%maxnoise;
+            if(newval > maxval) newval=maxval;
+            pt[y*nwidth+x]=newval;
+        }
+    }
+}
+
+int main()
+{
+    static const int sizes[][2]={ {1280,1024}, {4096,4096}, {77,13} };
+    static const struct { const char *name; RowFunc f; } impls[]={
+        { "scalar", rowScalar },
+#ifdef CCD_SIM_RENDER_X86
+        { "sse2", rowSSE2 },
+        { "avx2", rowAVX2 },
+#endif
+    };
+    int nimpl=1;
+    int bad=0;
+
+    pickImpl();
+#ifdef CCD_SIM_RENDER_X86
+    nimpl=__builtin_cpu_supports("avx2") ? 3 : __builtin_cpu_supports("sse2") ? 2 : 1;
+#endif
+
+    for (unsigned int s=0; s<sizeof(sizes)/sizeof(sizes[0]); s++)
+    {
+        int w=sizes[s][0], h=sizes[s][1];
+        size_t npix=(size_t)w*h;
+        unsigned short *src=(unsigned short *)malloc(npix*2);
+        unsigned short *ref=(unsigned short *)malloc(npix*2);
+        unsigned short *out=(unsigned short *)malloc(npix*2);
+        float *colvig=(float *)malloc(w*sizeof(float));
+        float *rowvig=(float *)malloc(h*sizeof(float));
+        int reps=npix > 4000000 ? 5 : 20;
+        double t;
+
+        for (size_t i=0; i<npix; i++)
+            src[i]=(i*2654435761u)>>20;
+        for (int x=0; x<w; x++)
+            colvig[x]=exp(-1.4*(w/2-x)*(w/2-x)/((double)w*w));
+        for (int y=0; y<h; y++)
+            rowvig[y]=exp(-1.4*(h/2-y)*(h/2-y)/((double)w*w));
+
+        printf("%dx%d\n",w,h);
+
+        memcpy(out,src,npix*2);
+        t=now();
+        oldLoops(out,w,h,1.2,1.2,300,1500,20,65000);
+        printf("  old loops          %8.3f ms\n",now()-t);
+
+        for (int glow=1; glow>=0; glow--)
+        {
+            for (int i=0; i<nimpl; i++)
+            {
+                rowimpl=impls[i].f;
+                t=now();
+                for (int r=0; r<reps; r++)
+                {
+                    memcpy(out,src,npix*2);
+                    CCDSimRender::skyAndNoise(out,w,h,glow ? colvig : NULL,glow ? rowvig : NULL,300.5,1500,20,65000,12345+r,1);
+                }
+                printf("  %s %-6s 1 thread %8.3f ms",glow ? "sky  " : "noise",impls[i].name,(now()-t)/reps);
+                if (i == 0)
+                    memcpy(ref,out,npix*2);
+                else if (memcmp(ref,out,npix*2))
+                {
+                    printf("  MISMATCH");
+                    bad++;
+                }
+                printf("\n");
+            }
+
+            pickImpl();
+            t=now();
+            for (int r=0; r<reps; r++)
+            {
+                memcpy(out,src,npix*2);
+                CCDSimRender::skyAndNoise(out,w,h,glow ? colvig : NULL,glow ? rowvig : NULL,300.5,1500,20,65000,12345+r,0);
+            }
+            printf("  %s best   threaded %8.3f ms",glow ? "sky  " : "noise",(now()-t)/reps);
+            if (memcmp(ref,out,npix*2))
+            {
+                printf("  MISMATCH");
+                bad++;
+            }
+            printf("\n");
+        }
+
+        free(src);
+        free(ref);
+        free(out);
+        free(colvig);
+        free(rowvig);
+    }
+
+    return bad != 0;
+}
+
+#endif
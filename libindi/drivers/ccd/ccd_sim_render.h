@@ -0,0 +1,43 @@
+/*******************************************************************************
+ CCD Simulator frame rendering
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef CCDSIMRENDER_H
+#define CCDSIMRENDER_H
+
+/*  The per pixel passes of the simulated frame. They run row by row in
+    bands spread over the processors, with SSE2 or AVX2 when the
+    processor has them. */
+
+class CCDSimRender
+{
+    public:
+
+        /*  Add sky glow and vignetting, then bias and read noise, to a
+            width x height frame. The vignetting is separable, the factor
+            of pixel x,y is colvig[x]*rowvig[y]; pass NULL colvig and rowvig
+            for frames without sky glow (darks and biases). The noise of
+            each pixel is uniform in [0,maxnoise) and only depends on seed,
+            so nthreads does not change the frame. nthreads 0 picks a count
+            for the frame size. */
+        static void skyAndNoise(unsigned short *frame, int width, int height,
+                                const float *colvig, const float *rowvig, float skyflux,
+                                int bias, int maxnoise, int maxval, unsigned int seed,
+                                int nthreads=0);
+};
+
+#endif // CCDSIMRENDER_H
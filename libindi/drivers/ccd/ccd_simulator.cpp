@@ -16,6 +16,7 @@
  Boston, MA 02110-1301, USA.
 *******************************************************************************/
 #include "ccd_simulator.h"
+#include "ccd_sim_render.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -119,8 +120,6 @@ CCDSim::CCDSim()
     bias=1500;
     maxnoise=20;
     maxval=65000;
-    maxpix=0;
-    minpix =65000;
     limitingmag=11.5;
     saturationmag=2;
     focallength=1280;   //  focal length of the telescope in millimeters
@@ -133,6 +132,11 @@ CCDSim::CCDSim()
     ImageScaley=1.0;
     time(&RunStart);
 
+    StarBox=0;
+    ProfileSeeing=0;
+    ProfileScalex=0;
+    ProfileScaley=0;
+
     //  Our PEPeriod is 8 minutes
     //  and we have a 22 arcsecond swing
     PEPeriod=8*60;
@@ -219,6 +223,9 @@ bool CCDSim::initProperties()
     IUFillSwitch(&TimeFactorS[2],"100X","100x",ISS_OFF);
     IUFillSwitchVector(TimeFactorSV,TimeFactorS,3,getDeviceName(),"ON_TIME_FACTOR","Time Factor","Simulator Config",IP_RW,ISR_1OFMANY,60,IPS_IDLE);
 
+    IUFillText(&CatalogT[0],"SIM_CATALOG_INDEX","Index file","");
+    IUFillTextVector(&CatalogTP,CatalogT,1,getDeviceName(),"SIMULATOR_CATALOG","Star Catalog","Simulator Config",IP_RW,60,IPS_IDLE);
+
     IUFillNumber(&FWHMN[0],"SIM_FWHM","FWHM (arcseconds)","%4.2f",0,60,0,7.5);
     IUFillNumberVector(&FWHMNP,FWHMN,1,ActiveDeviceT[1].text, "FWHM","FWHM",OPTIONS_TAB,IP_RO,60,IPS_IDLE);
 
@@ -255,6 +262,7 @@ void CCDSim::ISGetProperties (const char *dev)
 
     defineNumber(SimulatorSettingsNV);
     defineSwitch(TimeFactorSV);
+    defineText(&CatalogTP);
 
     return;
 }
@@ -461,12 +469,7 @@ int CCDSim::DrawCcdFrame(CCDChip *targetChip)
 
     if(ShowStarField)
     {
-        char gsccmd[250];
-        FILE *pp;
-        int stars=0;
-        int lines=0;
         int drawn=0;
-        int x,y;
         float PEOffset;
         float PESpot;
         float decDrift;
@@ -602,82 +605,54 @@ int CCDSim::DrawCcdFrame(CCDChip *targetChip)
 
         if (ftype==CCDChip::LIGHT_FRAME)
         {
-            //sprintf(gsccmd,"gsc -c %8.6f %+8.6f -r 120 -m 0 9.1",rad+PEOffset,decPE);
-            sprintf(gsccmd,"gsc -c %8.6f %+8.6f -r %4.1f -m 0 %4.2f -n 3000",rad+PEOffset,cameradec,radius,lookuplimit);
-            //fprintf(stderr,"gsccmd %s\n",gsccmd);
-            pp=popen(gsccmd,"r");
-            if(pp != NULL) {
-                char line[256];
-                while(fgets(line,256,pp)!=NULL)
+            const std::vector<CCDSimCatalog::Star> *stars;
+
+            stars=catalog.query(rad+PEOffset,cameradec,radius,lookuplimit);
+            if(stars != NULL) {
+                //  these are the same for every star
+                double sindecr=sin(decr);
+                double cosdecr=cos(decr);
+
+                for(size_t i=0; i<stars->size(); i++)
                 {
-                    //fprintf(stderr,"%s",line);
-
-                    //  ok, lets parse this line for specifcs we want
-                    char id[20];
-                    char plate[6];
-                    char ob[6];
-                    float mag;
-                    float mage;
-                    float ra;
-                    float dec;
-                    float pose;
-                    int band;
-                    float dist;
-                    int dir;
-                    int c;
+                    const CCDSimCatalog::Star &star=(*stars)[i];
+
+                    //  Convert the ra/dec to standard co-ordinates
+                    double sx;   //  standard co-ords
+                    double sy;   //
+                    double srar;        //  star ra in radians
+                    double sdecr;       //  star dec in radians;
+                    double ccdx;
+                    double ccdy;
+                    double cosdra;
+                    double denom;
                     int rc;
 
-                    rc=sscanf(line,"%10s %f %f %f %f %f %d %d %4s %2s %f %d",
-                            id,&ra,&dec,&pose,&mag,&mage,&band,&c,plate,ob,&dist,&dir);
-                    //fprintf(stderr,"Parsed %d items\n",rc);
-                    if(rc==12) {
-                        lines++;
-                        //if(c==0) {
-                        stars++;
-                        //fprintf(stderr,"%s %8.4f %8.4f %5.2f %5.2f %d\n",id,ra,dec,mag,dist,dir);
-
-                        //  Convert the ra/dec to standard co-ordinates
-                        double sx;   //  standard co-ords
-                        double sy;   //
-                        double srar;        //  star ra in radians
-                        double sdecr;       //  star dec in radians;
-                        double ccdx;
-                        double ccdy;
-
-                        //fprintf(stderr,"line %s",line);
-                        //fprintf(stderr,"parsed %6.5f %6.5f\n",ra,dec);
-
-                        srar=ra*0.0174532925;
-                        sdecr=dec*0.0174532925;
-                        //  Handbook of astronomical image processing
-                        //  page 253
-                        //  equations 9.1 and 9.2
-                        //  convert ra/dec to standard co-ordinates
-
-                        sx=cos(decr)*sin(srar-rar)/( cos(decr)*cos(sdecr)*cos(srar-rar)+sin(decr)*sin(sdecr) );
-                        sy=(sin(decr)*cos(sdecr)*cos(srar-rar)-cos(decr)*sin(sdecr))/( cos(decr)*cos(sdecr)*cos(srar-rar)+sin(decr)*sin(sdecr) );
-
-                        //  now convert to microns
-                        ccdx=pa*sx+pb*sy+pc;
-                        ccdy=pd*sx+pe*sy+pf;
-
-
-                        rc=DrawImageStar(targetChip, mag,ccdx,ccdy);
-                        drawn+=rc;
-                        if(rc==1)
-                        {
-                            //fprintf(stderr,"star %s scope %6.4f %6.4f star %6.4f %6.4f  ccd %6.2f %6.2f\n",id,rad,decPE,ra,dec,ccdx,ccdy);
-                            //fprintf(stderr,"star %s ccd %6.2f %6.2f\n",id,ccdx,ccdy);
-                        }
-                    }
+                    srar=star.ra*0.0174532925;
+                    sdecr=star.dec*0.0174532925;
+                    //  Handbook of astronomical image processing
+                    //  page 253
+                    //  equations 9.1 and 9.2
+                    //  convert ra/dec to standard co-ordinates
+
+                    cosdra=cos(srar-rar);
+                    denom=cosdecr*cos(sdecr)*cosdra+sindecr*sin(sdecr);
+                    sx=cosdecr*sin(srar-rar)/denom;
+                    sy=(sindecr*cos(sdecr)*cosdra-cosdecr*sin(sdecr))/denom;
+
+                    //  now convert to microns
+                    ccdx=pa*sx+pb*sy+pc;
+                    ccdy=pd*sx+pe*sy+pf;
+
+                    rc=DrawImageStar(targetChip, star.mag,ccdx,ccdy);
+                    drawn+=rc;
                 }
-                pclose(pp);
             } else
             {
                 IDMessage(getDeviceName(),"Error looking up stars, is gsc installed with appropriate environment variables set ??");
                 //fprintf(stderr,"Error doing gsc lookup\n");
             }
-            if(drawn==0)
+            if(drawn==0 && !catalog.isOpen())
             {
                 IDMessage(getDeviceName(),"Got no stars, is gsc installed with appropriate environment variables set ??");
 
@@ -690,99 +665,59 @@ int CCDSim::DrawCcdFrame(CCDChip *targetChip)
         //  fwhm equivalent to the full field of view
 
 
-        if (ftype==CCDChip::LIGHT_FRAME || ftype==CCDChip::FLAT_FRAME)
+        nheight = targetChip->getSubH() / targetChip->getBinY();
+        nwidth  = targetChip->getSubW() / targetChip->getBinX();
+
+        bool glow=(ftype==CCDChip::LIGHT_FRAME || ftype==CCDChip::FLAT_FRAME) && nwidth > 0 && nheight > 0;
+        float skyflux=0;
+
+        if (glow)
         {
-            float skyflux;
-            float glow;
+            float skyglowmag;
+            float vig;
             //  calculate flux from our zero point and gain values
-            glow=skyglow;
+            skyglowmag=skyglow;
             if(ftype==CCDChip::FLAT_FRAME)
             {
                 //  Assume flats are done with a diffuser
                 //  in broad daylight, so, the sky magnitude
                 //  is much brighter than at night
-                glow=skyglow/10;
+                skyglowmag=skyglow/10;
             }
 
-            //fprintf(stderr,"Using glow %4.2f\n",glow);
+            //fprintf(stderr,"Using glow %4.2f\n",skyglowmag);
 
-            skyflux=pow(10,((glow-z)*k/-2.5));
+            skyflux=pow(10,((skyglowmag-z)*k/-2.5));
             //  ok, flux represents one second now
             //  scale up linearly for exposure time
             skyflux=skyflux*ExposureTime*targetChip->getBinX()*targetChip->getBinY();
            //IDLog("SkyFlux = %g ExposureRequest %g\n",skyflux,ExposureTime);
 
-            unsigned short *pt;
+            //  The vignetting is a gaussian falloff with the distance from
+            //  the center, in arcseconds. exp(-(a+b)) is exp(-a)*exp(-b), so
+            //  it is a factor for the column times one for the row.
+            vig=nwidth;
+            vig=vig*ImageScalex;
 
-            pt=(unsigned short int *)targetChip->getFrameBuffer();
-
-            nheight = targetChip->getSubH() / targetChip->getBinY();
-            nwidth  = targetChip->getSubW() / targetChip->getBinX();
-
-            for(int y=0; y< nheight; y++)
+            ColVignetting.resize(nwidth);
+            for(int x=0; x< nwidth; x++)
             {
-                for(int x=0; x< nwidth; x++)
-                {
-                    float dc;   //  distance from center
-                    float fp;   //  flux this pixel;
-                    float sx,sy;
-                    float vig;
-
-                    sx=nwidth/2-x;
-                    sy=nheight/2-y;
-
-                    vig=nwidth;
-                    vig=vig*ImageScalex;
-                    //  need to make this account for actual pixel size
-                    dc=sqrt(sx*sx*ImageScalex*ImageScalex+sy*sy*ImageScaley*ImageScaley);
-                    //  now we have the distance from center, in arcseconds
-                    //  now lets plot a gaussian falloff to the edges
-                    //
-                    float fa;
-                    fa=exp(-2.0*0.7*(dc*dc)/vig/vig);
-
-                    //  get the current value
-                    fp=pt[0];
-
-                    //  Add the sky glow
-                    fp+=skyflux;
-
-                    //  now scale it for the vignetting
-                    fp=fa*fp;
-
-                    //  clamp to limits
-                    if(fp > maxval) fp=maxval;
-                    if (fp > maxpix) maxpix = fp;
-                    if (fp < minpix) minpix = fp;
-                    //  and put it back
-                    pt[0]=fp;
-                    pt++;
-
-                }
+                float sx=nwidth/2-x;
+                ColVignetting[x]=exp(-2.0*0.7*(sx*sx*ImageScalex*ImageScalex)/vig/vig);
             }
-        }
-
-
-        //  Now we add some bias and read noise
-        int subX = targetChip->getSubX() / targetChip->getBinX();
-        int subY = targetChip->getSubY() / targetChip->getBinX();
-        int subW = targetChip->getSubW() / targetChip->getBinX() + subX;
-        int subH = targetChip->getSubH() / targetChip->getBinX() + subY;
-
-        for(x=subX; x<subW; x++)
-        {
-            for(y=subY; y<subH; y++)
+            RowVignetting.resize(nheight);
+            for(int y=0; y< nheight; y++)
             {
-                int noise;
-
-                noise=random();
-                noise=noise%maxnoise; //
-
-                //IDLog("noise is %d\n", noise);
-                AddToPixel(targetChip, x,y,bias+noise);
+                float sy=nheight/2-y;
+                RowVignetting[y]=exp(-2.0*0.7*(sy*sy*ImageScaley*ImageScaley)/vig/vig);
             }
         }
 
+        //  Now we add the sky glow, then some bias and read noise
+        CCDSimRender::skyAndNoise((unsigned short *)targetChip->getFrameBuffer(), nwidth, nheight,
+                                  glow ? &ColVignetting[0] : NULL, glow ? &RowVignetting[0] : NULL,
+                                  skyflux, bias, maxnoise, maxval, random());
+
 
     } else {
         testvalue++;
@@ -807,8 +742,7 @@ int CCDSim::DrawImageStar(CCDChip *targetChip, float mag,float x,float y)
     //float r;
     int sx,sy;
     int drew=0;
-    int boxsizex=5;
-    int boxsizey=5;
+    int side;
     float flux;
     float ExposureTime;
 
@@ -835,40 +769,68 @@ int CCDSim::DrawImageStar(CCDChip *targetChip, float mag,float x,float y)
     //  scale up linearly for exposure time
     flux=flux*ExposureTime;
 
-    float qx;
-    //  we need a box size that gives a radius at least 3 times fwhm
-    qx=seeing/ImageScalex;
-    qx=qx*3;
-    boxsizex=(int)qx;
-    boxsizex++;
-    qx=seeing/ImageScaley;
-    qx=qx*3;
-    boxsizey=(int)qx;
-    boxsizey++;
-
-    //IDLog("BoxSize %d %d\n",boxsizex,boxsizey);
+    //  Every star has the same profile, only the flux changes,
+    //  so it is worked out again when the seeing or the scale do
+    if(StarProfile.empty() || ProfileSeeing != seeing || ProfileScalex != ImageScalex || ProfileScaley != ImageScaley)
+    {
+        float qx;
+        //  we need a box size that gives a radius at least 3 times fwhm
+        qx=seeing/ImageScaley;
+        qx=qx*3;
+        StarBox=(int)qx;
+        StarBox++;
+
+        side=2*StarBox+1;
+        StarProfile.resize(side*side);
+        for(sy=-StarBox; sy<=StarBox; sy++) {
+            for(sx=-StarBox; sx<=StarBox; sx++) {
+                float dc;   //  distance from center
+
+                //  need to make this account for actual pixel size
+                dc=sqrt(sx*sx*ImageScalex*ImageScalex+sy*sy*ImageScaley*ImageScaley);
+                //  now we have the distance from center, in arcseconds
+                StarProfile[(sy+StarBox)*side+sx+StarBox]=exp(-2.0*0.7*(dc*dc)/seeing/seeing);
+            }
+        }
 
+        ProfileSeeing=seeing;
+        ProfileScalex=ImageScalex;
+        ProfileScaley=ImageScaley;
+    }
 
-    for(sy=-boxsizey; sy<=boxsizey; sy++) {
-        for(sx=-boxsizey; sx<=boxsizey; sx++) {
-            int rc;
-            float dc;   //  distance from center
+    //IDLog("BoxSize %d\n",StarBox);
+
+    int binX = targetChip->getBinX();
+    int binY = targetChip->getBinY();
+    int nwidth = targetChip->getSubW() / binX;
+    int nheight = targetChip->getSubH() / binY;
+    int offX = targetChip->getSubX() / binX;
+    int offY = targetChip->getSubY() / binY;
+    unsigned short *pt = (unsigned short *)targetChip->getFrameBuffer();
+    const float *fa = &StarProfile[0];
+
+    side=2*StarBox+1;
+    for(sy=-StarBox; sy<=StarBox; sy++) {
+        int py=(int)(y+sy)-offY;
+        if(py < 0 || py >= nheight) {
+            fa+=side;
+            continue;
+        }
+        for(sx=-StarBox; sx<=StarBox; sx++, fa++) {
+            int px=(int)(x+sx)-offX;
             float fp;   //  flux this pixel;
+            int newval;
 
-            //  need to make this account for actual pixel size
-            dc=sqrt(sx*sx*ImageScalex*ImageScalex+sy*sy*ImageScaley*ImageScaley);
-            //  now we have the distance from center, in arcseconds
-            //  This should be gaussian, but, for now we'll just go with
-            //  a simple linear function
-            float fa;
-            fa=exp(-2.0*0.7*(dc*dc)/seeing/seeing);
-            fp=fa*flux*targetChip->getBinX()*targetChip->getBinY();
-
+            if(px < 0 || px >= nwidth)
+                continue;
 
+            fp=fa[0]*flux*binX*binY;
             if(fp < 0) fp=0;
 
-            rc=AddToPixel(targetChip, x+sx,y+sy,fp);
-            if(rc != 0) drew=1;
+            newval=pt[py*nwidth+px]+(int)fp;
+            if(newval > maxval) newval=maxval;
+            pt[py*nwidth+px]=newval;
+            drew=1;
         }
     }
     return drew;
@@ -898,8 +860,6 @@ int CCDSim::AddToPixel(CCDChip *targetChip, int x,int y,int val)
                     newval=pt[0];
                     newval+=val;
                     if(newval > maxval) newval=maxval;
-                    if (newval > maxpix) maxpix = newval;
-                    if (newval < minpix) minpix = newval;
                     pt[0]=newval;
                 }
             }
@@ -964,6 +924,30 @@ bool CCDSim::ISNewText(	const char *dev, const char *name, char *texts[], char *
             return true;
         }
 
+        if(strcmp(name,CatalogTP.name)==0)
+        {
+            IUUpdateText(&CatalogTP, texts, names, n);
+
+            //  an empty name goes back to gsc
+            if (CatalogT[0].text[0] == '\0')
+            {
+                catalog.close();
+                CatalogTP.s=IPS_IDLE;
+                IDSetText(&CatalogTP, "Looking up stars with gsc");
+            } else if (catalog.open(CatalogT[0].text))
+            {
+                CatalogTP.s=IPS_OK;
+                IDSetText(&CatalogTP, NULL);
+            } else
+            {
+                CatalogTP.s=IPS_ALERT;
+                IDSetText(&CatalogTP, "%s is not a star index, looking up stars with gsc", CatalogT[0].text);
+            }
+
+            saveConfig();
+            return true;
+        }
+
     }
 
     return INDI::CCD::ISNewText(dev,name,texts,names,n);
@@ -1121,6 +1105,7 @@ bool CCDSim::saveConfigItems(FILE *fp)
 
     IUSaveConfigNumber(fp,SimulatorSettingsNV);
     IUSaveConfigSwitch(fp, TimeFactorSV);
+    IUSaveConfigText(fp, &CatalogTP);
 
     return true;
 }
@@ -21,10 +21,12 @@
 
 #include "indibase/indiccd.h"
 #include "indibase/indifilterinterface.h"
+#include "ccd_sim_catalog.h"
 
 /*  Some headers we need */
 #include <math.h>
 #include <sys/time.h>
+#include <vector>
 
 
 class CCDSim : public INDI::CCD, public INDI::FilterInterface
@@ -49,8 +51,6 @@ class CCDSim : public INDI::CCD, public INDI::FilterInterface
         int bias;
         int maxnoise;
         int maxval;
-        int maxpix;
-        int minpix;
         float skyglow;
         float limitingmag;
         float saturationmag;
@@ -89,6 +89,21 @@ class CCDSim : public INDI::CCD, public INDI::FilterInterface
         ISwitch TimeFactorS[3];
         ISwitchVectorProperty *TimeFactorSV;
 
+        //  Stars come from this index, or gsc when it is empty
+        IText CatalogT[1];
+        ITextVectorProperty CatalogTP;
+        CCDSimCatalog catalog;
+
+        //  Star profile scaled for one unit of flux, (2*StarBox+1)^2 pixels,
+        //  and the vignetting of columns and rows, kept between frames
+        std::vector<float> StarProfile;
+        int StarBox;
+        float ProfileSeeing;
+        float ProfileScalex;
+        float ProfileScaley;
+        std::vector<float> ColVignetting;
+        std::vector<float> RowVignetting;
+
         bool SetupParms();
 
         //  We are going to snoop these from focuser
@@ -241,7 +241,7 @@ bool MoonLite::Ack()
     char resp[5];
     short pos=-1;
 
-    tcflush(PortFD, TCIOFLUSH);
+    tty_flush(PortFD, TCIOFLUSH);
 
     if ( (rc = tty_write(PortFD, ":GP#", 4, &nbytes_written)) != TTY_OK)
     {
@@ -272,7 +272,7 @@ bool MoonLite::updateStepMode()
     char errstr[MAXRBUF];
     char resp[3];
 
-    tcflush(PortFD, TCIOFLUSH);
+    tty_flush(PortFD, TCIOFLUSH);
 
     if ( (rc = tty_write(PortFD, ":GH#", 4, &nbytes_written)) != TTY_OK)
     {
@@ -311,7 +311,7 @@ bool MoonLite::updateTemperature()
     char resp[5];
     unsigned int temp;
 
-    tcflush(PortFD, TCIOFLUSH);
+    tty_flush(PortFD, TCIOFLUSH);
 
     tty_write(PortFD, ":C#", 3, &nbytes_written);
 
@@ -351,7 +351,7 @@ bool MoonLite::updatePosition()
     char resp[5];
     int pos=-1;
 
-    tcflush(PortFD, TCIOFLUSH);
+    tty_flush(PortFD, TCIOFLUSH);
 
     if ( (rc = tty_write(PortFD, ":GP#", 4, &nbytes_written)) != TTY_OK)
     {
@@ -389,7 +389,7 @@ bool MoonLite::updateSpeed()
     char resp[3];
     short speed;
 
-    tcflush(PortFD, TCIOFLUSH);
+    tty_flush(PortFD, TCIOFLUSH);
 
     if ( (rc = tty_write(PortFD, ":GD#", 4, &nbytes_written)) != TTY_OK)
     {
@@ -434,7 +434,7 @@ bool MoonLite::isMoving()
     char errstr[MAXRBUF];
     char resp[4];
 
-    tcflush(PortFD, TCIOFLUSH);
+    tty_flush(PortFD, TCIOFLUSH);
 
     if ( (rc = tty_write(PortFD, ":GI#", 4, &nbytes_written)) != TTY_OK)
     {
@@ -473,7 +473,7 @@ bool MoonLite::setTemperatureCalibration(double calibration)
 
     snprintf(cmd, 7, ":PO%02hhX#", cal);
 
-    tcflush(PortFD, TCIOFLUSH);
+    tty_flush(PortFD, TCIOFLUSH);
 
     if ( (rc = tty_write(PortFD, cmd, 6, &nbytes_written)) != TTY_OK)
     {
@@ -496,7 +496,7 @@ bool MoonLite::setTemperatureCoefficient(double coefficient)
 
     snprintf(cmd, 7, ":SC%02hhX#", coeff);
 
-    tcflush(PortFD, TCIOFLUSH);
+    tty_flush(PortFD, TCIOFLUSH);
 
     if ( (rc = tty_write(PortFD, cmd, 6, &nbytes_written)) != TTY_OK)
     {
@@ -574,7 +574,7 @@ bool MoonLite::setStepMode(FocusStepMode mode)
     char errstr[MAXRBUF];
     char cmd[4];
 
-    tcflush(PortFD, TCIOFLUSH);
+    tty_flush(PortFD, TCIOFLUSH);
 
     if (mode == FOCUS_HALF_STEP)
         strncpy(cmd, ":SH#", 4);
@@ -619,7 +619,7 @@ bool MoonLite::setTemperatureCompensation(bool enable)
     char errstr[MAXRBUF];
     char cmd[4];
 
-    tcflush(PortFD, TCIOFLUSH);
+    tty_flush(PortFD, TCIOFLUSH);
 
     if (enable)
         strncpy(cmd, ":+#", 4);
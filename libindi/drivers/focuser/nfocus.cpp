@@ -302,7 +302,7 @@ int NFocus::SendCommand(char *rf_cmd)
   }
 
 
-  tcflush(PortFD, TCIOFLUSH);
+  tty_flush(PortFD, TCIOFLUSH);
 
    if  ( (err_code = tty_write(PortFD, rf_cmd, strlen(rf_cmd)+1, &nbytes_written) != TTY_OK))
    {
@@ -378,7 +378,7 @@ int NFocus::ReadResponse(char *buf, int nbytes, int timeout)
         totalBytesRead += bytesRead;
     }
 
-    tcflush(PortFD, TCIOFLUSH);
+    tty_flush(PortFD, TCIOFLUSH);
 
    if (isDebug())
    {
@@ -372,7 +372,7 @@ int RoboFocus::SendCommand(char *rf_cmd)
   if (isSimulation())
       return 0;
 
-  tcflush(PortFD, TCIOFLUSH);
+  tty_flush(PortFD, TCIOFLUSH);
 
    if  ( (err_code = tty_write(PortFD, rf_cmd_cks, RF_MAX_CMD, &nbytes_written) != TTY_OK))
    {
@@ -477,7 +477,7 @@ int RoboFocus::ReadResponse(char *buf, int nbytes, int timeout)
       }
     }
 
-    tcflush(PortFD, TCIOFLUSH);
+    tty_flush(PortFD, TCIOFLUSH);
 
    if (isDebug())
    {
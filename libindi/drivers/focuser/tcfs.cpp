@@ -239,7 +239,7 @@ bool TCFS::Connect()
     dispatch_command(FMMODE);
     read_tcfs();
 
-    tcflush(fd, TCIOFLUSH);
+    tty_flush(fd, TCIOFLUSH);
 
     DEBUG(INDI::Logger::DBG_SESSION, "Successfully connected to TCF-S Focuser in Manual Mode.");
 
@@ -615,7 +615,7 @@ bool TCFS::dispatch_command(TCFSCommand command_type)
    if (isSimulation())
        return true;
 
-  tcflush(fd, TCIOFLUSH);
+  tty_flush(fd, TCIOFLUSH);
 
    if  ( (err_code = tty_write(fd, command, TCFS_MAX_CMD, &nbytes_written) != TTY_OK))
    {
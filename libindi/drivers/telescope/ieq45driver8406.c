@@ -200,7 +200,7 @@ int getCommandSexa(int fd, double *value, const char * cmd)
   int error_type;
   int nbytes_write=0, nbytes_read=0;
   
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
   if ( (error_type = tty_write_string(fd, cmd, &nbytes_write)) != TTY_OK)
    return error_type;
   
@@ -223,7 +223,7 @@ int getCommandSexa(int fd, double *value, const char * cmd)
    return -1;
   }
 
-   tcflush(fd, TCIFLUSH);
+   tty_flush(fd, TCIFLUSH);
    return 0;
 }
 
@@ -235,7 +235,7 @@ int getCommandInt(int fd, int *value, const char* cmd)
   int nbytes_write=0, nbytes_read=0;
 
   
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
 
   if ( (error_type = tty_write_string(fd, cmd, &nbytes_write)) != TTY_OK)
    return error_type;
@@ -274,7 +274,7 @@ int getCommandString(int fd, char *data, const char* cmd)
 
     /*read_ret = portRead(data, -1, IEQ45_TIMEOUT);*/
     error_type = tty_read_section(fd, data, '#', IEQ45_TIMEOUT, &nbytes_read);
-    tcflush(fd, TCIFLUSH);
+    tty_flush(fd, TCIFLUSH);
 
     if (error_type != TTY_OK)
 	return error_type;
@@ -338,7 +338,7 @@ int getTimeFormat(int fd, int *format)
   if ( (error_type = tty_read_section(fd, temp_string, '#', IEQ45_TIMEOUT, &nbytes_read)) != TTY_OK)
 	return error_type;
 
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
   
   if (nbytes_read < 1)
    return error_type;
@@ -394,7 +394,7 @@ int getSiteName(int fd, char *siteName, int siteNum)
 
    /*read_ret = portRead(siteName, -1, IEQ45_TIMEOUT);*/
    error_type = tty_read_section(fd, siteName, '#', IEQ45_TIMEOUT, &nbytes_read);
-   tcflush(fd, TCIFLUSH);
+   tty_flush(fd, TCIFLUSH);
 
    if (nbytes_read < 1)
      return error_type;
@@ -429,7 +429,7 @@ int getSiteLatitude(int fd, int *dd, int *mm)
 
   /*read_ret = portRead(temp_string, -1, IEQ45_TIMEOUT);*/
   error_type = tty_read_section(fd, temp_string, '#', IEQ45_TIMEOUT, &nbytes_read);
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
   
    if (nbytes_read < 1) 
    return error_type;
@@ -461,7 +461,7 @@ int getSiteLongitude(int fd, int *ddd, int *mm)
   error_type = tty_read_section(fd, temp_string, '#', IEQ45_TIMEOUT, &nbytes_read);
   /*read_ret = portRead(temp_string, -1, IEQ45_TIMEOUT);*/
   
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
   
   if (nbytes_read < 1)
     return error_type;
@@ -494,7 +494,7 @@ int getTrackFreq(int fd, double *value)
 
     /*read_ret = portRead(temp_string, -1, IEQ45_TIMEOUT);*/
     error_type = tty_read_section(fd, temp_string, '#', IEQ45_TIMEOUT, &nbytes_read);
-    tcflush(fd, TCIFLUSH);
+    tty_flush(fd, TCIFLUSH);
     
     if (nbytes_read < 1)
      return error_type;
@@ -527,7 +527,7 @@ int getNumberOfBars(int fd, int *value)
      return -1;*/
 
    error_type = tty_read_section(fd, temp_string, '#', IEQ45_TIMEOUT, &nbytes_read);
-   tcflush(fd, TCIFLUSH);
+   tty_flush(fd, TCIFLUSH);
    
    if (nbytes_read < 0)
     return error_type;
@@ -550,7 +550,7 @@ int getHomeSearchStatus(int fd, int *status)
 
   /*read_ret = portRead(temp_string, 1, IEQ45_TIMEOUT);*/
   error_type = tty_read_section(fd, temp_string, '#', IEQ45_TIMEOUT, &nbytes_read);
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
   
   if (nbytes_read < 1)
    return error_type;
@@ -606,7 +606,7 @@ int updateSkyCommanderCoord(int fd, double *ra, double *dec)
 
   error_type = tty_read(fd, coords, 16, IEQ45_TIMEOUT, &nbytes_read);
   /*read_ret = portRead(coords, 16, IEQ45_TIMEOUT);*/
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
 
   nbytes_read = sscanf(coords, " %g %g", &RA, &DEC);
 
@@ -639,7 +639,7 @@ int updateIntelliscopeCoord (int fd, double *ra, double *dec)
      but read one more later it if it's a intelliscope */
   /*read_ret = portRead (coords, 14, IEQ45_TIMEOUT);*/
   error_type = tty_read(fd, coords, 14, IEQ45_TIMEOUT, &nbytes_read);
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
   /*IDLog ("portRead() = [%s]\n", coords);*/
 
   /* Remove the Q in the response from the Intelliscope  but not the Sky Wizard */
@@ -685,7 +685,7 @@ int setStandardProcedure(int fd, char * data)
 
  error_type = tty_read(fd, bool_return, 1, IEQ45_TIMEOUT, &nbytes_read);
  /*read_ret = portRead(boolRet, 1, IEQ45_TIMEOUT);*/
- tcflush(fd, TCIFLUSH);
+ tty_flush(fd, TCIFLUSH);
  
  if (nbytes_read < 1)
    return error_type;
@@ -847,7 +847,7 @@ int setAlignmentMode(int fd, unsigned int alignMode)
        break;
    }
    
-   tcflush(fd, TCIFLUSH);
+   tty_flush(fd, TCIFLUSH);
    return 0;
 }
 
@@ -870,7 +870,7 @@ int setCalenderDate(int fd, int dd, int mm, int yy)
 
    /*read_ret = portRead(boolRet, 1, IEQ45_TIMEOUT);*/
    error_type = tty_read(fd, bool_return, 1, IEQ45_TIMEOUT, &nbytes_read);
-   tcflush(fd, TCIFLUSH);
+   tty_flush(fd, TCIFLUSH);
    
    if (nbytes_read < 1)
     return error_type;
@@ -1010,7 +1010,7 @@ int setSlewMode(int fd, int slewMode)
      break;
    }
    
-   tcflush(fd, TCIFLUSH);
+   tty_flush(fd, TCIFLUSH);
    return 0;
 
 }
@@ -1042,7 +1042,7 @@ int setFocuserMotion(int fd, int motionType)
      break;
   }
 
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
   return 0;
 }
 
@@ -1082,7 +1082,7 @@ int setFocuserSpeedMode (int fd, int speedMode)
      break;
  }
 
- tcflush(fd, TCIFLUSH);
+ tty_flush(fd, TCIFLUSH);
  return 0;
 }
 
@@ -1116,7 +1116,7 @@ int setGPSFocuserSpeed (int fd, int speed)
   /*if (portWrite(speed_str) < 0)
        return -1;*/
 
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
   return 0;
 }
 
@@ -1149,7 +1149,7 @@ int Slew(int fd)
       return error_type;
 
     /* We don't need to read the string message, just return corresponding error code */
-    tcflush(fd, TCIFLUSH);
+    tty_flush(fd, TCIFLUSH);
 
     if (slewNum[0] == '0')
      return 0;
@@ -1185,7 +1185,7 @@ int MoveTo(int fd, int direction)
     break;
   }
   
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
   return 0;
 }
 
@@ -1204,7 +1204,7 @@ int SendPulseCmd(int fd, int direction, int duration_msec)
   
   tty_write_string(fd, cmd, &nbytes_write);
   
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
   return 0;
 }
 
@@ -1250,7 +1250,7 @@ int HaltMovement(int fd, int direction)
     break;
   }
   
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
   return 0;
 
 }
@@ -1265,7 +1265,7 @@ int abortSlew(int fd)
  if ( (error_type = tty_write_string(fd, ":Q#", &nbytes_write)) != TTY_OK)
     	   return error_type;
 
- tcflush(fd, TCIFLUSH);
+ tty_flush(fd, TCIFLUSH);
  return 0;
 }
 
@@ -1292,7 +1292,7 @@ int Sync(int fd, char *matchedObject)
   
   /* Sleep 10ms before flushing. This solves some issues with IEQ45 compatible devices. */
   usleep(10000);
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
 
   return 0;
 }
@@ -1333,7 +1333,7 @@ int selectSite(int fd, int siteNum)
     break;
   }
   
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
   return 0;
 
 }
@@ -1364,7 +1364,7 @@ int selectCatalogObject(int fd, int catalog, int NNNN)
   /*if (portWrite(temp_string) < 0)
    return -1;*/
 
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
   return 0;
 }
 
@@ -1468,7 +1468,7 @@ int selectTrackingMode(int fd, int trackMode)
     break;
    }
    
-   tcflush(fd, TCIFLUSH);
+   tty_flush(fd, TCIFLUSH);
    return 0;
 
 }
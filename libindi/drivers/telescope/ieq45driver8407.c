@@ -224,7 +224,7 @@ int getCommandSexa(int fd, double *value, const char * cmd)
   int error_type;
   int nbytes_write=0, nbytes_read=0;
   
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
   if ( (error_type = tty_write_string(fd, cmd, &nbytes_write)) != TTY_OK)
    return error_type;
   
@@ -248,7 +248,7 @@ int getCommandSexa(int fd, double *value, const char * cmd)
    return -1;
   }
 
-   tcflush(fd, TCIFLUSH);
+   tty_flush(fd, TCIFLUSH);
    return 0;
 }
 
@@ -260,7 +260,7 @@ int getCommandInt(int fd, int *value, const char* cmd)
   int nbytes_write=0, nbytes_read=0;
 
   
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
 
   if ( (error_type = tty_write_string(fd, cmd, &nbytes_write)) != TTY_OK)
    return error_type;
@@ -299,7 +299,7 @@ int getCommandString(int fd, char *data, const char* cmd)
 
     /*read_ret = portRead(data, -1, IEQ45_TIMEOUT);*/
     error_type = tty_read_section(fd, data, '#', IEQ45_TIMEOUT, &nbytes_read);
-    tcflush(fd, TCIFLUSH);
+    tty_flush(fd, TCIFLUSH);
 
     if (error_type != TTY_OK)
 	return error_type;
@@ -363,7 +363,7 @@ int getTimeFormat(int fd, int *format)
   if ( (error_type = tty_read_section(fd, temp_string, '#', IEQ45_TIMEOUT, &nbytes_read)) != TTY_OK)
 	return error_type;
 
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
   
   if (nbytes_read < 1)
    return error_type;
@@ -419,7 +419,7 @@ int getSiteName(int fd, char *siteName, int siteNum)
 
    /*read_ret = portRead(siteName, -1, IEQ45_TIMEOUT);*/
    error_type = tty_read_section(fd, siteName, '#', IEQ45_TIMEOUT, &nbytes_read);
-   tcflush(fd, TCIFLUSH);
+   tty_flush(fd, TCIFLUSH);
 
    if (nbytes_read < 1)
      return error_type;
@@ -454,7 +454,7 @@ int getSiteLatitude(int fd, int *dd, int *mm)
 
   /*read_ret = portRead(temp_string, -1, IEQ45_TIMEOUT);*/
   error_type = tty_read_section(fd, temp_string, '#', IEQ45_TIMEOUT, &nbytes_read);
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
   
    if (nbytes_read < 1) 
    return error_type;
@@ -486,7 +486,7 @@ int getSiteLongitude(int fd, int *ddd, int *mm)
   error_type = tty_read_section(fd, temp_string, '#', IEQ45_TIMEOUT, &nbytes_read);
   /*read_ret = portRead(temp_string, -1, IEQ45_TIMEOUT);*/
   
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
   
   if (nbytes_read < 1)
     return error_type;
@@ -519,7 +519,7 @@ int getTrackFreq(int fd, double *value)
 
     /*read_ret = portRead(temp_string, -1, IEQ45_TIMEOUT);*/
     error_type = tty_read_section(fd, temp_string, '#', IEQ45_TIMEOUT, &nbytes_read);
-    tcflush(fd, TCIFLUSH);
+    tty_flush(fd, TCIFLUSH);
     
     if (nbytes_read < 1)
      return error_type;
@@ -552,7 +552,7 @@ int getNumberOfBars(int fd, int *value)
      return -1;*/
 
    error_type = tty_read_section(fd, temp_string, '#', IEQ45_TIMEOUT, &nbytes_read);
-   tcflush(fd, TCIFLUSH);
+   tty_flush(fd, TCIFLUSH);
    
    if (nbytes_read < 0)
     return error_type;
@@ -575,7 +575,7 @@ int getHomeSearchStatus(int fd, int *status)
 
   /*read_ret = portRead(temp_string, 1, IEQ45_TIMEOUT);*/
   error_type = tty_read_section(fd, temp_string, '#', IEQ45_TIMEOUT, &nbytes_read);
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
   
   if (nbytes_read < 1)
    return error_type;
@@ -631,7 +631,7 @@ int updateSkyCommanderCoord(int fd, double *ra, double *dec)
 
   error_type = tty_read(fd, coords, 16, IEQ45_TIMEOUT, &nbytes_read);
   /*read_ret = portRead(coords, 16, IEQ45_TIMEOUT);*/
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
 
   nbytes_read = sscanf(coords, " %g %g", &RA, &DEC);
 
@@ -664,7 +664,7 @@ int updateIntelliscopeCoord (int fd, double *ra, double *dec)
      but read one more later it if it's a intelliscope */
   /*read_ret = portRead (coords, 14, IEQ45_TIMEOUT);*/
   error_type = tty_read(fd, coords, 14, IEQ45_TIMEOUT, &nbytes_read);
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
   /*IDLog ("portRead() = [%s]\n", coords);*/
 
   /* Remove the Q in the response from the Intelliscope  but not the Sky Wizard */
@@ -710,7 +710,7 @@ int setStandardProcedure(int fd, char * data)
 
  error_type = tty_read(fd, bool_return, 1, IEQ45_TIMEOUT, &nbytes_read);
  /*read_ret = portRead(boolRet, 1, IEQ45_TIMEOUT);*/
- tcflush(fd, TCIFLUSH);
+ tty_flush(fd, TCIFLUSH);
  
  if (nbytes_read < 1)
    return error_type;
@@ -872,7 +872,7 @@ int setAlignmentMode(int fd, unsigned int alignMode)
        break;
    }
    
-   tcflush(fd, TCIFLUSH);
+   tty_flush(fd, TCIFLUSH);
    return 0;
 }
 
@@ -895,7 +895,7 @@ int setCalenderDate(int fd, int dd, int mm, int yy)
 
    /*read_ret = portRead(boolRet, 1, IEQ45_TIMEOUT);*/
    error_type = tty_read(fd, bool_return, 1, IEQ45_TIMEOUT, &nbytes_read);
-   tcflush(fd, TCIFLUSH);
+   tty_flush(fd, TCIFLUSH);
    
    if (nbytes_read < 1)
     return error_type;
@@ -1035,7 +1035,7 @@ int setSlewMode(int fd, int slewMode)
      break;
    }
    
-   tcflush(fd, TCIFLUSH);
+   tty_flush(fd, TCIFLUSH);
    return 0;
 
 }
@@ -1067,7 +1067,7 @@ int setFocuserMotion(int fd, int motionType)
      break;
   }
 
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
   return 0;
 }
 
@@ -1107,7 +1107,7 @@ int setFocuserSpeedMode (int fd, int speedMode)
      break;
  }
 
- tcflush(fd, TCIFLUSH);
+ tty_flush(fd, TCIFLUSH);
  return 0;
 }
 
@@ -1141,7 +1141,7 @@ int setGPSFocuserSpeed (int fd, int speed)
   /*if (portWrite(speed_str) < 0)
        return -1;*/
 
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
   return 0;
 }
 
@@ -1178,7 +1178,7 @@ int Slew(int fd)
 
   
   /* We don't need to read the string message, just return corresponding error code */
-    tcflush(fd, TCIFLUSH);
+    tty_flush(fd, TCIFLUSH);
 
     if (slewNum[0] == '1')
      return 0;
@@ -1214,7 +1214,7 @@ int MoveTo(int fd, int direction)
     break;
   }
   
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
   return 0;
 }
 
@@ -1233,7 +1233,7 @@ int SendPulseCmd(int fd, int direction, int duration_msec)
   
   tty_write_string(fd, cmd, &nbytes_write);
   
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
   return 0;
 }
 
@@ -1279,7 +1279,7 @@ int HaltMovement(int fd, int direction)
     break;
   }
   
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
   return 0;
 
 }
@@ -1294,7 +1294,7 @@ int abortSlew(int fd)
  if ( (error_type = tty_write_string(fd, ":Q#", &nbytes_write)) != TTY_OK)
     	   return error_type;
 
- tcflush(fd, TCIFLUSH);
+ tty_flush(fd, TCIFLUSH);
  return 0;
 }
 
@@ -1321,7 +1321,7 @@ int Sync(int fd, char *matchedObject)
   
   /* Sleep 10ms before flushing. This solves some issues with IEQ45 compatible devices. */
   usleep(10000);
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
 
   return 0;
 }
@@ -1362,7 +1362,7 @@ int selectSite(int fd, int siteNum)
     break;
   }
   
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
   return 0;
 
 }
@@ -1393,7 +1393,7 @@ int selectCatalogObject(int fd, int catalog, int NNNN)
   /*if (portWrite(temp_string) < 0)
    return -1;*/
 
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
   return 0;
 }
 
@@ -1497,7 +1497,7 @@ int selectTrackingMode(int fd, int trackMode)
     break;
    }
    
-   tcflush(fd, TCIFLUSH);
+   tty_flush(fd, TCIFLUSH);
    return 0;
 
 }
@@ -80,7 +80,7 @@ int check_lx200ap_connection(int fd)
 	  return error_type;
       }
       error_type = tty_read_section(fd, temp_string, '#', LX200_TIMEOUT, &nbytes_read) ;
-      tcflush(fd, TCIFLUSH);
+      tty_flush(fd, TCIFLUSH);
       if (nbytes_read > 1)
       {
 	  temp_string[ nbytes_read -1] = '\0';
@@ -116,7 +116,7 @@ int getAPUTCOffset(int fd, double *value)
 
 	return error_type ;
     }
-    tcflush(fd, TCIFLUSH);
+    tty_flush(fd, TCIFLUSH);
 
 /* Negative offsets, see AP keypad manual p. 77 */
     if((temp_string[0]== 'A') || ((temp_string[0]== '0')&&(temp_string[1]== '0')) ||(temp_string[0]== '@'))
@@ -305,7 +305,7 @@ int APSyncCM(int fd, char *matchedObject)
     /* Sleep 10ms before flushing. This solves some issues with LX200 compatible devices. */
     usleep(10000);
   
-    tcflush(fd, TCIFLUSH);
+    tty_flush(fd, TCIFLUSH);
 
     return 0;
 }
@@ -330,7 +330,7 @@ int APSyncCMR(int fd, char *matchedObject)
     /* Sleep 10ms before flushing. This solves some issues with LX200 compatible devices. */
     usleep(10000);
   
-    tcflush(fd, TCIFLUSH);
+    tty_flush(fd, TCIFLUSH);
 
     return 0;
 }
@@ -40,6 +40,8 @@
 
 int controller_format;
 int lx200_debug = 0;
+/* fd of a mount that did not answer pipelined queries, asked one at a time until it reconnects */
+static int lx200_unpipelined_fd = -1;
 
 /**************************************************************************
  Diagnostics
@@ -174,6 +176,9 @@ int check_lx200_connection(int in_fd)
 
   if (in_fd <= 0) return -1;
 
+  /* a new connection gets to try pipelining again */
+  lx200_unpipelined_fd = -1;
+
   for (i=0; i < 2; i++)
   {
     if (write(in_fd, ack, 1) < 0) return -1;
@@ -222,7 +227,7 @@ int getCommandSexa(int fd, double *value, const char * cmd)
   int error_type;
   int nbytes_write=0, nbytes_read=0;
   
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
 
   if (lx200_debug)
    IDLog("%s Command [%s]\n", __FUNCTION__, cmd);
@@ -230,8 +235,8 @@ int getCommandSexa(int fd, double *value, const char * cmd)
   if ( (error_type = tty_write_string(fd, cmd, &nbytes_write)) != TTY_OK)
    return error_type;
   
-  error_type = tty_read_section(fd, temp_string, '#', LX200_TIMEOUT, &nbytes_read);
-  tcflush(fd, TCIFLUSH);
+  error_type = tty_read_until(fd, temp_string, sizeof(temp_string), "#", 1, LX200_TIMEOUT*1000, &nbytes_read);
+  tty_flush(fd, TCIFLUSH);
   if (error_type != TTY_OK)
     return error_type;
 
@@ -250,10 +255,54 @@ int getCommandSexa(int fd, double *value, const char * cmd)
   if (lx200_debug)
       IDLog("%s Sexa Response <%g>\n", __FUNCTION__, *value);
 
-   tcflush(fd, TCIFLUSH);
+   tty_flush(fd, TCIFLUSH);
    return 0;
 }
 
+int getLX200EquatorialCoords(int fd, double *ra, double *dec)
+{
+  char ra_string[16], dec_string[16];
+  int error_type;
+  tty_transaction t[2] = {
+      { "#:GR#", 0, ra_string, sizeof(ra_string), "#", 1, 0, 0 },
+      { "#:GD#", 0, dec_string, sizeof(dec_string), "#", 1, 0, 0 } };
+
+  if (fd == lx200_unpipelined_fd)
+  {
+    if ( (error_type = getLX200RA(fd, ra)) < 0)
+      return error_type;
+    return getLX200DEC(fd, dec);
+  }
+
+  tty_flush(fd, TCIFLUSH);
+
+  if (lx200_debug)
+   IDLog("%s Command [%s%s]\n", __FUNCTION__, t[0].cmd, t[1].cmd);
+
+  /* both queries go out together, one round trip instead of two */
+  error_type = tty_transact(fd, t, 2, LX200_TIMEOUT*1000);
+  tty_flush(fd, TCIFLUSH);
+
+  if (error_type == TTY_OK)
+  {
+    ra_string[t[0].nbytes_read - 1] = '\0';
+    dec_string[t[1].nbytes_read - 1] = '\0';
+
+    if (lx200_debug)
+      IDLog("%s Response <%s> <%s>\n", __FUNCTION__, ra_string, dec_string);
+
+    if (f_scansexa(ra_string, ra) == 0 && f_scansexa(dec_string, dec) == 0)
+      return 0;
+  }
+
+  /* not every LX200 clone copes with a second command before it answers the first */
+  if (lx200_debug)
+    IDLog("%s pipelined query failed, asking one at a time from now on\n", __FUNCTION__);
+  lx200_unpipelined_fd = fd;
+
+  return getLX200EquatorialCoords(fd, ra, dec);
+}
+
 int getCommandInt(int fd, int *value, const char* cmd)
 {
   char temp_string[16];
@@ -261,7 +310,7 @@ int getCommandInt(int fd, int *value, const char* cmd)
   int error_type;
   int nbytes_write=0, nbytes_read=0;
   
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
 
   if (lx200_debug)
    IDLog("%s Command [%s]\n", __FUNCTION__, cmd);
@@ -270,7 +319,7 @@ int getCommandInt(int fd, int *value, const char* cmd)
    return error_type;
   
   error_type = tty_read_section(fd, temp_string, '#', LX200_TIMEOUT, &nbytes_read);
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
   if (error_type != TTY_OK)
     return error_type;
  
@@ -308,7 +357,7 @@ int getCommandString(int fd, char *data, const char* cmd)
     return error_type;
 
     error_type = tty_read_section(fd, data, '#', LX200_TIMEOUT, &nbytes_read);
-    tcflush(fd, TCIFLUSH);
+    tty_flush(fd, TCIFLUSH);
 
     if (error_type != TTY_OK)
 	return error_type;
@@ -337,7 +386,7 @@ int isSlewComplete(int fd)
     return error_type;
 
    error_type = tty_read_section(fd, data, '#', LX200_TIMEOUT, &nbytes_read);
-   tcflush(fd, TCIOFLUSH);
+   tty_flush(fd, TCIOFLUSH);
 
     if (error_type != TTY_OK)
     return error_type;
@@ -404,7 +453,7 @@ int getTimeFormat(int fd, int *format)
   if ( (error_type = tty_read_section(fd, temp_string, '#', LX200_TIMEOUT, &nbytes_read)) != TTY_OK)
 	return error_type;
 
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
   
   if (nbytes_read < 1)
    return error_type;
@@ -462,7 +511,7 @@ int getSiteName(int fd, char *siteName, int siteNum)
    }
 
    error_type = tty_read_section(fd, siteName, '#', LX200_TIMEOUT, &nbytes_read);
-   tcflush(fd, TCIFLUSH);
+   tty_flush(fd, TCIFLUSH);
 
    if (nbytes_read < 1)
      return error_type;
@@ -499,7 +548,7 @@ int getSiteLatitude(int fd, int *dd, int *mm)
     	return error_type;
 
   error_type = tty_read_section(fd, temp_string, '#', LX200_TIMEOUT, &nbytes_read);
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
   
    if (nbytes_read < 1) 
    return error_type;
@@ -536,7 +585,7 @@ int getSiteLongitude(int fd, int *ddd, int *mm)
 
   error_type = tty_read_section(fd, temp_string, '#', LX200_TIMEOUT, &nbytes_read);
   
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
   
   if (nbytes_read < 1)
     return error_type;
@@ -574,7 +623,7 @@ int getTrackFreq(int fd, double *value)
     	return error_type;
 
     error_type = tty_read_section(fd, temp_string, '#', LX200_TIMEOUT, &nbytes_read);
-    tcflush(fd, TCIFLUSH);
+    tty_flush(fd, TCIFLUSH);
     
     if (nbytes_read < 1)
      return error_type;
@@ -613,7 +662,7 @@ int getNumberOfBars(int fd, int *value)
      return -1;*/
 
    error_type = tty_read_section(fd, temp_string, '#', LX200_TIMEOUT, &nbytes_read);
-   tcflush(fd, TCIFLUSH);
+   tty_flush(fd, TCIFLUSH);
    
    if (nbytes_read < 0)
     return error_type;
@@ -636,7 +685,7 @@ int getHomeSearchStatus(int fd, int *status)
     	return error_type;
 
   error_type = tty_read_section(fd, temp_string, '#', LX200_TIMEOUT, &nbytes_read);
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
   
   if (nbytes_read < 1)
    return error_type;
@@ -709,7 +758,7 @@ int updateSkyCommanderCoord(int fd, double *ra, double *dec)
 
   error_type = tty_read(fd, coords, 16, LX200_TIMEOUT, &nbytes_read);
   /*read_ret = portRead(coords, 16, LX200_TIMEOUT);*/
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
 
   nbytes_read = sscanf(coords, " %g %g", &RA, &DEC);
 
@@ -742,7 +791,7 @@ int updateIntelliscopeCoord (int fd, double *ra, double *dec)
      but read one more later it if it's a intelliscope */
   /*read_ret = portRead (coords, 14, LX200_TIMEOUT);*/
   error_type = tty_read(fd, coords, 14, LX200_TIMEOUT, &nbytes_read);
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
   /*IDLog ("portRead() = [%s]\n", coords);*/
 
   /* Remove the Q in the response from the Intelliscope  but not the Sky Wizard */
@@ -790,7 +839,7 @@ int setStandardProcedure(int fd, const char * data)
     	return error_type;
 
  error_type = tty_read(fd, bool_return, 1, LX200_TIMEOUT, &nbytes_read);
- tcflush(fd, TCIFLUSH);
+ tty_flush(fd, TCIFLUSH);
  
  if (nbytes_read < 1)
    return error_type;
@@ -971,7 +1020,7 @@ int setAlignmentMode(int fd, unsigned int alignMode)
        break;
    }
    
-   tcflush(fd, TCIFLUSH);
+   tty_flush(fd, TCIFLUSH);
    return 0;
 }
 
@@ -993,7 +1042,7 @@ int setCalenderDate(int fd, int dd, int mm, int yy)
     	return error_type;
 
    error_type = tty_read(fd, bool_return, 1, LX200_TIMEOUT, &nbytes_read);
-   tcflush(fd, TCIFLUSH);
+   tty_flush(fd, TCIFLUSH);
    
    if (nbytes_read < 1)
    {
@@ -1155,7 +1204,7 @@ int setSlewMode(int fd, int slewMode)
      break;
    }
    
-   tcflush(fd, TCIFLUSH);
+   tty_flush(fd, TCIFLUSH);
    return 0;
 
 }
@@ -1181,7 +1230,7 @@ int setFocuserMotion(int fd, int motionType)
      break;
   }
 
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
   return 0;
 }
 
@@ -1212,7 +1261,7 @@ int setFocuserSpeedMode (int fd, int speedMode)
      break;
  }
 
- tcflush(fd, TCIFLUSH);
+ tty_flush(fd, TCIFLUSH);
  return 0;
 }
 
@@ -1240,7 +1289,7 @@ int setGPSFocuserSpeed (int fd, int speed)
   if ( (error_type = tty_write_string(fd, speed_str, &nbytes_write)) != TTY_OK)
     	return error_type;
 
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
   return 0;
 }
 
@@ -1283,7 +1332,7 @@ int Slew(int fd)
     }
 
     /* We don't need to read the string message, just return corresponding error code */
-    tcflush(fd, TCIFLUSH);
+    tty_flush(fd, TCIFLUSH);
 
     if (lx200_debug)
        IDLog("%s Response <%c>\n", __FUNCTION__, slewNum[0]);
@@ -1326,7 +1375,7 @@ int MoveTo(int fd, int direction)
     break;
   }
   
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
   return 0;
 }
 
@@ -1348,7 +1397,7 @@ int SendPulseCmd(int fd, int direction, int duration_msec)
 
   tty_write_string(fd, cmd, &nbytes_write);
   
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
   return 0;
 }
 
@@ -1394,7 +1443,7 @@ int HaltMovement(int fd, int direction)
     break;
   }
   
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
   return 0;
 
 }
@@ -1410,7 +1459,7 @@ int abortSlew(int fd)
  if ( (error_type = tty_write_string(fd, "#:Q#", &nbytes_write)) != TTY_OK)
     	   return error_type;
 
- tcflush(fd, TCIFLUSH);
+ tty_flush(fd, TCIFLUSH);
  return 0;
 }
 
@@ -1437,7 +1486,7 @@ int Sync(int fd, char *matchedObject)
   
   /* Sleep 10ms before flushing. This solves some issues with LX200 compatible devices. */
   usleep(10000);
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
 
   return 0;
 }
@@ -1480,7 +1529,7 @@ int selectSite(int fd, int siteNum)
     break;
   }
   
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
   return 0;
 
 }
@@ -1511,7 +1560,7 @@ int selectCatalogObject(int fd, int catalog, int NNNN)
   /*if (portWrite(temp_string) < 0)
    return -1;*/
 
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
   return 0;
 }
 
@@ -1602,7 +1651,7 @@ int selectTrackingMode(int fd, int trackMode)
     break;
    }
    
-   tcflush(fd, TCIFLUSH);
+   tty_flush(fd, TCIFLUSH);
    return 0;
 
 }
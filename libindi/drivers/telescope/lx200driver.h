@@ -137,6 +137,8 @@ int check_lx200_connection(int fd);
  
 /* Get Double from Sexagisemal */
 int getCommandSexa(int fd, double *value, const char *cmd);
+/* Get RA and DEC in one round trip */
+int getLX200EquatorialCoords(int fd, double *ra, double *dec);
 /* Get String */
 int getCommandString(int fd, char *data, const char* cmd);
 /* Get Int */
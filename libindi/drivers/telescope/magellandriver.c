@@ -93,7 +93,7 @@ int check_magellan_connection(int fd)
     usleep(50000);
   }
 
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
   return MAGELLAN_ERROR;
 }
 
@@ -134,7 +134,7 @@ char ACK(int fd)
     }
   }
 
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
   return result;
 }
 
@@ -163,7 +163,7 @@ int getCommandSexa(int fd, double *value, const char * cmd)
     }
   }
   
-  tcflush(fd, TCIFLUSH);
+  tty_flush(fd, TCIFLUSH);
   return result;
 }
 
@@ -181,7 +181,7 @@ static int getCommandString(int fd, char *data, const char* cmd)
       }
    }
 
-   tcflush(fd, TCIFLUSH);
+   tty_flush(fd, TCIFLUSH);
    return result;
 }
 
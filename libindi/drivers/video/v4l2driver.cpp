@@ -46,6 +46,7 @@ V4L2_Driver::V4L2_Driver()
   AbsExposureN=NULL;
   ManualExposureSP=NULL;
   stackMode=0;
+  stacker=new V4L2_Stacker();
 
   lx=new Lx();
 
@@ -53,6 +54,7 @@ V4L2_Driver::V4L2_Driver()
   recorder=v4l2_record->getDefaultRecorder();
   recorder->init();
   direct_record=false;
+  recordStatsTimer=-1;
   //const std::vector<unsigned int> &vsuppformats=decoder->getsupportedformats();
   IDLog("Using default recorder '%s'\n", recorder->getName());
 }
@@ -60,6 +62,7 @@ V4L2_Driver::V4L2_Driver()
 V4L2_Driver::~V4L2_Driver()
 {
   releaseBuffers();
+  delete stacker;
 }
 
 
@@ -83,6 +86,11 @@ bool V4L2_Driver::initProperties()
   IUFillSwitch(&ImageTypeS[1], "Color", "", ISS_OFF);
   IUFillSwitchVector(&ImageTypeSP, ImageTypeS, NARRAY(ImageTypeS), getDeviceName(), "Image Type", "", IMAGE_SETTINGS_TAB, IP_RW, ISR_1OFMANY, 0, IPS_IDLE);
 
+  /* Bayer demosaic */
+  IUFillSwitch(&DemosaicS[0], "BILINEAR", "Bilinear", ISS_ON);
+  IUFillSwitch(&DemosaicS[1], "EDGE_AWARE", "Edge aware", ISS_OFF);
+  IUFillSwitchVector(&DemosaicSP, DemosaicS, NARRAY(DemosaicS), getDeviceName(), "V4L2_DEMOSAIC", "Bayer demosaic", IMAGE_SETTINGS_TAB, IP_RW, ISR_1OFMANY, 0, IPS_IDLE);
+
   /* Camera Name */
   IUFillText(&camNameT[0], "Model", "", NULL);
   IUFillTextVector(&camNameTP, camNameT, NARRAY(camNameT), getDeviceName(), "Camera Model", "", IMAGE_INFO_TAB, IP_RO, 0, IPS_IDLE);
@@ -90,9 +98,17 @@ bool V4L2_Driver::initProperties()
   /* Stacking Mode */
   IUFillSwitch(&StackModeS[0], "None", "", ISS_ON);
   IUFillSwitch(&StackModeS[1], "Additive", "", ISS_OFF);
+  IUFillSwitch(&StackModeS[2], "Mean", "", ISS_OFF);
+  IUFillSwitch(&StackModeS[3], "SigmaClip", "Sigma clip", ISS_OFF);
+  IUFillSwitch(&StackModeS[4], "Median", "", ISS_OFF);
   IUFillSwitchVector(&StackModeSP, StackModeS, NARRAY(StackModeS), getDeviceName(), "Stack", "", MAIN_CONTROL_TAB, IP_RW, ISR_1OFMANY, 0, IPS_IDLE);
   stackMode=0;
 
+  /* Stacking options: frames per sigma clip/median batch, clipping threshold */
+  IUFillNumber(&StackOptionsN[0], "BATCH", "Batch", "%.f", 2, V4L2_STACK_MAXBATCH, 1, 8);
+  IUFillNumber(&StackOptionsN[1], "SIGMA", "Sigma", "%.1f", 0.5, 5, 0.1, 2.5);
+  IUFillNumberVector(&StackOptionsNP, StackOptionsN, NARRAY(StackOptionsN), getDeviceName(), "STACK_OPTIONS", "Stack options", MAIN_CONTROL_TAB, IP_RW, 0, IPS_IDLE);
+
   /* Inputs */
   IUFillSwitchVector(&InputsSP, NULL, 0, getDeviceName(), "V4L2_INPUT", "Inputs", CAPTURE_FORMAT, IP_RW, ISR_1OFMANY, 0, IPS_IDLE);
   /* Capture Formats */
@@ -116,6 +132,13 @@ bool V4L2_Driver::initProperties()
   IUFillSwitch(&RecordS[0], "ON", "Record On", ISS_OFF);
   IUFillSwitch(&RecordS[1], "OFF", "Record Off", ISS_ON);
   IUFillSwitchVector(&RecordSP, RecordS, NARRAY(RecordS), getDeviceName(), "VIDEO_RECORD", "Video Record", MAIN_CONTROL_TAB, IP_RW, ISR_1OFMANY, 0, IPS_IDLE);
+  IUFillSwitch(&RecordOptionsS[0], "DIRECT_IO", "Direct I/O", ISS_OFF);
+  IUFillSwitchVector(&RecordOptionsSP, RecordOptionsS, NARRAY(RecordOptionsS), getDeviceName(), "RECORD_OPTIONS", "Record Options", MAIN_CONTROL_TAB, IP_RW, ISR_NOFMANY, 0, IPS_IDLE);
+  IUFillNumber(&RecordStatsN[0], "FRAMES", "Frames", "%.f", 0, 0, 0, 0);
+  IUFillNumber(&RecordStatsN[1], "DROPPED", "Dropped", "%.f", 0, 0, 0, 0);
+  IUFillNumber(&RecordStatsN[2], "QUEUED", "Queued", "%.f", 0, 0, 0, 0);
+  IUFillNumber(&RecordStatsN[3], "MAX_QUEUED", "Max queued", "%.f", 0, 0, 0, 0);
+  IUFillNumberVector(&RecordStatsNP, RecordStatsN, NARRAY(RecordStatsN), getDeviceName(), "RECORD_STATS", "Record Stats", MAIN_CONTROL_TAB, IP_RO, 0, IPS_IDLE);
 
 
   PrimaryCCD.setCCDInfoWritable();
@@ -146,7 +169,9 @@ void V4L2_Driver::ISGetProperties (const char *dev)
     defineText(&camNameTP);
     defineSwitch(&StreamSP);
     defineSwitch(&StackModeSP);
+    defineNumber(&StackOptionsNP);
     defineSwitch(&ImageTypeSP);
+    defineSwitch(&DemosaicSP);
     defineSwitch(&InputsSP);
     defineSwitch(&CaptureFormatsSP);
 
@@ -185,7 +210,9 @@ bool V4L2_Driver::updateProperties ()
 
     defineSwitch(&StreamSP);
     defineSwitch(&StackModeSP);
+    defineNumber(&StackOptionsNP);
     defineSwitch(&ImageTypeSP);
+    defineSwitch(&DemosaicSP);
     defineSwitch(&InputsSP);
     defineSwitch(&CaptureFormatsSP);
 
@@ -200,6 +227,8 @@ bool V4L2_Driver::updateProperties ()
 
    defineSwitch(&RecordSP);  
    defineText(&RecordFileTP);
+   defineSwitch(&RecordOptionsSP);
+   defineNumber(&RecordStatsNP);
 
    SetCCDParams(V4LFrame->width, V4LFrame->height, 8, 5.6, 5.6);
    
@@ -219,7 +248,9 @@ bool V4L2_Driver::updateProperties ()
     deleteProperty(camNameTP.name);
     deleteProperty(StreamSP.name);
     deleteProperty(StackModeSP.name);
+    deleteProperty(StackOptionsNP.name);
     deleteProperty(ImageTypeSP.name);
+    deleteProperty(DemosaicSP.name);
     deleteProperty(InputsSP.name);
     deleteProperty(CaptureFormatsSP.name);
 
@@ -242,6 +273,8 @@ bool V4L2_Driver::updateProperties ()
 
     deleteProperty(RecordFileTP.name);
     deleteProperty(RecordSP.name);
+    deleteProperty(RecordOptionsSP.name);
+    deleteProperty(RecordStatsNP.name);
   }
 }
 
@@ -422,12 +455,23 @@ bool V4L2_Driver::ISNewSwitch (const char *dev, const char *name, ISState *state
     return true;
   }
   
+  /* Bayer demosaic */
+  if (!strcmp(name, DemosaicSP.name)) {
+    IUResetSwitch(&DemosaicSP);
+    IUUpdateSwitch(&DemosaicSP, states, names, n);
+    DemosaicSP.s = IPS_OK;
+    v4l_base->setBayerEdge(DemosaicS[1].s == ISS_ON);
+    IDSetSwitch(&DemosaicSP, NULL);
+    return true;
+  }
+
   /* Stacking Mode */
   if (!strcmp(name, StackModeSP.name)) {
     IUResetSwitch(&StackModeSP);
     IUUpdateSwitch(&StackModeSP, states, names, n);
     StackModeSP.s = IPS_OK;
     stackMode=IUFindOnSwitchIndex(&StackModeSP);
+    stacker->setMode(stackMode);
     
     IDSetSwitch(&StackModeSP, "Setting Stacking Mode: %s", StackModeS[stackMode].name);
     return true;
@@ -490,6 +534,8 @@ bool V4L2_Driver::ISNewSwitch (const char *dev, const char *name, ISState *state
 	    recorder->setDefaultColor();
 	}
 	v4l_base->start_capturing(errmsg);
+	updateRecordStats();
+	recordStatsTimer=IEAddTimer(1000, (IE_TCF *)recordStatsCallback, this);
       } else {
 	if (!is_recording) RecordSP.s=IPS_IDLE;
       }
@@ -501,8 +547,12 @@ bool V4L2_Driver::ISNewSwitch (const char *dev, const char *name, ISState *state
 	  v4l_base->doDecode(true);
 	  v4l_base->doRecord(false);
 	}
-	recorder->close();
-	DEBUGF(INDI::Logger::DBG_SESSION, "Recording stream has been disabled. Frame count %d\n", frameCount);
+	if (recordStatsTimer != -1) IERmTimer(recordStatsTimer);
+	recordStatsTimer=-1;
+	if (!recorder->close())
+	  DEBUG(INDI::Logger::DBG_ERROR, "Error writing the recording, it may be incomplete.");
+	updateRecordStats();
+	DEBUGF(INDI::Logger::DBG_SESSION, "Recording stream has been disabled. Frame count %d, %d dropped\n", frameCount, (int) RecordStatsN[1].value);
       }
     }
     
@@ -510,6 +560,15 @@ bool V4L2_Driver::ISNewSwitch (const char *dev, const char *name, ISState *state
     return true;
   }
 
+  /* Record Options */
+  if (!strcmp(name, RecordOptionsSP.name)) {
+    IUUpdateSwitch(&RecordOptionsSP, states, names, n);
+    recorder->setdirectio(RecordOptionsS[0].s == ISS_ON);
+    RecordOptionsSP.s = IPS_OK;
+    IDSetSwitch(&RecordOptionsSP, (RecordSP.s == IPS_BUSY) ? "Applies to the next recording." : NULL);
+    return true;
+  }
+
   /* V4L2 Options/Menus */
   for (iopt=0; iopt<v4loptions; iopt++) 
     if (!strcmp (Options[iopt].name, name))
@@ -590,6 +649,18 @@ bool V4L2_Driver::ISNewNumber (const char *dev, const char *name, double values[
   if (dev && strcmp (getDeviceName(), dev))
     return true;
 
+  /* Stacking options */
+  if (!strcmp(name, StackOptionsNP.name))
+    {
+      if (IUUpdateNumber(&StackOptionsNP, values, names, n) < 0)
+        return false;
+      stacker->setBatch((unsigned int) StackOptionsN[0].value);
+      stacker->setSigma(StackOptionsN[1].value);
+      StackOptionsNP.s = IPS_OK;
+      IDSetNumber(&StackOptionsNP, NULL);
+      return true;
+    }
+
        /* Capture Size (Step/Continuous) */
   if ((!strcmp(name, CaptureSizesNP.name)))
      {
@@ -831,7 +902,27 @@ bool V4L2_Driver::UpdateCCDBin(int hor, int ver)
   return true;
 }
 
-void V4L2_Driver::binFrame()
+/* sum bin x bin blocks of a w x h frame of T samples into the w/bin x h/bin
+   frame out, saturating at max */
+template <typename T>
+static void binSamples(const T *in, T *out, int w, int h, int bin, unsigned long long max)
+{
+    int bin_w = w / bin;
+    int bin_h = h / bin;
+
+    for (int i=0; i < bin_h; i++)
+        for (int j=0; j < bin_w; j++)
+        {
+            unsigned long long val = 0;
+            for (int k=0; k < bin; k++)
+                for (int l=0; l < bin; l++)
+                    val += in[(i * bin + k) * w + j * bin + l];
+            *(out++) = (T) (val > max ? max : val);
+        }
+}
+
+/* bin the frame buffer, or the frame at src into it */
+void V4L2_Driver::binFrame(const char *src)
 {
     int bin;
     if ( (bin = PrimaryCCD.getBinX()) == 1)
@@ -839,39 +930,31 @@ void V4L2_Driver::binFrame()
 
     int w = PrimaryCCD.getSubW();
     int h = PrimaryCCD.getSubH();
+    int bpp = PrimaryCCD.getBPP();
 
     int bin_w = w / bin;
     int bin_h = h / bin;
+    int bin_bytes = bin_w * bin_h * (bpp / 8);
 
-    unsigned char *bin_buffer = (unsigned char *) malloc(bin_w * bin_h * sizeof(char));
-    unsigned char *buffer = (unsigned char *) PrimaryCCD.getFrameBuffer();
-    //unsigned char *bin_buffer = buffer;
+    char *bin_buffer = (char *) malloc(bin_bytes);
+    char *buffer = PrimaryCCD.getFrameBuffer();
+    if (!src) src = buffer;
 
-    memset(bin_buffer, 0, bin_w * bin_h * sizeof(char));
-
-    unsigned char *bin_buf = bin_buffer;
-
-    unsigned char val;
-    for (int i=0; i < h; i+= bin)
-        for (int j=0; j < w; j+= bin)
-        {
-            for (int k=0; k < bin; k++)
-            {
-                for (int l=0; l < bin; l++)
-                {
-                    val = *(buffer + j + (i+k) * w + l);
-                    if (val + *bin_buf > 255)
-                        *bin_buffer = 255;
-                    else
-                        *bin_buf  += val;
-                }
-            }
-
-            bin_buf++;
-        }
+    switch (bpp)
+    {
+      case 16:
+        binSamples((const unsigned short *) src, (unsigned short *) bin_buffer, w, h, bin, 0xffff);
+        break;
+      case 32:
+        binSamples((const unsigned int *) src, (unsigned int *) bin_buffer, w, h, bin, 0xffffffff);
+        break;
+      default:
+        binSamples((const unsigned char *) src, (unsigned char *) bin_buffer, w, h, bin, 0xff);
+        break;
+    }
 
-    PrimaryCCD.setFrameBuffer((char *) bin_buffer);
-    PrimaryCCD.setFrameBufferSize(bin_w * bin_h * sizeof(char), false);
+    PrimaryCCD.setFrameBuffer(bin_buffer);
+    PrimaryCCD.setFrameBufferSize(bin_bytes, false);
     free (buffer);
 }
 
@@ -925,36 +1008,42 @@ void V4L2_Driver::updateFrame()
   {
     PrimaryCCD.setExposureDuration(ExposeTimeN[0].value);
     struct timeval current_exposure;
-    unsigned int i;
-    unsigned char *src, *dest;
+    bool grey = (ImageTypeS[0].s == ISS_ON);
+    unsigned int npixels = v4l_base->getWidth() * v4l_base->getHeight();
+    unsigned char *dest;
+    char *ownFrame = NULL;
     
     gettimeofday(&capture_end,NULL);
     timersub(&capture_end, &capture_start, &current_exposure);
 
-    if (ImageTypeS[0].s == ISS_ON) {
-      src = v4l_base->getY();
+    if (!stackMode || lx->isenabled()) {
       dest = (unsigned char *)PrimaryCCD.getFrameBuffer();
-      if (frameCount==0)
-        for (i=0; i< frameBytes; i++)
-	  *(dest++) = *(src++);
-      else
-        for (i=0; i< frameBytes; i++)
-	  *(dest++) += *(src++);
-      binFrame();
+      if (grey) {
+        // The frame stays in the capture buffer until the next one is read:
+        // bin from there, or lend it to the CCD layer until ExposureComplete()
+        if (PrimaryCCD.getBinX() > 1)
+          binFrame((char *) v4l_base->getY());
+        else {
+          ownFrame = PrimaryCCD.getFrameBuffer();
+          PrimaryCCD.setFrameBuffer((char *) v4l_base->getY());
+        }
+      } else {
+        // Binning not supported in color images for now
+        V4L2_Stacker::splitBGRA(v4l_base->getColorBuffer(), dest, dest + npixels, dest + 2 * npixels, npixels);
+      }
     } else {
-      // Binning not supported in color images for now
-      src = v4l_base->getColorBuffer();
-      dest = (unsigned char *)PrimaryCCD.getFrameBuffer();
-      unsigned char *red = dest;
-      unsigned char *green = dest + v4l_base->getWidth() * v4l_base->getHeight();
-      unsigned char *blue = dest + v4l_base->getWidth() * v4l_base->getHeight() * 2;
-      
-      for (int i=0; i <  frameBytes; i+=4)
-      {
-          *(blue++) = *(src+i);
-          *(green++) = *(src+i+1);
-          *(red++) = *(src+i+2);
+      // Stack in 16 or 32 bits, the frame buffer gets the result once complete
+      if (frameCount==0 && !stacker->setsize(npixels, grey ? 1 : 3)) {
+        DEBUG(INDI::Logger::DBG_ERROR, "Not enough memory to stack frames.");
+        v4l_base->stop_capturing(errmsg);
+        ExposeTimeNP->s = IPS_ALERT;
+        IDSetNumber(ExposeTimeNP, NULL);
+        return;
       }
+      if (grey)
+        stacker->addFrameGrey(v4l_base->getY());
+      else
+        stacker->addFrameBGRA(v4l_base->getColorBuffer());
     }
 
     frameCount+=1;
@@ -966,6 +1055,8 @@ void V4L2_Driver::updateFrame()
 	v4l_base->stop_capturing(errmsg);
 	DEBUGF(INDI::Logger::DBG_SESSION, "Capture of LX frame took %ld.%06ld seconds.\n", current_exposure.tv_sec, current_exposure.tv_usec);
 	ExposureComplete(&PrimaryCCD);
+	if (ownFrame) PrimaryCCD.setFrameBuffer(ownFrame);
+	ownFrame = NULL;
 	PrimaryCCD.setFrameBufferSize(frameBytes);
 	//}
     } else {
@@ -973,10 +1064,23 @@ void V4L2_Driver::updateFrame()
 	{
 	  v4l_base->stop_capturing(errmsg);
 	  DEBUGF(INDI::Logger::DBG_SESSION, "Capture of ONE frame (%d stacked frames) took %ld.%06ld seconds.\n", frameCount, current_exposure.tv_sec, current_exposure.tv_usec);
+	  if (stackMode) {
+	    unsigned int bpp = stacker->getBPP();
+	    PrimaryCCD.setBPP(bpp);
+	    PrimaryCCD.setFrameBufferSize(npixels * (grey ? 1 : 3) * (bpp / 8));
+	    stacker->getResult(PrimaryCCD.getFrameBuffer());
+	    if (grey)
+	      binFrame();
+	  }
 	  ExposureComplete(&PrimaryCCD);
+	  if (ownFrame) PrimaryCCD.setFrameBuffer(ownFrame);
+	  ownFrame = NULL;
+	  if (stackMode)
+	    PrimaryCCD.setBPP(8);
 	  PrimaryCCD.setFrameBufferSize(frameBytes);
 	}
     }
+    if (ownFrame) PrimaryCCD.setFrameBuffer(ownFrame);
   }
 
 }
@@ -990,6 +1094,30 @@ void V4L2_Driver::recordStream()
     recorder->writeFrameColor(v4l_base->getRGBBuffer());
 }
 
+void V4L2_Driver::updateRecordStats()
+{
+  V4L2_Recorder_Stats stats;
+
+  recorder->getstats(&stats);
+  RecordStatsN[0].value = stats.frames;
+  RecordStatsN[1].value = stats.dropped;
+  RecordStatsN[2].value = stats.queued;
+  RecordStatsN[3].value = stats.maxqueued;
+  RecordStatsNP.s = stats.dropped ? IPS_ALERT : (RecordSP.s == IPS_BUSY ? IPS_BUSY : IPS_OK);
+  IDSetNumber(&RecordStatsNP, NULL);
+}
+
+void V4L2_Driver::recordStatsCallback(void *userpointer)
+{
+  V4L2_Driver *p = (V4L2_Driver *)userpointer;
+
+  p->updateRecordStats();
+  if (p->RecordSP.s == IPS_BUSY)
+    p->recordStatsTimer = IEAddTimer(1000, (IE_TCF *)recordStatsCallback, p);
+  else
+    p->recordStatsTimer = -1;
+}
+
 void V4L2_Driver::updateStream()
 {
    int width  = v4l_base->getWidth();
@@ -1090,6 +1218,8 @@ bool V4L2_Driver::Disconnect()
     v4l_base->disconnectCam((StreamSP.s == IPS_BUSY) ||  (ExposeTimeNP->s == IPS_BUSY) || (RecordSP.s == IPS_BUSY)); 
     if ((StreamSP.s == IPS_BUSY) ||  (ExposeTimeNP->s == IPS_BUSY) || (RecordSP.s == IPS_BUSY))
       recorder->close();
+    if (recordStatsTimer != -1) IERmTimer(recordStatsTimer);
+    recordStatsTimer=-1;
   }
   return true;
 }
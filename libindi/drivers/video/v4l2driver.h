@@ -52,6 +52,7 @@
 
 #include "webcam/v4l2_base.h"
 #include "webcam/v4l2_record/v4l2_record.h"
+#include "webcam/v4l2_stack/v4l2_stack.h"
 #include "indiccd.h"
 
 // Long Exposure
@@ -115,8 +116,10 @@ class V4L2_Driver: public INDI::CCD
     ISwitch StreamS[2];
     ISwitch *CompressS;
     ISwitch ImageTypeS[2];
-    ISwitch StackModeS[2];
+    ISwitch DemosaicS[2];
+    ISwitch StackModeS[5];
     ISwitch RecordS[2];
+    ISwitch RecordOptionsS[1];
 	
     /* Texts */
     IText PortT[1];
@@ -127,6 +130,8 @@ class V4L2_Driver: public INDI::CCD
     INumber *ExposeTimeN;
     INumber FrameRateN[1];
     INumber *FrameN;
+    INumber StackOptionsN[2];
+    INumber RecordStatsN[4];
      
     /* BLOBs */
     IBLOBVectorProperty *imageBP;
@@ -136,6 +141,7 @@ class V4L2_Driver: public INDI::CCD
     ISwitchVectorProperty StreamSP;				/* Stream switch */
     ISwitchVectorProperty *CompressSP;				/* Compress stream switch */
     ISwitchVectorProperty ImageTypeSP;				/* Color or grey switch */
+    ISwitchVectorProperty DemosaicSP;				/* Bayer demosaic switch */
     ISwitchVectorProperty StackModeSP;				/* StackMode switch */
     ISwitchVectorProperty InputsSP;				/* Select input switch */
     ISwitchVectorProperty CaptureFormatsSP;    			/* Select Capture format switch */
@@ -146,6 +152,7 @@ class V4L2_Driver: public INDI::CCD
     unsigned int v4ladjustments;
     bool useExtCtrl;
     ISwitchVectorProperty RecordSP;				/* Record switch */
+    ISwitchVectorProperty RecordOptionsSP;			/* Record with direct I/O */
 
     /* Number vectors */
     INumberVectorProperty *ExposeTimeNP;				/* Exposure */
@@ -153,6 +160,8 @@ class V4L2_Driver: public INDI::CCD
     INumberVectorProperty FrameRateNP;				/* Frame rate (Step/Continuous) */
     INumberVectorProperty *FrameNP;				/* Frame dimenstion */
     INumberVectorProperty ImageAdjustNP;			/* Image controls */
+    INumberVectorProperty StackOptionsNP;			/* Stack batch size and clipping */
+    INumberVectorProperty RecordStatsNP;			/* Frames recorded, dropped and queued */
 
     /* Text vectors */
     ITextVectorProperty PortTP;
@@ -175,7 +184,7 @@ class V4L2_Driver: public INDI::CCD
    void releaseBuffers();
 
    bool setManualExposure(double duration);
-   void binFrame();
+   void binFrame(const char *src=NULL);
 
    virtual void updateV4L2Controls();
    V4L2_Base *v4l_base;
@@ -191,6 +200,7 @@ class V4L2_Driver: public INDI::CCD
    struct timeval exposure_duration;
    unsigned int stackMode;
    ulong frameBytes;
+   V4L2_Stacker *stacker;
    
    //Long Exposure
    Lx *lx;
@@ -203,6 +213,9 @@ class V4L2_Driver: public INDI::CCD
    V4L2_Record *v4l2_record;
    V4L2_Recorder *recorder;
    bool direct_record;
+   int recordStatsTimer;
+   void updateRecordStats();
+   static void recordStatsCallback(void *userpointer);
 };
    
 #endif
@@ -29,18 +29,37 @@
  * work procedures may be registered that are called when there is nothing
  *   else to do;
  *
+ * functions may be posted from other threads to be called from the loop.
+ *
+ * on linux, fds are watched with epoll(7) and timers run from a timerfd,
+ *   elsewhere select(2) is used.
+ *
  #define MAIN_TEST for a stand-alone test program.
+ #define EVENTLOOP_BENCH for a benchmark of idle cpu use and callback latency.
  */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <time.h>
+#include <stdint.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/time.h>
 #include <unistd.h>
 
+#include "config.h"
+
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_SYS_TIMERFD_H) && defined(HAVE_SYS_EVENTFD_H)
+#define	EPOLL_LOOP
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#endif
+
 #include "eventloop.h"
 
 /* info about one registered callback.
@@ -59,20 +78,45 @@ static int ncbinuse;			/* n entries in cback[] marked in_use */
 static int lastcb;			/* cback index of last cb called */
 
 /* info about one registered timer function.
- * the entries are kept sorted by decreasing time from epoch, ie,
- *   the next entry to fire is at the end of the array.
+ * timers are kept in a hierarchical timing wheel of TW_NLEVELS levels of
+ *   TW_SIZE slots. each slot is a list of the timers due within its span;
+ *   level 0 slots span 1 ms and each level above spans TW_SIZE times more.
+ *   adding and removing a timer is O(1). as the wheel turns past the start of
+ *   an upper slot its timers are moved down ("cascaded") to finer slots.
+ * times are ms on CLOCK_MONOTONIC so setting the system clock has no effect.
+ * records are malloced in blocks of TF_NBLOCK and never freed, unused ones
+ *   are kept on tffree. tfhash[] finds a record from its id.
  */
-typedef struct {
-    double tgo;				/* trigger time, ms from epoch */
+typedef struct _TFLink {
+    struct _TFLink *next, *prev;	/* doubly linked list, with a head */
+} TFLink;
+typedef struct _TF {
+    TFLink link;			/* slot or firing list, must be first */
+    struct _TF *hnext;			/* next in tfhash[] chain */
+    long long expires;			/* wheel tick to run */
+    double tgo;				/* trigger time, ms */
     void *ud;				/* user's data handle */
     TCF *fp;				/* timer function */
+    int where;				/* level*TW_SIZE + slot, -1 if firing */
     int tid;				/* unique id for this timer */
 } TF;
-static TF *timef;			/* malloced list of timer functions */
-static int ntimef;			/* n entries in ntimef[] */
+#define	TW_BITS		6		/* log2 of slots per level */
+#define	TW_SIZE		(1<<TW_BITS)	/* slots per level */
+#define	TW_MASK		(TW_SIZE-1)
+#define	TW_NLEVELS	4		/* 2^24 ms, about 4.7 hours */
+#define	TW_MAXDT	((1LL<<(TW_BITS*TW_NLEVELS))-1)	/* farthest tick */
+#define	TF_NBLOCK	64		/* records per malloc */
+static TFLink wheel[TW_NLEVELS][TW_SIZE];	/* slot list heads */
+static unsigned long long wheelmap[TW_NLEVELS];	/* bits of non-empty slots */
+static long long wheelnow;		/* next wheel tick to run, ms */
+static TFLink firing;			/* timers due and about to run */
+static TF *tffree;			/* list of unused records */
+static TF **tfhash;			/* malloced table of id chains */
+static int ntfhash;			/* n entries in tfhash[], power of 2 */
+static int ntimef;			/* n timers pending */
 static int tid;				/* source of unique timer ids */
-#define	EPOCHDT(tp) 			/* ms from epoch to timeval *tp */  \
-	(((tp)->tv_usec)/1000.0 + ((tp)->tv_sec)*1000.0)
+static TimerStats tfstats;		/* lateness of timers run */
+static double tfsumlate;		/* total lateness, ms */
 
 /* info about one registered work procedure.
  * the malloced array wproc is never shrunk, entries are reused. new id's are
@@ -88,11 +132,79 @@ static int nwproc;			/* n entries in wproc[] */
 static int nwpinuse;			/* n entries in wproc[] marked in-use */
 static int lastwp;			/* wproc index of last workproc called*/
 
+/* info about one function posted from another thread with postEvent().
+ * the poster queues it and makes postfd readable, a callback on postfd then
+ *   runs the queue in order from the loop.
+ */
+typedef struct _PE {
+    TCF *fp;				/* function to run */
+    void *ud;				/* user's data handle */
+    struct _PE *next;			/* next in queue */
+} PE;
+static PE *pehead, **petail = &pehead;	/* queue of posted functions */
+static int pewake;			/* set when postfd has been written */
+static int postfd[2] = {-1, -1};	/* read and write ends */
+static int postcid = -1;		/* callback id watching postfd[0] */
+static pthread_mutex_t pelock = PTHREAD_MUTEX_INITIALIZER;	/* guards all above */
+
+/* work procs run when a pass finds nothing else to do. rather than poll at
+ * full speed while idle, each such pass doubles the wait before the next,
+ * up to WP_MAXIDLE ms. any callback or timer starts over with no wait.
+ */
+#define	WP_MAXIDLE	16
+static int wpidle;			/* ms to wait before next work proc */
+
+#ifdef EPOLL_LOOP
+/* each fd is in epfd once however many callbacks watch it. fdw[fd] counts
+ * them and notes the pass in which the fd was last found ready. fds epoll
+ * cannot watch, such as plain files, are always ready as with select(2).
+ * timers are run by tfd, a timerfd set for the next wheel tick due.
+ */
+typedef struct {
+    int nref;				/* n callbacks in use on this fd */
+    int always;				/* set if epoll refused fd */
+    unsigned ready;			/* readypass when last ready */
+} FDW;
+static FDW *fdw;			/* malloced, indexed by fd */
+static int nfdw;			/* n entries in fdw[] */
+static int nalways;			/* n entries in fdw[] marked always */
+static unsigned readypass;		/* counts epoll_wait() passes */
+static int epfd = -1;			/* epoll set of callback fds and tfd */
+static int tfd = -1;			/* timerfd for the next timer */
+static long long tfdarmed = -1;		/* wheel tick tfd is set for, or -1 */
+#define	MAXEVENTS	64		/* max events per epoll_wait() */
+#else
+static fd_set rfdready;			/* fds select() found ready */
+#endif
+
 static void runWorkProc (void);
-static void callCallback(fd_set *rfdp);
+static void callCallback(void);
 static void checkTimer();
 static void oneLoop(void);
 static void deferTO (void *p);
+static double monoMS (void);
+static void tfInit (void);
+static void tfGrow (void);
+static void tfRehash (int n);
+static void tfInsert (TF *tp);
+static void tfLink (TFLink *head, TFLink *lp);
+static void tfUnlink (TFLink *lp);
+static void tfRemove (TF *tp);
+static void tfCascade (int lvl, int slot);
+static long long tfNext (void);
+#ifndef EPOLL_LOOP
+static double tfWait (void);
+#endif
+static void postOpen (void);
+static void postInit (void);
+static void postCB (int fd, void *ud);
+static int fdReady (int fd);
+#ifdef EPOLL_LOOP
+static int epollInit (void);
+static void watchFD (int fd);
+static void unwatchFD (int fd);
+static void armTimer (void);
+#endif
 
 /* inf loop to dispatch callbacks, work procs and timers as necessary.
  * never returns.
@@ -175,6 +287,9 @@ addCallback (int fd, CBF *fp, void *ud)
 	cp->ud = ud;
 	cp->fd = fd;
 	ncbinuse++;
+#ifdef EPOLL_LOOP
+	watchFD (fd);
+#endif
 
 	/* id is index into array */
 	return (cp - cback);
@@ -198,40 +313,53 @@ rmCallback (int cid)
 	/* mark for reuse */
 	cp->in_use = 0;
 	ncbinuse--;
+#ifdef EPOLL_LOOP
+	unwatchFD (cp->fd);
+#endif
 }
 
 /* register a new timer function, fp, to be called with ud as arg after ms
- * milliseconds. add to list in order of decreasing time from epoch, ie,
- * last entry runs soonest. return id for use with rmTimer().
+ * milliseconds. return id for use with rmTimer().
  */
 int
 addTimer (int ms, TCF *fp, void *ud)
 {
-	struct timeval t;
+	double now = monoMS();
 	TF *tp;
 
-	/* get time now */
-	gettimeofday (&t, NULL);
+	if (!ntfhash)
+	    tfInit();
 
-	/* add one entry */
-	timef = timef ? (TF *) realloc (timef, (ntimef+1)*sizeof(TF))
-		      : (TF *) malloc (sizeof(TF));
-	tp = &timef[ntimef++];
+	/* an empty wheel may be moved on to now */
+	if (!ntimef)
+	    wheelnow = (long long)floor(now);
+
+	if (ms < 0)
+	    ms = 0;
+
+	/* get a record */
+	if (!tffree)
+	    tfGrow();
+	tp = tffree;
+	tffree = tp->hnext;
 
 	/* init new entry */
 	tp->ud = ud;
 	tp->fp = fp;
-	tp->tgo = EPOCHDT(&t) + ms;
-
-	/* insert maintaining sort */
-	for ( ; tp > timef && tp[0].tgo > tp[-1].tgo; tp--) {
-	    TF tmptf = tp[-1];
-	    tp[-1] = tp[0];
-	    tp[0] = tmptf;
-	}
-
-	/* store and return new unique id */
-	return (tp->tid = ++tid);
+	tp->tgo = now + ms;
+	tp->expires = (long long)ceil(tp->tgo);
+	if (++tid <= 0)
+	    tid = 1;
+	tp->tid = tid;
+
+	/* file it */
+	if (++ntimef > ntfhash)
+	    tfRehash (2*ntfhash);
+	tp->hnext = tfhash[tp->tid & (ntfhash-1)];
+	tfhash[tp->tid & (ntfhash-1)] = tp;
+	tfInsert (tp);
+
+	return (tp->tid);
 }
 
 /* remove the timer with the given id, as returned from addTimer().
@@ -243,18 +371,70 @@ rmTimer (int timer_id)
 	TF *tp;
 
 	/* find it */
-	for (tp = timef; tp < &timef[ntimef]; tp++)
+	if (!ntfhash)
+	    return;
+	for (tp = tfhash[timer_id & (ntfhash-1)]; tp; tp = tp->hnext)
 	    if (tp->tid == timer_id)
 		break;
-	if (tp == &timef[ntimef])
+	if (!tp)
 	    return;
 
-	/* bubble it out */
-	for (++tp; tp < &timef[ntimef]; tp++)
-	    tp[-1] = tp[0];
+	tfRemove (tp);
+}
+
+/* fill *sp with the lateness of the timers run since resetTimerStats().
+ */
+void
+getTimerStats (TimerStats *sp)
+{
+	*sp = tfstats;
+	sp->meanlate = tfstats.nrun ? tfsumlate/tfstats.nrun : 0;
+	sp->npending = ntimef;
+}
+
+/* start counting timer lateness afresh.
+ */
+void
+resetTimerStats (void)
+{
+	memset (&tfstats, 0, sizeof(tfstats));
+	tfsumlate = 0;
+}
+
+/* arrange for fp to be called with ud as arg from the loop as soon as it can.
+ * may be called from any thread.
+ * return 0 if ok, else -1.
+ */
+int
+postEvent (TCF *fp, void *ud)
+{
+	PE *pe = (PE *) malloc (sizeof(PE));
+	int ret = 0;
+
+	if (!pe)
+	    return (-1);
+	pe->fp = fp;
+	pe->ud = ud;
+	pe->next = NULL;
+
+	pthread_mutex_lock (&pelock);
+	if (postfd[1] < 0)
+	    postOpen();
+	if (postfd[1] < 0) {
+	    free (pe);
+	    ret = -1;
+	} else {
+	    *petail = pe;
+	    petail = &pe->next;
+	    if (!pewake) {
+		uint64_t one = 1;
+		if (write (postfd[1], &one, sizeof(one)) > 0)
+		    pewake = 1;
+	    }
+	}
+	pthread_mutex_unlock (&pelock);
 
-	/* shrink list */
-	timef = (TF *) realloc (timef, (--ntimef)*sizeof(TF));
+	return (ret);
 }
 
 /* add a new work procedure, fp, to be called with ud when nothing else to do.
@@ -280,6 +460,7 @@ addWorkProc (WPF *fp, void *ud)
 	wp->fp = fp;
 	wp->ud = ud;
 	nwpinuse++;
+	wpidle = 0;
 
 	/* id is index into array */
 	return (wp - wproc);
@@ -326,47 +507,94 @@ runWorkProc ()
 	(*wp->fp) (wp->ud);
 }
 
-/* run next callback whose fd is listed as ready to go in rfdp */
+/* run next callback whose fd was found ready in this pass */
 static void
-callCallback(fd_set *rfdp)
+callCallback()
 {
 	CB *cp;
+	int n;
 
 	/* skip if list is empty */
 	if (!ncbinuse)
 	    return;
 
-	/* find next */
+	/* find next, giving up after one round in case its callback was removed */
+	n = ncback;
 	do {
 	    lastcb = (lastcb+1) % ncback;
 	    cp = &cback[lastcb];
-	} while (!cp->in_use || !FD_ISSET (cp->fd, rfdp));
+	    if (n-- == 0)
+		return;
+	} while (!cp->in_use || !fdReady (cp->fd));
 
 	/* run */
 	(*cp->fp) (cp->fd, cp->ud);
 }
 
-/* run the next timer callback whose time has come, if any. all we have to do
- * is is check the last entry in timef[] because it is sorted in decreasing
- * order of time from epoch to run, ie, last entry runs soonest.
+/* run every timer callback whose time has come. the wheel is turned from
+ * wheelnow to now, skipping straight to each tick at which something is due.
+ * the timers due at one tick are moved to the firing list before any is run so
+ * their functions may add and remove timers freely.
  */
 static void
 checkTimer()
 {
-	struct timeval now;
-	double tgonow;
-	TF *tp;
+	long long tnow;
 
 	/* skip if list is empty */
 	if (!ntimef)
 	    return;
 
-	gettimeofday (&now, NULL);
-	tgonow = EPOCHDT (&now);
-	tp = &timef[ntimef-1];
-	if (tp->tgo <= tgonow) {
-	    ntimef--;			/* pop then call */
-	    (*tp->fp) (tp->ud);
+	tnow = (long long)floor(monoMS());
+	while (wheelnow <= tnow) {
+	    long long next = tfNext();
+	    TFLink *head;
+	    int lvl;
+
+	    if (next > tnow) {
+		wheelnow = tnow + 1;
+		break;
+	    }
+	    wheelnow = next;
+
+	    /* cascade each level whose slot just came around */
+	    for (lvl = 1; lvl < TW_NLEVELS; lvl++) {
+		if ((wheelnow >> (TW_BITS*(lvl-1))) & TW_MASK)
+		    break;
+		tfCascade (lvl, (int)(wheelnow >> (TW_BITS*lvl)) & TW_MASK);
+	    }
+
+	    /* collect this tick's timers */
+	    head = &wheel[0][wheelnow & TW_MASK];
+	    wheelmap[0] &= ~(1ULL << (wheelnow & TW_MASK));
+	    while (head->next != head) {
+		TF *tp = (TF *) head->next;
+		tfUnlink (&tp->link);
+		tfLink (&firing, &tp->link);
+		tp->where = -1;
+	    }
+	    wheelnow++;
+
+	    /* pop then call */
+	    while (firing.next != &firing) {
+		TF *tp = (TF *) firing.next;
+		double late = monoMS() - tp->tgo;
+		TCF *fp = tp->fp;
+		void *ud = tp->ud;
+
+		tfRemove (tp);
+
+		if (late < 0)
+		    late = 0;
+		tfstats.nrun++;
+		if (late >= 1)
+		    tfstats.nlate++;
+		if (late > tfstats.maxlate)
+		    tfstats.maxlate = late;
+		tfsumlate += late;
+
+		(*fp) (ud);
+	    }
 	}
 }
 
@@ -376,10 +604,71 @@ checkTimer()
 static void
 oneLoop()
 {
+#ifdef EPOLL_LOOP
+	struct epoll_event ev[MAXEVENTS];
+	unsigned long nrun = tfstats.nrun;
+	int wait, ns, nready, i;
+
+	if (postcid == -1)
+	    postInit();
+	if (epfd < 0 && epollInit() < 0)
+	    exit(1);
+
+	/* set tfd for the soonest timer */
+	armTimer();
+
+	/* determine timeout:
+	 * if there are fds epoll can not watch or timers already due
+	 *   set delay = 0
+	 * else if there are work procs
+	 *   set delay = wpidle
+	 * else
+	 *   set delay = forever, tfd wakes us for timers
+	 */
+	if (nalways > 0 || firing.next != &firing)
+	    wait = 0;
+	else if (nwpinuse > 0)
+	    wait = wpidle;
+	else
+	    wait = -1;
+
+	/* check file descriptors, timeout depending on pending work */
+	ns = epoll_wait (epfd, ev, MAXEVENTS, wait);
+	if (ns < 0) {
+	    if (errno != EINTR)
+		perror ("epoll_wait");
+	    return;
+	}
+
+	/* mark the ready fds for this pass */
+	if (++readypass == 0) {
+	    for (i = 0; i < nfdw; i++)
+		fdw[i].ready = 0;
+	    readypass = 1;
+	}
+	nready = nalways;
+	for (i = 0; i < ns; i++) {
+	    int fd = ev[i].data.fd;
+	    if (fd == tfd) {
+		uint64_t n;
+		if (read (tfd, &n, sizeof(n)) < 0 && errno != EAGAIN)
+		    perror ("timerfd");
+		tfdarmed = -1;
+	    } else if (fd >= 0 && fd < nfdw) {
+		fdw[fd].ready = readypass;
+		nready++;
+	    }
+	}
+#else
 	struct timeval tv, *tvp;
+	unsigned long nrun = tfstats.nrun;
+	double wait;
 	fd_set rfd;
 	CB *cp;
-	int maxfd, ns;
+	int maxfd, nready;
+
+	if (postcid == -1)
+	    postInit();
 
 	/* build list of callback file descriptors to check */
 	FD_ZERO (&rfd);
@@ -393,43 +682,46 @@ oneLoop()
 	}
 
 	/* determine timeout:
-	 * if there are work procs
-	 *   set delay = 0
-	 * else if there is at least one timer func
+	 * if there is at least one timer func
 	 *   set delay = time until soonest timer func expires
-	 * else
+	 * if there are work procs
+	 *   set delay = no more than wpidle
+	 * if neither
 	 *   set delay = forever
 	 */
-	if (nwpinuse > 0) {
+	wait = ntimef > 0 ? tfWait() : -1;
+	if (nwpinuse > 0 && (wait < 0 || wait > wpidle))
+	    wait = wpidle;
+	if (wait >= 0) {
+	    wait /= 1000.0;				/* secs to wait */
 	    tvp = &tv;
-	    tvp->tv_sec = tvp->tv_usec = 0;
-	} else if (ntimef > 0) {
-	    struct timeval now;
-	    double late;
-	    gettimeofday (&now, NULL);
-	    late = timef[ntimef-1].tgo - EPOCHDT (&now);	/* ms late */
-	    if (late < 0)
-		late = 0;
-	    late /= 1000.0;					/* secs late */
-	    tvp = &tv;
-	    tvp->tv_sec = (long)floor(late);
-	    tvp->tv_usec = (long)floor((late - tvp->tv_sec)*1000000.0);
+	    tvp->tv_sec = (long)floor(wait);
+	    tvp->tv_usec = (long)floor((wait - tvp->tv_sec)*1000000.0);
 	} else
 	    tvp = NULL;
 
 	/* check file descriptors, timeout depending on pending work */
-	ns = select (maxfd+1, &rfd, NULL, NULL, tvp);
-	if (ns < 0) {
-	    perror ("select");
+	nready = select (maxfd+1, &rfd, NULL, NULL, tvp);
+	if (nready < 0) {
+	    if (errno != EINTR)
+		perror ("select");
             return;
 	}
+	rfdready = rfd;
+#endif
 	
 	/* dispatch */
 	checkTimer();
-	if (ns == 0)
+	if (nready == 0)
 	    runWorkProc();
 	else
-	    callCallback(&rfd);
+	    callCallback();
+
+	/* back off work procs while nothing else happens */
+	if (nready > 0 || tfstats.nrun != nrun)
+	    wpidle = 0;
+	else if (nwpinuse > 0)
+	    wpidle = wpidle == 0 ? 1 : (2*wpidle > WP_MAXIDLE ? WP_MAXIDLE : 2*wpidle);
 }
 
 /* timer callback used to implement deferLoop().
@@ -441,6 +733,378 @@ deferTO (void *p)
 	*(int*)p = 1;
 }
 
+/* ms now on a clock that never steps */
+static double
+monoMS (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec*1000.0 + ts.tv_nsec/1000000.0);
+}
+
+/* add lp to the end of the list at head */
+static void
+tfLink (TFLink *head, TFLink *lp)
+{
+	lp->prev = head->prev;
+	lp->next = head;
+	head->prev->next = lp;
+	head->prev = lp;
+}
+
+/* remove lp from whichever list it is in */
+static void
+tfUnlink (TFLink *lp)
+{
+	lp->prev->next = lp->next;
+	lp->next->prev = lp->prev;
+}
+
+/* empty the wheel and start the id table */
+static void
+tfInit (void)
+{
+	int i, j;
+
+	for (i = 0; i < TW_NLEVELS; i++)
+	    for (j = 0; j < TW_SIZE; j++)
+		wheel[i][j].next = wheel[i][j].prev = &wheel[i][j];
+	firing.next = firing.prev = &firing;
+
+	ntfhash = TF_NBLOCK;
+	tfhash = (TF **) calloc (ntfhash, sizeof(TF *));
+}
+
+/* put another block of records on tffree */
+static void
+tfGrow (void)
+{
+	TF *tp = (TF *) malloc (TF_NBLOCK*sizeof(TF));
+	int i;
+
+	for (i = 0; i < TF_NBLOCK; i++) {
+	    tp[i].hnext = tffree;
+	    tffree = &tp[i];
+	}
+}
+
+/* move every timer to a tfhash[] of n entries */
+static void
+tfRehash (int n)
+{
+	TF **newhash = (TF **) calloc (n, sizeof(TF *));
+	int i;
+
+	for (i = 0; i < ntfhash; i++) {
+	    TF *tp, *nexttp;
+	    for (tp = tfhash[i]; tp; tp = nexttp) {
+		nexttp = tp->hnext;
+		tp->hnext = newhash[tp->tid & (n-1)];
+		newhash[tp->tid & (n-1)] = tp;
+	    }
+	}
+
+	free (tfhash);
+	tfhash = newhash;
+	ntfhash = n;
+}
+
+/* add tp to the wheel slot that covers its expiry time.
+ * one already late goes in the slot run next.
+ */
+static void
+tfInsert (TF *tp)
+{
+	long long when = tp->expires;
+	long long dt = when - wheelnow;
+	int lvl, slot;
+
+	if (dt < 0) {
+	    when = wheelnow;
+	    dt = 0;
+	} else if (dt > TW_MAXDT) {
+	    when = wheelnow + TW_MAXDT;	/* filed again when cascaded */
+	    dt = TW_MAXDT;
+	}
+
+	for (lvl = 0; lvl < TW_NLEVELS-1; lvl++)
+	    if (dt < (1LL << (TW_BITS*(lvl+1))))
+		break;
+	slot = (int)(when >> (TW_BITS*lvl)) & TW_MASK;
+
+	tfLink (&wheel[lvl][slot], &tp->link);
+	wheelmap[lvl] |= 1ULL << slot;
+	tp->where = lvl*TW_SIZE + slot;
+}
+
+/* take tp out of its list, forget its id and put it on tffree */
+static void
+tfRemove (TF *tp)
+{
+	TF **tpp;
+
+	tfUnlink (&tp->link);
+	if (tp->where >= 0) {
+	    int lvl = tp->where / TW_SIZE, slot = tp->where % TW_SIZE;
+	    if (wheel[lvl][slot].next == &wheel[lvl][slot])
+		wheelmap[lvl] &= ~(1ULL << slot);
+	}
+
+	for (tpp = &tfhash[tp->tid & (ntfhash-1)]; *tpp != tp; tpp = &(*tpp)->hnext)
+	    continue;
+	*tpp = tp->hnext;
+
+	tp->hnext = tffree;
+	tffree = tp;
+	ntimef--;
+}
+
+/* rotate the slot bits m right by n */
+static unsigned long long
+tfRotate (unsigned long long m, int n)
+{
+	return (n ? (m >> n) | (m << (TW_SIZE - n)) : m);
+}
+
+/* return the first wheel tick at which a timer is due or a slot must be
+ * cascaded, or past the end of the wheel if it is empty.
+ * the slots of each level are searched from the one that comes around next,
+ *   which is the current one if the wheel is at its start and it has not been
+ *   cascaded yet. level 0 slots start with the one for wheelnow, which may
+ *   hold late timers.
+ */
+static long long
+tfNext (void)
+{
+	long long next = wheelnow + TW_MAXDT + 1;
+	int lvl;
+
+	for (lvl = 0; lvl < TW_NLEVELS; lvl++) {
+	    int shift = TW_BITS*lvl;
+	    long long t = (wheelnow + (1LL << shift) - 1) >> shift;
+
+	    if (!wheelmap[lvl])
+		continue;
+	    t += __builtin_ctzll (tfRotate (wheelmap[lvl], (int)t & TW_MASK));
+	    t <<= shift;
+	    if (t < next)
+		next = t;
+	}
+
+	return (next);
+}
+
+/* move the timers in the given slot to the slots below */
+static void
+tfCascade (int lvl, int slot)
+{
+	TFLink *head = &wheel[lvl][slot];
+
+	wheelmap[lvl] &= ~(1ULL << slot);
+	while (head->next != head) {
+	    TF *tp = (TF *) head->next;
+	    tfUnlink (&tp->link);
+	    tfInsert (tp);
+	}
+}
+
+#ifndef EPOLL_LOOP
+/* return ms until the next timer may be due, 0 if any are already */
+static double
+tfWait (void)
+{
+	double dt;
+
+	if (firing.next != &firing)
+	    return (0);
+	dt = tfNext() - monoMS();
+	return (dt < 0 ? 0 : dt);
+}
+#endif
+
+/* open postfd, with pelock held */
+static void
+postOpen (void)
+{
+#ifdef EPOLL_LOOP
+	postfd[0] = postfd[1] = eventfd (0, EFD_NONBLOCK|EFD_CLOEXEC);
+	if (postfd[0] < 0)
+	    perror ("eventfd");
+#else
+	int i;
+
+	if (pipe (postfd) < 0) {
+	    perror ("pipe");
+	    postfd[0] = postfd[1] = -1;
+	    return;
+	}
+	for (i = 0; i < 2; i++) {
+	    fcntl (postfd[i], F_SETFL, fcntl (postfd[i], F_GETFL) | O_NONBLOCK);
+	    fcntl (postfd[i], F_SETFD, FD_CLOEXEC);
+	}
+#endif
+}
+
+/* open postfd unless postEvent() already has, and watch it from the loop.
+ * leave postcid -2 if it can not be opened so we do not try again.
+ */
+static void
+postInit (void)
+{
+	pthread_mutex_lock (&pelock);
+	if (postfd[0] < 0)
+	    postOpen();
+	pthread_mutex_unlock (&pelock);
+
+	postcid = postfd[0] < 0 ? -2 : addCallback (postfd[0], postCB, NULL);
+}
+
+/* run all functions posted since last time */
+static void
+postCB (int fd, void *ud)
+{
+	char buf[64];
+	PE *pe, *next;
+
+	(void) ud;
+
+	pthread_mutex_lock (&pelock);
+	while (read (fd, buf, sizeof(buf)) > 0)
+	    continue;
+	pewake = 0;
+	pe = pehead;
+	pehead = NULL;
+	petail = &pehead;
+	pthread_mutex_unlock (&pelock);
+
+	for ( ; pe; pe = next) {
+	    next = pe->next;
+	    (*pe->fp) (pe->ud);
+	    free (pe);
+	}
+}
+
+/* return whether fd was found ready in this pass */
+static int
+fdReady (int fd)
+{
+#ifdef EPOLL_LOOP
+	return (fd >= 0 && fd < nfdw && (fdw[fd].always || fdw[fd].ready == readypass));
+#else
+	return (FD_ISSET (fd, &rfdready));
+#endif
+}
+
+#ifdef EPOLL_LOOP
+/* create epfd and tfd.
+ * return 0 if ok, else -1.
+ */
+static int
+epollInit (void)
+{
+	struct epoll_event ev;
+
+	epfd = epoll_create1 (EPOLL_CLOEXEC);
+	if (epfd < 0) {
+	    perror ("epoll_create1");
+	    return (-1);
+	}
+
+	tfd = timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+	if (tfd < 0) {
+	    perror ("timerfd_create");
+	    return (-1);
+	}
+	memset (&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = tfd;
+	if (epoll_ctl (epfd, EPOLL_CTL_ADD, tfd, &ev) < 0) {
+	    perror ("epoll_ctl");
+	    return (-1);
+	}
+
+	return (0);
+}
+
+/* count another callback on fd, adding fd to epfd if need be */
+static void
+watchFD (int fd)
+{
+	struct epoll_event ev;
+
+	if (fd < 0)
+	    return;
+	if (epfd < 0 && epollInit() < 0)
+	    exit(1);
+	if (fd >= nfdw) {
+	    int n = fd + 16;
+	    fdw = (FDW *) realloc (fdw, n*sizeof(FDW));
+	    memset (&fdw[nfdw], 0, (n-nfdw)*sizeof(FDW));
+	    nfdw = n;
+	}
+
+	/* always add, fd may have been closed and reopened since */
+	memset (&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+	if (epoll_ctl (epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+	    if (errno == EPERM) {
+		if (!fdw[fd].always) {
+		    fdw[fd].always = 1;
+		    nalways++;
+		}
+	    } else if (errno != EEXIST)
+		perror ("epoll_ctl");
+	}
+	fdw[fd].nref++;
+}
+
+/* count one less callback on fd, removing fd from epfd when none are left */
+static void
+unwatchFD (int fd)
+{
+	struct epoll_event ev;
+
+	if (fd < 0 || fd >= nfdw || fdw[fd].nref <= 0)
+	    return;
+	if (--fdw[fd].nref > 0)
+	    return;
+
+	if (fdw[fd].always) {
+	    fdw[fd].always = 0;
+	    nalways--;
+	} else {
+	    memset (&ev, 0, sizeof(ev));
+	    (void) epoll_ctl (epfd, EPOLL_CTL_DEL, fd, &ev);	/* may be closed */
+	}
+}
+
+/* set tfd to expire at the next wheel tick due, or not at all */
+static void
+armTimer (void)
+{
+	struct itimerspec its;
+	long long next = -1;
+
+	if (ntimef > 0 && firing.next == &firing)
+	    next = tfNext();
+	if (next == tfdarmed)
+	    return;
+
+	memset (&its, 0, sizeof(its));
+	if (next >= 0) {
+	    its.it_value.tv_sec = next / 1000;
+	    its.it_value.tv_nsec = (next % 1000) * 1000000;
+	    if (next == 0)
+		its.it_value.tv_nsec = 1;	/* 0 would disarm */
+	}
+	if (timerfd_settime (tfd, TFD_TIMER_ABSTIME, &its, NULL) < 0)
+	    perror ("timerfd_settime");
+	tfdarmed = next;
+}
+#endif
+
 #if defined(MAIN_TEST)
 /* make a small stand-alone test program.
  */
@@ -497,6 +1161,12 @@ stdinCB (int fd, void *ud)
 	case '3': mytid = addTimer (3000, to, (void *)3); break;
 	case '4': mytid = addTimer (4000, to, (void *)4); break;
 	case '5': mytid = addTimer (5000, to, (void *)5); break;
+	case 's': {
+	    TimerStats ts;
+	    getTimerStats (&ts);
+	    printf ("timers run %lu late %lu mean %.3f max %.3f ms pending %d\n",
+	    	ts.nrun, ts.nlate, ts.meanlate, ts.maxlate, ts.npending);
+	    } break;
 	default: return;	/* silently absorb other chars like \n */
 	}
 
@@ -513,3 +1183,171 @@ main (int ac, char *av[])
 
 #endif
 
+#if defined(EVENTLOOP_BENCH)
+/* measure idle cpu use and callback latency with 1, 10 and 100 fds watched.
+ * idle cpu is measured for 2 secs with a 100 ms timer running, then again
+ *   with a work proc added as well.
+ * latency is from a thread writing the time into each pipe in turn, or
+ *   posting it with postEvent(), to the callback that reads it.
+ * build once as is and once without HAVE_SYS_EPOLL_H to compare backends:
+ *   cc -O2 -DEVENTLOOP_BENCH -I. -I<build dir> eventloop.c -lm -lpthread
+ */
+
+#include <sys/resource.h>
+
+#define	NSAMP	1000			/* latency samples per test */
+
+static int bfd[100][2];			/* pipes */
+static int bnfd;			/* n pipes in use */
+static int bn;				/* samples back so far */
+static int bdone;			/* set when all samples are back */
+static double bsum, bmax;		/* latency, ms */
+static int bnwp;			/* work proc calls */
+
+static void
+benchSample (double t0)
+{
+	double dt = monoMS() - t0;
+
+	bsum += dt;
+	if (dt > bmax)
+	    bmax = dt;
+	if (++bn == NSAMP)
+	    bdone = 1;
+}
+
+static void
+benchCB (int fd, void *ud)
+{
+	double t0;
+
+	if (read (fd, &t0, sizeof(t0)) == sizeof(t0))
+	    benchSample (t0);
+}
+
+static void
+benchPost (void *ud)
+{
+	benchSample (*(double *)ud);
+	free (ud);
+}
+
+static void
+benchWP (void *ud)
+{
+	bnwp++;
+}
+
+static void
+benchTO (void *ud)
+{
+	*(int *)ud = addTimer (100, benchTO, ud);
+}
+
+/* write the time to each pipe in turn, or post it if ud is not NULL */
+static void *
+benchWriter (void *ud)
+{
+	struct timespec ts = {0, 500000};
+	int i;
+
+	for (i = 0; i < NSAMP; i++) {
+	    double t0;
+
+	    nanosleep (&ts, NULL);
+	    t0 = monoMS();
+	    if (ud) {
+		double *tp = (double *) malloc (sizeof(double));
+		*tp = t0;
+		postEvent (benchPost, tp);
+	    } else if (write (bfd[i % bnfd][1], &t0, sizeof(t0)) < 0)
+		perror ("write");
+	}
+	return (NULL);
+}
+
+/* return cpu secs used so far */
+static double
+benchCPU (void)
+{
+	struct rusage ru;
+
+	getrusage (RUSAGE_SELF, &ru);
+	return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec
+		+ (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec)/1e6);
+}
+
+/* run the loop for secs, return the percent of a cpu used */
+static double
+benchIdle (double secs)
+{
+	double c0 = benchCPU();
+	int never = 0;
+
+	deferLoop ((int)(secs*1000), &never);
+	return (100*(benchCPU() - c0)/secs);
+}
+
+/* time NSAMP samples from the writer thread */
+static void
+benchLatency (const char *what, int post)
+{
+	pthread_t th;
+
+	bn = bdone = 0;
+	bsum = bmax = 0;
+	pthread_create (&th, NULL, benchWriter, post ? &post : NULL);
+	deferLoop (0, &bdone);
+	pthread_join (th, NULL);
+	printf ("  %-6s latency mean %7.1f us max %7.1f us\n", what,
+		1000*bsum/NSAMP, 1000*bmax);
+}
+
+int
+main (int ac, char *av[])
+{
+	static int nfds[] = {1, 10, 100};
+	int i, j, tid;
+
+#ifdef EPOLL_LOOP
+	printf ("epoll backend\n");
+#else
+	printf ("select backend\n");
+#endif
+	for (i = 0; i < 3; i++) {
+	    int cid[100], wid;
+	    double idle, idlewp;
+
+	    bnfd = nfds[i];
+	    for (j = 0; j < bnfd; j++) {
+		if (pipe (bfd[j]) < 0) {
+		    perror ("pipe");
+		    exit(1);
+		}
+		cid[j] = addCallback (bfd[j][0], benchCB, NULL);
+	    }
+
+	    tid = addTimer (100, benchTO, &tid);
+	    idle = benchIdle (2);
+	    bnwp = 0;
+	    wid = addWorkProc (benchWP, NULL);
+	    idlewp = benchIdle (2);
+	    rmWorkProc (wid);
+	    rmTimer (tid);
+	    printf ("%3d fds: idle cpu %5.2f%%, with a work proc %5.2f%% (%d calls/s)\n",
+	    	bnfd, idle, idlewp, bnwp/2);
+
+	    benchLatency ("fd", 0);
+	    benchLatency ("post", 1);
+
+	    for (j = 0; j < bnfd; j++) {
+		rmCallback (cid[j]);
+		close (bfd[j][0]);
+		close (bfd[j][1]);
+	    }
+	}
+
+	return (0);
+}
+
+#endif
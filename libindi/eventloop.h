@@ -67,7 +67,7 @@ extern int addCallback (int fd, CBF *fp, void *ud);
 */
 extern void rmCallback (int cid);
 
-/** Add a new work procedure, fp, to be called with ud when nothing else to do.
+/** Add a new work procedure, fp, to be called with ud when nothing else to do. While nothing else happens, the wait between calls grows to a few ms rather than keeping a processor busy.
 *
 * \param fp a pointer to the work procedure callback function.
 * \param ud a pointer to be passed to the callback function when called.
@@ -81,7 +81,7 @@ extern int addWorkProc (WPF *fp, void *ud);
 */
 extern void rmWorkProc (int wid);
 
-/** Register a new timer function, \e fp, to be called with \e ud as argument after \e ms. Add to list in order of decreasing time from epoch, ie, last entry runs soonest. The timer will only invoke the callback function \b once. You need to call addTimer again if you want to repeat the process.
+/** Register a new timer function, \e fp, to be called with \e ud as argument after \e ms. The delay is measured on a monotonic clock, so setting the system time does not affect it. The timer will only invoke the callback function \b once. You need to call addTimer again if you want to repeat the process.
 *
 * \param ms timer period in milliseconds.
 * \param fp a pointer to the callback function.
@@ -96,6 +96,33 @@ extern int addTimer (int ms, TCF *fp, void *ud);
 */
 extern void rmTimer (int tid);
 
+/** Arrange for \e fp to be called with \e ud as argument from the event loop as soon as it can. Unlike the other functions here this may be called from any thread, so a thread such as a camera SDK's may hand its results to the loop without the loop polling for them. Functions posted are called in the order they were posted.
+*
+* \param fp a pointer to the function to call.
+* \param ud a pointer to be passed to the function when called.
+* \return 0 if posted, -1 if out of memory or file descriptors.
+*/
+extern int postEvent (TCF *fp, void *ud);
+
+/** \brief Lateness of the timers run since resetTimerStats(). */
+typedef struct {
+    unsigned long nrun;		/* timers run */
+    unsigned long nlate;	/* timers run 1 ms or more after they were due */
+    double meanlate;		/* mean lateness, ms */
+    double maxlate;		/* worst lateness, ms */
+    int npending;		/* timers waiting to run */
+} TimerStats;
+
+/** Report how late timer functions have been called.
+*
+* \param sp set to the counts and lateness since the last resetTimerStats().
+*/
+extern void getTimerStats (TimerStats *sp);
+
+/** Start counting timer lateness afresh.
+*/
+extern void resetTimerStats (void);
+
 /* utility functions */
 extern int deferLoop (int maxms, int *flagp);
 extern int deferLoop0 (int maxms, int *flagp);
@@ -352,7 +352,7 @@ extern void IERmCallback (int callbackid);
 
 /** \brief Register a new timer function, \e fp, to be called with \e ud as argument after \e ms.
 
- Add to list in order of decreasing time from epoch, ie, last entry runs soonest. The timer will only invoke the callback function \b once. You need to call addTimer again if you want to repeat the process.
+ The delay is measured on a monotonic clock, so setting the system time does not affect it. The timer will only invoke the callback function \b once. You need to call addTimer again if you want to repeat the process.
 *
 * \param millisecs timer period in milliseconds.
 * \param fp a pointer to the callback function.
@@ -368,6 +368,8 @@ extern int  IEAddTimer (int millisecs, IE_TCF *fp, void *userpointer);
 extern void IERmTimer (int timerid);
 
 /** \brief Add a new work procedure, fp, to be called with ud when nothing else to do.
+
+ While nothing else happens, the wait between calls grows to a few ms rather than keeping a processor busy.
 *
 * \param fp a pointer to the work procedure callback function.
 * \param userpointer a pointer to be passed to the callback function when called.
@@ -381,6 +383,16 @@ extern int  IEAddWorkProc (IE_WPF *fp, void *userpointer);
 */
 extern void IERmWorkProc (int workprocid);
 
+/** \brief Arrange for \e fp to be called with \e userpointer as argument from the driver's event loop as soon as it can.
+
+ Unlike the other IE functions this may be called from any thread, so that threads of a device SDK may hand their results to the driver without it polling for them.
+*
+* \param fp a pointer to the function to call.
+* \param userpointer a pointer to be passed to the function when called.
+* \return 0 if posted, -1 on error.
+*/
+extern int  IEPostEvent (IE_TCF *fp, void *userpointer);
+
 /* wait in-line for a flag to set, presumably by another event function */
 
 extern int IEDeferLoop (int maxms, int *flagp);
@@ -20,6 +20,7 @@
 
 #endif
 
+#define _GNU_SOURCE	/* memfd seals */
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -29,8 +30,16 @@
 #include <time.h>
 #include <unistd.h>
 #include <locale.h>
+#include <limits.h>
+#include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
 #include <pthread.h>
 
 #include "lilxml.h"
@@ -44,6 +53,35 @@ pthread_mutex_t stdout_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 #define MAXRBUF 2048
 
+/* BLOBs go out base64 encoded in lines of B64LINE digits, B64CHUNK lines are
+ * encoded at a time and written B64IOV lines at a time.
+ */
+#define B64LINE  72
+#define B64CHUNK 4096
+#ifdef IOV_MAX
+#define B64IOV   (IOV_MAX/2)
+#else
+#define B64IOV   512
+#endif
+
+/* when indiserver says it can take them, BLOB vectors of at least SHAREDMIN
+ * bytes are passed to it as sealed memfds rather than base64, up to
+ * MAXSHAREDFD BLOBs at once.
+ */
+#define SHAREDMIN   65536
+#define MAXSHAREDFD 64
+
+/* when indiserver says it can take them, other BLOB vectors of up to
+ * MAXSHAREDFD BLOBs are sent as raw bytes after the vector rather than base64.
+ */
+#if defined(SYS_memfd_create) && defined(F_ADD_SEALS)
+#define HAVE_MEMFD
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC       0x0001U
+#define MFD_ALLOW_SEALING 0x0002U
+#endif
+#endif
+
 /* output a string expanding special characters into xml/html escape sequences */
 /* N.B. You must free the returned buffer after use! */
 char * escapeXML(const char *s, unsigned int MAX_BUF_SIZE)
@@ -191,6 +229,12 @@ IERmWorkProc (int workprocid)
 	rmWorkProc (workprocid);
 }
 
+int
+IEPostEvent (IE_TCF *fp, void *p)
+{
+	return (postEvent ((TCF*)fp, p));
+}
+
 
 int
 IEDeferLoop (int maxms, int *flagp)
@@ -777,6 +821,7 @@ clientMsgCB (int fd, void *arg)
 {
 	char buf[1024], msg[1024], *bp;
 	int nr;
+	size_t used;
 	arg=arg;
 
 	/* one read */
@@ -791,8 +836,8 @@ clientMsgCB (int fd, void *arg)
 	}
 
 	/* crack and dispatch when complete */
-	for (bp = buf; nr-- > 0; bp++) {
-	    XMLEle *root = readXMLEle (clixml, *bp, msg);
+	for (bp = buf; nr > 0; bp += used, nr -= used) {
+	    XMLEle *root = readXMLEleBuf (clixml, bp, nr, &used, msg);
 	    if (root) {
 		if (dispatch (root, msg) < 0)
 		    fprintf (stderr, "%s dispatch error: %s\n", me, msg);
@@ -803,6 +848,174 @@ clientMsgCB (int fd, void *arg)
 
 }
 
+/* Index of roCheck by property name, so dispatch() finds a property without
+ * comparing its name to every one the driver defined. Slots hold the roCheck
+ * index plus one, 0 is empty. The IDDef functions add to it from any thread,
+ * propMutex guards both.
+ */
+static int *propIndex;
+static unsigned int propIndexSize;		/* power of 2 */
+static int roCheckSize;				/* allocated elements of roCheck */
+static int propMaxElements;			/* most members of any defined vector */
+static pthread_mutex_t propMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int
+propHash (const char *name)
+{
+	unsigned int h = 2166136261u;
+
+	while (*name)
+	    h = (h ^ (unsigned char)*name++) * 16777619u;
+	return (h);
+}
+
+/* return the roCheck index of name, or -1. call with propMutex held */
+static int
+propFind (const char *name)
+{
+	unsigned int i;
+	int j;
+
+	if (!propIndex)
+	    return (-1);
+
+	for (i = propHash(name) & (propIndexSize-1); (j = propIndex[i]); i = (i+1) & (propIndexSize-1))
+	    if (!strcmp (roCheck[j-1].propName, name))
+		return (j-1);
+
+	return (-1);
+}
+
+/* remember a defined property and its permission. the first definition of
+ * a name sets its permission, as it always has.
+ */
+static void
+propRegister (const char *name, IPerm perm, int nelements)
+{
+	unsigned int i;
+	int j;
+
+	pthread_mutex_lock(&propMutex);
+
+	if (nelements > propMaxElements)
+	    __atomic_store_n(&propMaxElements, nelements, __ATOMIC_RELAXED);
+
+	if (propFind(name) >= 0) {
+	    pthread_mutex_unlock(&propMutex);
+	    return;
+	}
+
+	if (nroCheck >= roCheckSize) {
+	    roCheckSize = roCheckSize ? 2*roCheckSize : 64;
+	    roCheck = (ROSC *) realloc (roCheck, roCheckSize*sizeof(ROSC));
+	}
+	strncpy (roCheck[nroCheck].propName, name, MAXINDINAME-1);
+	roCheck[nroCheck].propName[MAXINDINAME-1] = '\0';
+	roCheck[nroCheck].perm = perm;
+	nroCheck++;
+
+	/* keep the index at most half full, rebuild it when it grows */
+	if ((unsigned int)nroCheck*2 > propIndexSize) {
+	    propIndexSize = propIndexSize ? 2*propIndexSize : 128;
+	    free (propIndex);
+	    propIndex = (int *) calloc (propIndexSize, sizeof(int));
+	    j = 0;
+	} else
+	    j = nroCheck-1;
+
+	for (; j < nroCheck; j++) {
+	    for (i = propHash(roCheck[j].propName) & (propIndexSize-1); propIndex[i]; i = (i+1) & (propIndexSize-1))
+		continue;
+	    propIndex[i] = j+1;
+	}
+
+	pthread_mutex_unlock(&propMutex);
+}
+
+/* the permission of a defined property. return 0 if ok, -1 if not defined */
+static int
+propPerm (const char *name, IPerm *perm)
+{
+	int j;
+
+	pthread_mutex_lock(&propMutex);
+	j = propFind(name);
+	if (j >= 0)
+	    *perm = roCheck[j].perm;
+	pthread_mutex_unlock(&propMutex);
+
+	return (j < 0 ? -1 : 0);
+}
+
+/* room for the member arrays of a dispatch() branch that must take n: at
+ * least as many as the largest vector defined, so they rarely grow.
+ */
+static int
+dispatchRoom (int n, int maxn)
+{
+	int room = __atomic_load_n(&propMaxElements, __ATOMIC_RELAXED);
+
+	if (room < 2*maxn)
+	    room = 2*maxn;
+	if (room < n)
+	    room = n;
+	return (room);
+}
+
+/* crack a plain decimal number, independent of the locale and without
+ * setlocale(). return 0 if ok, -1 for anything else, such as sexagesimal,
+ * which is left to f_scansexa().
+ */
+static int
+scanDecimal (const char *s, double *dp)
+{
+	static const double p10[] = {
+	    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+	unsigned long long m = 0;
+	int e = 0, x = 0, xneg = 0, neg = 0, digits = 0;
+	double v;
+
+	while (*s == ' ' || *s == '\t' || *s == '\n' || *s == '\r')
+	    s++;
+	if (*s == '-' || *s == '+')
+	    neg = (*s++ == '-');
+
+	for (; *s >= '0' && *s <= '9'; s++, digits++)
+	    if ((m = m*10 + (*s - '0')) > (1ULL << 53))
+		return (-1);
+	if (*s == '.')
+	    for (s++; *s >= '0' && *s <= '9'; s++, digits++, e--)
+		if ((m = m*10 + (*s - '0')) > (1ULL << 53))
+		    return (-1);
+	if (!digits)
+	    return (-1);
+
+	if (*s == 'e' || *s == 'E') {
+	    s++;
+	    if (*s == '-' || *s == '+')
+		xneg = (*s++ == '-');
+	    if (*s < '0' || *s > '9')
+		return (-1);
+	    for (; *s >= '0' && *s <= '9'; s++)
+		if ((x = x*10 + (*s - '0')) > 1000)
+		    return (-1);
+	    e += xneg ? -x : x;
+	}
+
+	while (*s == ' ' || *s == '\t' || *s == '\n' || *s == '\r')
+	    s++;
+	if (*s || e < -22 || e > 22)
+	    return (-1);
+
+	/* an exact mantissa and power of ten, so one rounding as strtod() */
+	v = (double)m;
+	v = e < 0 ? v / p10[-e] : v * p10[e];
+	*dp = neg ? -v : v;
+	return (0);
+}
+
 /* crack the given INDI XML element and call driver's IS* entry points as they
  *   are recognized.
  * return 0 if ok else -1 with reason in msg[].
@@ -815,7 +1028,7 @@ dispatch (XMLEle *root, char msg[])
 
         char *rtag = tagXMLEle(root);
         XMLEle *ep;
-        int n,i=0;
+        int n;
 
         if (verbose)
             prXMLEle (stderr, root, 0);
@@ -827,46 +1040,35 @@ dispatch (XMLEle *root, char msg[])
             static char **names;
             static int maxn;
             char *dev, *name;
+            IPerm perm;
 
             /* pull out device and name */
             if (crackDN (root, &dev, &name, msg) < 0)
                 return (-1);
 
-            if (!isPropDefined(name))
+            /* ensure property is defined and not RO */
+            if (propPerm(name, &perm) < 0 || perm == IP_RO)
                 return -1;
 
-            /* ensure property is not RO */
-            for (i=0; i < nroCheck; i++)
-            {
-              if (!strcmp(roCheck[i].propName, name))
-              {
-               if (roCheck[i].perm == IP_RO)
-                 return -1;
-               else
-                   break;
-              }
-            }
-
-            /* seed for reallocs */
-            if (!doubles) {
-                doubles = (double *) malloc (1);
-                names = (char **) malloc (1);
-            }
-
             /* pull out each name/value pair */
-            setlocale(LC_NUMERIC,"C");
             for (n = 0, ep = nextXMLEle(root,1); ep; ep = nextXMLEle(root,0)) {
                 if (strcmp (tagXMLEle(ep), "oneNumber") == 0) {
                     XMLAtt *na = findXMLAtt (ep, "name");
                     if (na) {
+                        int bad;
                         if (n >= maxn) {
-                            /* grow for this and another */
-                            int newsz = (maxn=n+1)*sizeof(double);
-                            doubles = (double *) realloc(doubles,newsz);
-                            newsz = maxn*sizeof(char *);
-                            names = (char **) realloc (names, newsz);
+                            maxn = dispatchRoom(n+1, maxn);
+                            doubles = (double *) realloc(doubles, maxn*sizeof(double));
+                            names = (char **) realloc (names, maxn*sizeof(char *));
                         }
-                        if (f_scansexa (pcdataXMLEle(ep), &doubles[n]) < 0)
+                        /* sexagesimal and anything unusual the slow way */
+                        bad = scanDecimal (pcdataXMLEle(ep), &doubles[n]) < 0;
+                        if (bad) {
+                            setlocale(LC_NUMERIC,"C");
+                            bad = f_scansexa (pcdataXMLEle(ep), &doubles[n]) < 0;
+                            setlocale(LC_NUMERIC,"");
+                        }
+                        if (bad)
                             IDMessage (dev,"%s: Bad format %s", name,
                                                             pcdataXMLEle(ep));
                         else
@@ -874,7 +1076,6 @@ dispatch (XMLEle *root, char msg[])
                     }
                 }
             }
-            setlocale(LC_NUMERIC,"");
 
             /* invoke driver if something to do, but not an error if not */
             if (n > 0)
@@ -890,42 +1091,25 @@ dispatch (XMLEle *root, char msg[])
             static int maxn;
             char *dev, *name;
             XMLEle *ep;
+            IPerm perm;
 
             /* pull out device and name */
             if (crackDN (root, &dev, &name, msg) < 0)
                 return (-1);
 
-            if (!isPropDefined(name))
+            /* ensure property is defined and not RO */
+            if (propPerm(name, &perm) < 0 || perm == IP_RO)
                 return -1;
 
-            /* ensure property is not RO */
-            for (i=0; i < nroCheck; i++)
-            {
-              if (!strcmp(roCheck[i].propName, name))
-              {
-               if (roCheck[i].perm == IP_RO)
-                 return -1;
-               else
-                   break;
-              }
-            }
-
-            /* seed for reallocs */
-            if (!states) {
-                states = (ISState *) malloc (1);
-                names = (char **) malloc (1);
-            }
-
             /* pull out each name/state pair */
             for (n = 0, ep = nextXMLEle(root,1); ep; ep = nextXMLEle(root,0)) {
                 if (strcmp (tagXMLEle(ep), "oneSwitch") == 0) {
                     XMLAtt *na = findXMLAtt (ep, "name");
                     if (na) {
                         if (n >= maxn) {
-                            int newsz = (maxn=n+1)*sizeof(ISState);
-                            states = (ISState *) realloc(states, newsz);
-                            newsz = maxn*sizeof(char *);
-                            names = (char **) realloc (names, newsz);
+                            maxn = dispatchRoom(n+1, maxn);
+                            states = (ISState *) realloc(states, maxn*sizeof(ISState));
+                            names = (char **) realloc (names, maxn*sizeof(char *));
                         }
                         if (strcmp (pcdataXMLEle(ep),"On") == 0) {
                             states[n] = ISS_ON;
@@ -955,41 +1139,25 @@ dispatch (XMLEle *root, char msg[])
             static char **names;
             static int maxn;
             char *dev, *name;
+            IPerm perm;
 
             /* pull out device and name */
             if (crackDN (root, &dev, &name, msg) < 0)
                 return (-1);
 
-            if (!isPropDefined(name))
+            /* ensure property is defined and not RO */
+            if (propPerm(name, &perm) < 0 || perm == IP_RO)
                 return -1;
 
-            /* ensure property is not RO */
-            for (i=0; i < nroCheck; i++)
-            {
-              if (!strcmp(roCheck[i].propName, name))
-              {
-               if (roCheck[i].perm == IP_RO)
-                 return -1;
-               else
-                   break;
-              }
-            }
-
-            /* seed for reallocs */
-            if (!texts) {
-                texts = (char **) malloc (1);
-                names = (char **) malloc (1);
-            }
-
             /* pull out each name/text pair */
             for (n = 0, ep = nextXMLEle(root,1); ep; ep = nextXMLEle(root,0)) {
                 if (strcmp (tagXMLEle(ep), "oneText") == 0) {
                     XMLAtt *na = findXMLAtt (ep, "name");
                     if (na) {
                         if (n >= maxn) {
-                            int newsz = (maxn=n+1)*sizeof(char *);
-                            texts = (char **) realloc (texts, newsz);
-                            names = (char **) realloc (names, newsz);
+                            maxn = dispatchRoom(n+1, maxn);
+                            texts = (char **) realloc (texts, maxn*sizeof(char *));
+                            names = (char **) realloc (names, maxn*sizeof(char *));
                         }
                         texts[n] = pcdataXMLEle(ep);
                         names[n] = valuXMLAtt(na);
@@ -1014,24 +1182,16 @@ dispatch (XMLEle *root, char msg[])
             static int *sizes;
             static int maxn;
             char *dev, *name;
+            IPerm perm;
             int i;
 
             /* pull out device and name */
             if (crackDN (root, &dev, &name, msg) < 0)
                 return (-1);
 
-            if (!isPropDefined(name))
+            if (propPerm(name, &perm) < 0)
                 return -1;
 
-            /* seed for reallocs */
-            if (!blobs) {
-                blobs = (char **) malloc (1);
-                names = (char **) malloc (1);
-                formats = (char **) malloc (1);
-                blobsizes = (int *) malloc (1);
-                sizes = (int *) malloc (1);
-            }
-
             /* pull out each name/BLOB pair, decode */
             for (n = 0, ep = nextXMLEle(root,1); ep; ep = nextXMLEle(root,0)) {
                 if (strcmp (tagXMLEle(ep), "oneBLOB") == 0) {
@@ -1040,13 +1200,12 @@ dispatch (XMLEle *root, char msg[])
                     XMLAtt *sa = findXMLAtt (ep, "size");
                     if (na && fa && sa) {
                         if (n >= maxn) {
-                            int newsz = (maxn=n+1)*sizeof(char *);
-                            blobs = (char **) realloc (blobs, newsz);
-                            names = (char **) realloc (names, newsz);
-                            formats = (char **) realloc(formats,newsz);
-                            newsz = maxn*sizeof(int);
-                            sizes = (int *) realloc(sizes,newsz);
-                            blobsizes = (int *) realloc(blobsizes,newsz);
+                            maxn = dispatchRoom(n+1, maxn);
+                            blobs = (char **) realloc (blobs, maxn*sizeof(char *));
+                            names = (char **) realloc (names, maxn*sizeof(char *));
+                            formats = (char **) realloc(formats, maxn*sizeof(char *));
+                            sizes = (int *) realloc(sizes, maxn*sizeof(int));
+                            blobsizes = (int *) realloc(blobsizes, maxn*sizeof(int));
                         }
                         blobs[n] = malloc (3*pcdatalenXMLEle(ep)/4);
                         blobsizes[n] = from64tobits(blobs[n], pcdataXMLEle(ep));
@@ -1398,7 +1557,6 @@ void
 IDDefText (const ITextVectorProperty *tvp, const char *fmt, ...)
 {
         int i;
-        ROSC *SC;
 
         pthread_mutex_lock(&stdout_mutex);
 
@@ -1434,16 +1592,8 @@ IDDefText (const ITextVectorProperty *tvp, const char *fmt, ...)
 
         printf ("</defTextVector>\n");
 
-        if (!isPropDefined(tvp->name))
-        {
-                /* Add this property to insure proper sanity check */
-                roCheck = roCheck ? (ROSC *) realloc ( roCheck, sizeof(ROSC) * (nroCheck+1))
-                                : (ROSC *) malloc  ( sizeof(ROSC));
-                SC      = &roCheck[nroCheck++];
-
-                strcpy(SC->propName, tvp->name);
-                SC->perm = tvp->p;
-        }
+        /* Add this property to insure proper sanity check */
+        propRegister(tvp->name, tvp->p, tvp->ntp);
 
         setlocale(LC_NUMERIC,"");
         fflush (stdout);
@@ -1456,7 +1606,6 @@ void
 IDDefNumber (const INumberVectorProperty *n, const char *fmt, ...)
 {
         int i;
-        ROSC *SC;
 
         pthread_mutex_lock(&stdout_mutex);
 
@@ -1502,17 +1651,8 @@ IDDefNumber (const INumberVectorProperty *n, const char *fmt, ...)
 
         printf ("</defNumberVector>\n");
 
-        if (!isPropDefined(n->name))
-        {
-                /* Add this property to insure proper sanity check */
-                roCheck = roCheck ? (ROSC *) realloc ( roCheck, sizeof(ROSC) * (nroCheck+1))
-                                : (ROSC *) malloc  ( sizeof(ROSC));
-                SC      = &roCheck[nroCheck++];
-
-                strcpy(SC->propName, n->name);
-                SC->perm = n->p;
-
-        }
+        /* Add this property to insure proper sanity check */
+        propRegister(n->name, n->p, n->nnp);
 
         setlocale(LC_NUMERIC,"");
         fflush (stdout);
@@ -1526,7 +1666,6 @@ IDDefSwitch (const ISwitchVectorProperty *s, const char *fmt, ...)
 
 {
         int i;
-        ROSC *SC;
 
         pthread_mutex_lock(&stdout_mutex);
 
@@ -1563,16 +1702,8 @@ IDDefSwitch (const ISwitchVectorProperty *s, const char *fmt, ...)
 
         printf ("</defSwitchVector>\n");
 
-        if (!isPropDefined(s->name))
-        {
-                /* Add this property to insure proper sanity check */
-                roCheck = roCheck ? (ROSC *) realloc ( roCheck, sizeof(ROSC) * (nroCheck+1))
-                                : (ROSC *) malloc  ( sizeof(ROSC));
-                SC      = &roCheck[nroCheck++];
-
-                strcpy(SC->propName, s->name);
-                SC->perm = s->p;
-        }
+        /* Add this property to insure proper sanity check */
+        propRegister(s->name, s->p, s->nsp);
 
         setlocale(LC_NUMERIC,"");
         fflush (stdout);
@@ -1626,7 +1757,6 @@ void
 IDDefBLOB (const IBLOBVectorProperty *b, const char *fmt, ...)
 {
   int i;
-  ROSC *SC;
 
   pthread_mutex_lock(&stdout_mutex);
 
@@ -1661,16 +1791,8 @@ IDDefBLOB (const IBLOBVectorProperty *b, const char *fmt, ...)
 
         printf ("</defBLOBVector>\n");
 
-        if (!isPropDefined(b->name))
-        {
-                /* Add this property to insure proper sanity check */
-                roCheck = roCheck ? (ROSC *) realloc ( roCheck, sizeof(ROSC) * (nroCheck+1))
-                                : (ROSC *) malloc  ( sizeof(ROSC));
-                SC      = &roCheck[nroCheck++];
-
-                strcpy(SC->propName, b->name);
-                SC->perm = b->p;
-        }
+        /* Add this property to insure proper sanity check */
+        propRegister(b->name, b->p, b->nbp);
 
         setlocale(LC_NUMERIC,"");
         fflush (stdout);
@@ -1835,12 +1957,236 @@ IDSetLight (const ILightVectorProperty *lvp, const char *fmt, ...)
         pthread_mutex_unlock(&stdout_mutex);
 }
 
+/* write all of the n iov to fd, retrying partial writes.
+ * return 0 if ok else -1.
+ */
+static int
+writevAll (int fd, struct iovec *iov, int n)
+{
+        while (n > 0) {
+            ssize_t nw = writev (fd, iov, n);
+            if (nw < 0) {
+                if (errno == EINTR)
+                    continue;
+                return (-1);
+            }
+            while (n > 0 && (size_t)nw >= iov->iov_len) {
+                nw -= iov->iov_len;
+                iov++;
+                n--;
+            }
+            if (n > 0) {
+                iov->iov_base = (char *)iov->iov_base + nw;
+                iov->iov_len -= nw;
+            }
+        }
+        return (0);
+}
+
+/* write the content of bp base64 encoded to stdout in lines of B64LINE.
+ * whole lines are encoded B64CHUNK at a time and handed to writev with their
+ * newlines, so memory used does not depend on the size of the BLOB.
+ * N.B. caller must hold stdout_mutex.
+ */
+static void
+writeBLOB64 (const IBLOB *bp)
+{
+        static const char nl[] = "\n";
+        const int chunk = B64CHUNK*B64LINE/4*3;
+        const unsigned char *in = bp->blob;
+        int inlen = bp->bloblen;
+        unsigned char *encblob;
+        struct iovec iov[2*B64IOV];
+
+        if (inlen <= 0)
+            return;
+
+        /* anything printf'd so far must go first */
+        fflush (stdout);
+
+        encblob = malloc (B64CHUNK*B64LINE+4);
+        while (inlen > 0) {
+            int n = inlen < chunk ? inlen : chunk;
+            int l = to64frombits (encblob, in, n);
+            int j = 0;
+
+            while (j < l) {
+                int niov = 0;
+                for (; j < l && niov < 2*B64IOV; j += B64LINE) {
+                    iov[niov].iov_base = encblob + j;
+                    iov[niov++].iov_len = l - j < B64LINE ? l - j : B64LINE;
+                    iov[niov].iov_base = (void *)nl;
+                    iov[niov++].iov_len = 1;
+                }
+                if (writevAll (fileno(stdout), iov, niov) < 0) {
+                    fprintf (stderr, "%s: BLOB write: %s\n", me, strerror(errno));
+                    free (encblob);
+                    return;
+                }
+            }
+
+            in += n;
+            inlen -= n;
+        }
+        free (encblob);
+}
+
+/* return 1 if our stdout is a socket to an indiserver that takes BLOBs as
+ * fds, else 0.
+ */
+static int
+sharedBLOBsOk (void)
+{
+        static int ok = -1;
+        struct stat st;
+
+        if (ok < 0)
+            ok = getenv ("INDISHAREDBLOB") && fstat (fileno(stdout), &st) == 0
+                                                    && S_ISSOCK(st.st_mode);
+        return (ok);
+}
+
+/* return 1 if indiserver takes BLOB vectors with attached='binary', else 0.
+ */
+static int
+binaryBLOBsOk (void)
+{
+        static int ok = -1;
+
+        if (ok < 0)
+            ok = getenv ("INDIBINARYBLOB") != NULL;
+        return (ok);
+}
+
+/* write the content of each BLOB of bvp to stdout back to back, as the raw
+ * bytes following a vector sent with attached='binary'.
+ * N.B. caller must hold stdout_mutex and have flushed stdout.
+ */
+static void
+writeBLOBsRaw (const IBLOBVectorProperty *bvp)
+{
+        struct iovec iov[MAXSHAREDFD];
+        int i, niov;
+
+        for (i = niov = 0; i < bvp->nbp; i++)
+            if (bvp->bp[i].bloblen > 0) {
+                iov[niov].iov_base = bvp->bp[i].blob;
+                iov[niov++].iov_len = bvp->bp[i].bloblen;
+            }
+        if (writevAll (fileno(stdout), iov, niov) < 0)
+            fprintf (stderr, "%s: BLOB write: %s\n", me, strerror(errno));
+}
+
+/* copy the content of each BLOB of bvp to a new sealed memfd at fds[].
+ * return 0 if ok, else -1 with none left open.
+ */
+static int
+makeSharedBLOBs (const IBLOBVectorProperty *bvp, int fds[])
+{
+#ifdef HAVE_MEMFD
+        int i;
+
+        for (i = 0; i < bvp->nbp; i++) {
+            const IBLOB *bp = &bvp->bp[i];
+            const char *p = bp->blob;
+            int n = bp->bloblen > 0 ? bp->bloblen : 0;
+
+            fds[i] = syscall (SYS_memfd_create, bp->name,
+                                            MFD_CLOEXEC|MFD_ALLOW_SEALING);
+            if (fds[i] < 0)
+                break;
+            while (n > 0) {
+                ssize_t nw = write (fds[i], p, n);
+                if (nw < 0 && errno == EINTR)
+                    continue;
+                if (nw <= 0)
+                    break;
+                p += nw;
+                n -= nw;
+            }
+            if (n > 0 || fcntl (fds[i], F_ADD_SEALS, F_SEAL_SHRINK|F_SEAL_GROW|
+                                            F_SEAL_WRITE|F_SEAL_SEAL) < 0) {
+                close (fds[i]);
+                break;
+            }
+        }
+        if (i == bvp->nbp)
+            return (0);
+        while (--i >= 0)
+            close (fds[i]);
+#endif
+        return (-1);
+}
+
+/* send the oneBLOBs of bvp and its closing tag to indiserver, with the
+ * memfds at fds[] holding their content passed along, then close them.
+ * N.B. caller must hold stdout_mutex and have flushed stdout.
+ */
+static void
+sendSharedBLOBs (const IBLOBVectorProperty *bvp, int fds[])
+{
+        char cbuf[CMSG_SPACE(MAXSHAREDFD*sizeof(int))];
+        struct cmsghdr *cmp;
+        struct msghdr msg;
+        struct iovec iov;
+        char *text;
+        ssize_t nw;
+        int i, l;
+
+        text = malloc (bvp->nbp*(MAXINDINAME+MAXINDIBLOBFMT+100) + 32);
+        for (i = l = 0; i < bvp->nbp; i++)
+            l += sprintf (text+l, "  <oneBLOB\n    name='%s'\n    size='%d'\n"
+                            "    format='%s'\n    len='%d'/>\n", bvp->bp[i].name,
+                            bvp->bp[i].size, bvp->bp[i].format,
+                            bvp->bp[i].bloblen > 0 ? bvp->bp[i].bloblen : 0);
+        l += sprintf (text+l, "</setBLOBVector>\n");
+
+        memset (&msg, 0, sizeof(msg));
+        memset (cbuf, 0, sizeof(cbuf));
+        iov.iov_base = text;
+        iov.iov_len = l;
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = cbuf;
+        msg.msg_controllen = CMSG_SPACE(bvp->nbp*sizeof(int));
+        cmp = CMSG_FIRSTHDR(&msg);
+        cmp->cmsg_level = SOL_SOCKET;
+        cmp->cmsg_type = SCM_RIGHTS;
+        cmp->cmsg_len = CMSG_LEN(bvp->nbp*sizeof(int));
+        memcpy (CMSG_DATA(cmp), fds, bvp->nbp*sizeof(int));
+
+        /* the fds go with the first bytes, the rest may follow as usual */
+        while ((nw = sendmsg (fileno(stdout), &msg, 0)) < 0 && errno == EINTR)
+            continue;
+        iov.iov_base = text + (nw > 0 ? nw : 0);
+        iov.iov_len = l - (nw > 0 ? nw : 0);
+        if (nw < 0 || (nw < l && writevAll (fileno(stdout), &iov, 1) < 0))
+            fprintf (stderr, "%s: BLOB send: %s\n", me, strerror(errno));
+
+        for (i = 0; i < bvp->nbp; i++)
+            close (fds[i]);
+        free (text);
+}
+
 /* tell client to update an existing BLOB vector property */
 void
 IDSetBLOB (const IBLOBVectorProperty *bvp, const char *fmt, ...)
 {
+        int fds[MAXSHAREDFD];
+        long total = 0;
+        int shared = 0;
+        int binary;
         int i;
 
+        /* pass big BLOBs as memfds if possible, made before locking stdout */
+        if (sharedBLOBsOk() && bvp->nbp > 0 && bvp->nbp <= MAXSHAREDFD) {
+            for (i = 0; i < bvp->nbp; i++)
+                total += bvp->bp[i].bloblen > 0 ? bvp->bp[i].bloblen : 0;
+            shared = total >= SHAREDMIN && makeSharedBLOBs (bvp, fds) == 0;
+        }
+        binary = !shared && binaryBLOBsOk() && bvp->nbp > 0
+                                            && bvp->nbp <= MAXSHAREDFD;
+
         pthread_mutex_lock(&stdout_mutex);
 
         xmlv1();
@@ -1859,28 +2205,44 @@ IDSetBLOB (const IBLOBVectorProperty *bvp, const char *fmt, ...)
             printf ("'\n");
             va_end (ap);
         }
+        if (shared)
+            printf ("  attached='true'\n");
+        else if (binary)
+            printf ("  attached='binary'\n");
         printf (">\n");
 
-        for (i = 0; i < bvp->nbp; i++) {
-            IBLOB *bp = &bvp->bp[i];
-            unsigned char *encblob;
-            int j, l;
-
-            printf ("  <oneBLOB\n");
-            printf ("    name='%s'\n", bp->name);
-            printf ("    size='%d'\n", bp->size);
-            printf ("    format='%s'>\n", bp->format);
-
-            encblob = malloc (4*bp->bloblen/3+4);
-            l = to64frombits(encblob, bp->blob, bp->bloblen);
-            for (j = 0; j < l; j += 72)
-                printf ("%.72s\n", encblob+j);
-            free (encblob);
-
-            printf ("  </oneBLOB>\n");
+        if (shared) {
+            fflush (stdout);
+            sendSharedBLOBs (bvp, fds);
+        } else if (binary) {
+            for (i = 0; i < bvp->nbp; i++) {
+                IBLOB *bp = &bvp->bp[i];
+
+                printf ("  <oneBLOB\n");
+                printf ("    name='%s'\n", bp->name);
+                printf ("    size='%d'\n", bp->size);
+                printf ("    format='%s'\n", bp->format);
+                printf ("    len='%d'/>\n", bp->bloblen > 0 ? bp->bloblen : 0);
+            }
+            printf ("</setBLOBVector>");
+            fflush (stdout);
+            writeBLOBsRaw (bvp);
+        } else {
+            for (i = 0; i < bvp->nbp; i++) {
+                IBLOB *bp = &bvp->bp[i];
+
+                printf ("  <oneBLOB\n");
+                printf ("    name='%s'\n", bp->name);
+                printf ("    size='%d'\n", bp->size);
+                printf ("    format='%s'>\n", bp->format);
+
+                writeBLOB64 (bp);
+
+                printf ("  </oneBLOB>\n");
+            }
+            printf ("</setBLOBVector>\n");
         }
 
-  printf ("</setBLOBVector>\n");
   setlocale(LC_NUMERIC,"");
   fflush (stdout);
 
@@ -1923,14 +2285,13 @@ void IUUpdateMinMax(const INumberVectorProperty *nvp)
 /* Return 1 is property is already cached, 0 otherwise */
 int isPropDefined(const char *property_name)
 {
-  int i=0;
-
-  for (i=0; i < nroCheck; i++)
-    if (!strcmp(property_name, roCheck[i].propName))
-        return 1;
+  int i;
 
-  return 0;
+  pthread_mutex_lock(&propMutex);
+  i = propFind(property_name);
+  pthread_mutex_unlock(&propMutex);
 
+  return (i >= 0);
 }
 
 int IUFindIndex (const char *needle, char **hay, unsigned int n)
@@ -38,16 +38,60 @@
  * one client or device, they are queued and only removed after the last
  * consumer is finished. XMLEle are converted to linear strings before being
  * sent to optimize write system calls and avoid blocking to slow clients.
- * Clients that get more than maxqsiz bytes behind are shut down.
+ * Clients that get more than maxqsiz bytes of control messages or maxbulksiz
+ * bytes of BLOBs behind are shut down. A set*Vector from a driver takes the
+ * place of one still waiting for the same Property on the same queue, so a
+ * lagging client gets only the latest frame of a streaming camera and the
+ * latest of a stream of values. Values are only coalesced if no change of
+ * state, message or element is lost by it, so a vector carrying only some
+ * elements never hides one carrying others, and never across anything but
+ * set*Vectors.
+ * Where available, all fds are registered once with an edge triggered epoll
+ * instance and polled for write only while they have messages queued, so
+ * each pass only touches the clients and drivers that have work to do.
+ * BLOBs wait on a second queue for each client, so anything else queued is
+ * sent as soon as the message being sent is done. Each write gathers as many
+ * queued messages as it can with writev.
+ * With -t each client gets a writer thread for all this instead, so the
+ * main loop only reads and routes. Msgs are immutable once queued, counted
+ * atomically and freed by whoever lets go last. qlock guards all client
+ * queues, msglock the free Msg list.
+ *
+ * Clients on the same host may also connect to a Unix domain socket. Local
+ * drivers write to a socket too, so they may pass a big BLOB as a sealed
+ * memfd instead of base64. Such a setBLOBVector carries attached='true' and
+ * its oneBLOB elements are empty but for a len attribute, the fds follow in
+ * order as SCM_RIGHTS. Unix socket clients that sent getProperties with
+ * sharedblobs='On' get the same fds, everyone else gets base64 made here.
+ *
+ * Any peer may also skip base64 with attached='binary': the oneBLOB elements
+ * are empty with a len attribute as above, and the raw bytes of each follow
+ * in order right after </setBLOBVector>. Drivers we start are told they may
+ * send this by INDIBINARYBLOB, clients and remote drivers ask for it with
+ * binaryblobs='On' in the getProperties or enableBLOB they send first. Peers
+ * that did not ask still get base64.
  */
 
+#define _GNU_SOURCE	/* memfd seals */
+
 #include "config.h"
 
+#if defined(INDISERVER_BENCH_SELECT)
+#undef	HAVE_SYS_EPOLL_H		/* bench the select() core */
+#endif
+#if defined(INDISERVER_BENCH)
+#include <dirent.h>
+#include <poll.h>
+#include <sys/wait.h>
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <assert.h>
 #include <signal.h>
 #include <string.h>
+#include <ctype.h>
 #include <errno.h>
 #include <unistd.h>
 #include <time.h>
@@ -56,13 +100,24 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
 #include <arpa/inet.h>
+#include <poll.h>
+#include <pthread.h>
+#ifdef HAVE_SYS_EPOLL_H
+#include <stdint.h>
+#include <sys/epoll.h>
+#endif
 
 #include "lilxml.h"
 #include "indiapi.h"
 #include "fq.h"
+#include "base64.h"
 
 #define INDIPORT        7624            /* default TCP/IP port to listen */
 #define	REMOTEDVR	(-1234)		/* invalid PID to flag remote drivers */
@@ -70,6 +125,19 @@
 #define	MAXRBUF		4096		/* max read buffering here */
 #define	MAXWSIZ		4096		/* max bytes/write */
 #define	DEFMAXQSIZ	64		/* default max q behind, MB */
+#define	DEFMAXBULKSIZ	256		/* default max BLOBs behind, MB */
+#define	MAXEVENTS	64		/* max epoll events per wait */
+#define	MAXNOTSENT	(128*1024)	/* max unsent bytes left to the kernel */
+#define	MAXBURST	16		/* max reads or writes per fd per event */
+#define	MAXBLOBRD	65536		/* max bytes per read of a passing BLOB */
+#define	MAXFREEMSG	1024		/* max unused Msgs kept for reuse */
+#define	NROUTEHASH	256		/* initial Route hash table size, 2^n */
+#define	MAXSHAREDFD	64		/* max fds passed with one BLOB vector */
+#define	MAXBLOBSIZ	(1024UL*1024*1024) /* max raw bytes of one BLOB vector */
+#define	MAXBLOBMSG	(2*MAXBLOBSIZ)	/* max bytes of it passing through */
+#define	B64LINE		72		/* base64 digits per line we make */
+#define	MAXBATCH	64		/* max Msgs per client write */
+#define	MAXKEYELEM	32		/* max elements of a superseding vector */
 
 #ifdef OSX_HELPER_MODE
 #define LOGNAME "/Users/%s/Library/Logs/indiserver.log"
@@ -77,13 +145,50 @@
 #endif
 
 
-/* associate a usage count with queuded client or device message */
+/* the BLOBs of a setBLOBVector a driver passed as fds or raw bytes. the Msg
+ * content is the vector as the driver sent it, with the bytes if binary.
+ * b64 and bin are made from it when it is first sent to someone who can not
+ * take it that way.
+ */
 typedef struct {
+    int n;				/* n BLOBs, one per oneBLOB */
+    int nfds;				/* n, or 0 if the bytes are in raw */
+    int fds[MAXSHAREDFD];		/* sealed memfds */
+    unsigned long len[MAXSHAREDFD];	/* bytes of each */
+    const char *raw;			/* else bytes of all back to back in cp */
+    XMLEle *root;			/* the whole vector, parsed */
+    char *b64;				/* malloced base64 rendering, or NULL */
+    unsigned long b64l;			/* its length, known before it is made */
+    char *bin;				/* malloced binary rendering, or NULL */
+    unsigned long binl;			/* its length, known before it is made */
+} SharedBLOBs;
+
+/* how a consumer takes the BLOBs of a SharedBLOBs */
+typedef enum {BF_BASE64=0, BF_FDS, BF_BINARY} BLOBForm;
+
+/* associate a usage count with queuded client or device message */
+typedef struct _Msg {
     int count;				/* number of consumers left */
     unsigned long cl;			/* content length */
     char *cp;				/* content: buf or malloced */
+    SharedBLOBs *sb;			/* malloced if cp carries BLOBs unencoded */
+    struct _Route *key;			/* Property of a set*Vector from a driver */
+    const char *keytag;			/* its tag, one of settags[] */
+    char keystate[8];			/* its state attribute */
+    int keymsg;				/* 1 if it has a message attribute */
+    int nkeyelem;			/* n keyelem, -1 if too many to tell */
+    unsigned int keyelem[MAXKEYELEM];	/* hashes of its element names, sorted */
+    struct _Msg *next;			/* next on free list when unused */
     char buf[MAXWSIZ];		/* local buf for most messages */
 } Msg;
+static Msg *freemsgs;			/* list of unused Msgs */
+static int nfreemsgs;			/* n on freemsgs */
+
+/* the messages a newer one may supersede while queued, see setMsgKey() */
+static const char *settags[] = {
+    "setNumberVector", "setTextVector", "setSwitchVector", "setLightVector",
+    "setBLOBVector",
+};
 
 /* BLOB handling, NEVER is the default */
 typedef enum {B_NEVER=0, B_ALSO, B_ONLY} BLOBHandling;
@@ -110,6 +215,36 @@ struct
     //FILE *fs;
 } fifo;
 
+/* what is queued for one client and how much of it is sent. malloced on its
+ * own so a writer thread can finish with it after clinfo moves or the client
+ * is shut down. with writer threads all but s are guarded by qlock.
+ */
+typedef struct {
+    int s;				/* socket of the client */
+    FQ *ctlq;				/* Msgs other than BLOBs */
+    FQ *bulkq;				/* BLOB Msgs, sent when ctlq is empty */
+    int inbulk;				/* if nsent, the Msg begun is bulkq's */
+    unsigned long nsent;		/* bytes of the Msg begun sent so far */
+    unsigned long nqbytes[2];		/* total content of Msgs on ctlq, bulkq */
+    int nbusy[2];			/* head Msgs of each in the write under way */
+    unsigned long nsuperseded[2];	/* Msgs dropped from each for newer ones */
+    int sharedblobs;			/* 1 if takes BLOBs as fds */
+    int binaryblobs;			/* 1 if takes BLOBs as raw bytes */
+    int quit;				/* writer thread is to clean up and go */
+    pthread_cond_t wake;		/* signal writer thread of news */
+} ClQueue;
+
+/* one Msg of a client write and the part of it to go */
+typedef struct {
+    Msg *mp;				/* head or later of its queue */
+    int bulk;				/* 1 if on bulkq, else ctlq */
+    BLOBForm form;			/* how it goes to this client */
+    unsigned long off;			/* where to start */
+    unsigned long cl;			/* its whole content length */
+    const char *cp;			/* content from off */
+    unsigned long n;			/* bytes of it to send */
+} QBatch;
+
 /* info for each connected client */
 typedef struct {
     int active;				/* 1 when this record is in use */
@@ -118,9 +253,12 @@ typedef struct {
     int allprops;			/* saw getProperties w/o device */
     BLOBHandling blob;			/* when to send setBLOBs */
     int s;				/* socket for this client */
+    int local;				/* 1 if s is on our Unix socket */
+    int spoke;				/* 1 once its first message is read */
     LilXML *lp;				/* XML parsing context */
-    FQ *msgq;				/* Msg queue */
-    unsigned int nsent;				/* bytes of current Msg sent so far */
+    ClQueue *q;				/* what is queued to send it */
+    int wpoll;				/* 1 while polling s for write */
+    unsigned long routed;		/* routeserial when last considered */
 } ClInfo;
 static ClInfo *clinfo;			/*  malloced pool of clients */
 static int nclinfo;			/* n total (not active) */
@@ -145,17 +283,86 @@ typedef struct {
     int restarts;			/* times process has been restarted */
     LilXML *lp;				/* XML parsing context */
     FQ *msgq;				/* Msg queue */
+    unsigned long nqbytes;		/* total content of Msgs on msgq */
     unsigned int nsent;			/* bytes of current Msg sent so far */
+    int wpoll;				/* 1 while polling wfd for write */
+    Msg *blobmp;			/* setBLOBVector being passed through */
+    XMLEle *blobroot;			/* its opening tag, for routing */
+    unsigned long blobsiz;		/* bytes malloced at blobmp->cp */
+    unsigned long blobscan;		/* where to look next for its end */
+    unsigned long blobneed;		/* its whole length once known, else 0 */
+    int *fds;				/* malloced fds received, not yet used */
+    int nfds;				/* n entries in fds[] */
+    unsigned long routed;		/* routeserial when last considered */
 } DvrInfo;
 static DvrInfo *dvrinfo;		/* malloced array of drivers */
 static int ndvrinfo;			/* n total */
 
+/* one client or driver with a Property matching a Route */
+typedef struct {
+    int idx;				/* index into clinfo or dvrinfo */
+    int pi;				/* index into its props or sprops */
+} RouteSub;
+
+/* everyone interested in one device and property, or in the whole device
+ * if name is "". This indexes the Property lists so messages are only routed
+ * to the clients and drivers that want them. Routes are looked up by hash
+ * and never freed, so the names are interned here once.
+ */
+typedef struct _Route {
+    struct _Route *next;		/* next in same hash chain */
+    unsigned int hash;			/* routeHash(dev,name) */
+    char *dev;				/* malloced device name */
+    char *name;				/* malloced property name, or "" */
+    RouteSub *cls;			/* malloced clients with this Property */
+    int ncls;				/* n entries in cls[] */
+    RouteSub *sdrs;			/* malloced drivers snooping this Property */
+    int nsdrs;				/* n entries in sdrs[] */
+    int *rdrs;				/* malloced drivers serving dev, if name "" */
+    int nrdrs;				/* n entries in rdrs[] */
+} Route;
+static Route **routes;			/* malloced hash table of Route chains */
+static int nroutes;			/* n Routes in table */
+static int nroutehash;			/* n chains in table, 2^n */
+static int *allcls;			/* malloced clients with allprops */
+static int nallcls;			/* n entries in allcls[] */
+static unsigned long routeserial;	/* bumped for each message routed */
+
 static char *me;			/* our name */
 static int port = INDIPORT;		/* public INDI port */
 static int verbose;			/* chattiness */
 static int lsocket;			/* listen socket */
+static int usocket = -1;		/* Unix domain listen socket, if any */
+static char *upath;			/* its path */
 static char *ldir;			/* where to log driver messages */
-static int maxqsiz = (DEFMAXQSIZ*1024*1024); /* kill if these bytes behind */
+static unsigned long maxqsiz = (DEFMAXQSIZ*1024UL*1024UL); /* kill if these bytes behind */
+static unsigned long maxbulksiz = (DEFMAXBULKSIZ*1024UL*1024UL); /* same for BLOBs */
+static int threaded;			/* 1 for a writer thread per client */
+static pthread_mutex_t qlock = PTHREAD_MUTEX_INITIALIZER; /* client queues */
+static pthread_mutex_t msglock = PTHREAD_MUTEX_INITIALIZER; /* freemsgs */
+static pthread_mutex_t renderlock = PTHREAD_MUTEX_INITIALIZER; /* sb b64, bin */
+
+/* kinds of fds watched by the event core. with epoll each registration
+ * carries its kind, the index of its clinfo[] or dvrinfo[] slot and the fd
+ * itself, so events still pending for a slot that has since been recycled
+ * can be recognized.
+ */
+typedef enum {
+    IO_LISTEN = 1,			/* lsocket or usocket */
+    IO_FIFO,				/* fifo.fd */
+    IO_CLIENT,				/* client socket */
+    IO_DVR,				/* driver rfd, also wfd if remote */
+    IO_DVRW,				/* local driver wfd */
+    IO_DVRE				/* local driver efd */
+} IOKind;
+
+#ifdef HAVE_SYS_EPOLL_H
+#define	IOKEY(k,i,fd)	(((uint64_t)(k)<<56) | ((uint64_t)(i)<<32) | (uint32_t)(fd))
+#define	IOKIND(key)	((int)((key)>>56))
+#define	IOINDEX(key)	((int)(((key)>>32) & 0xffffff))
+#define	IOFD(key)	((int)(uint32_t)(key))
+static int epfd = -1;			/* epoll instance */
+#endif
 
 static void logStartup(int ac, char *av[]);
 static void usage (void);
@@ -164,9 +371,10 @@ static void noSIGPIPE (void);
 static void indiFIFO(void);
 static void indiRun (void);
 static void indiListen (void);
+static void indiListenUnix (void);
 static void newFIFO(void);
-static void newClient (void);
-static int newClSocket (void);
+static int newClient (int lfd);
+static int newClSocket (int lfd);
 static void shutdownClient (ClInfo *cp);
 static int readFromClient (ClInfo *cp);
 static void startDvr (DvrInfo *dp);
@@ -184,21 +392,83 @@ static void addSDevice (DvrInfo *dp, const char *dev, const char *name);
 static Property *findSDevice (DvrInfo *dp, const char *dev, const char *name);
 static void addClDevice (ClInfo *cp, const char *dev, const char *name, int isblob);
 static int findClDevice (ClInfo *cp, const char *dev, const char *name);
+static int q2Client (ClInfo *notme, ClInfo *cp, Property *pp, int isblob,
+    Msg *mp, XMLEle *root);
+static unsigned int routeHash (const char *dev, const char *name);
+static Route *findRoute (const char *dev, const char *name, int create);
+static void addRouteSub (RouteSub **subs, int *nsubs, int idx, int pi);
+static void rmRouteSub (RouteSub *subs, int *nsubs, int idx);
+static void addRouteInt (int **ints, int *nints, int idx);
+static void rmRouteInt (int *ints, int *nints, int idx);
+static void addDvrDevice (DvrInfo *dp, const char *dev);
 static int readFromDriver (DvrInfo *dp);
+static int parseFromDriver (DvrInfo *dp, char *buf, int nr);
+static void startBLOB (DvrInfo *dp, XMLEle *root);
+static int growBLOB (DvrInfo *dp, unsigned long need);
+static int moreBLOB (DvrInfo *dp, const char *bp, int n);
+static unsigned long findBLOBEnd (DvrInfo *dp);
+static void freeBLOB (DvrInfo *dp);
+static int attachBLOBs (DvrInfo *dp, Msg *mp);
+static int binaryBLOBs (DvrInfo *dp, Msg *mp, unsigned long end);
+static SharedBLOBs *newSharedBLOBs (const char *cp, unsigned long cl,
+    int *badp);
+static void freeSharedBLOBs (SharedBLOBs *sb);
+static void doneSharedBLOBs (SharedBLOBs *sb);
+static unsigned long rawBytes (SharedBLOBs *sb);
+static const unsigned char *blobBytes (SharedBLOBs *sb, int i, unsigned long j,
+    unsigned long n, unsigned char *buf);
+static void renderBLOBs (SharedBLOBs *sb);
+static void renderBinary (SharedBLOBs *sb);
+static int sprBinary (char *s, SharedBLOBs *sb);
+static int sprTag (char *s, XMLEle *ep, int level, const char *close);
+static ssize_t recvFds (DvrInfo *dp, void *buf, size_t n);
 static int stderrFromDriver (DvrInfo *dp);
-static int msgQSize (FQ *q);
+static void setMsgKey (Msg *mp, const char *dev, const char *name,
+    XMLEle *root);
 static void setMsgXMLEle (Msg *mp, XMLEle *root);
 static void setMsgStr (Msg *mp, char *str);
 static void freeMsg (Msg *mp);
 static Msg *newMsg (void);
+static void msgHold (Msg *mp);
+static void msgRelease (Msg *mp);
 static int sendClientMsg (ClInfo *cp);
 static int sendDriverMsg (DvrInfo *cp);
+static ClQueue *newClQueue (int s);
+static void delClQueue (ClQueue *q);
+static void freeClQueue (ClQueue *q);
+static int clQueued (ClQueue *q);
+static int clSuperseded (ClQueue *q, int bulk, Msg *mp);
+static int keyElemsCover (Msg *mp, Msg *old);
+static void addKeyElem (Msg *mp, const char *s, int l);
+static int clBatch (ClQueue *q, QBatch *b);
+static int clContent (QBatch *b, int nb, unsigned long max);
+static ssize_t clWrite (ClQueue *q, QBatch *b, int nb);
+static void clSent (ClQueue *q, QBatch *b, int nb, unsigned long nw);
+static void *clWriter (void *arg);
+static void lockQ (void);
+static void unlockQ (void);
+static BLOBForm clBLOBForm (ClQueue *q, Msg *mp);
+static void crackBLOBForms (ClInfo *cp, XMLEle *root);
+static const char *msgContent (Msg *mp, BLOBForm form, unsigned long *lp);
+static unsigned long msgQBytes (Msg *mp, BLOBForm form);
 static void crackBLOB (const char *enableBLOB, BLOBHandling *bp);
 static void crackBLOBHandling(const char *dev, const char *name, const char *enableBLOB, ClInfo *cp);
 static void traceMsg (XMLEle *root);
 static char *indi_tstamp (char *s);
 static void logDMsg (XMLEle *root, const char *dev);
 static void Bye(void);
+static void ioInit (void);
+static void ioAddFd (int fd, int kind, int idx);
+static void ioDelFd (int fd);
+static void ioClientWrite (ClInfo *cp, int on);
+static void ioDriverWrite (DvrInfo *dp, int on);
+static int pushClientMsg (ClInfo *cp, Msg *mp, XMLEle *root);
+static void pushDriverMsg (DvrInfo *dp, Msg *mp, XMLEle *root);
+
+#if defined(INDISERVER_BENCH)
+#define	main	serverMain	/* the bench main below runs the server */
+int serverMain (int ac, char *av[]);
+#endif
 
 int
 main (int ac, char *av[])
@@ -237,12 +507,20 @@ main (int ac, char *av[])
 		    ldir = *++av;
 		    ac--;
 		    break;
+		case 'b':
+		    if (ac < 2) {
+			fprintf (stderr, "-b requires max MB of BLOBs behind\n");
+			usage();
+		    }
+		    maxbulksiz = 1024UL*1024UL*strtoul(*++av, NULL, 0);
+		    ac--;
+		    break;
 		case 'm':
 		    if (ac < 2) {
 			fprintf (stderr, "-m requires max MB behind\n");
 			usage();
 		    }
-		    maxqsiz = 1024*1024*atoi(*++av);
+		    maxqsiz = 1024UL*1024UL*strtoul(*++av, NULL, 0);
 		    ac--;
 		    break;
 		case 'p':
@@ -261,6 +539,17 @@ main (int ac, char *av[])
         fifo.name = *++av;
         ac--;
         break;
+		case 'u':
+		    if (ac < 2) {
+			fprintf (stderr, "-u requires socket path\n");
+			usage();
+		    }
+		    upath = *++av;
+		    ac--;
+		    break;
+		case 't':
+		    threaded = 1;
+		    break;
 		case 'v':
 		    verbose++;
 		    break;
@@ -279,6 +568,9 @@ main (int ac, char *av[])
 	noZombies();
 	noSIGPIPE();
 
+	/* prepare the event core before any fds are opened */
+	ioInit();
+
 	/* realloc seed for client pool */
 	clinfo = (ClInfo *) malloc (1);
 	nclinfo = 0;
@@ -295,6 +587,8 @@ main (int ac, char *av[])
 
 	/* announce we are online */
 	indiListen();
+	if (upath)
+	    indiListenUnix();
 
         /* Load up FIFO, if available */
         indiFIFO();
@@ -329,9 +623,12 @@ usage(void)
     fprintf (stderr, "INDI Library: %s\nCode %s. Protocol %g.\n", CMAKE_INDI_VERSION_STRING, "$Revision: 726523 $", INDIV);
 	fprintf (stderr, "Options:\n");
         fprintf (stderr, " -l d     : log driver messages to <d>/YYYY-MM-DD.islog\n");
-        fprintf (stderr, " -m m     : kill client if gets more than this many MB behind, default %d\n", DEFMAXQSIZ);
+        fprintf (stderr, " -b b     : kill client if gets more than this many MB of BLOBs behind, default %d\n", DEFMAXBULKSIZ);
+        fprintf (stderr, " -m m     : kill client if gets more than this many MB of the rest behind, default %d\n", DEFMAXQSIZ);
         fprintf (stderr, " -p p     : alternate IP port, default %d\n", INDIPORT);
         fprintf (stderr, " -f path  : Path to fifo for dynamic startup and shutdown of drivers.\n");
+        fprintf (stderr, " -u path  : also listen to Unix domain socket <path> for local clients\n");
+        fprintf (stderr, " -t       : write to each client from a thread of its own\n");
         fprintf (stderr, " -v       : show key events, no traffic\n");
         fprintf (stderr, " -vv      : -v + key message content\n");
         fprintf (stderr, " -vvv     : -vv + complete xml\n");
@@ -421,9 +718,11 @@ startLocalDvr (DvrInfo *dp)
   fprintf(stderr, "STARTING \"%s\"\n", dp->name); fflush(stderr);
 #endif
 
-	/* build three pipes: r, w and error*/
-	if (pipe (rp) < 0) {
-	    fprintf (stderr, "%s: read pipe: %s\n", indi_tstamp(NULL),
+	/* build three pipes: r, w and error. r is a socket so the driver can
+	 * pass BLOBs as fds.
+	 */
+	if (socketpair (AF_UNIX, SOCK_STREAM, 0, rp) < 0) {
+	    fprintf (stderr, "%s: read socket: %s\n", indi_tstamp(NULL),
 							    strerror(errno));
 	    Bye();
 	}
@@ -467,6 +766,8 @@ startLocalDvr (DvrInfo *dp)
 	      setenv("INDISKEL", dp->envSkel, 1);
 	    else
 	      unsetenv("INDISKEL");
+	    setenv("INDISHAREDBLOB", "1", 1);
+	    setenv("INDIBINARYBLOB", "1", 1);
 	    char executable[MAXSBUF];
 	    if (*dp->envPrefix) {
 	      setenv("INDIPREFIX", dp->envPrefix, 1);
@@ -496,22 +797,31 @@ startLocalDvr (DvrInfo *dp)
 	dp->wfd = wp[1];
 	dp->efd = ep[0];
 	dp->lp = newLilXML();
+	setHeadXMLEle (dp->lp, "setBLOBVector");
     dp->msgq = newFQ(1);
     dp->sprops = (Property*) malloc (1);	/* seed for realloc */
 	dp->nsprops = 0;
 	dp->nsent = 0;
+	dp->nqbytes = 0;
+	dp->wpoll = 0;
     dp->active = 1;
     dp->ndev = 0;
     dp->dev = (char **) malloc(sizeof(char *));
+    dp->fds = NULL;
+    dp->nfds = 0;
+
+	/* watch all three pipes */
+	ioAddFd (dp->rfd, IO_DVR, dp - dvrinfo);
+	ioAddFd (dp->wfd, IO_DVRW, dp - dvrinfo);
+	ioAddFd (dp->efd, IO_DVRE, dp - dvrinfo);
 
 	/* first message primes driver to report its properties -- dev known
 	 * if restarting
 	 */
     mp = newMsg();
-	pushFQ (dp->msgq, mp);
     sprintf (buf, "<getProperties version='%g'/>\n", INDIV);
 	setMsgStr (mp, buf);
-    mp->count++;
+	pushDriverMsg (dp, mp, NULL);
 
 	if (verbose > 0)
 	    fprintf (stderr, "%s: Driver %s: pid=%d rfd=%d wfd=%d efd=%d\n",
@@ -545,30 +855,32 @@ startRemoteDvr (DvrInfo *dp)
 	dp->rfd = sockfd;
 	dp->wfd = sockfd;
 	dp->lp = newLilXML();
+	setHeadXMLEle (dp->lp, "setBLOBVector");
 	dp->msgq = newFQ(1);
     dp->sprops = (Property*) malloc (1);	/* seed for realloc */
 	dp->nsprops = 0;
 	dp->nsent = 0;
+	dp->nqbytes = 0;
+	dp->wpoll = 0;
     dp->active = 1;
-    dp->ndev = 1;
+    dp->ndev = 0;
     dp->dev = (char **) malloc(sizeof(char *));
 
 	/* N.B. storing name now is key to limiting outbound traffic to this
 	 * dev.
 	 */
-    dp->dev[0] = (char *) malloc(MAXINDIDEVICE * sizeof(char));
-    strncpy (dp->dev[0], dev, MAXINDIDEVICE-1);
-    dp->dev[0][MAXINDIDEVICE-1] = '\0';
+    addDvrDevice (dp, dev);
 
 	/* Sending getProperties with device lets remote server limit its
 	 * outbound (and our inbound) traffic on this socket to this device.
+	 * BLOBs may as well come without base64, if it knows how.
 	 */
+	ioAddFd (dp->rfd, IO_DVR, dp - dvrinfo);
 	mp = newMsg();
-	pushFQ (dp->msgq, mp);
-	sprintf (buf, "<getProperties device='%s' version='%g'/>\n",
+	sprintf (buf, "<getProperties device='%s' version='%g' binaryblobs='On'/>\n",
              dp->dev[0], INDIV);
 	setMsgStr (mp, buf);
-	mp->count++;
+	pushDriverMsg (dp, mp, NULL);
 
 	if (verbose > 0)
 	    fprintf (stderr, "%s: Driver %s: socket=%d\n", indi_tstamp(NULL),
@@ -656,14 +968,60 @@ indiListen ()
 
 	/* ok */
 	lsocket = sfd;
+	ioAddFd (lsocket, IO_LISTEN, 0);
 	if (verbose > 0)
 	    fprintf (stderr, "%s: listening to port %d on fd %d\n",
 	    					indi_tstamp(NULL), port, sfd);
 }
 
+/* create the local INDI endpoint usocket at upath.
+ * exit if trouble.
+ */
+static void
+indiListenUnix ()
+{
+	struct sockaddr_un serv_socket;
+	int sfd;
+
+	if (strlen (upath) >= sizeof(serv_socket.sun_path)) {
+	    fprintf (stderr, "%s: %s: path too long\n", indi_tstamp(NULL), upath);
+	    Bye();
+	}
+
+	/* make socket endpoint */
+	if ((sfd = socket (AF_UNIX, SOCK_STREAM, 0)) < 0) {
+	    fprintf (stderr, "%s: socket: %s\n", indi_tstamp(NULL), strerror(errno));
+	    Bye();
+	}
+
+	/* bind to upath, replacing any left over by a previous server */
+	memset (&serv_socket, 0, sizeof(serv_socket));
+	serv_socket.sun_family = AF_UNIX;
+	strcpy (serv_socket.sun_path, upath);
+	(void) unlink (upath);
+	if (bind(sfd,(struct sockaddr*)&serv_socket,sizeof(serv_socket)) < 0){
+	    fprintf (stderr, "%s: bind(%s): %s\n", indi_tstamp(NULL), upath,
+							    strerror(errno));
+	    Bye();
+	}
+
+	if (listen (sfd, 5) < 0) {
+	    fprintf (stderr, "%s: listen: %s\n", indi_tstamp(NULL), strerror(errno));
+	    Bye();
+	}
+
+	/* ok */
+	usocket = sfd;
+	ioAddFd (usocket, IO_LISTEN, 0);
+	if (verbose > 0)
+	    fprintf (stderr, "%s: listening to %s on fd %d\n",
+	    					indi_tstamp(NULL), upath, sfd);
+}
+
 /* Attempt to open up FIFO */
 static void indiFIFO(void)
 {
+    ioDelFd(fifo.fd);
     close(fifo.fd);
     fifo.fd=-1;
 
@@ -677,10 +1035,106 @@ static void indiFIFO(void)
            fprintf(stderr, "%s: open(%s): %s.\n", indi_tstamp(NULL), fifo.name, strerror(errno));
            Bye();
        }
+
+       ioAddFd(fifo.fd, IO_FIFO, 0);
     }
 
 }
 
+/* prepare the event core.
+ * exit if trouble.
+ */
+static void
+ioInit (void)
+{
+#ifdef HAVE_SYS_EPOLL_H
+	epfd = epoll_create1 (EPOLL_CLOEXEC);
+	if (epfd < 0) {
+	    fprintf (stderr, "%s: epoll_create: %s\n", indi_tstamp(NULL),
+							    strerror(errno));
+	    Bye();
+	}
+#endif
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+/* add or modify the epoll registration of fd.
+ * we always want to read except from a local driver's wfd, write only if asked.
+ * exit if trouble.
+ */
+static void
+ioCtl (int op, int fd, int kind, int idx, int wantw)
+{
+	struct epoll_event ev;
+
+	memset (&ev, 0, sizeof(ev));
+	ev.events = EPOLLET;
+	if (kind != IO_DVRW)
+	    ev.events |= EPOLLIN;
+	if (wantw)
+	    ev.events |= EPOLLOUT;
+	ev.data.u64 = IOKEY(kind, idx, fd);
+	if (epoll_ctl (epfd, op, fd, &ev) < 0) {
+	    fprintf (stderr, "%s: epoll_ctl(%d): %s\n", indi_tstamp(NULL), fd,
+							    strerror(errno));
+	    Bye();
+	}
+}
+#endif
+
+/* start watching fd of the given kind for clinfo[idx] or dvrinfo[idx].
+ * with epoll, fds are edge triggered so they must never block.
+ */
+static void
+ioAddFd (int fd, int kind, int idx)
+{
+#ifdef HAVE_SYS_EPOLL_H
+	fcntl (fd, F_SETFL, fcntl (fd, F_GETFL, 0) | O_NONBLOCK);
+	ioCtl (EPOLL_CTL_ADD, fd, kind, idx, 0);
+#endif
+}
+
+/* stop watching fd, call before closing it.
+ * N.B. a forked driver may still hold a copy of fd so closing is not enough.
+ */
+static void
+ioDelFd (int fd)
+{
+#ifdef HAVE_SYS_EPOLL_H
+	if (fd >= 0)
+	    (void) epoll_ctl (epfd, EPOLL_CTL_DEL, fd, NULL);
+#endif
+}
+
+/* start or stop polling client cp for write */
+static void
+ioClientWrite (ClInfo *cp, int on)
+{
+	if (cp->wpoll == on)
+	    return;
+	cp->wpoll = on;
+#ifdef HAVE_SYS_EPOLL_H
+	ioCtl (EPOLL_CTL_MOD, cp->s, IO_CLIENT, cp - clinfo, on);
+#endif
+}
+
+/* start or stop polling driver dp for write */
+static void
+ioDriverWrite (DvrInfo *dp, int on)
+{
+	if (dp->wpoll == on)
+	    return;
+	dp->wpoll = on;
+#ifdef HAVE_SYS_EPOLL_H
+	if (dp->pid == REMOTEDVR)
+	    ioCtl (EPOLL_CTL_MOD, dp->rfd, IO_DVR, dp - dvrinfo, on);
+	else
+	    ioCtl (EPOLL_CTL_MOD, dp->wfd, IO_DVRW, dp - dvrinfo, on);
+#endif
+}
+
+#ifndef HAVE_SYS_EPOLL_H
+
 /* service traffic from clients and drivers */
 static void
 indiRun(void)
@@ -703,13 +1157,18 @@ indiRun(void)
 	FD_SET(lsocket, &rs);
         if (lsocket > maxfd)
                 maxfd = lsocket;
+	if (usocket >= 0) {
+	    FD_SET(usocket, &rs);
+	    if (usocket > maxfd)
+		maxfd = usocket;
+	}
 
 	/* add all client readers and client writers with work to send */
 	for (i = 0; i < nclinfo; i++) {
 	    ClInfo *cp = &clinfo[i];
 	    if (cp->active) {
 		FD_SET(cp->s, &rs);
-		if (nFQ(cp->msgq) > 0)
+		if (!threaded && clQueued (cp->q) > 0)
 		    FD_SET(cp->s, &ws);
 		if (cp->s > maxfd)
 		    maxfd = cp->s;
@@ -758,7 +1217,11 @@ indiRun(void)
 
 	/* new client? */
 	if (s > 0 && FD_ISSET(lsocket, &rs)) {
-	    newClient();
+	    newClient(lsocket);
+	    s--;
+	}
+	if (s > 0 && usocket >= 0 && FD_ISSET(usocket, &rs)) {
+	    newClient(usocket);
 	    s--;
 	}
 
@@ -800,6 +1263,132 @@ indiRun(void)
 	}
 }
 
+#else
+
+/* drain io on client slot idx as reported by events for fd.
+ * fds are edge triggered so keep going until the kernel has no more for us,
+ * but yield after MAXBURST rounds and rearm so one busy peer can not starve
+ * the rest.
+ */
+static void
+ioClient (int idx, int fd, unsigned int events)
+{
+	ClInfo *cp = &clinfo[idx];
+	int n, r, more = 0;
+
+	if (events & (EPOLLIN|EPOLLHUP|EPOLLERR)) {
+	    for (n = r = 0; r != 1 && n < MAXBURST; n++) {
+		if (!cp->active || cp->s != fd)
+		    return;	/* shut down meanwhile */
+		r = readFromClient (cp);
+	    }
+	    more |= (r != 1);
+	}
+
+	if (events & EPOLLOUT) {
+	    for (n = r = 0; r != 1 && n < MAXBURST; n++) {
+		if (!cp->active || cp->s != fd)
+		    return;	/* shut down meanwhile */
+		if (clQueued (cp->q) == 0)
+		    break;
+		r = sendClientMsg (cp);
+	    }
+	    more |= (n == MAXBURST && r != 1);
+	}
+
+	/* modifying an fd makes epoll report it again if still ready */
+	if (more && cp->active && cp->s == fd)
+	    ioCtl (EPOLL_CTL_MOD, fd, IO_CLIENT, idx, cp->wpoll);
+}
+
+/* drain io on driver slot idx as reported by events for fd of the given kind.
+ * same rules as ioClient().
+ */
+static void
+ioDriver (int kind, int idx, int fd, unsigned int events)
+{
+	DvrInfo *dp = &dvrinfo[idx];
+	int n, r, more = 0;
+
+#define	DVRFDOK	(dp->active && ((kind == IO_DVR && dp->rfd == fd) || \
+			(kind == IO_DVRW && dp->wfd == fd) || \
+			(kind == IO_DVRE && dp->efd == fd)))
+
+	if (kind != IO_DVRW && (events & (EPOLLIN|EPOLLHUP|EPOLLERR))) {
+	    for (n = r = 0; r != 1 && n < MAXBURST; n++) {
+		if (!DVRFDOK)
+		    return;	/* shut down meanwhile */
+		r = kind == IO_DVRE ? stderrFromDriver (dp) : readFromDriver (dp);
+	    }
+	    more |= (r != 1);
+	}
+
+	if (kind != IO_DVRE && (events & (EPOLLOUT|EPOLLERR))) {
+	    for (n = r = 0; r != 1 && n < MAXBURST; n++) {
+		if (!DVRFDOK)
+		    return;	/* shut down meanwhile */
+		if (nFQ(dp->msgq) == 0)
+		    break;
+		r = sendDriverMsg (dp);
+	    }
+	    more |= (n == MAXBURST && r != 1);
+	}
+
+	if (more && DVRFDOK)
+	    ioCtl (EPOLL_CTL_MOD, fd, kind, idx, kind == IO_DVRE ? 0 :
+		    (kind == IO_DVR && dp->pid != REMOTEDVR) ? 0 : dp->wpoll);
+
+#undef	DVRFDOK
+}
+
+/* service traffic from clients and drivers.
+ * only the fds with something to do are touched, each was registered once
+ * with epoll when it was opened.
+ */
+static void
+indiRun(void)
+{
+	struct epoll_event ev[MAXEVENTS];
+	int i, n;
+
+	/* wait for action */
+	n = epoll_wait (epfd, ev, MAXEVENTS, -1);
+	if (n < 0) {
+	    if (errno == EINTR)
+		return;
+	    fprintf (stderr, "%s: epoll_wait: %s\n", indi_tstamp(NULL),
+							    strerror(errno));
+	    Bye();
+	}
+
+	/* N.B. edges are not repeated so every event must be handled here,
+	 *   even if a handler shut down other clients or drivers.
+	 */
+	for (i = 0; i < n; i++) {
+	    uint64_t key = ev[i].data.u64;
+	    int fd = IOFD(key);
+
+	    switch (IOKIND(key)) {
+	    case IO_LISTEN:
+		while (newClient(fd) == 0)
+		    continue;
+		break;
+	    case IO_FIFO:
+		if (fd == fifo.fd)
+		    newFIFO();
+		break;
+	    case IO_CLIENT:
+		ioClient (IOINDEX(key), fd, ev[i].events);
+		break;
+	    default:
+		ioDriver (IOKIND(key), IOINDEX(key), fd, ev[i].events);
+		break;
+	    }
+	}
+}
+
+#endif /* HAVE_SYS_EPOLL_H */
+
 int isDeviceInDriver(const char *dev, DvrInfo *dp)
 {
     int i=0;
@@ -812,6 +1401,24 @@ int isDeviceInDriver(const char *dev, DvrInfo *dp)
     return 0;
 }
 
+/* add dev to the devices served by dp and to its Route */
+static void
+addDvrDevice (DvrInfo *dp, const char *dev)
+{
+    Route *rp;
+
+    dp->dev = (char **) realloc(dp->dev, (dp->ndev+1) * sizeof(char *));
+    dp->dev[dp->ndev] = (char *) malloc(MAXINDIDEVICE * sizeof(char));
+
+    strncpy (dp->dev[dp->ndev], dev, MAXINDIDEVICE-1);
+    dp->dev[dp->ndev][MAXINDIDEVICE-1] = '\0';
+
+    rp = findRoute (dp->dev[dp->ndev], "", 1);
+    addRouteInt (&rp->rdrs, &rp->nrdrs, dp - dvrinfo);
+
+    dp->ndev++;
+}
+
 /* Read commands from FIFO and process them. Start/stop drivers accordingly */
 static void newFIFO(void)
 {
@@ -941,11 +1548,9 @@ static void newFIFO(void)
                 prXMLEle(stderr, root, 0);
                 Msg * mp = newMsg();
 
-                q2Clients(NULL, 0, dp->dev[i], NULL, mp, root);
-               if (mp->count > 0)
-                   setMsgXMLEle (mp, root);
-               else
-                   freeMsg (mp);
+                msgHold (mp);
+                q2Clients(NULL, 0, dp->dev[i], "", mp, root);
+                msgRelease (mp);
               delXMLEle (root);
             }
 
@@ -957,17 +1562,20 @@ static void newFIFO(void)
    }
 }
 
-/* prepare for new client arriving on lsocket.
+/* prepare for new client arriving on lfd, lsocket or usocket.
+ * return 0 if added one, -1 if none was waiting.
  * exit if trouble.
  */
-static void
-newClient()
+static int
+newClient(int lfd)
 {
 	ClInfo *cp = NULL;
 	int s, cli;
 
 	/* assign new socket */
-	s = newClSocket ();
+	s = newClSocket (lfd);
+	if (s < 0)
+	    return (-1);
 
 	/* try to reuse a clinfo slot, else add one */
 	for (cli = 0; cli < nclinfo; cli++)
@@ -987,12 +1595,30 @@ newClient()
 	memset (cp, 0, sizeof(*cp));
 	cp->active = 1;
 	cp->s = s;
+	cp->local = (lfd == usocket);
 	cp->lp = newLilXML();
-	cp->msgq = newFQ(1);
+	cp->q = newClQueue (s);
 	cp->props = malloc (1);
-	cp->nsent = 0;
+	ioAddFd (cp->s, IO_CLIENT, cp - clinfo);
 
-	if (verbose > 0) {
+	/* start its writer, it lets go of cp->q on its own */
+	if (threaded) {
+	    pthread_attr_t attr;
+	    pthread_t tid;
+
+	    pthread_attr_init (&attr);
+	    pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+	    if (pthread_create (&tid, &attr, clWriter, cp->q) != 0) {
+		fprintf (stderr, "can not start writer for new client\n");
+		Bye();
+	    }
+	    pthread_attr_destroy (&attr);
+	}
+
+	if (verbose > 0 && cp->local) {
+	    fprintf(stderr,"%s: Client %d: new arrival on %s - welcome!\n",
+			    indi_tstamp(NULL), cp->s, upath);
+	} else if (verbose > 0) {
 	    struct sockaddr_in addr;
 	    socklen_t len = sizeof(addr);
 	    getpeername(s, (struct sockaddr*)&addr, &len);
@@ -1007,11 +1633,13 @@ newClient()
       active++;
   fprintf(stderr, "CLIENTS %d\n", active); fflush(stderr);
 #endif
+
+	return (0);
 }
 
 /* read more from the given client, send to each appropriate driver when see
  * xml closure. also send all newXXX() to all other interested clients.
- * return -1 if had to shut down anything, else 0.
+ * return -1 if had to shut down anything, 1 if nothing was ready, else 0.
  */
 static int
 readFromClient (ClInfo *cp)
@@ -1019,9 +1647,12 @@ readFromClient (ClInfo *cp)
 	char buf[MAXRBUF];
 	int shutany = 0;
 	ssize_t i, nr;
+	size_t used;
 
 	/* read client */
 	nr = read (cp->s, buf, sizeof(buf));
+	if (nr < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+	    return (1);
 	if (nr <= 0) {
 	    if (nr < 0)
 		fprintf (stderr, "%s: Client %d: read: %s\n", indi_tstamp(NULL),
@@ -1034,9 +1665,9 @@ readFromClient (ClInfo *cp)
 	}
 
 	/* process XML, sending when find closure */
-	for (i = 0; i < nr; i++) {
+	for (i = 0; i < nr; i += used) {
 	    char err[1024];
-	    XMLEle *root = readXMLEle (cp->lp, buf[i], err);
+	    XMLEle *root = readXMLEleBuf (cp->lp, buf+i, nr-i, &used, err);
 	    if (root) {
 		char *roottag = tagXMLEle(root);
 		const char *dev = findXMLAttValu (root, "device");
@@ -1060,8 +1691,17 @@ readFromClient (ClInfo *cp)
 		 */
 		if (dev[0])
                     addClDevice (cp, dev, name, isblob);
-		else if (!strcmp (roottag, "getProperties") && !cp->nprops)
+		else if (!strcmp (roottag, "getProperties") && !cp->nprops
+							    && !cp->allprops) {
 		    cp->allprops = 1;
+		    addRouteInt (&allcls, &nallcls, cp - clinfo);
+		}
+
+		/* clients may ask for BLOBs as fds or raw bytes, first thing */
+		if (!cp->spoke) {
+		    crackBLOBForms (cp, root);
+		    cp->spoke = 1;
+		}
 
 		/* snag enableBLOB -- send to remote drivers too */
 		if (!strcmp (roottag, "enableBLOB"))
@@ -1070,6 +1710,7 @@ readFromClient (ClInfo *cp)
 
 		/* build a new message -- set content iff anyone cares */
 		mp = newMsg();
+		msgHold (mp);
 
 		/* send message to driver(s) responsible for dev */
 		q2RDrivers (dev, mp, root);
@@ -1080,11 +1721,8 @@ readFromClient (ClInfo *cp)
 			shutany++;
 		}
 
-		/* set message content if anyone cares else forget it */
-		if (mp->count > 0)
-		    setMsgXMLEle (mp, root);
-		else
-		    freeMsg (mp);
+		/* forget message if no one cares */
+		msgRelease (mp);
 		delXMLEle (root);
 
 	    } else if (err[0]) {
@@ -1103,17 +1741,33 @@ readFromClient (ClInfo *cp)
 
 /* read more from the given driver, send to each interested client when see
  * xml closure. if driver dies, try restarting.
- * return 0 if ok else -1 if had to shut down anything.
+ * return 0 if ok, 1 if nothing was ready, else -1 if had to shut down anything.
  */
 static int
 readFromDriver (DvrInfo *dp)
 {
 	char buf[MAXRBUF];
-	int shutany = 0;
-	ssize_t i, nr;
+	Msg *mp = dp->blobmp;
+	ssize_t nr;
 
-	/* read driver */
-	nr = read (dp->rfd, buf, sizeof(buf));
+	/* passing a BLOB through? read straight into its message, as much
+	 * of its raw bytes as are ready if binary
+	 */
+	if (mp) {
+	    unsigned long want = MAXBLOBRD;
+
+	    if (dp->blobneed > mp->cl + want)
+		want = dp->blobneed - mp->cl;
+	    if (growBLOB (dp, mp->cl + want) < 0) {
+		shutdownDvr (dp, 1);
+		return (-1);
+	    }
+	    mp = dp->blobmp;
+	    nr = recvFds (dp, mp->cp + mp->cl, want);
+	} else
+	    nr = recvFds (dp, buf, sizeof(buf));
+	if (nr < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+	    return (1);
 	if (nr <= 0) {
 	    if (nr < 0)
 		fprintf (stderr, "%s: Driver %s: stdin %s\n", indi_tstamp(NULL),
@@ -1125,11 +1779,28 @@ readFromDriver (DvrInfo *dp)
 	    return (-1);
 	}
 
+	if (mp)
+	    return (moreBLOB (dp, NULL, nr));
+	return (parseFromDriver (dp, buf, nr));
+}
+
+/* parse nr more bytes from the given driver, send to each interested client
+ * when see xml closure. setBLOBVector content is not parsed, it is handed to
+ * moreBLOB() as is.
+ * return 0 if ok else -1 if had to shut down anything.
+ */
+static int
+parseFromDriver (DvrInfo *dp, char *buf, int nr)
+{
+	int shutany = 0;
+	int i;
+	size_t used;
+
 	/* process XML, sending when find closure */
-    for (i = 0; i < nr; i++)
+    for (i = 0; i < nr; i += used)
     {
 	    char err[1024];
-	    XMLEle *root = readXMLEle (dp->lp, buf[i], err);
+	    XMLEle *root = readXMLEleBuf (dp->lp, buf+i, nr-i, &used, err);
         if (root)
         {
 		char *roottag = tagXMLEle(root);
@@ -1170,26 +1841,30 @@ readFromDriver (DvrInfo *dp)
         /* Found a new device? Let's add it to driver info */
         if (dev[0] && isDeviceInDriver(dev, dp) == 0)
         {
-            dp->dev = (char **) realloc(dp->dev, (dp->ndev+1) * sizeof(char *));
-            dp->dev[dp->ndev] = (char *) malloc(MAXINDIDEVICE * sizeof(char));
-
-            strncpy (dp->dev[dp->ndev], dev, MAXINDIDEVICE-1);
-            dp->dev[dp->ndev][MAXINDIDEVICE-1] = '\0';
-
 #ifdef OSX_HELPER_MODE
             if (!dp->ndev)
               fprintf(stderr, "STARTED \"%s\"\n", dp->name); fflush(stderr);
 #endif
 
-            dp->ndev++;
+            addDvrDevice (dp, dev);
         }
 
 		/* log messages if any and wanted */
 		if (ldir)
 		    logDMsg (root, dev);
 
+		/* BLOB content is copied through as is, send when complete */
+		if (gotHeadXMLEle (dp->lp)) {
+		    startBLOB (dp, root);
+		    i += used;
+		    if (moreBLOB (dp, buf+i, nr-i) < 0)
+			shutany++;
+		    break;
+		}
+
 		/* build a new message -- set content iff anyone cares */
 		mp = newMsg();
+		msgHold (mp);
 
 		/* send to interested clients */
          if (q2Clients (NULL, isblob, dev, name, mp, root) < 0)
@@ -1198,11 +1873,8 @@ readFromDriver (DvrInfo *dp)
 		/* send to snooping drivers */
         q2SDrivers (isblob, dev, name, mp, root);
 
-		/* set message content if anyone cares else forget it */
-		if (mp->count > 0)
-		    setMsgXMLEle (mp, root);
-		else
-		    freeMsg (mp);
+		/* forget message if no one cares */
+		msgRelease (mp);
 		delXMLEle (root);
 
 	    } else if (err[0]) {
@@ -1219,71 +1891,642 @@ readFromDriver (DvrInfo *dp)
 	return (shutany ? -1 : 0);
 }
 
-/* read more from the given driver stderr, add prefix and send to our stderr.
- * return 0 if ok else -1 if had to restart.
+/* start passing the setBLOBVector whose opening tag is root through from dp
+ * without parsing its content. the Msg starts with the opening tag, the rest
+ * is appended verbatim as it arrives.
+ */
+static void
+startBLOB (DvrInfo *dp, XMLEle *root)
+{
+	Msg *mp = newMsg();
+	int l;
+
+	/* sprXMLEle closes an empty element with "/>\n", reopen it */
+	dp->blobsiz = sprlXMLEle (root, 0) + MAXBLOBRD + 1;
+	mp->cp = malloc (dp->blobsiz);
+	l = sprXMLEle (mp->cp, root, 0);
+	mp->cl = l - 3;
+	mp->cp[mp->cl++] = '>';
+
+	dp->blobmp = mp;
+	dp->blobroot = root;
+	dp->blobscan = mp->cl;
+	dp->blobneed = 0;
+}
+
+/* n more bytes of the BLOB passing through dp have arrived. copy them from bp,
+ * or they were read in place if bp is NULL. it is complete at its closing
+ * tag, or after the raw bytes that follow it if binary. then queue it for
+ * everyone interested just like any other message and parse on in whatever
+ * followed.
+ * return 0 if ok else -1 if had to shut down anything.
  */
 static int
-stderrFromDriver (DvrInfo *dp)
+moreBLOB (DvrInfo *dp, const char *bp, int n)
 {
-	static char exbuf[MAXRBUF];
-	static int nexbuf;
-	ssize_t i, nr;
+	Msg *mp = dp->blobmp;
+	XMLEle *root = dp->blobroot;
+	const char *dev, *name;
+	unsigned long end, extra;
+	int shutany = 0;
 
-	/* read more */
-	nr = read (dp->efd, exbuf+nexbuf, sizeof(exbuf)-nexbuf);
-	if (nr <= 0) {
-	    if (nr < 0)
-		fprintf (stderr, "%s: Driver %s: stderr %s\n", indi_tstamp(NULL),
-						    dp->name, strerror(errno));
-	    else
-		fprintf (stderr, "%s: Driver %s: stderr EOF\n",
-							indi_tstamp(NULL), dp->name);
-            shutdownDvr (dp, 1);
-	    return (-1);
+	/* append */
+	if (bp) {
+	    if (growBLOB (dp, mp->cl + n) < 0) {
+		shutdownDvr (dp, 1);
+		return (-1);
+	    }
+	    memcpy (mp->cp + mp->cl, bp, n);
 	}
-	nexbuf += nr;
+	mp->cl += n;
 
-	/* prefix each whole line to our stderr, save extra for next time */
-	for (i = 0; i < nexbuf; i++) {
-	    if (exbuf[i] == '\n') {
-		fprintf (stderr, "%s: Driver %s: %.*s\n", indi_tstamp(NULL),
-							    dp->name, (int)i, exbuf);
-		i++;				  /* count including nl */
-		nexbuf -= i;			  /* remove from nexbuf */
-		memmove (exbuf, exbuf+i, nexbuf); /* slide remaining to front */
-		i = -1;				  /* restart for loop scan */
+	/* done unless found closing tag, and all raw bytes if binary */
+	if (!dp->blobneed) {
+	    end = findBLOBEnd (dp);
+	    if (!end)
+		return (0);
+	    if (strcmp (findXMLAttValu (root, "attached"), "binary"))
+		dp->blobneed = end;
+	    else if (binaryBLOBs (dp, mp, end) < 0) {
+		fprintf (stderr, "%s: Driver %s: bad binary BLOBs for %s.%s\n",
+				indi_tstamp(NULL), dp->name,
+				findXMLAttValu (root, "device"),
+				findXMLAttValu (root, "name"));
+		shutdownDvr (dp, 1);
+		return (-1);
 	    }
 	}
+	if (mp->cl < dp->blobneed)
+	    return (0);
+	end = dp->blobneed;
+	extra = mp->cl - end;
+	mp->cl = end;
+	if (mp->sb)
+	    mp->sb->raw = mp->cp + end - rawBytes (mp->sb);
+	dp->blobmp = NULL;
+	dp->blobroot = NULL;
+	dp->blobneed = 0;
+
+	/* hold mp while its tail is parsed, even if no one wants it */
+	msgHold (mp);
+
+	dev = findXMLAttValu (root, "device");
+	name = findXMLAttValu (root, "name");
+	if (!strcmp (findXMLAttValu (root, "attached"), "true") &&
+						    attachBLOBs (dp, mp) < 0) {
+	    fprintf (stderr, "%s: Driver %s: bad shared BLOBs for %s.%s\n",
+					indi_tstamp(NULL), dp->name, dev, name);
+	} else {
+	    if (q2Clients (NULL, 1, dev, name, mp, root) < 0)
+		shutany++;
+	    q2SDrivers (1, dev, name, mp, root);
+	}
+	delXMLEle (root);
+
+	if (extra > 0 && parseFromDriver (dp, mp->cp + end, extra) < 0)
+	    shutany++;
+
+	msgRelease (mp);
+
+	return (shutany ? -1 : 0);
+}
+
+/* make room for need bytes of the BLOB passing through dp, and its final \0.
+ * return 0 if ok, else -1 if it would be too big or there is no memory, then
+ * the message so far is as it was.
+ */
+static int
+growBLOB (DvrInfo *dp, unsigned long need)
+{
+	Msg *mp = dp->blobmp;
+	unsigned long siz = dp->blobsiz;
+	char *cp;
+
+	if (need + 1 <= siz)
+	    return (0);
+	if (need > MAXBLOBMSG) {
+	    fprintf (stderr, "%s: Driver %s: BLOB over %lu bytes\n",
+			    indi_tstamp(NULL), dp->name, (unsigned long)MAXBLOBMSG);
+	    return (-1);
+	}
+
+	siz *= 2;
+	if (siz < need + 1)
+	    siz = need + 1;
+	cp = realloc (mp->cp, siz);
+	if (!cp) {
+	    fprintf (stderr, "%s: Driver %s: no memory for %lu byte BLOB\n",
+					    indi_tstamp(NULL), dp->name, need);
+	    return (-1);
+	}
+	mp->cp = cp;
+	dp->blobsiz = siz;
+	return (0);
+}
+
+/* return offset just past the closing tag of the BLOB passing through dp,
+ * else 0 if it has not arrived yet.
+ */
+static unsigned long
+findBLOBEnd (DvrInfo *dp)
+{
+	static const char endtag[] = "</setBLOBVector";
+	const int ln = sizeof(endtag) - 1;
+	Msg *mp = dp->blobmp;
+	char *p = mp->cp + dp->blobscan;
+	char *end = mp->cp + mp->cl;
+
+	/* base64 has no '<' so this skips quickly to each child closure */
+	while ((p = memchr (p, '<', end - p)) != NULL) {
+	    char *q = p + ln;
+	    if (q > end)
+		break;				/* need more to tell */
+	    if (!memcmp (p, endtag, ln)) {
+		while (q < end && isspace(*q))
+		    q++;
+		if (q == end)
+		    break;			/* need more to tell */
+		if (*q == '>')
+		    return (q + 1 - mp->cp);
+	    }
+	    p++;
+	}
+
+	/* resume from first spot that might still be it */
+	dp->blobscan = (p ? p : end) - mp->cp;
+	return (0);
+}
+
+/* discard any partial BLOB passing through dp, and fds not used yet */
+static void
+freeBLOB (DvrInfo *dp)
+{
+	if (dp->blobmp)
+	    freeMsg (dp->blobmp);
+	delXMLEle (dp->blobroot);
+	dp->blobmp = NULL;
+	dp->blobroot = NULL;
+	dp->blobneed = 0;
+	while (dp->nfds > 0)
+	    close (dp->fds[--dp->nfds]);
+	free (dp->fds);
+	dp->fds = NULL;
+}
+
+/* the setBLOBVector complete in mp came from dp with attached='true'. parse
+ * it and give it the next fd received from dp for each of its oneBLOBs.
+ * return 0 if ok, else -1 and mp must not be sent.
+ */
+static int
+attachBLOBs (DvrInfo *dp, Msg *mp)
+{
+	SharedBLOBs *sb;
+	int bad = 0;
+	int n;
+
+	/* the fds are not in step with the vectors any more if it is no good */
+	sb = newSharedBLOBs (mp->cp, mp->cl, &bad);
+	if (!sb) {
+	    while (dp->nfds > 0)
+		close (dp->fds[--dp->nfds]);
+	    return (-1);
+	}
+	mp->sb = sb;
+
+	/* claim the fds, freeMsg() closes them */
+	n = sb->n;
+	if (n > dp->nfds) {
+	    n = dp->nfds;
+	    bad = 1;
+	}
+	memcpy (sb->fds, dp->fds, n*sizeof(int));
+	sb->nfds = n;
+	dp->nfds -= n;
+	memmove (dp->fds, dp->fds + n, dp->nfds*sizeof(int));
+
+	/* each must hold the len it claims, and keep holding it */
+	for (n = 0; n < sb->nfds; n++) {
+	    struct stat st;
+
+	    if (fstat (sb->fds[n], &st) < 0
+				    || (unsigned long)st.st_size < sb->len[n])
+		bad = 1;
+#ifdef F_GET_SEALS
+	    else if ((fcntl (sb->fds[n], F_GET_SEALS) & (F_SEAL_SHRINK|F_SEAL_WRITE))
+					    != (F_SEAL_SHRINK|F_SEAL_WRITE))
+		bad = 1;
+#endif
+	}
+	if (bad)
+	    return (-1);
+
+	doneSharedBLOBs (sb);
+	return (0);
+}
+
+/* the setBLOBVector in mp from dp has attached='binary' and its XML ends at
+ * end. parse it and note in dp how long it will be with the raw bytes that
+ * follow.
+ * return 0 if ok, else -1 and the rest from dp can not be made sense of or
+ * there is no room for it.
+ */
+static int
+binaryBLOBs (DvrInfo *dp, Msg *mp, unsigned long end)
+{
+	SharedBLOBs *sb;
+	int bad = 0;
+
+	sb = newSharedBLOBs (mp->cp, end, &bad);
+	if (!sb)
+	    return (-1);
+	mp->sb = sb;
+	if (bad)
+	    return (-1);
+
+	/* make room for all of it now rather than doubling up to it.
+	 * newSharedBLOBs() bounded the sum, so it can not wrap.
+	 */
+	if (growBLOB (dp, end + rawBytes (sb)) < 0)
+	    return (-1);
+	dp->blobneed = end + rawBytes (sb);
+
+	doneSharedBLOBs (sb);
+	sb->binl = dp->blobneed;
+	return (0);
+}
+
+/* parse the setBLOBVector in cp[0..cl-1] whose BLOBs do not come in it, and
+ * start a SharedBLOBs for it with the len of each of its oneBLOBs. set *badp
+ * if any are not as they should be, including if they add up to more than
+ * MAXBLOBSIZ.
+ * return it, else NULL if cp is not XML at all.
+ */
+static SharedBLOBs *
+newSharedBLOBs (const char *cp, unsigned long cl, int *badp)
+{
+	LilXML *lp = newLilXML();
+	SharedBLOBs *sb;
+	XMLEle *root, *ep;
+	unsigned long tot = 0;
+	char err[1024];
+	size_t used;
+	int n;
+
+	root = readXMLEleBuf (lp, cp, cl, &used, err);
+	delLilXML (lp);
+	if (!root)
+	    return (NULL);
+
+	sb = (SharedBLOBs *) calloc (1, sizeof(SharedBLOBs));
+	sb->root = root;
+
+	n = nXMLEle (root);
+	if (n == 0 || n > MAXSHAREDFD)
+	    *badp = 1;
+	for (n = 0, ep = nextXMLEle (root, 1); ep && n < MAXSHAREDFD;
+					    n++, ep = nextXMLEle (root, 0)) {
+	    const char *len = findXMLAttValu (ep, "len");
+	    char *lenend;
+
+	    /* the peer says how much to read, believe only what fits */
+	    errno = 0;
+	    sb->len[n] = strtoul (len, &lenend, 10);
+	    if (strcmp (tagXMLEle (ep), "oneBLOB") || !isdigit (len[0])
+			    || *lenend || errno || sb->len[n] > MAXBLOBSIZ - tot) {
+		*badp = 1;
+		sb->len[n] = 0;
+	    }
+	    tot += sb->len[n];
+	}
+	sb->n = n;
+
+	return (sb);
+}
+
+/* close and free everything in sb */
+static void
+freeSharedBLOBs (SharedBLOBs *sb)
+{
+	while (sb->nfds > 0)
+	    close (sb->fds[--sb->nfds]);
+	delXMLEle (sb->root);
+	free (sb->b64);
+	free (sb->bin);
+	free (sb);
+}
+
+/* the BLOBs of sb are all there. strip sb->root down to how they go in
+ * base64 and note how long the renderings made from it will be.
+ */
+static void
+doneSharedBLOBs (SharedBLOBs *sb)
+{
+	const int in = B64LINE/4*3;
+	char *tag;
+	unsigned long l;
+	XMLEle *ep;
+	int i;
+
+	rmXMLAtt (sb->root, "attached");
+	for (ep = nextXMLEle (sb->root, 1); ep; ep = nextXMLEle (sb->root, 0))
+	    rmXMLAtt (ep, "len");
+
+	tag = malloc (sprlXMLEle (sb->root, 0) + sb->n*32 + 64);
+	sb->binl = sprBinary (tag, sb) + rawBytes (sb);
+
+	l = sprTag (tag, sb->root, 0, ">\n") + strlen ("</setBLOBVector>\n");
+	for (i = 0, ep = nextXMLEle (sb->root, 1); ep && i < sb->n;
+					    i++, ep = nextXMLEle (sb->root, 0)) {
+	    l += sprTag (tag, ep, 1, ">\n") + strlen ("  </oneBLOB>\n");
+	    l += sb->len[i]/in*(B64LINE+1);
+	    if (sb->len[i]%in)
+		l += (sb->len[i]%in + 2)/3*4 + 1;
+	}
+	sb->b64l = l;
+
+	free (tag);
+}
+
+/* return the bytes of all the BLOBs of sb together */
+static unsigned long
+rawBytes (SharedBLOBs *sb)
+{
+	unsigned long n = 0;
+	int i;
+
+	for (i = 0; i < sb->n; i++)
+	    n += sb->len[i];
+	return (n);
+}
+
+/* return n bytes of BLOB i of sb starting at j. they are read to buf if they
+ * are in a fd, or NULL if they can not be.
+ */
+static const unsigned char *
+blobBytes (SharedBLOBs *sb, int i, unsigned long j, unsigned long n,
+unsigned char *buf)
+{
+	unsigned long k;
+	ssize_t nr = 0;
+	int b;
+
+	if (!sb->nfds) {
+	    for (b = 0; b < i; b++)
+		j += sb->len[b];
+	    return ((const unsigned char *) sb->raw + j);
+	}
+
+	for (k = 0; k < n; k += nr)
+	    if ((nr = pread (sb->fds[i], buf + k, n - k, j + k)) <= 0) {
+		fprintf (stderr, "%s: shared BLOB read: %s\n",
+			indi_tstamp(NULL), nr < 0 ? strerror(errno) : "EOF");
+		return (NULL);
+	    }
+	return (buf);
+}
+
+/* make the base64 rendering of the BLOBs in sb, for everyone who can not
+ * take them unencoded. it is laid out as IDSetBLOB() would have.
+ */
+static void
+renderBLOBs (SharedBLOBs *sb)
+{
+	const int chunk = 1024*(B64LINE/4*3);
+	unsigned char *in;
+	unsigned long l;
+	XMLEle *ep;
+	int i;
+
+	sb->b64 = malloc (sb->b64l + 1);
+	in = malloc (chunk);
+	if (!sb->b64 || !in) {
+	    fprintf (stderr, "%s: no memory for %lu byte BLOB\n",
+						    indi_tstamp(NULL), sb->b64l);
+	    Bye();
+	}
+
+	l = sprTag (sb->b64, sb->root, 0, ">\n");
+	for (i = 0, ep = nextXMLEle (sb->root, 1); ep && i < sb->n;
+					    i++, ep = nextXMLEle (sb->root, 0)) {
+	    unsigned long j, k, n;
+
+	    l += sprTag (sb->b64 + l, ep, 1, ">\n");
+	    for (j = 0; j < sb->len[i]; j += n) {
+		const unsigned char *p;
+
+		/* whole chunks keep the lines where doneSharedBLOBs() counts
+		 * them, so what can not be read goes as zeros
+		 */
+		n = sb->len[i] - j < chunk ? sb->len[i] - j : chunk;
+		if (!(p = blobBytes (sb, i, j, n, in))) {
+		    memset (in, 0, n);
+		    p = in;
+		}
+
+		for (k = 0; k < n; k += B64LINE/4*3) {
+		    l += to64frombits ((unsigned char *)sb->b64 + l, p + k,
+			    n - k < B64LINE/4*3 ? n - k : B64LINE/4*3);
+		    sb->b64[l++] = '\n';
+		}
+	    }
+	    l += sprintf (sb->b64 + l, "  </oneBLOB>\n");
+	}
+	l += sprintf (sb->b64 + l, "</setBLOBVector>\n");
+
+	free (in);
+}
+
+/* make the binary rendering of the BLOBs passed as fds in sb, for everyone
+ * who can take raw bytes but not the fds.
+ */
+static void
+renderBinary (SharedBLOBs *sb)
+{
+	unsigned long l;
+	int i;
+
+	sb->bin = malloc (sb->binl + 1);
+	if (!sb->bin) {
+	    fprintf (stderr, "%s: no memory for %lu byte BLOB\n",
+						    indi_tstamp(NULL), sb->binl);
+	    Bye();
+	}
+
+	/* read straight into place */
+	l = sprBinary (sb->bin, sb);
+	for (i = 0; i < sb->n; i++) {
+	    if (!blobBytes (sb, i, 0, sb->len[i], (unsigned char *)sb->bin + l))
+		memset (sb->bin + l, 0, sb->len[i]);
+	    l += sb->len[i];
+	}
+}
+
+/* print the XML of the binary rendering of sb to s, from sb->root as left by
+ * doneSharedBLOBs(). the raw bytes are to follow.
+ * return length printed.
+ */
+static int
+sprBinary (char *s, SharedBLOBs *sb)
+{
+	XMLEle *ep;
+	int i, l;
+
+	l = sprTag (s, sb->root, 0, " attached=\"binary\">\n");
+	for (i = 0, ep = nextXMLEle (sb->root, 1); ep && i < sb->n;
+					    i++, ep = nextXMLEle (sb->root, 0)) {
+	    l += sprTag (s+l, ep, 1, "");
+	    l += sprintf (s+l, " len=\"%lu\"/>\n", sb->len[i]);
+	}
+	l += sprintf (s+l, "</setBLOBVector>");
+	return (l);
+}
+
+/* print the opening tag of ep with its attributes to s at the given level,
+ * followed by close.
+ * return length printed.
+ */
+static int
+sprTag (char *s, XMLEle *ep, int level, const char *close)
+{
+	XMLAtt *ap;
+	int sl;
+
+	sl = sprintf (s, "%*s<%s", level*2, "", tagXMLEle (ep));
+	for (ap = nextXMLAtt (ep, 1); ap; ap = nextXMLAtt (ep, 0))
+	    sl += sprintf (s+sl, " %s=\"%s\"", nameXMLAtt (ap),
+						entityXML (valuXMLAtt (ap)));
+	sl += sprintf (s+sl, "%s", close);
+	return (sl);
+}
+
+/* read up to n bytes from dp to buf. a local driver may pass fds along, they
+ * wait on dp->fds in the order received until attachBLOBs() claims them.
+ * return as read(2).
+ */
+static ssize_t
+recvFds (DvrInfo *dp, void *buf, size_t n)
+{
+	char cbuf[CMSG_SPACE(MAXSHAREDFD*sizeof(int))];
+	struct cmsghdr *cmp;
+	struct msghdr msg;
+	struct iovec iov;
+	ssize_t nr;
+
+	if (dp->pid == REMOTEDVR)
+	    return (read (dp->rfd, buf, n));
+
+	memset (&msg, 0, sizeof(msg));
+	iov.iov_base = buf;
+	iov.iov_len = n;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+	nr = recvmsg (dp->rfd, &msg, 0);
+	if (nr <= 0)
+	    return (nr);
+
+	for (cmp = CMSG_FIRSTHDR(&msg); cmp; cmp = CMSG_NXTHDR(&msg, cmp)) {
+	    int i, nfd;
+
+	    if (cmp->cmsg_level != SOL_SOCKET || cmp->cmsg_type != SCM_RIGHTS)
+		continue;
+	    nfd = (cmp->cmsg_len - CMSG_LEN(0))/sizeof(int);
+	    dp->fds = (int *) realloc (dp->fds, (dp->nfds + nfd)*sizeof(int));
+	    memcpy (dp->fds + dp->nfds, CMSG_DATA(cmp), nfd*sizeof(int));
+	    for (i = 0; i < nfd; i++)	/* not for drivers we fork */
+		fcntl (dp->fds[dp->nfds+i], F_SETFD, FD_CLOEXEC);
+	    dp->nfds += nfd;
+	}
+	if (msg.msg_flags & MSG_CTRUNC)
+	    fprintf (stderr, "%s: Driver %s: more than %d fds at once\n",
+				    indi_tstamp(NULL), dp->name, MAXSHAREDFD);
+
+	return (nr);
+}
+
+/* read more from the given driver stderr, add prefix and send to our stderr.
+ * return 0 if ok, 1 if nothing was ready, else -1 if had to restart.
+ */
+static int
+stderrFromDriver (DvrInfo *dp)
+{
+	static char exbuf[MAXRBUF];
+	static int nexbuf;
+	ssize_t i, nr;
+
+	/* read more */
+	nr = read (dp->efd, exbuf+nexbuf, sizeof(exbuf)-nexbuf);
+	if (nr < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+	    return (1);
+	if (nr <= 0) {
+	    if (nr < 0)
+		fprintf (stderr, "%s: Driver %s: stderr %s\n", indi_tstamp(NULL),
+						    dp->name, strerror(errno));
+	    else
+		fprintf (stderr, "%s: Driver %s: stderr EOF\n",
+							indi_tstamp(NULL), dp->name);
+            shutdownDvr (dp, 1);
+	    return (-1);
+	}
+	nexbuf += nr;
+
+	/* prefix each whole line to our stderr, save extra for next time */
+	for (i = 0; i < nexbuf; i++) {
+	    if (exbuf[i] == '\n') {
+		fprintf (stderr, "%s: Driver %s: %.*s\n", indi_tstamp(NULL),
+							    dp->name, (int)i, exbuf);
+		i++;				  /* count including nl */
+		nexbuf -= i;			  /* remove from nexbuf */
+		memmove (exbuf, exbuf+i, nexbuf); /* slide remaining to front */
+		i = -1;				  /* restart for loop scan */
+	    }
+	}
+
+	return (0);
+}
 
-	return (0);
-}
-
 /* close down the given client */
 static void
 shutdownClient (ClInfo *cp)
 {
-	Msg *mp;
+	unsigned long nctl, nbulk;
+	int i;
 
-	/* close connection */
+	/* close connection, delClQueue() closes s when no one writes to it */
+	ioDelFd (cp->s);
 	shutdown (cp->s, SHUT_RDWR);
-	close (cp->s);
+	cp->wpoll = 0;
+
+	/* remove from routing */
+	for (i = 0; i < cp->nprops; i++) {
+	    Route *rp = findRoute (cp->props[i].dev, cp->props[i].name, 0);
+	    rmRouteSub (rp->cls, &rp->ncls, cp - clinfo);
+	}
+	if (cp->allprops)
+	    rmRouteInt (allcls, &nallcls, cp - clinfo);
 
 	/* free memory */
 	delLilXML (cp->lp);
 	free (cp->props);
 
-	/* decrement and possibly free any unsent messages for this client */
-	while ((mp = (Msg*) popFQ(cp->msgq)) != NULL)
-	    if (--mp->count == 0)
-		freeMsg (mp);
-	delFQ (cp->msgq);
+	/* let go of any unsent messages for this client */
+	lockQ();
+	nctl = cp->q->nsuperseded[0];
+	nbulk = cp->q->nsuperseded[1];
+	unlockQ();
+	delClQueue (cp->q);
+	cp->q = NULL;
 
 	/* ok now to recycle */
 	cp->active = 0;
 
-	if (verbose > 0)
+	if (verbose > 0) {
+	    fprintf (stderr, "%s: Client %d: %lu values and %lu BLOBs superseded while queued\n",
+					    indi_tstamp(NULL), cp->s, nctl, nbulk);
 	    fprintf (stderr, "%s: Client %d: shut down complete - bye!\n",
 							indi_tstamp(NULL), cp->s);
+	}
 #ifdef OSX_HELPER_MODE
   int active = 0;
   for (int i = 0; i < nclinfo; i++)
@@ -1298,28 +2541,46 @@ static void
 shutdownDvr (DvrInfo *dp, int restart)
 {
 	Msg *mp;
+	int i;
 
 	/* make sure it's dead, reclaim resources */
 	if (dp->pid == REMOTEDVR) {
 	    /* socket connection */
+	    ioDelFd (dp->wfd);
 	    shutdown (dp->wfd, SHUT_RDWR);
 	    close (dp->wfd);	/* same as rfd */
 	} else {
 	    /* local pipe connection */
             kill (dp->pid, SIGKILL);	/* we've insured there are no zombies */
+	    ioDelFd (dp->wfd);
+	    ioDelFd (dp->rfd);
+	    ioDelFd (dp->efd);
 	    close (dp->wfd);
 	    close (dp->rfd);
 	    close (dp->efd);
 	}
+	dp->wpoll = 0;
 
 #ifdef OSX_HELPER_MODE
   fprintf(stderr, "STOPPED \"%s\"\n", dp->name); fflush(stderr);
 #endif
 
+	/* remove from routing */
+	for (i = 0; i < dp->nsprops; i++) {
+	    Route *rp = findRoute (dp->sprops[i].dev, dp->sprops[i].name, 0);
+	    rmRouteSub (rp->sdrs, &rp->nsdrs, dp - dvrinfo);
+	}
+	for (i = 0; i < dp->ndev; i++) {
+	    Route *rp = findRoute (dp->dev[i], "", 0);
+	    rmRouteInt (rp->rdrs, &rp->nrdrs, dp - dvrinfo);
+	    free (dp->dev[i]);
+	}
+
 	/* free memory */
 	free (dp->sprops);
     free(dp->dev);
 	delLilXML (dp->lp);
+	freeBLOB (dp);
 
    /* ok now to recycle */
    dp->active = 0;
@@ -1327,9 +2588,9 @@ shutdownDvr (DvrInfo *dp, int restart)
 
 	/* decrement and possibly free any unsent messages for this client */
 	while ((mp = (Msg*) popFQ(dp->msgq)) != NULL)
-	    if (--mp->count == 0)
-		freeMsg (mp);
+	    msgRelease (mp);
 	delFQ (dp->msgq);
+	dp->nqbytes = 0;
 
         if (restart)
         {
@@ -1347,27 +2608,35 @@ static void
 q2RDrivers (const char *dev, Msg *mp, XMLEle *root)
 {
 	int sawremote = 0;
+	Route *rp = NULL;
 	DvrInfo *dp;
+	int i;
+
+	/* just drivers known to support dev, else all */
+	if (dev[0]) {
+	    rp = findRoute (dev, "", 0);
+	    if (!rp)
+		return;
+	}
 
 	/* queue message to each interested driver.
 	 * N.B. don't send generic getProps to more than one remote driver,
 	 *   otherwise they all fan out and we get multiple responses back.
 	 */
-	for (dp = dvrinfo; dp < &dvrinfo[ndvrinfo]; dp++) {
-	    int isremote = (dp->pid == REMOTEDVR);
+	for (i = 0; i < (rp ? rp->nrdrs : ndvrinfo); i++) {
+	    int isremote;
+
+	    dp = &dvrinfo[rp ? rp->rdrs[i] : i];
+	    isremote = (dp->pid == REMOTEDVR);
             if (dp->active == 0)
                 continue;
-        //if (dev[0] && dp->dev[0] && strcmp (dev, dp->dev))
-            if (dev[0] && isDeviceInDriver(dev, dp) == 0)
-                continue;	/* driver known to not support this dev */
 	    if (!dev[0] && isremote && sawremote)
 		continue;	/* already sent generic to another remote */
 	    if (isremote)
 		sawremote = 1;
 
 	    /* ok: queue message to this driver */
-	    mp->count++;
-	    pushFQ (dp->msgq, mp);
+	    pushDriverMsg (dp, mp, root);
 	    if (verbose > 1)
 		fprintf (stderr, "%s: Driver %s: queuing responsible for <%s device='%s' name='%s'>\n",
 				    indi_tstamp(NULL), dp->name, tagXMLEle(root),
@@ -1382,26 +2651,38 @@ q2RDrivers (const char *dev, Msg *mp, XMLEle *root)
 static void
 q2SDrivers (int isblob, const char *dev, const char *name, Msg *mp, XMLEle *root)
 {
-	DvrInfo *dp;
+	Route *rps[2];
+	int r, i;
 
-	for (dp = dvrinfo; dp < &dvrinfo[ndvrinfo]; dp++) {
-            Property *sp = findSDevice (dp, dev, name);
+	/* drivers snooping dev/name then all of dev. a driver snooping both
+	 * found dev/name first, as findSDevice() would, because addSDevice()
+	 * never adds dev/name after dev.
+	 */
+	rps[0] = findRoute (dev, name, 0);
+	rps[1] = name[0] ? findRoute (dev, "", 0) : NULL;
+	routeserial++;
 
-	    /* nothing for dp if not snooping for dev/name or wrong BLOB mode */
-	    if (!sp)
+	for (r = 0; r < 2; r++) {
+	  for (i = 0; rps[r] && i < rps[r]->nsdrs; i++) {
+	    DvrInfo *dp = &dvrinfo[rps[r]->sdrs[i].idx];
+	    Property *sp = &dp->sprops[rps[r]->sdrs[i].pi];
+
+	    /* nothing for dp if already seen or wrong BLOB mode */
+	    if (dp->routed == routeserial)
 		continue;
+	    dp->routed = routeserial;
 	    if ((isblob && sp->blob==B_NEVER) || (!isblob && sp->blob==B_ONLY))
 		continue;
 
 	    /* ok: queue message to this device */
-	    mp->count++;
-	    pushFQ (dp->msgq, mp);
+	    pushDriverMsg (dp, mp, root);
 	    if (verbose > 1) {
 		fprintf (stderr, "%s: Driver %s: queuing snooped <%s device='%s' name='%s'>\n",
 				    indi_tstamp(NULL), dp->name, tagXMLEle(root),
 				    findXMLAttValu (root, "device"),
 				    findXMLAttValu (root, "name"));
 	    }
+	  }
 	}
 }
 
@@ -1412,6 +2693,7 @@ static void
 addSDevice (DvrInfo *dp, const char *dev, const char *name)
 {
         Property *sp;
+	Route *rp;
 	char *ip;
 
 	/* no dups */
@@ -1434,6 +2716,9 @@ addSDevice (DvrInfo *dp, const char *dev, const char *name)
 
 	sp->blob = B_NEVER;
 
+	rp = findRoute (sp->dev, sp->name, 1);
+	addRouteSub (&rp->sdrs, &rp->nsdrs, dp - dvrinfo, dp->nsprops-1);
+
 	if (verbose)
 	    fprintf (stderr, "%s: Driver %s: snooping on %s.%s\n", indi_tstamp(NULL),
 							dp->name, dev, name);
@@ -1458,6 +2743,7 @@ findSDevice (DvrInfo *dp, const char *dev, const char *name)
 
 
 /* put Msg mp on queue of each client interested in dev/name, except notme.
+ * an empty dev or name means all of them, never pass NULL.
  * if BLOB always honor current mode.
  * return -1 if had to shut down any clients, else 0.
  */
@@ -1465,204 +2751,826 @@ static int
 q2Clients (ClInfo *notme, int isblob, const char *dev, const char *name, Msg *mp, XMLEle *root)
 {
 	int shutany = 0;
-	ClInfo *cp;
-    int ql,i=0;
+	Route *rp;
+	int i;
 
-	/* queue message to each interested client */
-	for (cp = clinfo; cp < &clinfo[nclinfo]; cp++) {
-	    /* cp in use? notme? want this dev/name? blob? */
-	    if (!cp->active || cp == notme)
-		continue;
-            if (findClDevice (cp, dev, name) < 0)
-		continue;
+	/* the routes hash both, a NULL would crash us */
+	if (!dev)
+	    dev = "";
+	if (!name)
+	    name = "";
 
-            //if ((isblob && cp->blob==B_NEVER) || (!isblob && cp->blob==B_ONLY))
-            if (!isblob && cp->blob==B_ONLY)
-                continue;
+	routeserial++;
 
-            if (isblob)
-            {
-                if (cp->nprops > 0)
-                {
-                Property *pp = NULL;
-                int blob_found=0;
-                for (i = 0; i < cp->nprops; i++)
-                {
-                    pp = &cp->props[i];
-                    if (!strcmp (pp->dev, dev) && (!strcmp(pp->name, name)))
-                    {
-                        blob_found = 1;
-                        break;
-                    }
-                }
+	/* a driver's set*Vector may supersede one still queued */
+	if (!notme && !mp->key)
+	    setMsgKey (mp, dev, name, root);
 
-                if ( (blob_found && pp->blob == B_NEVER) || (blob_found==0 && cp->blob == B_NEVER) )
-                    continue;
-               }
-               else if (cp->blob == B_NEVER)
-                   continue;
-           }
-
-	    /* shut down this client if its q is already too large */
-	    ql = msgQSize(cp->msgq);
-	    if (ql > maxqsiz) {
-		if (verbose)
-		    fprintf (stderr, "%s: Client %d: %d bytes behind, shutting down\n",
-						    indi_tstamp(NULL), cp->s, ql);
-		shutdownClient (cp);
+	/* clients with a Property for exactly dev/name go first, so its BLOB
+	 * mode applies. N.B. lists are walked backwards because shutting down
+	 * a client moves the last entry into its place.
+	 */
+	if ((rp = findRoute (dev, name, 0)) != NULL)
+	    for (i = rp->ncls-1; i >= 0; i--) {
+		ClInfo *cp = &clinfo[rp->cls[i].idx];
+		if (q2Client (notme, cp, &cp->props[rp->cls[i].pi], isblob, mp,
+								    root) < 0)
+		    shutany++;
+	    }
+
+	/* then clients wanting all of dev */
+	if (name[0] && (rp = findRoute (dev, "", 0)) != NULL)
+	    for (i = rp->ncls-1; i >= 0; i--)
+		if (q2Client (notme, &clinfo[rp->cls[i].idx], NULL, isblob, mp,
+								    root) < 0)
+		    shutany++;
+
+	/* then clients wanting everything */
+	for (i = nallcls-1; i >= 0; i--)
+	    if (q2Client (notme, &clinfo[allcls[i]], NULL, isblob, mp, root) < 0)
 		shutany++;
+
+	/* no dev is for everyone */
+	if (!dev[0])
+	    for (i = 0; i < nclinfo; i++)
+		if (q2Client (notme, &clinfo[i], NULL, isblob, mp, root) < 0)
+		    shutany++;
+
+	return (shutany ? -1 : 0);
+}
+
+/* put Msg mp on queue of client cp, unless it is notme, not in use, already
+ * has it or does not want it in its BLOB mode. pp is cp's Property for exactly
+ * the dev/name of mp, if any.
+ * return -1 if had to shut down cp, else 0.
+ */
+static int
+q2Client (ClInfo *notme, ClInfo *cp, Property *pp, int isblob, Msg *mp,
+XMLEle *root)
+{
+	unsigned long nctl, nbulk;
+
+	/* cp in use? notme? seen already? */
+	if (!cp->active || cp == notme || cp->routed == routeserial)
+	    return (0);
+	cp->routed = routeserial;
+
+	/* BLOB mode for this property, else for cp */
+	if (!isblob && cp->blob==B_ONLY)
+	    return (0);
+	if (isblob && (pp ? pp->blob : cp->blob) == B_NEVER)
+	    return (0);
+
+	/* shut down this client if either of its queues is already too large */
+	lockQ();
+	nctl = cp->q->nqbytes[0];
+	nbulk = cp->q->nqbytes[1];
+	unlockQ();
+	if (nctl > maxqsiz || nbulk > maxbulksiz) {
+	    if (verbose)
+		fprintf (stderr, "%s: Client %d: %lu + %lu BLOB bytes behind, shutting down\n",
+				    indi_tstamp(NULL), cp->s, nctl, nbulk);
+	    shutdownClient (cp);
+	    return (-1);
+	}
+
+	/* ok: queue message to this client */
+	if (pushClientMsg (cp, mp, root) && verbose > 1)
+	    fprintf (stderr, "%s: Client %d: superseding <%s device='%s' name='%s'>\n",
+				indi_tstamp(NULL), cp->s, tagXMLEle(root),
+				findXMLAttValu (root, "device"),
+				findXMLAttValu (root, "name"));
+	else if (verbose > 1)
+	    fprintf (stderr, "%s: Client %d: queuing <%s device='%s' name='%s'>\n",
+				indi_tstamp(NULL), cp->s, tagXMLEle(root),
+				findXMLAttValu (root, "device"),
+				findXMLAttValu (root, "name"));
+
+	return (0);
+}
+
+/* add Msg mp to the queue of client cp for its kind, start polling for write
+ * if first or wake its writer thread. a set*Vector may take the place of one
+ * for the same Property not yet begun, see clSuperseded(), which is dropped.
+ * if mp has no content yet it is set from root, so it is only built if
+ * someone wants it.
+ * return 1 if mp superseded a Msg, else 0.
+ */
+static int
+pushClientMsg (ClInfo *cp, Msg *mp, XMLEle *root)
+{
+	const char *tag = tagXMLEle (root);
+	ClQueue *q = cp->q;
+	int bulk, i;
+	Msg *old;
+	FQ *fq;
+
+	if (!mp->cp)
+	    setMsgXMLEle (mp, root);
+	msgHold (mp);
+
+	lockQ();
+	bulk = !strcmp (tag, "setBLOBVector") || !strcmp (tag, "newBLOBVector");
+	fq = bulk ? q->bulkq : q->ctlq;
+	i = mp->key ? clSuperseded (q, bulk, mp) : -1;
+	if (i >= 0) {
+	    old = (Msg *) peekiFQ (fq, i);
+	    q->nqbytes[bulk] -= msgQBytes (old, clBLOBForm (q, old));
+	    q->nsuperseded[bulk]++;
+	    setiFQ (fq, i, mp);
+	    msgRelease (old);
+	} else
+	    pushFQ (fq, mp);
+	q->nqbytes[bulk] += msgQBytes (mp, clBLOBForm (q, mp));
+	if (threaded)
+	    pthread_cond_signal (&q->wake);
+	unlockQ();
+
+	if (!threaded)
+	    ioClientWrite (cp, 1);
+
+	return (i >= 0);
+}
+
+/* add Msg mp to the queue of driver dp, start polling for write if first.
+ * if mp has no content yet it is set from root, as for pushClientMsg().
+ */
+static void
+pushDriverMsg (DvrInfo *dp, Msg *mp, XMLEle *root)
+{
+	if (!mp->cp)
+	    setMsgXMLEle (mp, root);
+	msgHold (mp);
+	pushFQ (dp->msgq, mp);
+	dp->nqbytes += msgQBytes (mp, BF_BASE64);
+	ioDriverWrite (dp, 1);
+}
+
+/* if root is a set*Vector note what a newer one for the same dev/name needs
+ * to know to take the place of Msg mp while it is queued.
+ */
+static void
+setMsgKey (Msg *mp, const char *dev, const char *name, XMLEle *root)
+{
+	const char *tag = tagXMLEle (root);
+	size_t i;
+
+	for (i = 0; i < sizeof(settags)/sizeof(settags[0]); i++)
+	    if (!strcmp (tag, settags[i]))
+		break;
+	if (i == sizeof(settags)/sizeof(settags[0]))
+	    return;
+
+	mp->key = findRoute (dev, name, 1);
+	mp->keytag = settags[i];
+	strncpy (mp->keystate, findXMLAttValu (root, "state"),
+						    sizeof(mp->keystate)-1);
+	mp->keystate[sizeof(mp->keystate)-1] = '\0';
+	mp->keymsg = findXMLAtt (root, "message") != NULL;
+
+	/* a vector may carry only some of the elements of its Property. the
+	 * elements of a BLOB passed through are not parsed, find them in cp.
+	 */
+	mp->nkeyelem = 0;
+	if (mp->sb && mp->sb->root)
+	    root = mp->sb->root;
+	if (nXMLEle (root) > 0) {
+	    XMLEle *ep;
+	    for (ep = nextXMLEle (root, 1); ep; ep = nextXMLEle (root, 0)) {
+		const char *en = findXMLAttValu (ep, "name");
+		addKeyElem (mp, en, strlen (en));
+	    }
+	} else if (mp->cp) {
+	    const char *p = mp->cp, *end = mp->cp + mp->cl;
+	    while ((p = memmem (p, end - p, "<oneBLOB", 8)) != NULL) {
+		const char *gt = memchr (p, '>', end - p);
+		const char *np, *q;
+		if (!gt)
+		    break;
+		np = memmem (p, gt - p, " name=", 6);
+		if (np && np + 7 < gt && (q = memchr (np + 7, np[6], gt - np - 7)))
+		    addKeyElem (mp, np + 7, q - np - 7);
+		else
+		    mp->nkeyelem = -1;		/* can not tell, never coalesce */
+		p = gt;
+	    }
+	}
+}
+
+/* add the hash of element name s, l chars long, to the sorted keyelem of mp.
+ */
+static void
+addKeyElem (Msg *mp, const char *s, int l)
+{
+	unsigned int h = 2166136261u;		/* FNV-1a */
+	int i, j;
+
+	if (mp->nkeyelem < 0)
+	    return;
+	while (l-- > 0)
+	    h = (h ^ (unsigned char)*s++) * 16777619u;
+	for (i = 0; i < mp->nkeyelem && mp->keyelem[i] < h; i++)
+	    continue;
+	if (i < mp->nkeyelem && mp->keyelem[i] == h)
+	    return;
+	if (mp->nkeyelem == MAXKEYELEM) {
+	    mp->nkeyelem = -1;
+	    return;
+	}
+	for (j = mp->nkeyelem++; j > i; j--)
+	    mp->keyelem[j] = mp->keyelem[j-1];
+	mp->keyelem[i] = h;
+}
+
+/* return 1 if Msg mp carries every element Msg old does, else 0.
+ */
+static int
+keyElemsCover (Msg *mp, Msg *old)
+{
+	int i, j;
+
+	if (mp->nkeyelem < 0 || old->nkeyelem < 0)
+	    return (0);
+	for (i = j = 0; i < old->nkeyelem; i++, j++) {
+	    while (j < mp->nkeyelem && mp->keyelem[j] < old->keyelem[i])
+		j++;
+	    if (j == mp->nkeyelem || mp->keyelem[j] != old->keyelem[i])
+		return (0);
+	}
+	return (1);
+}
+
+/* print root as content in Msg mp.
+ */
+static void
+setMsgXMLEle (Msg *mp, XMLEle *root)
+{
+	/* want cl to only count content, but need room for final \0 */
+	mp->cl = sprlXMLEle (root, 0);
+	if (mp->cl < sizeof(mp->buf))
+	    mp->cp = mp->buf;
+	else
+	    mp->cp = malloc (mp->cl+1);
+	sprXMLEle (mp->cp, root, 0);
+}
+
+/* save str as content in Msg mp.
+ */
+static void
+setMsgStr (Msg *mp, char *str)
+{
+	/* want cl to only count content, but need room for final \0 */
+	mp->cl = strlen (str);
+	if (mp->cl < sizeof(mp->buf))
+	    mp->cp = mp->buf;
+	else
+	    mp->cp = malloc (mp->cl+1);
+	strcpy (mp->cp, str);
+}
+
+/* return pointer to one new Msg with no content and no consumers.
+ * reuse one from freemsgs if possible, only its header is cleared.
+ */
+static Msg *
+newMsg (void)
+{
+	Msg *mp;
+
+	if (threaded)
+	    pthread_mutex_lock (&msglock);
+	mp = freemsgs;
+	if (mp) {
+	    freemsgs = mp->next;
+	    nfreemsgs--;
+	}
+	if (threaded)
+	    pthread_mutex_unlock (&msglock);
+
+	if (!mp)
+	    return ((Msg *) calloc (1, sizeof(Msg)));
+
+	mp->count = 0;
+	mp->cl = 0;
+	mp->cp = NULL;
+	mp->sb = NULL;
+	mp->key = NULL;
+	mp->next = NULL;
+	return (mp);
+}
+
+/* free Msg mp and everything it contains.
+ * keep up to MAXFREEMSG on freemsgs for newMsg() to reuse.
+ */
+static void
+freeMsg (Msg *mp)
+{
+	if (mp->cp && mp->cp != mp->buf)
+	    free (mp->cp);
+	if (mp->sb)
+	    freeSharedBLOBs (mp->sb);
+
+	if (threaded)
+	    pthread_mutex_lock (&msglock);
+	if (nfreemsgs < MAXFREEMSG) {
+	    mp->next = freemsgs;
+	    freemsgs = mp;
+	    nfreemsgs++;
+	    mp = NULL;
+	}
+	if (threaded)
+	    pthread_mutex_unlock (&msglock);
+	free (mp);
+}
+
+/* add a consumer of mp */
+static void
+msgHold (Msg *mp)
+{
+	__sync_fetch_and_add (&mp->count, 1);
+}
+
+/* one consumer of mp is done with it, free it if that was the last */
+static void
+msgRelease (Msg *mp)
+{
+	if (__sync_sub_and_fetch (&mp->count, 1) == 0)
+	    freeMsg (mp);
+}
+
+/* return how the client of q takes the BLOBs of mp, if it has any */
+static BLOBForm
+clBLOBForm (ClQueue *q, Msg *mp)
+{
+	if (mp->sb && mp->sb->nfds && q->sharedblobs)
+	    return (BF_FDS);
+	if (q->binaryblobs)
+	    return (BF_BINARY);
+	return (BF_BASE64);
+}
+
+/* note from root, the first message from client cp, whether it takes BLOBs
+ * as fds or raw bytes. later ones do not count: they may come from clients
+ * of a server that does not know about this and passes them on to us.
+ */
+static void
+crackBLOBForms (ClInfo *cp, XMLEle *root)
+{
+	if (strcmp (tagXMLEle (root), "getProperties") &&
+				    strcmp (tagXMLEle (root), "enableBLOB"))
+	    return;
+
+	lockQ();
+	if (cp->local && !strcmp (findXMLAttValu (root, "sharedblobs"), "On"))
+	    cp->q->sharedblobs = 1;
+	if (!strcmp (findXMLAttValu (root, "binaryblobs"), "On"))
+	    cp->q->binaryblobs = 1;
+	unlockQ();
+}
+
+/* return the content of mp as sent to a consumer who takes its BLOBs in the
+ * given form, and its length at *lp. the renderings of BLOBs that did not
+ * come that way are made the first time they are wanted, so call only when
+ * about to send.
+ */
+static const char *
+msgContent (Msg *mp, BLOBForm form, unsigned long *lp)
+{
+	SharedBLOBs *sb = mp->sb;
+
+	if (!sb || form == BF_FDS || (form == BF_BINARY && !sb->nfds)) {
+	    *lp = mp->cl;
+	    return (mp->cp);
+	}
+	/* writer threads may want the same rendering at once */
+	if (threaded)
+	    pthread_mutex_lock (&renderlock);
+	if (form == BF_BINARY) {
+	    if (!sb->bin)
+		renderBinary (sb);
+	    *lp = sb->binl;
+	} else {
+	    if (!sb->b64)
+		renderBLOBs (sb);
+	    *lp = sb->b64l;
+	}
+	if (threaded)
+	    pthread_mutex_unlock (&renderlock);
+	return (form == BF_BINARY ? sb->bin : sb->b64);
+}
+
+/* return how much a consumer who takes BLOBs in the given form is behind
+ * while mp is on its queue. fds count for the BLOBs they hold.
+ */
+static unsigned long
+msgQBytes (Msg *mp, BLOBForm form)
+{
+	if (!mp->sb)
+	    return (mp->cl);
+	switch (form) {
+	case BF_FDS:
+	    return (mp->cl + rawBytes (mp->sb));
+	case BF_BINARY:
+	    return (mp->sb->nfds ? mp->sb->binl : mp->cl);
+	default:
+	    return (mp->sb->b64l);
+	}
+}
+
+/* write as much as the given client can take of what is queued for it.
+ * pop messages from the queue when complete and free each if we are the last
+ * one to use it. shut down this client if trouble.
+ * N.B. we assume we will never be called with nothing queued.
+ * return 0 if ok, 1 if client can not take more now, else -1 if had to shut down.
+ */
+static int
+sendClientMsg (ClInfo *cp)
+{
+	QBatch b[MAXBATCH];
+	ClQueue *q = cp->q;
+	ssize_t nw;
+	int nb;
+
+	/* gather what goes next. never more than MAXWSIZ to reduce blocking.
+	 * with epoll the socket never blocks, so let it take all it can.
+	 */
+	nb = clBatch (q, b);
+#ifdef HAVE_SYS_EPOLL_H
+	nb = clContent (b, nb, 0);
+#else
+	nb = clContent (b, nb, MAXWSIZ);
+#endif
+	nw = clWrite (q, b, nb);
+	if (nw < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+	    clSent (q, b, nb, 0);
+	    return (1);
+	}
+
+	/* shut down if trouble */
+	if (nw <= 0) {
+	    if (nw == 0)
+		fprintf (stderr, "%s: Client %d: write returned 0\n",
+						    indi_tstamp(NULL), cp->s);
+	    else
+		fprintf (stderr, "%s: Client %d: write: %s\n", indi_tstamp(NULL),
+						    cp->s, strerror(errno));
+	    shutdownClient (cp);
+	    return (-1);
+	}
+
+	clSent (q, b, nb, nw);
+	if (clQueued (q) == 0)
+	    ioClientWrite (cp, 0);
+
+	return (0);
+}
+
+/* write to the client of q from a thread of its own until told to quit,
+ * then free q. a socket that fails is shut down for the main loop to notice.
+ */
+static void *
+clWriter (void *arg)
+{
+	ClQueue *q = (ClQueue *) arg;
+	QBatch b[MAXBATCH];
+	struct pollfd pfd;
+	int dead = 0;
+	ssize_t nw;
+	int nb, full;
+
+	pthread_mutex_lock (&qlock);
+	while (!q->quit) {
+	    if (dead || clQueued (q) == 0) {
+		pthread_cond_wait (&q->wake, &qlock);
 		continue;
 	    }
 
-	    /* ok: queue message to this client */
-	    mp->count++;
-	    pushFQ (cp->msgq, mp);
-	    if (verbose > 1)
-		fprintf (stderr, "%s: Client %d: queuing <%s device='%s' name='%s'>\n",
-				    indi_tstamp(NULL), cp->s, tagXMLEle(root),
-				    findXMLAttValu (root, "device"),
-				    findXMLAttValu (root, "name"));
+	    /* write without holding up the main loop */
+	    nb = clBatch (q, b);
+	    pthread_mutex_unlock (&qlock);
+	    nb = clContent (b, nb, 0);
+	    nw = clWrite (q, b, nb);
+	    full = nw < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+	    if (full) {
+		nw = 0;
+	    } else if (nw <= 0) {
+		if (nw == 0)
+		    fprintf (stderr, "%s: Client %d: write returned 0\n",
+						    indi_tstamp(NULL), q->s);
+		else
+		    fprintf (stderr, "%s: Client %d: write: %s\n",
+				    indi_tstamp(NULL), q->s, strerror(errno));
+		shutdown (q->s, SHUT_RDWR);
+		dead = 1;
+		nw = 0;
+	    }
+	    pthread_mutex_lock (&qlock);
+	    clSent (q, b, nb, nw);
+
+	    /* wait for room, meanwhile what is queued may be superseded */
+	    if (full) {
+		pthread_mutex_unlock (&qlock);
+		pfd.fd = q->s;
+		pfd.events = POLLOUT;
+		(void) poll (&pfd, 1, -1);
+		pthread_mutex_lock (&qlock);
+	    }
 	}
+	pthread_mutex_unlock (&qlock);
 
-	return (shutany ? -1 : 0);
+	freeClQueue (q);
+	return (NULL);
+}
+
+/* return a new, empty queue for the client on socket s */
+static ClQueue *
+newClQueue (int s)
+{
+	ClQueue *q = (ClQueue *) calloc (1, sizeof(ClQueue));
+
+	if (!q) {
+	    fprintf (stderr, "no memory for new client\n");
+	    Bye();
+	}
+	q->s = s;
+	q->ctlq = newFQ(1);
+	q->bulkq = newFQ(1);
+	pthread_cond_init (&q->wake, NULL);
+	return (q);
+}
+
+/* done with q once nothing more is being written from it */
+static void
+delClQueue (ClQueue *q)
+{
+	if (!threaded) {
+	    freeClQueue (q);
+	    return;
+	}
+
+	/* its writer finishes the write it is in, if any, and frees it */
+	lockQ();
+	q->quit = 1;
+	pthread_cond_signal (&q->wake);
+	unlockQ();
+}
+
+/* let go of all Msgs still on q, close its socket and free it */
+static void
+freeClQueue (ClQueue *q)
+{
+	Msg *mp;
+
+	while ((mp = (Msg *) popFQ (q->ctlq)) != NULL)
+	    msgRelease (mp);
+	while ((mp = (Msg *) popFQ (q->bulkq)) != NULL)
+	    msgRelease (mp);
+	delFQ (q->ctlq);
+	delFQ (q->bulkq);
+	close (q->s);
+	pthread_cond_destroy (&q->wake);
+	free (q);
+}
+
+/* return the index on ctlq or bulkq of q of the Msg mp is to take the place
+ * of, else -1. that is the last one queued for the same Property and tag if
+ * it is not yet begun and only set*Vectors follow it. mp must carry all the
+ * elements it does. a BLOB frame is then always superseded, anything else
+ * only if mp has the same state and the one it replaces has no message, so
+ * no change the client would have seen is lost.
+ * call with qlock held.
+ */
+static int
+clSuperseded (ClQueue *q, int bulk, Msg *mp)
+{
+	FQ *fq = bulk ? q->bulkq : q->ctlq;
+	int started = q->nbusy[bulk];
+	Msg *old;
+	int i;
+
+	if (!started && q->nsent && q->inbulk == bulk)
+	    started = 1;
+	for (i = nFQ(fq)-1; i >= started; i--) {
+	    old = (Msg *) peekiFQ (fq, i);
+	    if (!old->key)
+		return (-1);
+	    if (old->key != mp->key || old->keytag != mp->keytag)
+		continue;
+	    if (!keyElemsCover (mp, old))
+		return (-1);
+	    if (bulk || (!old->keymsg && !strcmp (old->keystate, mp->keystate)))
+		return (i);
+	    return (-1);
+	}
+	return (-1);
+}
+
+/* return how many Msgs are on q */
+static int
+clQueued (ClQueue *q)
+{
+	return (nFQ(q->ctlq) + nFQ(q->bulkq));
 }
 
-/* return size of all Msqs on the given q */
+/* fill b with the Msgs of q to write next, in order, and return how many.
+ * a message begun is finished first, then whatever is on ctlq, then a BLOB.
+ * a Msg whose fds go along starts a write of its own.
+ * call with qlock held, follow with clSent() once written.
+ */
 static int
-msgQSize (FQ *q)
+clBatch (ClQueue *q, QBatch *b)
 {
-	int i, l = 0;
+	int nctl = nFQ(q->ctlq), nbulk = nFQ(q->bulkq);
+	int nb = 0, bulk0 = 0;
+	int i, bulk;
+
+	if (q->nsent && q->inbulk) {
+	    b[nb].mp = (Msg *) peekFQ (q->bulkq);
+	    b[nb].bulk = 1;
+	    b[nb].off = q->nsent;
+	    b[nb].form = clBLOBForm (q, b[nb].mp);
+	    nb++;
+	    bulk0 = 1;
+	}
 
-	for (i = 0; i < nFQ(q); i++) {
-	    Msg *mp = (Msg *) peekiFQ(q,i);
-	    l += mp->cl;
+	/* BLOBs are too big to gain from sharing a write, and the ones not yet
+	 * taken may still be superseded, so take at most one
+	 */
+	for (bulk = 0; bulk < 2 && nb < MAXBATCH; bulk++) {
+	    FQ *fq = bulk ? q->bulkq : q->ctlq;
+	    int n = bulk ? (nbulk > 0) : nctl;
+
+	    for (i = bulk ? bulk0 : 0; i < n && nb < MAXBATCH; i++) {
+		Msg *mp = (Msg *) peekiFQ (fq, i);
+		BLOBForm form = clBLOBForm (q, mp);
+		unsigned long off = 0;
+
+		if (!bulk && i == 0 && q->nsent && !q->inbulk)
+		    off = q->nsent;
+		if (form == BF_FDS && off == 0 && nb > 0)
+		    goto out;
+		b[nb].mp = mp;
+		b[nb].bulk = bulk;
+		b[nb].off = off;
+		b[nb].form = form;
+		nb++;
+	    }
 	}
 
-	return (l);
+    out:
+	/* these may not be superseded until clSent() */
+	q->nbusy[0] = q->nbusy[1] = 0;
+	for (i = 0; i < nb; i++)
+	    q->nbusy[b[i].bulk]++;
+	return (nb);
 }
 
-/* print root as content in Msg mp.
+/* find the content of each of the nb entries of b, limiting the total to
+ * max bytes unless 0. return how many entries are to be written.
  */
-static void
-setMsgXMLEle (Msg *mp, XMLEle *root)
+static int
+clContent (QBatch *b, int nb, unsigned long max)
 {
-	/* want cl to only count content, but need room for final \0 */
-	mp->cl = sprlXMLEle (root, 0);
-	if (mp->cl < sizeof(mp->buf))
-	    mp->cp = mp->buf;
-	else
-	    mp->cp = malloc (mp->cl+1);
-	sprXMLEle (mp->cp, root, 0);
-}
+	unsigned long tot = 0;
+	const char *cont;
+	int i;
 
-/* save str as content in Msg mp.
- */
-static void
-setMsgStr (Msg *mp, char *str)
-{
-	/* want cl to only count content, but need room for final \0 */
-	mp->cl = strlen (str);
-	if (mp->cl < sizeof(mp->buf))
-	    mp->cp = mp->buf;
-	else
-	    mp->cp = malloc (mp->cl+1);
-	strcpy (mp->cp, str);
+	for (i = 0; i < nb; i++) {
+	    cont = msgContent (b[i].mp, b[i].form, &b[i].cl);
+	    b[i].cp = cont + b[i].off;
+	    b[i].n = b[i].cl - b[i].off;
+	    if (max && tot + b[i].n >= max) {
+		b[i].n = max - tot;
+		return (i+1);
+	    }
+	    tot += b[i].n;
+	}
+
+	return (nb);
 }
 
-/* return pointer to one new nulled Msg
+/* write the nb entries of b to the client of q in one go, with the fds of the
+ * first if it starts a Msg that passes them. return as write(2).
  */
-static Msg *
-newMsg (void)
+static ssize_t
+clWrite (ClQueue *q, QBatch *b, int nb)
 {
-	return ((Msg *) calloc (1, sizeof(Msg)));
-}
+	char cbuf[CMSG_SPACE(MAXSHAREDFD*sizeof(int))];
+	struct iovec iov[MAXBATCH];
+	struct msghdr msg;
+	int i;
 
-/* free Msg mp and everything it contains */
-static void
-freeMsg (Msg *mp)
-{
-	if (mp->cp && mp->cp != mp->buf)
-	    free (mp->cp);
-	free (mp);
+	memset (&msg, 0, sizeof(msg));
+	for (i = 0; i < nb; i++) {
+	    iov[i].iov_base = (void *) b[i].cp;
+	    iov[i].iov_len = b[i].n;
+	}
+	msg.msg_iov = iov;
+	msg.msg_iovlen = nb;
+
+	if (b[0].form == BF_FDS && b[0].off == 0) {
+	    SharedBLOBs *sb = b[0].mp->sb;
+	    struct cmsghdr *cmp;
+
+	    memset (cbuf, 0, sizeof(cbuf));
+	    msg.msg_control = cbuf;
+	    msg.msg_controllen = CMSG_SPACE(sb->nfds*sizeof(int));
+	    cmp = CMSG_FIRSTHDR(&msg);
+	    cmp->cmsg_level = SOL_SOCKET;
+	    cmp->cmsg_type = SCM_RIGHTS;
+	    cmp->cmsg_len = CMSG_LEN(sb->nfds*sizeof(int));
+	    memcpy (CMSG_DATA(cmp), sb->fds, sb->nfds*sizeof(int));
+	}
+
+	return (sendmsg (q->s, &msg, 0));
 }
 
-/* write the next chunk of the current message in the queue to the given
- * client. pop message from queue when complete and free the message if we are
- * the last one to use it. shut down this client if trouble.
- * N.B. we assume we will never be called with cp->msgq empty.
- * return 0 if ok else -1 if had to shut down.
+/* account for nw bytes written of the nb entries of b, the write they were
+ * batched for is over. pop each Msg that is complete and free it if we are
+ * the last one to use it.
+ * call with qlock held.
  */
-static int
-sendClientMsg (ClInfo *cp)
+static void
+clSent (ClQueue *q, QBatch *b, int nb, unsigned long nw)
 {
-	ssize_t nsend, nw;
-	Msg *mp;
-
-	/* get current message */
-	mp = (Msg *) peekFQ (cp->msgq);
+	int i;
 
-	/* send next chunk, never more than MAXWSIZ to reduce blocking */
-	nsend = mp->cl - cp->nsent;
-	if (nsend > MAXWSIZ)
-	    nsend = MAXWSIZ;
-	nw = write (cp->s, &mp->cp[cp->nsent], nsend);
+	/* the write is over, whatever it took */
+	q->nbusy[0] = q->nbusy[1] = 0;
+
+	for (i = 0; i < nb && nw > 0; i++) {
+	    Msg *mp = b[i].mp;
+	    unsigned long n = nw < b[i].n ? nw : b[i].n;
+
+	    /* trace */
+	    if (verbose > 2) {
+		fprintf(stderr, "%s: Client %d: sending msg copy %d nq %d:\n%.*s\n",
+				indi_tstamp(NULL), q->s, mp->count, clQueued(q),
+				(int)n, b[i].cp);
+	    } else if (verbose > 1) {
+		fprintf(stderr, "%s: Client %d: sending %.50s\n",
+					    indi_tstamp(NULL), q->s, b[i].cp);
+	    }
 
-	/* shut down if trouble */
-	if (nw <= 0) {
-	    if (nw == 0)
-		fprintf (stderr, "%s: Client %d: write returned 0\n",
-						    indi_tstamp(NULL), cp->s);
-	    else
-		fprintf (stderr, "%s: Client %d: write: %s\n", indi_tstamp(NULL),
-						    cp->s, strerror(errno));
-	    shutdownClient (cp);
-	    return (-1);
-	}
+	    nw -= n;
+	    if (b[i].off + n < b[i].cl) {
+		q->nsent = b[i].off + n;
+		q->inbulk = b[i].bulk;
+		return;
+	    }
 
-	/* trace */
-	if (verbose > 2) {
-	    fprintf(stderr, "%s: Client %d: sending msg copy %d nq %d:\n%.*s\n",
-				indi_tstamp(NULL), cp->s, mp->count, nFQ(cp->msgq),
-				(int)nw, &mp->cp[cp->nsent]);
-	} else if (verbose > 1) {
-	    fprintf(stderr, "%s: Client %d: sending %.50s\n", indi_tstamp(NULL),
-						    cp->s, &mp->cp[cp->nsent]);
+	    /* complete: it is at the head of its queue */
+	    q->nsent = 0;
+	    q->nqbytes[b[i].bulk] -= msgQBytes (mp, b[i].form);
+	    popFQ (b[i].bulk ? q->bulkq : q->ctlq);
+	    msgRelease (mp);
 	}
+}
 
-	/* update amount sent. when complete: free message if we are the last
-	 * to use it and pop from our queue.
-	 */
-	cp->nsent += nw;
-	if (cp->nsent == mp->cl) {
-	    if (--mp->count == 0)
-		freeMsg (mp);
-	    popFQ (cp->msgq);
-	    cp->nsent = 0;
-	}
+/* lock all client queues, if there are writer threads to share them with */
+static void
+lockQ (void)
+{
+	if (threaded)
+	    pthread_mutex_lock (&qlock);
+}
 
-	return (0);
+/* undo lockQ() */
+static void
+unlockQ (void)
+{
+	if (threaded)
+	    pthread_mutex_unlock (&qlock);
 }
 
 /* write the next chunk of the current message in the queue to the given
  * driver. pop message from queue when complete and free the message if we are
  * the last one to use it. restart this driver if touble.
  * N.B. we assume we will never be called with dp->msgq empty.
- * return 0 if ok else -1 if had to shut down.
+ * return 0 if ok, 1 if driver can not take more now, else -1 if had to shut down.
  */
 static int
 sendDriverMsg (DvrInfo *dp)
 {
 	ssize_t nsend, nw;
+	unsigned long cl;
+	const char *cont;
 	Msg *mp;
 
-	/* get current message */
+	/* get current message, drivers always get BLOBs in base64 */
 	mp = (Msg *) peekFQ (dp->msgq);
+	cont = msgContent (mp, BF_BASE64, &cl);
 
-	/* send next chunk, never more than MAXWSIZ to reduce blocking */
-	nsend = mp->cl - dp->nsent;
+	/* send next chunk, never more than MAXWSIZ to reduce blocking.
+	 * with epoll the pipe never blocks, so let it take all it can.
+	 */
+	nsend = cl - dp->nsent;
+#ifndef HAVE_SYS_EPOLL_H
 	if (nsend > MAXWSIZ)
 	    nsend = MAXWSIZ;
-	nw = write (dp->wfd, &mp->cp[dp->nsent], nsend);
+#endif
+	nw = write (dp->wfd, &cont[dp->nsent], nsend);
+	if (nw < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+	    return (1);
 
 	/* restart if trouble */
 	if (nw <= 0) {
@@ -1680,21 +3588,23 @@ sendDriverMsg (DvrInfo *dp)
 	if (verbose > 2) {
 	    fprintf(stderr, "%s: Driver %s: sending msg copy %d nq %d:\n%.*s\n",
 			    indi_tstamp(NULL), dp->name, mp->count, nFQ(dp->msgq),
-			    (int)nw, &mp->cp[dp->nsent]);
+			    (int)nw, &cont[dp->nsent]);
 	} else if (verbose > 1) {
 	    fprintf(stderr, "%s: Driver %s: sending %.50s\n", indi_tstamp(NULL),
-						dp->name, &mp->cp[dp->nsent]);
+						dp->name, &cont[dp->nsent]);
 	}
 
 	/* update amount sent. when complete: free message if we are the last
 	 * to use it and pop from our queue.
 	 */
 	dp->nsent += nw;
-	if (dp->nsent == mp->cl) {
-	    if (--mp->count == 0)
-		freeMsg (mp);
+	if (dp->nsent == cl) {
+	    dp->nqbytes -= msgQBytes (mp, BF_BASE64);
+	    msgRelease (mp);
 	    popFQ (dp->msgq);
 	    dp->nsent = 0;
+	    if (nFQ(dp->msgq) == 0)
+		ioDriverWrite (dp, 0);
 	}
 
 	return (0);
@@ -1724,6 +3634,7 @@ static void
 addClDevice (ClInfo *cp, const char *dev, const char *name, int isblob)
 {
 	Property *pp;
+	Route *rp;
 	//char *ip;
         int i=0;
 
@@ -1753,30 +3664,164 @@ addClDevice (ClInfo *cp, const char *dev, const char *name, int isblob)
 	strncpy (ip, name, MAXINDINAME-1);
         ip[MAXINDINAME-1] = '\0';*/
 
-        strncpy (pp->dev, dev, MAXINDIDEVICE);
-        strncpy (pp->name, name, MAXINDINAME);
+        strncpy (pp->dev, dev, MAXINDIDEVICE-1);
+        pp->dev[MAXINDIDEVICE-1] = '\0';
+        strncpy (pp->name, name, MAXINDINAME-1);
+        pp->name[MAXINDINAME-1] = '\0';
         pp->blob = B_NEVER;
+
+	rp = findRoute (pp->dev, pp->name, 1);
+	addRouteSub (&rp->cls, &rp->ncls, cp - clinfo, cp->nprops-1);
+}
+
+/* return hash of the pair dev/name */
+static unsigned int
+routeHash (const char *dev, const char *name)
+{
+	unsigned int h = 2166136261u;		/* FNV-1a */
+
+	while (*dev)
+	    h = (h ^ (unsigned char)*dev++) * 16777619u;
+	h *= 16777619u;				/* as if \0 between */
+	while (*name)
+	    h = (h ^ (unsigned char)*name++) * 16777619u;
+	return (h);
+}
+
+/* return the Route for dev/name. if none: add one if create, else NULL.
+ */
+static Route *
+findRoute (const char *dev, const char *name, int create)
+{
+	unsigned int h;
+	Route *rp;
+	int i;
+
+	assert (dev != NULL && name != NULL);
+	h = routeHash (dev, name);
+
+	if (routes)
+	    for (rp = routes[h & (nroutehash-1)]; rp; rp = rp->next)
+		if (rp->hash == h && !strcmp (rp->dev, dev)
+						&& !strcmp (rp->name, name))
+		    return (rp);
+	if (!create)
+	    return (NULL);
+
+	/* double the table when chains get long */
+	if (nroutes >= 2*nroutehash) {
+	    int n = nroutehash ? 2*nroutehash : NROUTEHASH;
+	    Route **newroutes = (Route **) calloc (n, sizeof(Route *));
+
+	    for (i = 0; i < nroutehash; i++) {
+		while ((rp = routes[i]) != NULL) {
+		    routes[i] = rp->next;
+		    rp->next = newroutes[rp->hash & (n-1)];
+		    newroutes[rp->hash & (n-1)] = rp;
+		}
+	    }
+	    free (routes);
+	    routes = newroutes;
+	    nroutehash = n;
+	}
+
+	/* add */
+	rp = (Route *) calloc (1, sizeof(Route));
+	rp->hash = h;
+	rp->dev = strcpy (malloc (strlen(dev)+1), dev);
+	rp->name = strcpy (malloc (strlen(name)+1), name);
+	rp->next = routes[h & (nroutehash-1)];
+	routes[h & (nroutehash-1)] = rp;
+	nroutes++;
+
+	return (rp);
+}
+
+/* add idx/pi to the given list of subscribers */
+static void
+addRouteSub (RouteSub **subs, int *nsubs, int idx, int pi)
+{
+	RouteSub *sp;
+
+	*subs = (RouteSub *) realloc (*subs, (*nsubs+1)*sizeof(RouteSub));
+	sp = &(*subs)[(*nsubs)++];
+	sp->idx = idx;
+	sp->pi = pi;
+}
+
+/* remove idx from the given list of subscribers, moving the last into its
+ * place.
+ */
+static void
+rmRouteSub (RouteSub *subs, int *nsubs, int idx)
+{
+	int i;
+
+	for (i = 0; i < *nsubs; i++) {
+	    if (subs[i].idx == idx) {
+		subs[i] = subs[--(*nsubs)];
+		return;
+	    }
+	}
+}
+
+/* add idx to the given list of clients or drivers */
+static void
+addRouteInt (int **ints, int *nints, int idx)
+{
+	*ints = (int *) realloc (*ints, (*nints+1)*sizeof(int));
+	(*ints)[(*nints)++] = idx;
+}
+
+/* remove idx from the given list of clients or drivers, moving the last into
+ * its place.
+ */
+static void
+rmRouteInt (int *ints, int *nints, int idx)
+{
+	int i;
+
+	for (i = 0; i < *nints; i++) {
+	    if (ints[i] == idx) {
+		ints[i] = ints[--(*nints)];
+		return;
+	    }
+	}
 }
 
 
-/* block to accept a new client arriving on lsocket.
- * return private nonblocking socket or exit.
+/* accept a new client arriving on lfd.
+ * return private socket, -1 if none was waiting, or exit.
  */
 static int
-newClSocket ()
+newClSocket (int lfd)
 {
-	struct sockaddr_in cli_socket;
+	struct sockaddr_storage cli_socket;
 	socklen_t cli_len;
 	int cli_fd;
 
 	/* get a private connection to new client */
 	cli_len = sizeof(cli_socket);
-	cli_fd = accept (lsocket, (struct sockaddr *)&cli_socket, &cli_len);
+	cli_fd = accept (lfd, (struct sockaddr *)&cli_socket, &cli_len);
+	if (cli_fd < 0 && (errno == EAGAIN || errno == EWOULDBLOCK ||
+				errno == EINTR || errno == ECONNABORTED))
+	    return (-1);
 	if(cli_fd < 0) {
 	    fprintf (stderr, "accept: %s\n", strerror(errno));
 	    Bye();
 	}
 
+#ifdef TCP_NOTSENT_LOWAT
+	/* leave little more to the kernel than it can send right away, the
+	 * rest stays queued here where newer values may still supersede it
+	 */
+	if (lfd != usocket) {
+	    int lowat = MAXNOTSENT;
+	    (void) setsockopt (cli_fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowat,
+								sizeof(lowat));
+	}
+#endif
+
 	/* ok */
 	return (cli_fd);
 }
@@ -1919,6 +3964,519 @@ static void
 Bye()
 {
 	fprintf (stderr, "%s: good bye\n", indi_tstamp(NULL));
+	if (usocket >= 0)
+	    (void) unlink (upath);
 	exit(1);
 }
 
+#if defined(INDISERVER_BENCH)
+
+/* Client fan-out load: one driver floods setNumberVectors and every one of
+ * nclients clients wants them all. Reports the events delivered per second of
+ * server CPU, so the bench's own clients on the same CPUs do not count.
+ *   cc -O2 -DINDISERVER_BENCH -I. -Ilibs -o indiserverbench indiserver.c \
+ *	fq.c base64.c libs/lilxml.c -lpthread
+ * and add -DINDISERVER_BENCH_SELECT for the select() core. Run as
+ *   indiserverbench [-t] [nclients [nmessages [port]]]
+ * The server runs its own binary as the driver. The state changes with every
+ * value so none are coalesced, each client gets all nmessages.
+ *
+ * With -r it measures round trips instead: one client sets a number and waits
+ * for the driver to echo it back while the driver streams BLOB frames as fast
+ * as it can to nblobclients other clients.
+ *   indiserverbench -r [-t] [nblobclients [blobkB [npings [port]]]]
+ * -t runs the server with -t in either mode.
+ */
+
+#define	BENCHDVR	"INDIBENCH_DRIVER"	/* "nclients nmessages" for the driver */
+#define	BENCHRTT	"INDIBENCH_RTT"		/* BLOB frame bytes for the -r driver */
+#define	BENCHTAIL	64		/* bytes kept to match across reads */
+
+/* driver: answer the server's and each client's getProperties, then flood */
+static int
+benchDriver (int nclients, int nmsgs)
+{
+	char buf[MAXRBUF];
+	int ngets = 0, i;
+
+	/* stdout is ours alone, let stdio gather it */
+	setvbuf (stdout, NULL, _IOFBF, 65536);
+
+	/* the server sends each getProperties on a line of its own */
+	while (ngets < nclients + 1 && fgets (buf, sizeof(buf), stdin)) {
+	    if (strstr (buf, "<getProperties")) {
+		if (ngets++ == 0) {
+		    printf ("<defNumberVector device='Bench' name='V' perm='ro' state='Idle'>\n");
+		    printf (" <defNumber name='N' format='%%g' min='0' max='0' step='0'>0</defNumber>\n");
+		    printf ("</defNumberVector>\n");
+		    printf ("<defNumberVector device='Bench' name='End' perm='ro' state='Idle'>\n");
+		    printf (" <defNumber name='N' format='%%g' min='0' max='0' step='0'>0</defNumber>\n");
+		    printf ("</defNumberVector>\n");
+		    fflush (stdout);
+		}
+	    }
+	}
+
+	for (i = 0; i < nmsgs; i++)
+	    printf ("<setNumberVector device='Bench' name='V' state='%s'>"
+				"<oneNumber name='N'>%d</oneNumber></setNumberVector>\n",
+							(i & 1) ? "Busy" : "Ok", i);
+	printf ("<setNumberVector device='Bench' name='End' state='Ok'>"
+				"<oneNumber name='N'>%d</oneNumber></setNumberVector>\n", i);
+	fflush (stdout);
+
+	/* the server tells us to go by closing our stdin */
+	while (read (0, buf, sizeof(buf)) > 0)
+	    continue;
+	return (0);
+}
+
+/* -r driver: echo each new P straight back, stream IMG frames in between */
+static int
+benchRTTDriver (int blobsize)
+{
+	LilXML *lp = newLilXML();
+	char errmsg[1024];
+	int enclen = 4*((blobsize+2)/3);
+	char *b64 = (char *) malloc (enclen);
+	int defined = 0;
+
+	setvbuf (stdout, NULL, _IOFBF, 65536);
+	memset (b64, 'A', enclen);	/* all zeros */
+
+	for (;;) {
+	    struct pollfd pfd;
+	    char buf[MAXRBUF];
+	    int nr, i;
+
+	    /* block until the server asks, then only look between frames */
+	    pfd.fd = 0;
+	    pfd.events = POLLIN;
+	    if (poll (&pfd, 1, defined ? 0 : -1) > 0) {
+		nr = read (0, buf, sizeof(buf));
+		if (nr <= 0)
+		    return (0);
+		for (i = 0; i < nr; i++) {
+		    XMLEle *root = readXMLEle (lp, buf[i], errmsg);
+		    if (!root)
+			continue;
+		    if (!strcmp (tagXMLEle(root), "getProperties")) {
+			printf ("<defNumberVector device='Bench' name='P' perm='rw' state='Idle'>\n");
+			printf (" <defNumber name='N' format='%%g' min='0' max='0' step='0'>0</defNumber>\n");
+			printf ("</defNumberVector>\n");
+			printf ("<defBLOBVector device='Bench' name='IMG' perm='ro' state='Idle'>\n");
+			printf (" <defBLOB name='F'/>\n");
+			printf ("</defBLOBVector>\n");
+			defined = 1;
+		    } else if (!strcmp (tagXMLEle(root), "newNumberVector")) {
+			XMLEle *ep = findXMLEle (root, "oneNumber");
+			printf ("<setNumberVector device='Bench' name='P' state='Ok'>"
+				"<oneNumber name='N'>%s</oneNumber></setNumberVector>\n",
+						ep ? pcdataXMLEle (ep) : "0");
+		    }
+		    delXMLEle (root);
+		}
+		fflush (stdout);
+	    }
+
+	    if (defined) {
+		printf ("<setBLOBVector device='Bench' name='IMG' state='Ok'>"
+			"<oneBLOB name='F' size='%d' format='.fits' enclen='%d'>\n",
+							blobsize, enclen);
+		fwrite (b64, 1, enclen, stdout);
+		printf ("\n</oneBLOB></setBLOBVector>\n");
+		if (fflush (stdout) == EOF)
+		    return (0);
+	    }
+	}
+}
+
+/* CPU seconds used by all threads of process pid so far, to the ns */
+static double
+benchCPU (pid_t pid)
+{
+	char fn[64];
+	unsigned long long ns, tns = 0;
+	struct dirent *dep;
+	DIR *dp;
+
+	snprintf (fn, sizeof(fn), "/proc/%d/task", (int)pid);
+	dp = opendir (fn);
+	if (!dp)
+	    return (0);
+	while ((dep = readdir (dp)) != NULL) {
+	    char tfn[sizeof(fn) + sizeof(dep->d_name) + 16];
+	    FILE *fp;
+
+	    if (dep->d_name[0] == '.')
+		continue;
+	    snprintf (tfn, sizeof(tfn), "%s/%s/schedstat", fn, dep->d_name);
+	    fp = fopen (tfn, "r");
+	    if (!fp)
+		continue;
+	    if (fscanf (fp, "%llu", &ns) == 1)
+		tns += ns;
+	    fclose (fp);
+	}
+	closedir (dp);
+	return (tns * 1e-9);
+}
+
+static double
+benchNow (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec + ts.tv_nsec * 1e-9);
+}
+
+#undef	main
+
+/* fork a server on bport running us as its driver, wait for it to listen.
+ * return its pid, or -1 if it did not start.
+ */
+static pid_t
+benchServer (int bport, int thr, struct sockaddr_in *sap)
+{
+	char bportstr[32];
+	pid_t spid;
+	int i;
+
+	snprintf (bportstr, sizeof(bportstr), "%d", bport);
+	spid = fork();
+	if (spid < 0) {
+	    perror ("fork");
+	    return (-1);
+	}
+	if (spid == 0) {
+	    char *sav[] = {"indiserver", "-p", bportstr, "/proc/self/exe", NULL, NULL};
+	    if (thr) {
+		sav[4] = sav[3];
+		sav[3] = "-t";
+	    }
+	    if (!freopen ("/dev/null", "w", stderr))
+		_exit (1);
+	    _exit (serverMain (4 + thr, sav));
+	}
+
+	memset (sap, 0, sizeof(*sap));
+	sap->sin_family = AF_INET;
+	sap->sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+	sap->sin_port = htons ((unsigned short)bport);
+
+	/* give the server a moment to listen */
+	for (i = 0; i < 50; i++) {
+	    int s = socket (AF_INET, SOCK_STREAM, 0);
+	    if (connect (s, (struct sockaddr *)sap, sizeof(*sap)) == 0) {
+		close (s);
+		break;
+	    }
+	    close (s);
+	    usleep (100000);
+	}
+	if (waitpid (spid, NULL, WNOHANG) != 0) {
+	    fprintf (stderr, "server did not start, port %d in use?\n", bport);
+	    return (-1);
+	}
+	return (spid);
+}
+
+/* connect a client to the bench server and send it msg, -1 if we can not */
+static int
+benchClient (struct sockaddr_in *sap, const char *msg)
+{
+	int fd = socket (AF_INET, SOCK_STREAM, 0);
+	int len = strlen (msg);
+
+	if (fd < 0 || connect (fd, (struct sockaddr *)sap, sizeof(*sap)) < 0
+			    || write (fd, msg, len) != len) {
+	    perror ("client");
+	    if (fd >= 0)
+		close (fd);
+	    return (-1);
+	}
+	return (fd);
+}
+
+static int
+benchCmpDouble (const void *a, const void *b)
+{
+	double d = *(const double *)a - *(const double *)b;
+
+	return (d < 0 ? -1 : d > 0);
+}
+
+/* -r: npings round trips of P from one client while nblob others take IMG */
+static int
+benchRTT (int nblob, int blobkb, int npings, int bport, int thr)
+{
+	static const char gp[] = "<getProperties version='1.7'/>\n";
+	static const char eb[] = "<getProperties version='1.7'/>\n"
+				"<enableBLOB device='Bench'>Also</enableBLOB>\n";
+	struct sockaddr_in serv_addr;
+	volatile long *nblobbytes;
+	double *rtt, t0, t, cpu0, cpu;
+	long nb0;
+	LilXML *lp;
+	char errmsg[1024], sz[32];
+	pid_t spid, bpid;
+	int pfd, i, n;
+
+	snprintf (sz, sizeof(sz), "%d", blobkb * 1024);
+	setenv (BENCHRTT, sz, 1);
+	spid = benchServer (bport, thr, &serv_addr);
+	unsetenv (BENCHRTT);
+	if (spid < 0)
+	    return (1);
+
+	/* the ping client, wait for P so we know the driver is up */
+	pfd = benchClient (&serv_addr, gp);
+	if (pfd < 0) {
+	    kill (spid, SIGTERM);
+	    return (1);
+	}
+	lp = newLilXML();
+	for (n = 0; !n; ) {
+	    char buf[MAXRBUF];
+	    int nr = read (pfd, buf, sizeof(buf));
+
+	    if (nr <= 0) {
+		fprintf (stderr, "driver did not define P\n");
+		kill (spid, SIGTERM);
+		return (1);
+	    }
+	    for (i = 0; i < nr; i++) {
+		XMLEle *root = readXMLEle (lp, buf[i], errmsg);
+		if (root) {
+		    n |= !strcmp (findXMLAttValu (root, "name"), "P");
+		    delXMLEle (root);
+		}
+	    }
+	}
+
+	/* the BLOB clients read and count everything, until we kill them */
+	nblobbytes = (volatile long *) mmap (NULL, sizeof(long), PROT_READ|PROT_WRITE,
+						    MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if (nblobbytes == MAP_FAILED) {
+	    perror ("mmap");
+	    kill (spid, SIGTERM);
+	    return (1);
+	}
+	*nblobbytes = 0;
+	bpid = fork();
+	if (bpid == 0) {
+	    struct pollfd *pfds = (struct pollfd *) calloc (nblob, sizeof(struct pollfd));
+	    for (i = 0; i < nblob; i++) {
+		if ((pfds[i].fd = benchClient (&serv_addr, eb)) < 0)
+		    _exit (1);
+		pfds[i].events = POLLIN;
+	    }
+	    while (poll (pfds, nblob, -1) > 0) {
+		for (i = 0; i < nblob; i++) {
+		    char buf[65536];
+		    int nr;
+
+		    if (!(pfds[i].revents & (POLLIN|POLLHUP|POLLERR)))
+			continue;
+		    nr = read (pfds[i].fd, buf, sizeof(buf));
+		    if (nr <= 0)
+			_exit (1);
+		    *nblobbytes += nr;
+		}
+	    }
+	    _exit (1);
+	}
+
+	/* let the BLOB stream fill the queues before we time anything */
+	sleep (1);
+
+	rtt = (double *) calloc (npings, sizeof(double));
+	nb0 = *nblobbytes;
+	cpu0 = benchCPU (spid);
+	t0 = benchNow();
+	for (n = 0; n < npings; n++) {
+	    char msg[256];
+	    double tp = benchNow();
+	    int len, got = 0;
+
+	    len = snprintf (msg, sizeof(msg), "<newNumberVector device='Bench' name='P'>"
+				"<oneNumber name='N'>%d</oneNumber></newNumberVector>\n", n);
+	    if (write (pfd, msg, len) != len) {
+		perror ("ping");
+		break;
+	    }
+	    while (!got) {
+		struct pollfd p;
+		char buf[MAXRBUF];
+		int nr;
+
+		p.fd = pfd;
+		p.events = POLLIN;
+		if (poll (&p, 1, 10000) <= 0 || (nr = read (pfd, buf, sizeof(buf))) <= 0) {
+		    fprintf (stderr, "ping %d lost\n", n);
+		    break;
+		}
+		for (i = 0; i < nr; i++) {
+		    XMLEle *root = readXMLEle (lp, buf[i], errmsg), *ep;
+		    if (!root)
+			continue;
+		    if (!strcmp (tagXMLEle(root), "setNumberVector")
+				&& (ep = findXMLEle (root, "oneNumber")) != NULL
+				&& atoi (pcdataXMLEle (ep)) == n)
+			got = 1;
+		    delXMLEle (root);
+		}
+	    }
+	    if (!got)
+		break;
+	    rtt[n] = (benchNow() - tp) * 1e3;
+	}
+	t = benchNow() - t0;
+	cpu = benchCPU (spid) - cpu0;
+
+	kill (bpid, SIGTERM);
+	waitpid (bpid, NULL, 0);
+	kill (spid, SIGTERM);
+	waitpid (spid, NULL, 0);
+
+	if (n == 0)
+	    return (1);
+	qsort (rtt, n, sizeof(double), benchCmpDouble);
+	printf ("%s core%s, %3d BLOB clients of %5d kB: %6d round trips ms p50 %7.3f p90 %7.3f p99 %7.3f max %7.3f, BLOBs %7.1f MB/s, %5.2f s CPU\n",
+#ifdef HAVE_SYS_EPOLL_H
+		"epoll",
+#else
+		"select",
+#endif
+		thr ? " -t" : "", nblob, blobkb, n, rtt[n/2], rtt[n*9/10], rtt[n*99/100],
+		rtt[n-1], (*nblobbytes - nb0) / t / 1e6, cpu);
+	return (n == npings ? 0 : 1);
+}
+
+int
+main (int ac, char *av[])
+{
+	int nclients, nmsgs, bport;
+	struct sockaddr_in serv_addr;
+	struct pollfd *pfds;
+	char (*tails)[BENCHTAIL];
+	int *tlen;
+	long nevents = 0;
+	int i, nleft, ndone = 0;
+	int rtt = 0, thr = 0, blobsize;
+	double cpu0, t0, cpu, t;
+	char counts[64], *dvr;
+	pid_t spid;
+
+	/* the server runs us as its driver, with what to do in our env */
+	if ((dvr = getenv (BENCHDVR)) != NULL
+			&& sscanf (dvr, "%d %d", &nclients, &nmsgs) == 2)
+	    return (benchDriver (nclients, nmsgs));
+	if ((dvr = getenv (BENCHRTT)) != NULL
+			&& sscanf (dvr, "%d", &blobsize) == 1)
+	    return (benchRTTDriver (blobsize));
+
+	for (; ac > 1 && av[1][0] == '-'; ac--, av++) {
+	    if (!strcmp (av[1], "-r"))
+		rtt = 1;
+	    else if (!strcmp (av[1], "-t"))
+		thr = 1;
+	    else {
+		fprintf (stderr, "Usage: indiserverbench [-t] [nclients [nmessages [port]]]\n");
+		fprintf (stderr, "       indiserverbench -r [-t] [nblobclients [blobkB [npings [port]]]]\n");
+		return (1);
+	    }
+	}
+
+	if (rtt)
+	    return (benchRTT (ac > 1 ? atoi(av[1]) : 2, ac > 2 ? atoi(av[2]) : 1024,
+				ac > 3 ? atoi(av[3]) : 1000,
+				ac > 4 ? atoi(av[4]) : INDIPORT + 100, thr));
+
+	nclients = ac > 1 ? atoi(av[1]) : 100;
+	nmsgs = ac > 2 ? atoi(av[2]) : 1000000 / nclients;
+	bport = ac > 3 ? atoi(av[3]) : INDIPORT + 100;
+
+	snprintf (counts, sizeof(counts), "%d %d", nclients, nmsgs);
+	setenv (BENCHDVR, counts, 1);
+	spid = benchServer (bport, thr, &serv_addr);
+	unsetenv (BENCHDVR);
+	if (spid < 0)
+	    return (1);
+
+	pfds = (struct pollfd *) calloc (nclients, sizeof(struct pollfd));
+	tails = calloc (nclients, BENCHTAIL);
+	tlen = (int *) calloc (nclients, sizeof(int));
+
+	cpu0 = benchCPU (spid);
+	t0 = benchNow();
+	for (i = 0; i < nclients; i++) {
+	    if ((pfds[i].fd = benchClient (&serv_addr,
+				"<getProperties version='1.7'/>\n")) < 0) {
+		kill (spid, SIGTERM);
+		return (1);
+	    }
+	    pfds[i].events = POLLIN;
+	}
+
+	/* each client reads until it sees End */
+	for (nleft = nclients; nleft > 0; ) {
+	    if (poll (pfds, nclients, 60000) <= 0) {
+		fprintf (stderr, "timed out with %d clients not done\n", nleft);
+		break;
+	    }
+	    for (i = 0; i < nclients; i++) {
+		char buf[BENCHTAIL + 65536 + 1], *p;
+		int nr;
+
+		if (!(pfds[i].revents & (POLLIN|POLLHUP|POLLERR)))
+		    continue;
+		memcpy (buf, tails[i], tlen[i]);
+		nr = read (pfds[i].fd, buf + tlen[i], 65536);
+		if (nr <= 0) {
+		    fprintf (stderr, "client %d lost\n", i);
+		    pfds[i].fd = -pfds[i].fd - 1;
+		    nleft--;
+		    continue;
+		}
+		nr += tlen[i];
+		buf[nr] = '\0';
+		for (p = buf; (p = strstr (p, "<setNumberVector")) != NULL; p++) {
+		    if (p + BENCHTAIL > buf + nr)
+			break;		/* count it once it is all here */
+		    if (!strncmp (p, "<setNumberVector device=\"Bench\" name=\"End\"", 42)) {
+			pfds[i].fd = -pfds[i].fd - 1;
+			nleft--;
+			ndone++;
+			break;
+		    }
+		    nevents++;
+		}
+		if (pfds[i].fd >= 0) {
+		    /* keep a partial tag for the next read, none counted */
+		    if (!p)
+			p = buf + (nr >= BENCHTAIL ? nr - (BENCHTAIL-1) : 0);
+		    tlen[i] = buf + nr - p;
+		    memcpy (tails[i], p, tlen[i]);
+		}
+	    }
+	}
+
+	t = benchNow() - t0;
+	cpu = benchCPU (spid) - cpu0;
+	kill (spid, SIGTERM);
+	waitpid (spid, NULL, 0);
+
+	printf ("%s core%s, %4d clients: %9ld events %6.2f s %5.2f s CPU %9.0f events/s %9.0f events/CPU s, %d done\n",
+#ifdef HAVE_SYS_EPOLL_H
+		"epoll",
+#else
+		"select",
+#endif
+		thr ? " -t" : "", nclients, nevents, t, cpu, nevents / t, cpu > 0 ? nevents / cpu : 0,
+		ndone);
+	return (ndone == nclients ? 0 : 1);
+}
+
+#endif /* INDISERVER_BENCH */
@@ -0,0 +1,82 @@
+/*
+    INDI LIB
+    Guide star detection for rapid guiding
+    Copyright(c) 2013 CloudMakers, s. r. o. All rights reserved.
+
+    Star detection algorithm is based on PHD Guiding by Craig Stark
+    Copyright (c) 2006-2010 Craig Stark. All rights reserved.
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+/** \file guidestar.h
+    \brief Find the brightest star-like spot in a 16 bit frame and its centroid.
+
+    Each pixel is rated by how well the 9x9 pixels around it fit a star profile. The search runs along rows, several pixels at a time with SSE2 or AVX2 where
+    available, and large areas are split in bands of rows searched by separate threads.
+*/
+
+#ifndef GUIDESTAR_H
+#define GUIDESTAR_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \defgroup guidestar Guide Star Functions: Find a guide star in a frame
+ */
+/*@{*/
+
+/** \brief A guide star found in a frame. */
+typedef struct {
+    int ix, iy;		/* pixel with the best fit, 0 if none */
+    double fit;		/* fit of the star profile at ix, iy, 0 if none */
+    double x, y;	/* centroid, set by centroidGuideStar() */
+} GuideStar;
+
+/** \brief Find the pixel that best fits a star profile.
+    \param frame 16 bit pixels, row after row.
+    \param width number of pixels in a row.
+    \param height number of rows.
+    \param minx first column to search. The search is limited to 4 pixels from the edges.
+    \param maxx column past the last one to search.
+    \param miny first row to search.
+    \param maxy row past the last one to search.
+    \param nthreads number of threads to use, 0 to pick from the search area and processors available.
+    \param gs set to the pixel with the best fit. Of equal fits, the one with the lowest column, then row, is chosen.
+    \return 0 if a pixel with a fit above 0 was found, -1 otherwise.
+ */
+extern int findGuideStar(const unsigned short *frame, int width, int height, int minx, int maxx, int miny, int maxy,
+    int nthreads, GuideStar *gs);
+
+/** \brief Find the centroid of a star found by findGuideStar().
+    The 9x9 pixels around gs->ix, gs->iy are weighted by how much they exceed the mean of the pixels at the box's border.
+    \param frame 16 bit pixels, row after row.
+    \param width number of pixels in a row.
+    \param height number of rows.
+    \param gs star to set x and y of.
+    \return 0 on success, -1 if the box is off the frame or nothing rises above the background.
+ */
+extern int centroidGuideStar(const unsigned short *frame, int width, int height, GuideStar *gs);
+
+/*@}*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -18,10 +18,12 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
 #include <netdb.h>
 #include <fcntl.h>
@@ -35,6 +37,8 @@
 #include <errno.h>
 
 #define MAXINDIBUF 256
+#define MAXSHAREDFD 64
+#define MAXBINARYBLOB (1024UL*1024*1024)   // raw bytes of one BLOB vector, as indiserver
 
 INDI::BaseClient::BaseClient()
 {
@@ -72,6 +76,35 @@ bool INDI::BaseClient::connectServer()
     int pipefd[2];
     int ret = 0;
 
+    /* a path is the Unix domain socket of a local server */
+    if (cServer[0] == '/')
+    {
+        struct sockaddr_un serv_un;
+
+        if (cServer.size() >= sizeof(serv_un.sun_path))
+        {
+            fprintf(stderr, "%s: path too long\n", cServer.c_str());
+            return false;
+        }
+
+        memset (&serv_un, 0, sizeof(serv_un));
+        serv_un.sun_family = AF_UNIX;
+        strcpy(serv_un.sun_path, cServer.c_str());
+        if ((sockfd = socket (AF_UNIX, SOCK_STREAM, 0)) < 0)
+        {
+            perror ("socket");
+            return false;
+        }
+
+        if (::connect (sockfd,(struct sockaddr *)&serv_un,sizeof(serv_un))<0)
+        {
+            perror ("connect");
+            close(sockfd);
+            return false;
+        }
+    }
+    else
+    {
     /* lookup host address */
     hp = gethostbyname(cServer.c_str());
     if (!hp)
@@ -97,6 +130,7 @@ bool INDI::BaseClient::connectServer()
         perror ("connect");
         return false;
     }
+    }
 
     /* prepare for line-oriented i/o with client */
     svrwfp = fdopen (sockfd, "w");
@@ -234,6 +268,8 @@ void INDI::BaseClient::listenINDI()
 {
     char buffer[MAXINDIBUF];
     char msg[MAXRBUF];
+    char cbuf[CMSG_SPACE(MAXSHAREDFD*sizeof(int))];
+    const char *shared = (cServer[0] == '/') ? " sharedblobs='On' binaryblobs='On'" : " binaryblobs='On'";
 
     int n=0, err_code=0;
     int maxfd=0;
@@ -241,12 +277,12 @@ void INDI::BaseClient::listenINDI()
 
     setlocale(LC_NUMERIC,"C");
     if (cDeviceNames.empty())
-       fprintf(svrwfp, "<getProperties version='%g'/>\n", INDIV);
+       fprintf(svrwfp, "<getProperties version='%g'%s/>\n", INDIV, shared);
     else
     {
         vector<string>::const_iterator stri;
         for ( stri = cDeviceNames.begin(); stri != cDeviceNames.end(); stri++)
-            fprintf(svrwfp, "<getProperties version='%g' device='%s'/>\n", INDIV, (*stri).c_str());
+            fprintf(svrwfp, "<getProperties version='%g' device='%s'%s/>\n", INDIV, (*stri).c_str(), shared);
     }
     setlocale(LC_NUMERIC,"");
 
@@ -288,7 +324,32 @@ void INDI::BaseClient::listenINDI()
 
         if (n > 0 && FD_ISSET(sockfd, &rs))
         {
-            n = recv(sockfd, buffer, MAXINDIBUF, MSG_DONTWAIT);
+            struct msghdr rmsg;
+            struct iovec iov;
+
+            /* a local server passes the files of shared BLOBs along with the first bytes of their vector */
+            memset(&rmsg, 0, sizeof(rmsg));
+            iov.iov_base = buffer;
+            iov.iov_len = MAXINDIBUF;
+            rmsg.msg_iov = &iov;
+            rmsg.msg_iovlen = 1;
+            rmsg.msg_control = cbuf;
+            rmsg.msg_controllen = sizeof(cbuf);
+            n = recvmsg(sockfd, &rmsg, MSG_DONTWAIT);
+            if (n > 0)
+            {
+                for (struct cmsghdr *cmp = CMSG_FIRSTHDR(&rmsg); cmp; cmp = CMSG_NXTHDR(&rmsg, cmp))
+                {
+                    if (cmp->cmsg_level != SOL_SOCKET || cmp->cmsg_type != SCM_RIGHTS)
+                        continue;
+                    int *fds = (int *) CMSG_DATA(cmp);
+                    for (unsigned int i=0; i < (cmp->cmsg_len - CMSG_LEN(0))/sizeof(int); i++)
+                    {
+                        fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+                        sharedFds.push_back(fds[i]);
+                    }
+                }
+            }
             if (n<=0)
             {
 
@@ -302,14 +363,38 @@ void INDI::BaseClient::listenINDI()
                     continue;
             }
 
-            for (int i=0; i < n; i++)
+            size_t used;
+            bool lost = false;
+            for (int i=0; i < n; i += used)
             {
-              // IDLog("Getting #%d bytes in for loop, calling readXMLEle for byte %d\n", n, i);
-                XMLEle *root = readXMLEle (lillp, buffer[i], msg);
+                XMLEle *root = readXMLEleBuf (lillp, buffer+i, n-i, &used, msg);
                 //IDLog("############# BLOCK # POST READ XML ELE #####################\n");
 
                 if (root)
                 {
+                    // A shared BLOB vector takes one file per oneBLOB, they are closed whatever becomes of it
+                    if (!strcmp (tagXMLEle(root), "setBLOBVector") && !strcmp (findXMLAttValu(root, "attached"), "true"))
+                        while ((int) blobFds.size() < nXMLEle(root) && !sharedFds.empty())
+                        {
+                            blobFds.push_back(sharedFds.front());
+                            sharedFds.pop_front();
+                        }
+
+                    // A binary BLOB vector is followed by the bytes of each oneBLOB
+                    if (!strcmp (tagXMLEle(root), "setBLOBVector") && !strcmp (findXMLAttValu(root, "attached"), "binary"))
+                    {
+                        int nraw = readBinaryBLOBs(root, buffer+i+used, n-i-used);
+                        if (nraw < 0)
+                        {
+                            fprintf (stderr,"INDI server %s/%d disconnected.\n", cServer.c_str(), cPort);
+                            delXMLEle (root);
+                            close(sockfd);
+                            lost = true;
+                            break;
+                        }
+                        used += nraw;
+                    }
+
                     if ( (err_code = dispatchCommand(root, msg)) < 0)
                     {
                          // Silenty ignore property duplication errors
@@ -320,6 +405,11 @@ void INDI::BaseClient::listenINDI()
                          }
                     }
 
+                   for (unsigned int j=0; j < blobFds.size(); j++)
+                       close(blobFds[j]);
+                   blobFds.clear();
+                   blobRaw.clear();
+
                    delXMLEle (root);	// not yet, delete and continue
                 }
                 else if (msg[0])
@@ -328,12 +418,21 @@ void INDI::BaseClient::listenINDI()
                    return;
                 }
             }
+
+            if (lost)
+                break;
         }
 
     }
 
     delLilXML(lillp);
 
+    while (!sharedFds.empty())
+    {
+        close(sharedFds.front());
+        sharedFds.pop_front();
+    }
+
     serverDisconnected( (sConnected == false) ? 0 : -1);
     sConnected = false;
 
@@ -341,6 +440,43 @@ void INDI::BaseClient::listenINDI()
 
 }
 
+int INDI::BaseClient::readBinaryBLOBs(XMLEle *root, const char *buf, int n)
+{
+    unsigned long total=0;
+    int nr;
+
+    // The server says how much to read, believe only what fits
+    for (XMLEle *ep = nextXMLEle(root, 1); ep; ep = nextXMLEle(root, 0))
+    {
+        const char *lenstr = findXMLAttValu(ep, "len");
+        char *lenend;
+        errno = 0;
+        unsigned long len = strtoul(lenstr, &lenend, 10);
+        if (!isdigit(lenstr[0]) || *lenend || errno || len > MAXBINARYBLOB - total)
+            return -1;
+        total += len;
+    }
+
+    // One more so there is always a first byte to point at
+    blobRaw.resize(total+1);
+
+    if (n > (int) total)
+        n = total;
+    memcpy(&blobRaw[0], buf, n);
+
+    // The rest is on its way, wait for all of it
+    for (unsigned long i=n; i < total; i += nr)
+    {
+        nr = recv(sockfd, &blobRaw[i], total-i, MSG_WAITALL);
+        if (nr < 0 && errno == EINTR)
+            nr = 0;
+        else if (nr <= 0)
+            return -1;
+    }
+
+    return n;
+}
+
 int INDI::BaseClient::dispatchCommand(XMLEle *root, char * errmsg)
 {
     if  (!strcmp (tagXMLEle(root), "message"))
@@ -368,6 +504,24 @@ int INDI::BaseClient::dispatchCommand(XMLEle *root, char * errmsg)
        (!strcmp (tagXMLEle(root), "defLightVector"))  ||
        (!strcmp (tagXMLEle(root), "defBLOBVector")))
         return dp->buildProp(root, errmsg);
+    else if (!strcmp (tagXMLEle(root), "setBLOBVector") && !strcmp (findXMLAttValu(root, "attached"), "true"))
+    {
+        if ((int) blobFds.size() < nXMLEle(root))
+        {
+            strcpy(errmsg, "Shared BLOB vector without its files");
+            return INDI_DISPATCH_ERROR;
+        }
+        return dp->setValue(root, errmsg, &blobFds[0]);
+    }
+    else if (!strcmp (tagXMLEle(root), "setBLOBVector") && !strcmp (findXMLAttValu(root, "attached"), "binary"))
+    {
+        if (blobRaw.empty())
+        {
+            strcpy(errmsg, "Binary BLOB vector without its bytes");
+            return INDI_DISPATCH_ERROR;
+        }
+        return dp->setValue(root, errmsg, NULL, &blobRaw[0]);
+    }
     else if (!strcmp (tagXMLEle(root), "setTextVector") ||
              !strcmp (tagXMLEle(root), "setNumberVector") ||
              !strcmp (tagXMLEle(root), "setSwitchVector") ||
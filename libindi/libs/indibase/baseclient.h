@@ -20,6 +20,7 @@
 #define INDIBASECLIENT_H
 
 #include <vector>
+#include <deque>
 #include <map>
 #include <string>
 
@@ -61,8 +62,9 @@ public:
     virtual ~BaseClient();
 
     /** \brief Set the server host name and port
-        \param hostname INDI server host name or IP address.
-        \param port INDI server port.
+        \param hostname INDI server host name or IP address, or the path of its Unix domain socket (indiserver -u).
+        \param port INDI server port, unused with a Unix domain socket.
+        \note Over a Unix domain socket the server passes BLOBs by file descriptor instead of base64 where the driver allows it.
     */
     void setServer(const char * hostname, unsigned int port);
 
@@ -188,6 +190,10 @@ private:
     // Listen to INDI server and process incoming messages
     void listenINDI();
 
+    // Read the bytes following a setBLOBVector with attached='binary' to blobRaw,
+    // the first n of them already read to buf. Return how many of buf it took, or -1.
+    int readBinaryBLOBs(XMLEle *root, const char *buf, int n);
+
     // Thread for listenINDI()
     pthread_t listen_thread;
 
@@ -203,6 +209,13 @@ private:
     LilXML *lillp;			/* XML parser context */
     FILE *svrwfp;			/* FILE * to talk to server */
 
+    // Files holding BLOBs passed by a local server, in the order received,
+    // and those of the vector being dispatched
+    deque<int> sharedFds;
+    vector<int> blobFds;
+    // Bytes of the binary BLOB vector being dispatched
+    vector<char> blobRaw;
+
     int m_receiveFd;
     int m_sendFd;
 
@@ -26,6 +26,15 @@
 #include <unistd.h>
 
 #include "config.h"
+
+#ifdef HAVE_LZ4_H
+#include <lz4.h>
+#endif
+
+#ifdef HAVE_ZSTD_H
+#include <zstd.h>
+#endif
+
 #include "basedevice.h"
 #include "baseclient.h"
 #include "indicom.h"
@@ -777,7 +786,7 @@ bool INDI::BaseDevice::isConnected()
 /*
  * return 0 if ok else -1 with reason in errmsg
  */
-int INDI::BaseDevice::setValue (XMLEle *root, char * errmsg)
+int INDI::BaseDevice::setValue (XMLEle *root, char * errmsg, const int *fds, const char *raw)
 {
     XMLAtt *ap;
     XMLEle *ep;
@@ -956,31 +965,102 @@ int INDI::BaseDevice::setValue (XMLEle *root, char * errmsg)
         if (timeoutSet)
             bvp->timeout = timeout;
 
-        return setBLOB(bvp, root, errmsg);
+        return setBLOB(bvp, root, errmsg, fds, raw);
     }
 
     snprintf(errmsg, MAXRBUF, "INDI: <%s> Unable to process tag", tagXMLEle(root));
     return -1;
 }
 
+/* BLOB format suffixes naming a codec we can decode */
+static const char *blobCodecs[] = {
+    ".z",
+#ifdef HAVE_LZ4_H
+    ".lz4",
+#endif
+#ifdef HAVE_ZSTD_H
+    ".zst",
+#endif
+};
+
+/* If format ends with a codec we can decode, remove it from format and
+ * return it, else return NULL.
+ */
+static const char *stripBLOBCodec(char *format)
+{
+    size_t len = strlen(format);
+
+    for (unsigned int i=0; i < sizeof(blobCodecs)/sizeof(blobCodecs[0]); i++)
+    {
+        size_t n = strlen(blobCodecs[i]);
+        if (len > n && !strcmp(format + len - n, blobCodecs[i]))
+        {
+            format[len - n] = '\0';
+            return blobCodecs[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* Read len bytes of a BLOB passed as the file fd into blobEL.
+ * Return 0 if okay, -1 if error
+ */
+static int readSharedBLOB(IBLOB *blobEL, int fd, int len)
+{
+    int nr;
+
+    if (len < 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    blobEL->blob = realloc (blobEL->blob, len > 0 ? len : 1);
+    blobEL->bloblen = len;
+
+    for (int i=0; i < len; i += nr)
+    {
+        nr = pread(fd, static_cast<char *> (blobEL->blob) + i, len - i, i);
+        if (nr < 0 && errno == EINTR)
+            nr = 0;
+        else if (nr <= 0)
+        {
+            if (nr == 0)
+                errno = EIO;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
 /* Set BLOB vector. Process incoming data stream
  * Return 0 if okay, -1 if error
 */
-int INDI::BaseDevice::setBLOB(IBLOBVectorProperty *bvp, XMLEle * root, char * errmsg)
+int INDI::BaseDevice::setBLOB(IBLOBVectorProperty *bvp, XMLEle * root, char * errmsg, const int *fds, const char *raw)
 {   
     IBLOB *blobEL;
+    const char *rawBLOB=NULL;
     unsigned char * dataBuffer=NULL;
     XMLEle *ep;
     int n=0, r=0;
     uLongf dataSize=0;
 
     /* pull out each name/BLOB pair, decode */
-    for (n = 0, ep = nextXMLEle(root,1); ep; ep = nextXMLEle(root,0))
+    for (n = 0, ep = nextXMLEle(root,1); ep; n++, ep = nextXMLEle(root,0))
     {
         if (strcmp (tagXMLEle(ep), "oneBLOB") == 0)
         {
             XMLAtt *na = findXMLAtt (ep, "name");
 
+            /* binary, the bytes of each follow those of the one before */
+            if (raw)
+            {
+                rawBLOB = raw;
+                raw += atoi(findXMLAttValu(ep, "len"));
+            }
+
             blobEL = IUFindBLOB(bvp, findXMLAttValu (ep, "name"));
 
             XMLAtt *fa = findXMLAtt (ep, "format");
@@ -998,15 +1078,34 @@ int INDI::BaseDevice::setBLOB(IBLOBVectorProperty *bvp, XMLEle * root, char * er
                     continue;
                 }
 
-                 blobEL->blob = (unsigned char *) realloc (blobEL->blob, 3*pcdatalenXMLEle(ep)/4);
+                 if (fds)
+                 {
+                     /* shared by a local server, the bytes are in fds[n] */
+                     if (readSharedBLOB(blobEL, fds[n], atoi(findXMLAttValu(ep, "len"))) < 0)
+                     {
+                         snprintf(errmsg, MAXRBUF, "INDI: %s.%s.%s shared BLOB read error: %s", blobEL->bvp->device, blobEL->bvp->name, blobEL->name, strerror(errno));
+                         return -1;
+                     }
+                 }
+                 else if (rawBLOB)
+                 {
+                     int len = atoi(findXMLAttValu(ep, "len"));
+                     blobEL->blob = realloc (blobEL->blob, len > 0 ? len : 1);
+                     blobEL->bloblen = len > 0 ? len : 0;
+                     memcpy (blobEL->blob, rawBLOB, blobEL->bloblen);
+                 }
+                 else
+                 {
+                     blobEL->blob = (unsigned char *) realloc (blobEL->blob, 3*pcdatalenXMLEle(ep)/4);
 
-                 blobEL->bloblen = from64tobits( static_cast<char *> (blobEL->blob), pcdataXMLEle(ep));
+                     blobEL->bloblen = from64tobits( static_cast<char *> (blobEL->blob), pcdataXMLEle(ep));
+                 }
 
                  strncpy(blobEL->format, valuXMLAtt(fa), MAXINDIFORMAT);
 
-                    if (strstr(blobEL->format, ".z"))
+                    const char *codec = stripBLOBCodec(blobEL->format);
+                    if (codec)
                     {
-                        blobEL->format[strlen(blobEL->format)-2] = '\0';
                         dataSize = blobEL->size * sizeof(unsigned char);
                         dataBuffer = (unsigned char *) malloc(dataSize);
 
@@ -1016,7 +1115,26 @@ int INDI::BaseDevice::setBLOB(IBLOBVectorProperty *bvp, XMLEle * root, char * er
                                 return (-1);
                         }
 
-                        r = uncompress(dataBuffer, &dataSize, static_cast<unsigned char *> (blobEL->blob), (uLong) blobEL->bloblen);
+                        if (!strcmp(codec, ".z"))
+                            r = uncompress(dataBuffer, &dataSize, static_cast<unsigned char *> (blobEL->blob), (uLong) blobEL->bloblen);
+#ifdef HAVE_LZ4_H
+                        else if (!strcmp(codec, ".lz4"))
+                        {
+                            int nd = LZ4_decompress_safe(static_cast<char *> (blobEL->blob), (char *) dataBuffer, blobEL->bloblen, dataSize);
+                            r = (nd < 0) ? nd : Z_OK;
+                            if (nd >= 0)
+                                dataSize = nd;
+                        }
+#endif
+#ifdef HAVE_ZSTD_H
+                        else if (!strcmp(codec, ".zst"))
+                        {
+                            size_t nd = ZSTD_decompress(dataBuffer, dataSize, blobEL->blob, blobEL->bloblen);
+                            r = ZSTD_isError(nd) ? -1 : Z_OK;
+                            if (!ZSTD_isError(nd))
+                                dataSize = nd;
+                        }
+#endif
                         if (r != Z_OK)
                         {
                             snprintf(errmsg, MAXRBUF, "INDI: %s.%s.%s compression error: %d", blobEL->bvp->device, blobEL->bvp->name, blobEL->name, r);
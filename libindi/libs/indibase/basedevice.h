@@ -164,10 +164,12 @@ protected:
       \return 0 if parsing is successful, -1 otherwise and errmsg is set */
     int buildProp(XMLEle *root, char *errmsg);
 
-    /** \brief handle SetXXX commands from client */
-    int setValue (XMLEle *root, char * errmsg);
-    /** \brief Parse and store BLOB in the respective vector */
-    int setBLOB(IBLOBVectorProperty *pp, XMLEle * root, char * errmsg);
+    /** \brief handle SetXXX commands from client
+        \param fds for a setBLOBVector with attached='true', the files holding each oneBLOB in order.
+        \param raw for a setBLOBVector with attached='binary', the bytes of each oneBLOB back to back. */
+    int setValue (XMLEle *root, char * errmsg, const int *fds = NULL, const char *raw = NULL);
+    /** \brief Parse and store BLOB in the respective vector, from fds or raw if given as for setValue() */
+    int setBLOB(IBLOBVectorProperty *pp, XMLEle * root, char * errmsg, const int *fds = NULL, const char *raw = NULL);
 
 private:
 
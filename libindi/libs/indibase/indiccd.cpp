@@ -23,6 +23,8 @@
 *******************************************************************************/
 
 #include "indiccd.h"
+#include "config.h"
+#include "guidestar.h"
 
 #include <string.h>
 #include <time.h>
@@ -30,18 +32,295 @@
 #include <zlib.h>
 #include <errno.h>
 #include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include <fitsio.h>
 
+#ifdef HAVE_LZ4_H
+#include <lz4.h>
+#include <lz4hc.h>
+#endif
+
+#ifdef HAVE_ZSTD_H
+#include <zstd.h>
+#endif
+
 const char *IMAGE_SETTINGS_TAB  = "Image Settings";
 const char *IMAGE_INFO_TAB      = "Image Info";
 const char *GUIDE_HEAD_TAB      = "Guider Head";
 const char *GUIDE_CONTROL_TAB   = "Guider Control";
 const char *RAPIDGUIDE_TAB      = "Rapid Guide";
 
+#define MAXUPLOADS  2           /* images queued for upload before ExposureComplete waits */
+#define ZCHUNK      (1<<20)     /* bytes compressed by each thread at a time */
+#define ZWINDOW     32768       /* deflate window, primed from the previous chunk */
+#define MAXZTHREADS 16          /* most threads used to compress one image */
+
+/* one image handed from ExposureComplete to the upload thread.
+ * the BLOB property is copied so the upload never touches the chip's
+ * properties, which the driver keeps using for the next exposure.
+ * the compression figures of every codec, Rice included, are handed back
+ * to the driver thread to report once the image is out.
+ */
+struct INDI::CCD::UploadJob
+{
+    INDI::CCD *ccd;
+    CCDChip *chip;
+    void *data;                         /* FITS or raw image, malloced */
+    size_t len;
+    bool sendImage, saveImage, compress;
+    CCDChip::CCD_COMPRESSION compressType;
+    int compressLevel;
+    char ext[MAXINDIBLOBFMT];           /* image extension, sans '.' */
+    std::string dir, prefix;            /* UploadSettingsT when queued */
+    IBLOBVectorProperty bvp;
+    IBLOB blob;
+    bool saved;
+    bool compressed;                    /* compressRatio and compressTime are set */
+    double compressRatio, compressTime; /* ms */
+    UploadJob *next;
+};
+
+/* compression figures of one image, posted to the driver thread */
+struct INDI::CCD::CompressInfo
+{
+    CCDChip *chip;
+    double ratio, time;
+};
+
+/* one deflate chunk of a parallel compression */
+typedef struct
+{
+    const unsigned char *in;            /* chunk start, ZWINDOW before is dictionary */
+    size_t inlen;
+    int first, last;
+    unsigned char *out;
+    size_t outlen;
+    uLong adler;                        /* adler32 of this chunk alone */
+    int ok;
+} ZChunk;
+
+typedef struct
+{
+    ZChunk *chunks;
+    int nchunks;
+    int nextchunk;
+    int level;
+    pthread_mutex_t lock;
+} ZJob;
+
+/* raw deflate one chunk, ending on a byte boundary unless it is the last so
+ * the chunks may simply be joined. each chunk starts with the window of data
+ * before it as dictionary, so the ratio is close to a single stream.
+ */
+static void deflateChunk (ZChunk *cp, int level)
+{
+    z_stream zs;
+    size_t bound;
+
+    cp->ok = 0;
+    memset (&zs, 0, sizeof(zs));
+    if (deflateInit2 (&zs, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return;
+
+    if (!cp->first)
+    {
+        const unsigned char *dict = cp->in - ZWINDOW;
+        deflateSetDictionary (&zs, dict, ZWINDOW);
+    }
+
+    bound = deflateBound (&zs, cp->inlen) + 16;
+    cp->out = (unsigned char *) malloc (bound);
+    if (!cp->out)
+    {
+        deflateEnd (&zs);
+        return;
+    }
+
+    zs.next_in = (Bytef *) cp->in;
+    zs.avail_in = cp->inlen;
+    zs.next_out = cp->out;
+    zs.avail_out = bound;
+    if (deflate (&zs, cp->last ? Z_FINISH : Z_SYNC_FLUSH) == (cp->last ? Z_STREAM_END : Z_OK) && zs.avail_in == 0)
+    {
+        cp->outlen = bound - zs.avail_out;
+        cp->adler = adler32 (adler32 (0L, Z_NULL, 0), cp->in, cp->inlen);
+        cp->ok = 1;
+    }
+    deflateEnd (&zs);
+}
+
+/* compress chunks until none are left */
+static void *deflateThread (void *context)
+{
+    ZJob *jp = (ZJob *) context;
+
+    for (;;)
+    {
+        int i;
+
+        pthread_mutex_lock (&jp->lock);
+        i = jp->nextchunk++;
+        pthread_mutex_unlock (&jp->lock);
+        if (i >= jp->nchunks)
+            break;
+        deflateChunk (&jp->chunks[i], jp->level);
+    }
+
+    return NULL;
+}
+
+/* compress in[inlen] into a malloced zlib stream, spread over the available
+ * processors. the result is a single stream any inflate() can read.
+ * return 0 with *outp and *outlenp set, else -1.
+ */
+static int compressParallel (const unsigned char *in, size_t inlen, int level, unsigned char **outp, size_t *outlenp)
+{
+    pthread_t threads[MAXZTHREADS];
+    int nthreads, nstarted = 0;
+    ZJob job;
+    unsigned char *out, *op;
+    uLong adler;
+    size_t outlen;
+    int i, ok = 1;
+
+    job.nchunks = inlen ? (inlen + ZCHUNK - 1) / ZCHUNK : 1;
+    job.nextchunk = 0;
+    job.level = level;
+    job.chunks = (ZChunk *) calloc (job.nchunks, sizeof(ZChunk));
+    if (!job.chunks)
+        return -1;
+    pthread_mutex_init (&job.lock, NULL);
+
+    for (i = 0; i < job.nchunks; i++)
+    {
+        ZChunk *cp = &job.chunks[i];
+        cp->in = in + (size_t)i*ZCHUNK;
+        cp->inlen = (i == job.nchunks-1) ? inlen - (size_t)i*ZCHUNK : ZCHUNK;
+        cp->first = (i == 0);
+        cp->last = (i == job.nchunks-1);
+    }
+
+    nthreads = sysconf (_SC_NPROCESSORS_ONLN);
+    if (nthreads > job.nchunks)
+        nthreads = job.nchunks;
+    if (nthreads > MAXZTHREADS)
+        nthreads = MAXZTHREADS;
+
+    /* this thread does its share too */
+    for (i = 1; i < nthreads; i++)
+        if (pthread_create (&threads[nstarted], NULL, deflateThread, &job) == 0)
+            nstarted++;
+    deflateThread (&job);
+    for (i = 0; i < nstarted; i++)
+        pthread_join (threads[i], NULL);
+    pthread_mutex_destroy (&job.lock);
+
+    /* zlib header, joined chunks, then the combined adler32 */
+    outlen = 2 + 4;
+    for (i = 0; i < job.nchunks; i++)
+    {
+        ok &= job.chunks[i].ok;
+        outlen += job.chunks[i].outlen;
+    }
+
+    out = ok ? (unsigned char *) malloc (outlen) : NULL;
+    if (out)
+    {
+        op = out;
+        *op++ = 0x78;
+        *op++ = level == 1 ? 0x01 : level < 6 ? 0x5e : level == 6 ? 0x9c : 0xda;
+        adler = adler32 (0L, Z_NULL, 0);
+        for (i = 0; i < job.nchunks; i++)
+        {
+            memcpy (op, job.chunks[i].out, job.chunks[i].outlen);
+            op += job.chunks[i].outlen;
+            adler = adler32_combine (adler, job.chunks[i].adler, job.chunks[i].inlen);
+        }
+        *op++ = adler >> 24;
+        *op++ = adler >> 16;
+        *op++ = adler >> 8;
+        *op++ = adler;
+        *outp = out;
+        *outlenp = outlen;
+    }
+
+    for (i = 0; i < job.nchunks; i++)
+        free (job.chunks[i].out);
+    free (job.chunks);
+
+    return out ? 0 : -1;
+}
+
+/* compress in[inlen] into a malloced buffer with the given codec and level.
+ * set *suffix to the BLOB format suffix naming the codec.
+ * return 0 with *outp and *outlenp set, else -1.
+ */
+static int compressImage (CCDChip::CCD_COMPRESSION type, int level, const unsigned char *in, size_t inlen,
+                          unsigned char **outp, size_t *outlenp, const char **suffix)
+{
+    switch (type)
+    {
+#ifdef HAVE_LZ4_H
+    case CCDChip::LZ4_COMPRESSION:
+    {
+        int bound = LZ4_compressBound (inlen);
+        int n;
+        unsigned char *out;
+
+        if (bound <= 0 || (out = (unsigned char *) malloc (bound)) == NULL)
+            return -1;
+        /* level 1 is plain LZ4, higher levels use the slower HC matcher */
+        if (level <= 1)
+            n = LZ4_compress_default ((const char *)in, (char *)out, inlen, bound);
+        else
+            n = LZ4_compress_HC ((const char *)in, (char *)out, inlen, bound, level > LZ4HC_CLEVEL_MAX ? LZ4HC_CLEVEL_MAX : level);
+        if (n <= 0)
+        {
+            free (out);
+            return -1;
+        }
+        *outp = out;
+        *outlenp = n;
+        *suffix = ".lz4";
+        return 0;
+    }
+#endif
+
+#ifdef HAVE_ZSTD_H
+    case CCDChip::ZSTD_COMPRESSION:
+    {
+        size_t bound = ZSTD_compressBound (inlen);
+        size_t n;
+        unsigned char *out = (unsigned char *) malloc (bound);
+
+        if (out == NULL)
+            return -1;
+        n = ZSTD_compress (out, bound, in, inlen, level > ZSTD_maxCLevel() ? ZSTD_maxCLevel() : level);
+        if (ZSTD_isError (n))
+        {
+            free (out);
+            return -1;
+        }
+        *outp = out;
+        *outlenp = n;
+        *suffix = ".zst";
+        return 0;
+    }
+#endif
+
+    default:
+        *suffix = ".z";
+        return compressParallel (in, inlen, level > 9 ? 9 : level, outp, outlenp);
+    }
+}
+
 CCDChip::CCDChip()
 {
     SendCompressed=false;
+    CompressType=ZLIB_COMPRESSION;
+    CompressLevel=9;
     Interlaced=false;
 
     RawFrame= (char *) malloc(sizeof(char)); // Seed for realloc
@@ -62,6 +341,9 @@ CCDChip::CCDChip()
     ImageBinNP = new INumberVectorProperty;
     ImagePixelSizeNP = new INumberVectorProperty;
     CompressSP = new ISwitchVectorProperty;
+    CompressTypeSP = new ISwitchVectorProperty;
+    CompressLevelNP = new INumberVectorProperty;
+    CompressInfoNP = new INumberVectorProperty;
     FitsBP = new IBLOBVectorProperty;
     RapidGuideSP = new ISwitchVectorProperty;
     RapidGuideSetupSP = new ISwitchVectorProperty;
@@ -82,6 +364,9 @@ CCDChip::~CCDChip()
     delete ImageBinNP;
     delete ImagePixelSizeNP;
     delete CompressSP;
+    delete CompressTypeSP;
+    delete CompressLevelNP;
+    delete CompressInfoNP;
     delete FitsBP;
     delete RapidGuideSP;
     delete RapidGuideSetupSP;
@@ -275,10 +560,30 @@ INDI::CCD::CCD()
     RA=-1000;
     Dec=-1000;
     ActiveDeviceTP = new ITextVectorProperty;
+
+    pthread_mutex_init(&uploadMutex, NULL);
+    pthread_cond_init(&uploadCond, NULL);
+    uploadQueue = NULL;
+    uploadsPending = 0;
+    uploadThreadRunning = false;
+    uploadQuit = false;
 }
 
 INDI::CCD::~CCD()
 {
+    //  Let queued images go out before we go away
+    if (uploadThreadRunning)
+    {
+        pthread_mutex_lock(&uploadMutex);
+        uploadQuit = true;
+        pthread_cond_broadcast(&uploadCond);
+        pthread_mutex_unlock(&uploadMutex);
+        pthread_join(uploadThread, NULL);
+    }
+
+    pthread_cond_destroy(&uploadCond);
+    pthread_mutex_destroy(&uploadMutex);
+
     delete ActiveDeviceTP;
 }
 
@@ -338,6 +643,19 @@ bool INDI::CCD::initProperties()
     IUFillSwitchVector(PrimaryCCD.CompressSP,PrimaryCCD.CompressS,2,getDeviceName(),"CCD_COMPRESSION","Image",IMAGE_SETTINGS_TAB,IP_RW,ISR_1OFMANY,60,IPS_IDLE);
     PrimaryCCD.SendCompressed = true;
 
+    IUFillSwitch(&PrimaryCCD.CompressTypeS[CCDChip::ZLIB_COMPRESSION],"ZLIB","Zlib",ISS_ON);
+    IUFillSwitch(&PrimaryCCD.CompressTypeS[CCDChip::LZ4_COMPRESSION],"LZ4","LZ4",ISS_OFF);
+    IUFillSwitch(&PrimaryCCD.CompressTypeS[CCDChip::ZSTD_COMPRESSION],"ZSTD","Zstd",ISS_OFF);
+    IUFillSwitch(&PrimaryCCD.CompressTypeS[CCDChip::RICE_COMPRESSION],"RICE","Rice",ISS_OFF);
+    IUFillSwitchVector(PrimaryCCD.CompressTypeSP,PrimaryCCD.CompressTypeS,4,getDeviceName(),"CCD_COMPRESSION_TYPE","Codec",IMAGE_SETTINGS_TAB,IP_RW,ISR_1OFMANY,60,IPS_IDLE);
+
+    IUFillNumber(&PrimaryCCD.CompressLevelN[0],"COMPRESSION_LEVEL","Level","%2.0f",1,22,1,9);
+    IUFillNumberVector(PrimaryCCD.CompressLevelNP,PrimaryCCD.CompressLevelN,1,getDeviceName(),"CCD_COMPRESSION_LEVEL","Compression",IMAGE_SETTINGS_TAB,IP_RW,60,IPS_IDLE);
+
+    IUFillNumber(&PrimaryCCD.CompressInfoN[CCDChip::COMPRESSION_RATIO],"COMPRESSION_RATIO","Ratio","%5.2f",0,1000,0,0);
+    IUFillNumber(&PrimaryCCD.CompressInfoN[CCDChip::COMPRESSION_TIME],"COMPRESSION_TIME","Time (ms)","%7.1f",0,1e6,0,0);
+    IUFillNumberVector(PrimaryCCD.CompressInfoNP,PrimaryCCD.CompressInfoN,2,getDeviceName(),"CCD_COMPRESSION_INFO","Last Frame",IMAGE_INFO_TAB,IP_RO,60,IPS_IDLE);
+
     IUFillBLOB(&PrimaryCCD.FitsB,"CCD1","Image","");
     IUFillBLOBVector(PrimaryCCD.FitsBP,&PrimaryCCD.FitsB,1,getDeviceName(),"CCD1","Image Data",IMAGE_INFO_TAB,IP_RO,60,IPS_IDLE);
 
@@ -392,6 +710,19 @@ bool INDI::CCD::initProperties()
     IUFillSwitchVector(GuideCCD.CompressSP,GuideCCD.CompressS,2,getDeviceName(),"GUIDER_COMPRESSION","Image",GUIDE_HEAD_TAB,IP_RW,ISR_1OFMANY,60,IPS_IDLE);
     GuideCCD.SendCompressed = true;
 
+    IUFillSwitch(&GuideCCD.CompressTypeS[CCDChip::ZLIB_COMPRESSION],"GZLIB","Zlib",ISS_ON);
+    IUFillSwitch(&GuideCCD.CompressTypeS[CCDChip::LZ4_COMPRESSION],"GLZ4","LZ4",ISS_OFF);
+    IUFillSwitch(&GuideCCD.CompressTypeS[CCDChip::ZSTD_COMPRESSION],"GZSTD","Zstd",ISS_OFF);
+    IUFillSwitch(&GuideCCD.CompressTypeS[CCDChip::RICE_COMPRESSION],"GRICE","Rice",ISS_OFF);
+    IUFillSwitchVector(GuideCCD.CompressTypeSP,GuideCCD.CompressTypeS,4,getDeviceName(),"GUIDER_COMPRESSION_TYPE","Codec",GUIDE_HEAD_TAB,IP_RW,ISR_1OFMANY,60,IPS_IDLE);
+
+    IUFillNumber(&GuideCCD.CompressLevelN[0],"GCOMPRESSION_LEVEL","Level","%2.0f",1,22,1,9);
+    IUFillNumberVector(GuideCCD.CompressLevelNP,GuideCCD.CompressLevelN,1,getDeviceName(),"GUIDER_COMPRESSION_LEVEL","Compression",GUIDE_HEAD_TAB,IP_RW,60,IPS_IDLE);
+
+    IUFillNumber(&GuideCCD.CompressInfoN[CCDChip::COMPRESSION_RATIO],"GCOMPRESSION_RATIO","Ratio","%5.2f",0,1000,0,0);
+    IUFillNumber(&GuideCCD.CompressInfoN[CCDChip::COMPRESSION_TIME],"GCOMPRESSION_TIME","Time (ms)","%7.1f",0,1e6,0,0);
+    IUFillNumberVector(GuideCCD.CompressInfoNP,GuideCCD.CompressInfoN,2,getDeviceName(),"GUIDER_COMPRESSION_INFO","Last Frame",IMAGE_INFO_TAB,IP_RO,60,IPS_IDLE);
+
     IUFillBLOB(&GuideCCD.FitsB,"CCD2","Guider Image","");
     IUFillBLOBVector(GuideCCD.FitsBP,&GuideCCD.FitsB,1,getDeviceName(),"CCD2","Image Data",IMAGE_INFO_TAB,IP_RO,60,IPS_IDLE);
 
@@ -485,10 +816,16 @@ bool INDI::CCD::updateProperties()
                 defineNumber(GuideCCD.ImageBinNP);
         }
         defineSwitch(PrimaryCCD.CompressSP);
+        defineSwitch(PrimaryCCD.CompressTypeSP);
+        defineNumber(PrimaryCCD.CompressLevelNP);
+        defineNumber(PrimaryCCD.CompressInfoNP);
         defineBLOB(PrimaryCCD.FitsBP);
         if(capability.hasGuideHead)
         {
             defineSwitch(GuideCCD.CompressSP);
+            defineSwitch(GuideCCD.CompressTypeSP);
+            defineNumber(GuideCCD.CompressLevelNP);
+            defineNumber(GuideCCD.CompressInfoNP);
             defineBLOB(GuideCCD.FitsBP);
         }
         if(capability.hasST4Port)
@@ -536,6 +873,9 @@ bool INDI::CCD::updateProperties()
             deleteProperty(PrimaryCCD.AbortExposureSP->name);
         deleteProperty(PrimaryCCD.FitsBP->name);
         deleteProperty(PrimaryCCD.CompressSP->name);
+        deleteProperty(PrimaryCCD.CompressTypeSP->name);
+        deleteProperty(PrimaryCCD.CompressLevelNP->name);
+        deleteProperty(PrimaryCCD.CompressInfoNP->name);
         deleteProperty(PrimaryCCD.RapidGuideSP->name);
         if (RapidGuideEnabled)
         {
@@ -554,6 +894,9 @@ bool INDI::CCD::updateProperties()
             if (capability.canBin)
                 deleteProperty(GuideCCD.ImageBinNP->name);
             deleteProperty(GuideCCD.CompressSP->name);
+            deleteProperty(GuideCCD.CompressTypeSP->name);
+            deleteProperty(GuideCCD.CompressLevelNP->name);
+            deleteProperty(GuideCCD.CompressInfoNP->name);
             deleteProperty(GuideCCD.FrameTypeSP->name);
             deleteProperty(GuideCCD.RapidGuideSP->name);
             if (GuiderRapidGuideEnabled)
@@ -848,6 +1191,18 @@ bool INDI::CCD::ISNewNumber (const char *dev, const char *name, double values[],
             return true;
         }
 
+        if (!strcmp(name, PrimaryCCD.CompressLevelNP->name) || !strcmp(name, GuideCCD.CompressLevelNP->name))
+        {
+            CCDChip *targetChip = strcmp(name, PrimaryCCD.CompressLevelNP->name) ? &GuideCCD : &PrimaryCCD;
+
+            if (IUUpdateNumber(targetChip->CompressLevelNP, values, names, n) < 0)
+                return false;
+            targetChip->CompressLevel = (int) targetChip->CompressLevelN[0].value;
+            targetChip->CompressLevelNP->s = IPS_OK;
+            IDSetNumber(targetChip->CompressLevelNP, NULL);
+            return true;
+        }
+
         // Guide CCD Info
         if (!strcmp(name, GuideCCD.ImagePixelSizeNP->name))
         {
@@ -963,6 +1318,36 @@ bool INDI::CCD::ISNewSwitch (const char *dev, const char *name, ISState *states,
             return true;
         }
 
+        if(strcmp(name,PrimaryCCD.CompressTypeSP->name)==0 || strcmp(name,GuideCCD.CompressTypeSP->name)==0)
+        {
+            CCDChip *targetChip = strcmp(name,PrimaryCCD.CompressTypeSP->name) ? &GuideCCD : &PrimaryCCD;
+
+            IUUpdateSwitch(targetChip->CompressTypeSP,states,names,n);
+            int type = IUFindOnSwitchIndex(targetChip->CompressTypeSP);
+
+#ifndef HAVE_LZ4_H
+            if (type == CCDChip::LZ4_COMPRESSION)
+                type = -1;
+#endif
+#ifndef HAVE_ZSTD_H
+            if (type == CCDChip::ZSTD_COMPRESSION)
+                type = -1;
+#endif
+            if (type < 0)
+            {
+                IUResetSwitch(targetChip->CompressTypeSP);
+                targetChip->CompressTypeS[targetChip->CompressType].s = ISS_ON;
+                targetChip->CompressTypeSP->s = IPS_ALERT;
+                IDSetSwitch(targetChip->CompressTypeSP, "This codec is not available in this build of INDI.");
+                return false;
+            }
+
+            targetChip->CompressType = (CCDChip::CCD_COMPRESSION) type;
+            targetChip->CompressTypeSP->s = IPS_OK;
+            IDSetSwitch(targetChip->CompressTypeSP,NULL);
+            return true;
+        }
+
         if(strcmp(name,PrimaryCCD.FrameTypeSP->name)==0)
         {
             IUUpdateSwitch(PrimaryCCD.FrameTypeSP,states,names,n);
@@ -1267,16 +1652,12 @@ bool INDI::CCD::ExposureComplete(CCDChip *targetChip)
     
     if (sendData)
     {
-      static double P0 = 0.906, P1 = 0.584, P2 = 0.365, P3 = 0.117, P4 = 0.049, P5 = -0.05, P6 = -0.064, P7 = -0.074, P8 = -0.094;
       targetChip->RapidGuideDataNP->s=IPS_BUSY;
       int width = targetChip->getSubW() / targetChip->getBinX();
       int height = targetChip->getSubH() / targetChip->getBinY();
       unsigned short *src = (unsigned short *) targetChip->getFrameBuffer();
-      int i0, i1, i2, i3, i4, i5, i6, i7, i8;
-      int ix = 0, iy = 0;
-      int xM4;
       unsigned short *p;
-      double average, fit, bestFit = 0;
+      GuideStar star;
       int minx = 4;
       int maxx = width -4;
       int miny = 4;
@@ -1287,62 +1668,22 @@ bool INDI::CCD::ExposureComplete(CCDChip *targetChip)
         miny = std::max(targetChip->lastRapidY - 20, 4);
         maxy = std::min(targetChip->lastRapidY + 20, height -4);
       }
-      for (int x = minx; x < maxx; x++)
-        for (int y = miny; y < maxy; y++)
-        {
-          i0 = i1 = i2 = i3 = i4 = i5 = i6 = i7 = i8 = 0;
-          xM4 = x - 4; 
-          p = src + (y - 4) * width + xM4; i8 += *p++; i8 += *p++; i8 += *p++; i8 += *p++; i8 += *p++; i8 += *p++; i8 += *p++; i8 += *p++; i8 += *p++;
-          p = src + (y - 3) * width + xM4; i8 += *p++; i8 += *p++; i8 += *p++; i7 += *p++; i6 += *p++; i7 += *p++; i8 += *p++; i8 += *p++; i8 += *p++;
-          p = src + (y - 2) * width + xM4; i8 += *p++; i8 += *p++; i5 += *p++; i4 += *p++; i3 += *p++; i4 += *p++; i5 += *p++; i8 += *p++; i8 += *p++;
-          p = src + (y - 1) * width + xM4; i8 += *p++; i7 += *p++; i4 += *p++; i2 += *p++; i1 += *p++; i2 += *p++; i4 += *p++; i8 += *p++; i8 += *p++;
-          p = src + (y + 0) * width + xM4; i8 += *p++; i6 += *p++; i3 += *p++; i1 += *p++; i0 += *p++; i1 += *p++; i3 += *p++; i6 += *p++; i8 += *p++;
-          p = src + (y + 1) * width + xM4; i8 += *p++; i7 += *p++; i4 += *p++; i2 += *p++; i1 += *p++; i2 += *p++; i4 += *p++; i8 += *p++; i8 += *p++;
-          p = src + (y + 2) * width + xM4; i8 += *p++; i8 += *p++; i5 += *p++; i4 += *p++; i3 += *p++; i4 += *p++; i5 += *p++; i8 += *p++; i8 += *p++;
-          p = src + (y + 3) * width + xM4; i8 += *p++; i8 += *p++; i8 += *p++; i7 += *p++; i6 += *p++; i7 += *p++; i8 += *p++; i8 += *p++; i8 += *p++;
-          p = src + (y + 4) * width + xM4; i8 += *p++; i8 += *p++; i8 += *p++; i8 += *p++; i8 += *p++; i8 += *p++; i8 += *p++; i8 += *p++; i8 += *p++;
-          average = (i0 + i1 + i2 + i3 + i4 + i5 + i6 + i7 + i8) / 85.0;
-          fit = P0 * (i0 - average) + P1 * (i1 - 4 * average) + P2 * (i2 - 4 * average) + P3 * (i3 - 4 * average) + P4 * (i4 - 8 * average) + P5 * (i5 - 4 * average) + P6 * (i6 - 4 * average) + P7 * (i7 - 8 * average) + P8 * (i8 - 48 * average);
-          if (bestFit < fit)
-          {
-            bestFit = fit;
-            ix = x;
-            iy = y;
-          }
-        }
+      findGuideStar(src, width, height, minx, maxx, miny, maxy, 0, &star);
+      int ix = star.ix, iy = star.iy;
 
       targetChip->RapidGuideDataN[0].value = ix;
       targetChip->RapidGuideDataN[1].value = iy;
-      targetChip->RapidGuideDataN[2].value = bestFit;
+      targetChip->RapidGuideDataN[2].value = star.fit;
       targetChip->lastRapidX = ix;
       targetChip->lastRapidY = iy;
-      if (bestFit > 50)
-      {        
-        double sumX = 0;
-        double sumY = 0;
-        double total = 0;
-        for (int y = iy - 4; y <= iy + 4; y++) {
-          p = src + y * width + ix - 4;
-          for (int x = ix - 4; x <= ix + 4; x++) {
-            double w = *p++;
-            sumX += x * w;
-            sumY += y * w;
-            total += w;
-          }
-        }
-        if (total > 0)
-        {    
-          targetChip->RapidGuideDataN[0].value = sumX/total;
-          targetChip->RapidGuideDataN[1].value = sumY/total;
+      if (star.fit > 50 && centroidGuideStar(src, width, height, &star) == 0)
+      {
+          targetChip->RapidGuideDataN[0].value = star.x;
+          targetChip->RapidGuideDataN[1].value = star.y;
           targetChip->RapidGuideDataNP->s=IPS_OK;
 
           DEBUGF(INDI::Logger::DBG_DEBUG, "Guide Star X: %g Y: %g FIT: %g", targetChip->RapidGuideDataN[0].value, targetChip->RapidGuideDataN[1].value,
                   targetChip->RapidGuideDataN[2].value);
-        }
-        else {
-          targetChip->RapidGuideDataNP->s=IPS_ALERT;
-          targetChip->lastRapidX = targetChip->lastRapidY = -1;
-        }
       }
       else {
         targetChip->RapidGuideDataNP->s=IPS_ALERT;
@@ -1425,7 +1766,7 @@ bool INDI::CCD::ExposureComplete(CCDChip *targetChip)
                   break;
 
               case 32:
-                  byte_type = TULONG;
+                  byte_type = TUINT;
                   img_type = ULONG_IMG;
                   bit_depth = "32 bits per pixel";
                   break;
@@ -1463,6 +1804,15 @@ bool INDI::CCD::ExposureComplete(CCDChip *targetChip)
             return false;
           }
 
+          //  Rice is applied by CFITSIO to tiles of the image as it is written
+          bool riceCompressed = targetChip->SendCompressed && targetChip->CompressType == CCDChip::RICE_COMPRESSION;
+          struct timeval riceStart;
+          if (riceCompressed)
+          {
+              gettimeofday(&riceStart, NULL);
+              fits_set_compression_type(fptr, RICE_1, &status);
+          }
+
           fits_create_img(fptr, img_type , naxis, naxes, &status);
 
           if (status)
@@ -1485,13 +1835,31 @@ bool INDI::CCD::ExposureComplete(CCDChip *targetChip)
 
           fits_close_file(fptr,&status);
 
-          uploadFile(targetChip, memptr, memsize, sendImage, saveImage);
-
-          free(memptr);
+          //  Rice figures go with the image so frames are reported in order
+          if (riceCompressed)
+          {
+              struct timeval riceEnd;
+              gettimeofday(&riceEnd, NULL);
+              CompressInfo rice = { targetChip, (double) nelements * (targetChip->getBPP()/8) / memsize,
+                                    (riceEnd.tv_sec - riceStart.tv_sec)*1e3 + (riceEnd.tv_usec - riceStart.tv_usec)/1e3 };
+              uploadFile(targetChip, memptr, memsize, sendImage, saveImage, &rice);
+          }
+          else
+              uploadFile(targetChip, memptr, memsize, sendImage, saveImage);
       }
       else
       {
-          uploadFile(targetChip, targetChip->getFrameBuffer(), targetChip->getFrameBufferSize(), sendImage, saveImage);
+          //  Copy the frame so the driver may reuse its buffer while we upload
+          size_t rawsize = targetChip->getFrameBufferSize();
+          void *rawptr = malloc(rawsize);
+          if (rawptr == NULL)
+          {
+              DEBUG(INDI::Logger::DBG_ERROR, "Error: Ran out of memory copying image");
+              return false;
+          }
+          memcpy(rawptr, targetChip->getFrameBuffer(), rawsize);
+
+          uploadFile(targetChip, rawptr, rawsize, sendImage, saveImage);
       }
 
 
@@ -1535,91 +1903,257 @@ bool INDI::CCD::ExposureComplete(CCDChip *targetChip)
     return true;
 }
 
-bool INDI::CCD::uploadFile(CCDChip * targetChip, const void *fitsData, size_t totalBytes, bool sendImage, bool saveImage)
+bool INDI::CCD::uploadFile(CCDChip * targetChip, void *fitsData, size_t totalBytes, bool sendImage, bool saveImage,
+                           const CompressInfo *rice)
 {
-    unsigned char *compressedData = NULL;
-    uLongf compressedBytes=0;
-
-    if (saveImage)
+    UploadJob *job = new UploadJob;
+
+    //  fitsData is ours now, the upload thread frees it once sent and saved
+    job->ccd = this;
+    job->chip = targetChip;
+    job->data = fitsData;
+    job->len = totalBytes;
+    job->sendImage = sendImage;
+    job->saveImage = saveImage;
+    job->compress = targetChip->SendCompressed;
+    job->compressType = targetChip->CompressType;
+    job->compressLevel = targetChip->CompressLevel;
+    strncpy(job->ext, targetChip->getImageExtension(), MAXINDIBLOBFMT);
+    job->ext[MAXINDIBLOBFMT-1] = '\0';
+
+    //  Rice FITS files are already compressed, other images fall back to zlib
+    if (job->compress && job->compressType == CCDChip::RICE_COMPRESSION)
     {
-        targetChip->FitsB.blob=(unsigned char *)fitsData;
-        targetChip->FitsB.bloblen=totalBytes;
-        snprintf(targetChip->FitsB.format, MAXINDIBLOBFMT, ".%s", targetChip->getImageExtension());
-
-        FILE *fp = NULL;
-        char imageFileName[MAXRBUF];
-        std::string prefix = UploadSettingsT[1].text;
-        int maxIndex = getFileIndex(UploadSettingsT[0].text, UploadSettingsT[1].text, targetChip->FitsB.format);
-
-        if (maxIndex < 0)
+        if (!strcmp(job->ext, "fits"))
         {
-            DEBUGF(INDI::Logger::DBG_ERROR, "Error iterating directory %s. %s", UploadSettingsT[0].text, strerror(errno));
-            return false;
+            strncpy(job->ext, "fits.fz", MAXINDIBLOBFMT);
+            job->compress = false;
         }
+        else
+            job->compressType = CCDChip::ZLIB_COMPRESSION;
+    }
+    job->dir = UploadSettingsT[0].text;
+    job->prefix = UploadSettingsT[1].text;
+    job->saved = false;
+    job->compressed = rice != NULL;
+    if (rice)
+    {
+        job->compressRatio = rice->ratio;
+        job->compressTime = rice->time;
+    }
+    job->next = NULL;
 
-        if (maxIndex > 0)
+    targetChip->FitsBP->s=IPS_OK;
+    job->blob = targetChip->FitsB;
+    job->bvp = *targetChip->FitsBP;
+    job->bvp.bp = &job->blob;
+    job->bvp.nbp = 1;
+    job->blob.bvp = &job->bvp;
+
+    pthread_mutex_lock(&uploadMutex);
+
+    if (!uploadThreadRunning)
+    {
+        if (pthread_create(&uploadThread, NULL, uploadThreadHelper, this) != 0)
         {
-            char indexString[3];
-            snprintf(indexString, 3, "%02d", maxIndex);
-            std::string prefixIndex = indexString;
-            prefix.replace(prefix.find("XX"), 2, prefixIndex);
+            //  No thread, upload in line as before
+            pthread_mutex_unlock(&uploadMutex);
+            processUpload(job);
+            if (job->compressed)
+            {
+                CompressInfo info = { job->chip, job->compressRatio, job->compressTime };
+                setCompressInfo(&info);
+            }
+            free(job->data);
+            delete job;
+            return true;
         }
+        uploadThreadRunning = true;
+    }
+
+    //  Wait for a free slot so at most MAXUPLOADS images are held
+    while (uploadsPending >= MAXUPLOADS)
+        pthread_cond_wait(&uploadCond, &uploadMutex);
 
-        snprintf(imageFileName, MAXRBUF, "%s/%s%s", UploadSettingsT[0].text, prefix.c_str(), targetChip->FitsB.format);
-        fp = fopen(imageFileName, "w");
-        if (fp == NULL)
+    UploadJob **jpp = &uploadQueue;
+    while (*jpp)
+        jpp = &(*jpp)->next;
+    *jpp = job;
+    uploadsPending++;
+    pthread_cond_broadcast(&uploadCond);
+
+    pthread_mutex_unlock(&uploadMutex);
+
+    return true;
+}
+
+void *INDI::CCD::uploadThreadHelper(void *context)
+{
+    INDI::CCD *ccd = static_cast<INDI::CCD *>(context);
+
+    pthread_mutex_lock(&ccd->uploadMutex);
+
+    for (;;)
+    {
+        while (ccd->uploadQueue == NULL && !ccd->uploadQuit)
+            pthread_cond_wait(&ccd->uploadCond, &ccd->uploadMutex);
+
+        UploadJob *job = ccd->uploadQueue;
+        if (job == NULL)
+            break;
+
+        pthread_mutex_unlock(&ccd->uploadMutex);
+        ccd->processUpload(job);
+
+        //  The chip's properties belong to the driver thread, report there
+        if (job->compressed)
         {
-            DEBUGF(INDI::Logger::DBG_ERROR, "Unable to save image file (%s). %s", imageFileName, strerror(errno));
-            return false;
+            CompressInfo *info = new CompressInfo;
+            info->chip = job->chip;
+            info->ratio = job->compressRatio;
+            info->time = job->compressTime;
+            if (IEPostEvent(compressInfoHelper, info) < 0)
+                delete info;
         }
 
-        int n=0;
-        for (int nr=0; nr < (int) targetChip->FitsB.bloblen; nr += n)
-            n = fwrite( (static_cast<char *>(targetChip->FitsB.blob) + nr), 1, targetChip->FitsB.bloblen - nr, fp);
+        pthread_mutex_lock(&ccd->uploadMutex);
+
+        //  Only now free the slot, the job held the image until sent
+        ccd->uploadQueue = job->next;
+        ccd->uploadsPending--;
+        pthread_cond_broadcast(&ccd->uploadCond);
 
-        DEBUGF(INDI::Logger::DBG_SESSION, "Image saved to %s", imageFileName);
-        fclose(fp);
+        free(job->data);
+        delete job;
     }
 
-    if (targetChip->SendCompressed)
+    pthread_mutex_unlock(&ccd->uploadMutex);
+
+    return NULL;
+}
+
+void INDI::CCD::compressInfoHelper(void *context)
+{
+    CompressInfo *info = static_cast<CompressInfo *>(context);
+
+    setCompressInfo(info);
+    delete info;
+}
+
+void INDI::CCD::setCompressInfo(const CompressInfo *info)
+{
+    info->chip->CompressInfoN[CCDChip::COMPRESSION_RATIO].value = info->ratio;
+    info->chip->CompressInfoN[CCDChip::COMPRESSION_TIME].value = info->time;
+    info->chip->CompressInfoNP->s = IPS_OK;
+    IDSetNumber(info->chip->CompressInfoNP, NULL);
+}
+
+void *INDI::CCD::saveThreadHelper(void *context)
+{
+    UploadJob *job = static_cast<UploadJob *>(context);
+
+    job->saved = job->ccd->saveUpload(job);
+
+    return NULL;
+}
+
+void INDI::CCD::processUpload(UploadJob *job)
+{
+    unsigned char *compressedData = NULL;
+    size_t compressedBytes=0;
+    pthread_t saveThread;
+    bool saveThreadStarted = false;
+
+    //  Write the file while we compress and send
+    if (job->saveImage)
     {
-        compressedBytes = sizeof(char) * totalBytes + totalBytes / 64 + 16 + 3;
-        compressedData = (unsigned char *) malloc (compressedBytes);
+        if (pthread_create(&saveThread, NULL, saveThreadHelper, job) == 0)
+            saveThreadStarted = true;
+        else
+            saveUpload(job);
+    }
 
-        if (fitsData == NULL || compressedData == NULL)
+    if (job->sendImage)
+    {
+        if (job->compress)
         {
-            if (compressedData)
-                free(compressedData);
-            DEBUG(INDI::Logger::DBG_ERROR, "Error: Ran out of memory compressing image");
-            return false;
-        }
+            const char *suffix;
+            struct timeval start, end;
 
-        int r = compress2(compressedData, &compressedBytes, (const Bytef*)fitsData, totalBytes, 9);
-        if (r != Z_OK)
+            gettimeofday(&start, NULL);
+            if (compressImage(job->compressType, job->compressLevel, (const unsigned char *) job->data, job->len,
+                              &compressedData, &compressedBytes, &suffix) < 0)
+                DEBUG(INDI::Logger::DBG_ERROR, "Error: Failed to compress image");
+            else
+            {
+                gettimeofday(&end, NULL);
+
+                job->blob.blob=compressedData;
+                job->blob.bloblen=compressedBytes;
+                snprintf(job->blob.format, MAXINDIBLOBFMT, ".%s%s", job->ext, suffix);
+
+                job->compressRatio = (double) job->len / compressedBytes;
+                job->compressTime = (end.tv_sec - start.tv_sec)*1e3 + (end.tv_usec - start.tv_usec)/1e3;
+                job->compressed = true;
+            }
+        } else
         {
-            /* this should NEVER happen */
-            DEBUG(INDI::Logger::DBG_ERROR, "Error: Failed to compress image");
-            return false;
+            job->blob.blob=job->data;
+            job->blob.bloblen=job->len;
+            snprintf(job->blob.format, MAXINDIBLOBFMT, ".%s", job->ext);
         }
 
-        targetChip->FitsB.blob=compressedData;
-        targetChip->FitsB.bloblen=compressedBytes;
-        snprintf(targetChip->FitsB.format, MAXINDIBLOBFMT, ".%s.z", targetChip->getImageExtension());
-    } else
+        job->blob.size = job->len;
+
+        if (!job->compress || compressedData)
+            IDSetBLOB(&job->bvp, NULL);
+
+        if (compressedData)
+            free (compressedData);
+    }
+
+    if (saveThreadStarted)
+        pthread_join(saveThread, NULL);
+}
+
+bool INDI::CCD::saveUpload(UploadJob *job)
+{
+    FILE *fp = NULL;
+    char imageFileName[MAXRBUF];
+    char format[MAXINDIBLOBFMT];
+    std::string prefix = job->prefix;
+
+    snprintf(format, MAXINDIBLOBFMT, ".%s", job->ext);
+    int maxIndex = getFileIndex(job->dir.c_str(), job->prefix.c_str(), format);
+
+    if (maxIndex < 0)
     {
-        targetChip->FitsB.blob=(unsigned char *)fitsData;
-        targetChip->FitsB.bloblen=totalBytes;
-        snprintf(targetChip->FitsB.format, MAXINDIBLOBFMT, ".%s", targetChip->getImageExtension());
+        DEBUGF(INDI::Logger::DBG_ERROR, "Error iterating directory %s. %s", job->dir.c_str(), strerror(errno));
+        return false;
     }
 
-    targetChip->FitsB.size = totalBytes;
-    targetChip->FitsBP->s=IPS_OK;
+    if (maxIndex > 0)
+    {
+        char indexString[3];
+        snprintf(indexString, 3, "%02d", maxIndex);
+        std::string prefixIndex = indexString;
+        prefix.replace(prefix.find("XX"), 2, prefixIndex);
+    }
 
-    if (sendImage)
-        IDSetBLOB(targetChip->FitsBP,NULL);
+    snprintf(imageFileName, MAXRBUF, "%s/%s%s", job->dir.c_str(), prefix.c_str(), format);
+    fp = fopen(imageFileName, "w");
+    if (fp == NULL)
+    {
+        DEBUGF(INDI::Logger::DBG_ERROR, "Unable to save image file (%s). %s", imageFileName, strerror(errno));
+        return false;
+    }
+
+    int n=0;
+    for (int nr=0; nr < (int) job->len; nr += n)
+        n = fwrite( (static_cast<char *>(job->data) + nr), 1, job->len - nr, fp);
 
-    if (compressedData)
-        free (compressedData);
+    DEBUGF(INDI::Logger::DBG_SESSION, "Image saved to %s", imageFileName);
+    fclose(fp);
 
     return true;
 }
@@ -1653,9 +2187,15 @@ bool INDI::CCD::saveConfigItems(FILE *fp)
     IUSaveConfigText(fp, &UploadSettingsTP);
 
     IUSaveConfigSwitch(fp, PrimaryCCD.CompressSP);
+    IUSaveConfigSwitch(fp, PrimaryCCD.CompressTypeSP);
+    IUSaveConfigNumber(fp, PrimaryCCD.CompressLevelNP);
 
     if (capability.hasGuideHead)
+    {
         IUSaveConfigSwitch(fp, GuideCCD.CompressSP);
+        IUSaveConfigSwitch(fp, GuideCCD.CompressTypeSP);
+        IUSaveConfigNumber(fp, GuideCCD.CompressLevelNP);
+    }
 
     if (capability.canSubFrame)
         IUSaveConfigNumber(fp, PrimaryCCD.ImageFrameNP);
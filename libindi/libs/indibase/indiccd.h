@@ -28,6 +28,7 @@
 
 #include <fitsio.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "defaultdevice.h"
 #include "indiguiderinterface.h"
@@ -52,6 +53,8 @@ public:
     typedef enum { FRAME_X, FRAME_Y, FRAME_W, FRAME_H} CCD_FRAME_INDEX;
     typedef enum { BIN_W, BIN_H} CCD_BIN_INDEX;
     typedef enum { CCD_MAX_X, CCD_MAX_Y, CCD_PIXEL_SIZE, CCD_PIXEL_SIZE_X, CCD_PIXEL_SIZE_Y, CCD_BITSPERPIXEL} CCD_INFO_INDEX;
+    typedef enum { ZLIB_COMPRESSION=0, LZ4_COMPRESSION, ZSTD_COMPRESSION, RICE_COMPRESSION } CCD_COMPRESSION;
+    typedef enum { COMPRESSION_RATIO, COMPRESSION_TIME } CCD_COMPRESSION_INFO_INDEX;
 
     /**
      * @brief getXRes Get the horizontal resolution in pixels of the CCD Chip.
@@ -163,6 +166,20 @@ public:
      */
     inline bool isCompressed() { return SendCompressed; }
 
+    /**
+     * @brief getCompressionType
+     * @return Codec used when the frame is compressed.
+     * \note LZ4 and Zstd are only available if INDI was built with them. Rice compresses FITS tiles through CFITSIO,
+     *       so the FITS file is sent and saved as a compressed .fits.fz file.
+     */
+    inline CCD_COMPRESSION getCompressionType() { return CompressType; }
+
+    /**
+     * @brief getCompressionLevel
+     * @return Compression level, clamped to the range of the codec in use.
+     */
+    inline int getCompressionLevel() { return CompressLevel; }
+
     /**
      * @brief isInterlaced
      * @return True if CCD chip is Interlaced, false otherwise.
@@ -321,6 +338,8 @@ private:
     char *RawFrame;
     int RawFrameSize;
     bool SendCompressed;
+    CCD_COMPRESSION CompressType;
+    int CompressLevel;
     CCD_FRAME FrameType;
     double exposureDuration;
     timeval startExposureTime;
@@ -349,6 +368,15 @@ private:
     ISwitch CompressS[2];
     ISwitchVectorProperty *CompressSP;
 
+    ISwitch CompressTypeS[4];
+    ISwitchVectorProperty *CompressTypeSP;
+
+    INumber CompressLevelN[1];
+    INumberVectorProperty *CompressLevelNP;
+
+    INumber CompressInfoN[2];
+    INumberVectorProperty *CompressInfoNP;
+
     IBLOB FitsB;
     IBLOBVectorProperty *FitsBP;
 
@@ -459,6 +487,9 @@ class INDI::CCD : public INDI::DefaultDevice, INDI::GuiderInterface
         /** \brief Uploads target Chip exposed buffer as FITS to the client. Dervied classes should class this functon when an exposure is complete.
          * @param targetChip chip that contains upload image data
              \note This function is not implemented in INDI::CCD, it must be implemented in the child class
+             \note The FITS file is built from the frame buffer before returning, so the driver may start the next exposure into it right away.
+             Compressing, saving and sending the image are done by a background thread, so the BLOB may reach the client after the exposure is
+             reported complete.
         */
         virtual bool ExposureComplete(CCDChip *targetChip);
 
@@ -655,10 +686,29 @@ class INDI::CCD : public INDI::DefaultDevice, INDI::GuiderInterface
      private:
         Capability capability;
 
-        bool uploadFile(CCDChip * targetChip, const void *fitsData, size_t totalBytes, bool sendImage, bool saveImage);
+        struct UploadJob;
+        struct CompressInfo;
+
+        bool uploadFile(CCDChip * targetChip, void *fitsData, size_t totalBytes, bool sendImage, bool saveImage,
+                        const CompressInfo *rice = NULL);
+        void processUpload(UploadJob *job);
+        bool saveUpload(UploadJob *job);
+        static void *uploadThreadHelper(void *context);
+        static void *saveThreadHelper(void *context);
+        static void compressInfoHelper(void *context);
+        static void setCompressInfo(const CompressInfo *info);
         void getMinMax(double *min, double *max, CCDChip *targetChip);
         int getFileIndex(const char *dir, const char *prefix, const char *ext);
 
+        //  Images waiting for the upload thread. At most two are held so a
+        //  slow link throttles the driver instead of using up memory.
+        pthread_t uploadThread;
+        pthread_mutex_t uploadMutex;
+        pthread_cond_t uploadCond;
+        UploadJob *uploadQueue;
+        int uploadsPending;
+        bool uploadThreadRunning;
+        bool uploadQuit;
 
 };
 
@@ -21,8 +21,16 @@
 #include "indilogger.h"
 #include <indicom.h>
 #include <cstdio>
-
+#include <errno.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
 #include <iostream>
+#include <vector>
 
 namespace INDI
 {
@@ -253,6 +261,260 @@ void Logger::lock(){}
 void Logger::unlock(){}
 #endif
 
+#define LOG_MSGSIZE	257		/* longest message, with its nul */
+#define LOG_RINGSIZE	512		/* messages queued per thread, a power of 2 */
+#define LOG_REPEAT_NS	1000000000ULL	/* a repeated message is written once in this time */
+#define LOG_SCREEN_RATE	50		/* messages a second to the client, besides errors and warnings */
+#define LOG_WRITER_MS	50		/* longest a message for the file only waits for the writer */
+
+/**
+ * \brief One message. file and screen are the outputs it goes to, decided when it was printed.
+ * repeats counts the copies of the thread's previous message, of level repeatLevel, that were not
+ * queued; again says this message is one more of them.
+ */
+struct Logger::Entry
+{
+	unsigned long long ns;
+	unsigned int level;
+	unsigned int repeats;
+	unsigned int repeatLevel;
+	bool again;
+	bool file;
+	bool screen;
+	char device[MAXINDIDEVICE];
+	char msg[LOG_MSGSIZE];
+};
+
+/**
+ * \brief Ring of one thread. The thread only moves head and the writer only moves tail, so neither locks.
+ * The rest is the thread's own record of its last message.
+ */
+struct Logger::Ring
+{
+	Entry slots[LOG_RINGSIZE];
+	unsigned int head;
+	unsigned int tail;
+	bool abandoned;
+	Ring *next;
+
+	unsigned int lastLevel;
+	unsigned int repeats;
+	unsigned long long lastNs;
+	char lastDevice[MAXINDIDEVICE];
+	char lastMsg[LOG_MSGSIZE];
+};
+
+Logger::Ring *Logger::rings_ = 0;
+pthread_mutex_t Logger::drainLock_ = PTHREAD_MUTEX_INITIALIZER;
+bool Logger::writerRunning_ = false;
+
+static pthread_key_t ringKey_;
+static pthread_once_t ringOnce_ = PTHREAD_ONCE_INIT;
+static sem_t wake_;
+static int writerSleeping_;
+/* file lines of the current batch; plain statics, the writer may still run while exit() destroys objects */
+static char fileBuf_[65536];
+static size_t fileLen_;
+static bool fileDirty_;
+static unsigned int screenTokens_ = LOG_SCREEN_RATE;
+static unsigned long long screenRefillNs_;
+static unsigned int screenSuppressed_;
+static char screenSuppressedDevice_[MAXINDIDEVICE];
+
+static unsigned long long monotonicNs(const struct timespec *since)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (unsigned long long)(now.tv_sec - since->tv_sec) * 1000000000ULL + now.tv_nsec - since->tv_nsec;
+}
+
+void Logger::startWriter()
+{
+	pthread_t thread;
+	pthread_attr_t attr;
+
+	pthread_key_create(&ringKey_, abandonRing);
+	sem_init(&wake_, 0, 0);
+	atexit(flushAtExit);
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	writerRunning_ = pthread_create(&thread, &attr, writerThread, NULL) == 0;
+	pthread_attr_destroy(&attr);
+}
+
+void Logger::flushAtExit()
+{
+	flush();
+}
+
+Logger::Ring *Logger::threadRing()
+{
+	Ring *r;
+
+	pthread_once(&ringOnce_, startWriter);
+	r = (Ring *) pthread_getspecific(ringKey_);
+	if (r)
+		return r;
+
+	r = (Ring *) calloc(1, sizeof(Ring));
+	if (!r)
+		return NULL;
+	pthread_setspecific(ringKey_, r);
+
+	/* the writer only ever reads rings_, so pushing needs no lock */
+	r->next = __atomic_load_n(&rings_, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&rings_, &r->next, r, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		;
+	return r;
+}
+
+/* thread exit, the writer frees the ring once it is written */
+void Logger::abandonRing(void *r)
+{
+	__atomic_store_n(&((Ring *)r)->abandoned, true, __ATOMIC_RELEASE);
+	wakeWriter();
+}
+
+void Logger::wakeWriter()
+{
+	/* the store of the ring head must be seen before writerSleeping_ is read */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&writerSleeping_, __ATOMIC_ACQUIRE) && __atomic_exchange_n(&writerSleeping_, 0, __ATOMIC_ACQ_REL))
+		sem_post(&wake_);
+}
+
+void *Logger::writerThread(void *)
+{
+	/* take the instance before the loop: getInstance() locks lock_, which
+	 * configure() holds while it waits for drainLock_ */
+	Logger &logger = getInstance();
+
+	for (;;)
+	{
+		int n;
+
+		pthread_mutex_lock(&drainLock_);
+		n = logger.drain();
+		pthread_mutex_unlock(&drainLock_);
+		if (n > 0)
+			continue;
+
+		/* say we sleep, then look once more so a message queued meanwhile is not left waiting */
+		__atomic_store_n(&writerSleeping_, 1, __ATOMIC_SEQ_CST);
+		pthread_mutex_lock(&drainLock_);
+		n = logger.drain();
+		pthread_mutex_unlock(&drainLock_);
+		if (n == 0)
+		{
+			struct timespec ts;
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_nsec += LOG_WRITER_MS * 1000000L;
+			if (ts.tv_nsec >= 1000000000L)
+			{
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000L;
+			}
+			while (sem_timedwait(&wake_, &ts) < 0 && errno == EINTR)
+				;
+		}
+		__atomic_store_n(&writerSleeping_, 0, __ATOMIC_RELAXED);
+	}
+
+	return NULL;
+}
+
+/**
+ * \brief Add a line for the repeats of the last message of a thread that no other message followed.
+ */
+void Logger::writeRepeats(Ring *r)
+{
+	unsigned int repeats = __atomic_exchange_n(&r->repeats, 0, __ATOMIC_RELAXED);
+	unsigned long long ns;
+	int n;
+
+	if (repeats == 0 || !(configuration_&file_on) || !(r->lastLevel & fileVerbosityLevel_))
+		return;
+	if (fileLen_ + 128 > sizeof(fileBuf_))
+	{
+		out_.write(fileBuf_, fileLen_);
+		fileLen_ = 0;
+	}
+	ns = monotonicNs(&initialTime_);
+	n = snprintf(fileBuf_ + fileLen_, 128, "%s\t%llu.%06llu sec\t: last message repeated %u more times\n",
+		     Tags[rank(r->lastLevel)], ns / 1000000000ULL, ns / 1000ULL % 1000000ULL, repeats);
+	if (n > 0)
+		fileLen_ += n < 128 ? n : 127;
+	fileDirty_ = true;
+}
+
+bool Logger::older(const Entry *a, const Entry *b)
+{
+	return a->ns < b->ns;
+}
+
+int Logger::drain()
+{
+	std::vector<const Entry *> batch;
+	std::vector<unsigned int> heads;
+	Ring *first = __atomic_load_n(&rings_, __ATOMIC_ACQUIRE);
+	Ring *r, *prev;
+	size_t i;
+
+	for (r = first; r; r = r->next)
+	{
+		unsigned int head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+
+		for (unsigned int t = r->tail; t != head; t++)
+			batch.push_back(&r->slots[t % LOG_RINGSIZE]);
+		heads.push_back(head);
+	}
+
+	/* the threads' messages interleaved in time */
+	std::sort(batch.begin(), batch.end(), older);
+	for (i = 0; i < batch.size(); i++)
+		write(batch[i]);
+
+	/* hand the slots back, and free the rings of threads that are gone */
+	for (prev = NULL, r = first, i = 0; r; i++)
+	{
+		Ring *next = r->next;
+		unsigned int tail = heads[i];
+
+		__atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+
+		/* new rings are pushed before first, so only it may not be unlinked */
+		if (prev && __atomic_load_n(&r->abandoned, __ATOMIC_ACQUIRE) &&
+		    __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == tail)
+		{
+			writeRepeats(r);
+			prev->next = next;
+			free(r);
+		}
+		else
+			prev = r;
+		r = next;
+	}
+
+	if (fileLen_ > 0)
+	{
+		if (configuration_&file_on)
+			out_.write(fileBuf_, fileLen_);
+		fileLen_ = 0;
+		fileDirty_ = true;
+	}
+
+	if (batch.empty())
+	{
+		if (fileDirty_ && (configuration_&file_on))
+			out_.flush();
+		fileDirty_ = false;
+		if (screenSuppressed_ > 0)
+			writeScreen(NULL, NULL);
+	}
+
+	return batch.size();
+}
 
 /**
  * \brief Constructor.
@@ -264,7 +526,7 @@ void Logger::unlock(){}
  */
 Logger::Logger(): configured_(false)
 {
-  gettimeofday(&initialTime_, NULL);
+  clock_gettime(CLOCK_MONOTONIC, &initialTime_);
 }
 
 /**
@@ -281,6 +543,8 @@ void Logger::configure (const std::string&	outputFile,
 			const int		screenVerbosityLevel)
 {
 		Logger::lock();
+		/* the writer thread must not be using the stream */
+		pthread_mutex_lock(&drainLock_);
 
 		fileVerbosityLevel_ = fileVerbosityLevel;
 		screenVerbosityLevel_ = screenVerbosityLevel;
@@ -304,6 +568,7 @@ void Logger::configure (const std::string&	outputFile,
 		configuration_ = configuration;
 		configured_ = true;
 
+		pthread_mutex_unlock(&drainLock_);
 		Logger::unlock();
 }
 
@@ -355,6 +620,12 @@ unsigned int Logger::rank(unsigned int l) {
   }
 }
 
+
+
+/**
+ * \brief Method used to print message called by the DEBUG() macro.
+ * The message is queued on the ring of the calling thread, the writer thread writes it.
+ */
 void Logger::print(const char *devicename,
 		   const unsigned int verbosityLevel,
 		   const std::string& file,
@@ -363,43 +634,306 @@ void Logger::print(const char *devicename,
 		   const char *message,
 		   ...)
 {
-  bool filelog = (verbosityLevel & fileVerbosityLevel_) != 0;
-  bool screenlog = (verbosityLevel & screenVerbosityLevel_) != 0;
+  bool filelog = (verbosityLevel & fileVerbosityLevel_) != 0 && (configuration_&file_on);
+  bool screenlog = (verbosityLevel & screenVerbosityLevel_) != 0 && (configuration_&screen_on);
+
+	if (!configured_) {
+			std::cerr << "ERROR: Logger not configured!" << 
+				std::endl;
+			return;
+	}
+	/* nothing to format when the level is off */
+	if (!filelog && !screenlog)
+		return;
+
+	Ring *r = threadRing();
+	if (!r)
+		return;
 
+  va_list ap;
+  char msg[LOG_MSGSIZE];
+  unsigned long long ns;
+  bool same;
+
+  va_start(ap, message);
+  vsnprintf(msg, LOG_MSGSIZE, message, ap);
+  va_end(ap);
+  if (!devicename)
+    devicename = "";
+
+	ns = monotonicNs(&initialTime_);
+	same = verbosityLevel == r->lastLevel && strcmp(msg, r->lastMsg) == 0 &&
+	       strncmp(devicename, r->lastDevice, MAXINDIDEVICE-1) == 0;
+	if (same && ns - r->lastNs < LOG_REPEAT_NS)
+	{
+		__atomic_fetch_add(&r->repeats, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	/* the writer is behind, help it rather than lose messages */
+	unsigned int head = r->head;
+	while (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >= LOG_RINGSIZE)
+	{
+		if (pthread_mutex_trylock(&drainLock_) == 0)
+		{
+			drain();
+			pthread_mutex_unlock(&drainLock_);
+		}
+		else
+			sched_yield();
+	}
+
+	Entry *e = &r->slots[head % LOG_RINGSIZE];
+	e->ns = ns;
+	e->level = verbosityLevel;
+	e->repeats = __atomic_exchange_n(&r->repeats, 0, __ATOMIC_RELAXED);
+	e->repeatLevel = r->lastLevel;
+	e->again = same;
+	e->file = filelog;
+	e->screen = screenlog;
+	strncpy(e->device, devicename, MAXINDIDEVICE-1);
+	e->device[MAXINDIDEVICE-1] = '\0';
+	strcpy(e->msg, msg);
+	__atomic_store_n(&r->head, head+1, __ATOMIC_RELEASE);
+
+	r->lastNs = ns;
+	if (!same)
+	{
+		r->lastLevel = verbosityLevel;
+		strcpy(r->lastMsg, msg);
+		strcpy(r->lastDevice, e->device);
+	}
+
+	/* waking the writer costs a system call, messages for the file only can wait a little */
+	if (!writerRunning_)
+		flush();
+	else if (screenlog || head+1 - __atomic_load_n(&r->tail, __ATOMIC_RELAXED) >= LOG_RINGSIZE/4)
+		wakeWriter();
+}
+
+/**
+ * \brief Add the file line of a message to the batch, and send it to the client.
+ */
+void Logger::write(const Entry *e)
+{
+	char text[LOG_MSGSIZE+48];
+	char line[LOG_MSGSIZE+128];
+
+	for (int pass = (e->repeats > 0 && !e->again) ? 0 : 1; pass < 2; pass++)
+	{
+		unsigned int level = pass ? e->level : e->repeatLevel;
+		const char *what = text;
+		int n;
+
+		/* first the repeats of the previous message of the thread */
+		if (!pass)
+			snprintf(text, sizeof(text), "last message repeated %u more times", e->repeats);
+		else if (e->repeats > 0)
+			snprintf(text, sizeof(text), "%s (repeated %u times)", e->msg, e->repeats+1);
+		else
+			what = e->msg;
+
+		if (e->file)
+		{
+			n = snprintf(line, sizeof(line), "%s\t%llu.%06llu sec\t: %s\n", Tags[rank(level)],
+				     e->ns / 1000000000ULL, e->ns / 1000ULL % 1000000ULL, what);
+			if (n >= (int)sizeof(line))
+				n = sizeof(line)-1;
+			if (fileLen_ + n > sizeof(fileBuf_))
+			{
+				if (configuration_&file_on)
+					out_.write(fileBuf_, fileLen_);
+				fileLen_ = 0;
+				fileDirty_ = true;
+			}
+			memcpy(fileBuf_ + fileLen_, line, n);
+			fileLen_ += n;
+		}
+
+		if (e->screen && pass)
+			writeScreen(e, what);
+	}
+}
+
+/**
+ * \brief Send a message to the client, unless too many went in the last second.
+ * Errors and warnings always go. With e NULL, only say how many did not.
+ */
+void Logger::writeScreen(const Entry *e, const char *msg)
+{
+	unsigned long long ns = monotonicNs(&initialTime_);
+	unsigned long long tokens = (ns - screenRefillNs_) * LOG_SCREEN_RATE / 1000000000ULL;
+
+	if (tokens > 0)
+	{
+		screenTokens_ = screenTokens_ + tokens > LOG_SCREEN_RATE ? LOG_SCREEN_RATE : screenTokens_ + tokens;
+		screenRefillNs_ = ns;
+	}
+
+	if (e && !(e->level & (DBG_ERROR|DBG_WARNING)) && screenTokens_ == 0)
+	{
+		if (screenSuppressed_++ == 0)
+			strcpy(screenSuppressedDevice_, e->device);
+		return;
+	}
+
+	if (screenSuppressed_ > 0 && (e || screenTokens_ > 0))
+	{
+		IDMessage(screenSuppressedDevice_, "%u messages were not shown", screenSuppressed_);
+		screenSuppressed_ = 0;
+	}
+
+	if (e)
+	{
+		IDMessage(e->device, "%s", msg);
+		if (screenTokens_ > 0)
+			screenTokens_--;
+	}
+}
+
+/**
+ * \brief Write out what all threads queued and flush the file. It is also done on exit.
+ */
+void Logger::flush()
+{
+	if (m_ == 0)
+		return;
+
+	pthread_mutex_lock(&drainLock_);
+	while (m_->drain() > 0)
+		;
+
+	for (Ring *r = __atomic_load_n(&rings_, __ATOMIC_ACQUIRE); r; r = r->next)
+		m_->writeRepeats(r);
+	if (fileLen_ > 0 && (configuration_&file_on))
+	{
+		m_->out_.write(fileBuf_, fileLen_);
+		m_->out_.flush();
+	}
+	fileLen_ = 0;
+	pthread_mutex_unlock(&drainLock_);
+}
+
+}
+
+#if defined(LOGGER_BENCH)
+
+/* g++ -O2 -DLOGGER_BENCH -I. -I.. -I../.. indilogger.cpp -lindidriver -lpthread
+   Floods the logger from a few threads with distinct and with repeated messages,
+   and times print() against the synchronous logger it replaced. */
+
+#include <pthread.h>
+#include <unistd.h>
+
+static std::ofstream oldOut;
+static pthread_mutex_t oldLock = PTHREAD_MUTEX_INITIALIZER;
+static struct timeval oldStart;
+
+/* the old print(): format, lock, write a line and flush it */
+static void oldPrint(const char *devicename, unsigned int level, const char *message, ...)
+{
   va_list ap;
   char msg[257];
   char usec[7];
+  struct timeval currentTime, resTime;
 
-  msg[256]='\0';
   va_start(ap, message);
   vsnprintf(msg, 257, message, ap);
   va_end(ap);
+  gettimeofday(&currentTime, NULL);
+  timersub(&currentTime, &oldStart, &resTime);
+  snprintf(usec, 7, "%06ld", resTime.tv_usec);
+  pthread_mutex_lock(&oldLock);
+  oldOut << INDI::Logger::Tags[INDI::Logger::rank(level)] << "\t" << (resTime.tv_sec) << "." << (usec) << " sec" <<
+    "\t: " << msg << std::endl;
+  pthread_mutex_unlock(&oldLock);
+}
 
-	if (!configured_) {
-			std::cerr << "ERROR: Logger not configured!" << 
-				std::endl;
-			return;
-	}
-	struct timeval currentTime, resTime;
-	usec[6]='\0';
-	gettimeofday(&currentTime, NULL);
-	timersub(&currentTime, &initialTime_, &resTime);
-	snprintf(usec, 7, "%06ld", resTime.tv_usec);
-	Logger::lock();
+#define BENCH_THREADS 4
+#define BENCH_MSGS 100000
 
-	if ((configuration_&file_on) && filelog)
-	  //out_ << Tags[rank(verbosityLevel)] << "\t["<< file << ":" << line << "]\t" <<
-	  out_ << Tags[rank(verbosityLevel)] << "\t" <<
-	    (resTime.tv_sec) <<"."<<(usec) << " sec"<<
-				"\t: " << msg << std::endl;
-
-	if ((configuration_&screen_on) && screenlog)
-	  IDMessage(devicename, "%s", msg);
-	    /*		std::cerr << "DEBUG [" << file << ":" << line << "] @ " <<
-				(currentTime.tv_sec - initialTime_.tv_sec) <<
-	    			":" << message << std::endl;
-	    */
-	Logger::unlock();
+static bool benchOld, benchRepeat;
+static int benchPace;
+static double benchTotal[BENCH_THREADS], benchWorst[BENCH_THREADS];
+
+static double nowUs()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void *flood(void *arg)
+{
+  long id = (long) arg;
+  double total = 0, worst = 0;
+
+  for (int i = 0; i < BENCH_MSGS; i++)
+  {
+    if (benchPace)
+      usleep(benchPace);
+    int n = benchRepeat ? 0 : i;
+    double t = nowUs();
+    if (benchOld)
+      oldPrint("Bench", INDI::Logger::DBG_DEBUG, "thread %ld tracking step %d ra %g dec %g", id, n, 1.5 * n, -0.25 * n);
+    else
+      INDI::Logger::getInstance().print("Bench", INDI::Logger::DBG_DEBUG, __FILE__, __LINE__,
+                                        "thread %ld tracking step %d ra %g dec %g", id, n, 1.5 * n, -0.25 * n);
+    t = nowUs() - t;
+    total += t;
+    if (t > worst)
+      worst = t;
+  }
+  benchTotal[id] = total;
+  benchWorst[id] = worst;
+  return NULL;
+}
+
+/* nthreads threads log BENCH_MSGS messages each, pace us apart */
+static void run(const char *name, bool old, bool repeat, int nthreads, int pace)
+{
+  pthread_t threads[BENCH_THREADS];
+  double total = 0, worst = 0;
+
+  benchOld = old;
+  benchRepeat = repeat;
+  benchPace = pace;
+  for (long i = 0; i < nthreads; i++)
+    pthread_create(&threads[i], NULL, flood, (void *) i);
+  for (int i = 0; i < nthreads; i++)
+  {
+    pthread_join(threads[i], NULL);
+    total += benchTotal[i];
+    if (benchWorst[i] > worst)
+      worst = benchWorst[i];
+  }
+  printf("%-32s %7.3f us per print, worst %8.1f us", name, total / (nthreads * BENCH_MSGS), worst);
+  if (!old)
+  {
+    double f = nowUs();
+    INDI::Logger::flush();
+    printf(", %7.1f ms to flush", (nowUs() - f) / 1000);
+  }
+  printf("\n");
 }
 
+int main()
+{
+  gettimeofday(&oldStart, NULL);
+  oldOut.open("/tmp/logger_bench_old.log", std::ios::app);
+  INDI::Logger::getInstance().configure("/tmp/logger_bench", INDI::Logger::file_on | INDI::Logger::screen_off,
+                                        INDI::Logger::DBG_DEBUG, INDI::Logger::DBG_DEBUG);
+
+  run("old, flood", true, false, BENCH_THREADS, 0);
+  run("ring, flood", false, false, BENCH_THREADS, 0);
+  run("old, repeated message flood", true, true, BENCH_THREADS, 0);
+  run("ring, repeated message flood", false, true, BENCH_THREADS, 0);
+  run("old, one thread every 50 us", true, false, 1, 50);
+  run("ring, one thread every 50 us", false, false, 1, 50);
+
+  printf("logs in /tmp/logger_bench_old.log and %s\n", INDI::Logger::getLogFile().c_str());
+  return 0;
 }
+
+#endif
+
@@ -27,6 +27,7 @@
 #include <string>
 #include <sstream>
 #include <sys/time.h>
+#include <pthread.h>
 
 #include <indiapi.h>
 #include <defaultdevice.h>
@@ -73,6 +74,12 @@ namespace  INDI
  *  logger in C++. It is implemented as a Singleton, so it can be easily called through two DEBUG macros.
  * It is Pthread-safe. It allows to log on both file and screen, and to specify a verbosity threshold for both of them.
  *
+ * print() only formats the message into a ring buffer of the calling thread, without taking any lock. A background
+ * thread writes the rings to the file, in batches flushed when there is nothing left to write, and to the client.
+ * A message repeated by the same thread is written at most once a second, with the number of repeats. Messages
+ * to the client, other than errors and warnings, are limited to a few dozen a second. Call flush() to write out
+ * what is queued; it is done on exit.
+ *
  * - By default, the class defines 4 levels of debugging/logging levels:
  *      -# Errors: Use macro DEBUG(INDI::Logger::DBG_ERROR, "My Error Message)
  *
@@ -136,9 +143,47 @@ class Logger
         std::ofstream out_;
 
         /**
-         * \brief Initial time (used to print relative times)
+         * \brief Initial time on the monotonic clock (used to print relative times)
+         */
+        struct timespec initialTime_;
+
+        /**
+         * \brief Message queue of one thread, and one message in it
+         */
+        struct Ring;
+        struct Entry;
+
+        /**
+         * \brief Rings of all threads that have logged, newest first
+         */
+        static Ring *rings_;
+
+        /**
+         * \brief Held while the rings are written out, by the writer thread or flush()
          */
-        struct timeval initialTime_;
+        static pthread_mutex_t drainLock_;
+
+        static bool writerRunning_;
+        static void startWriter();
+        static void *writerThread(void *);
+        static void flushAtExit();
+
+        /**
+         * \brief The ring of the calling thread, made on its first message and freed after it exits
+         */
+        static Ring *threadRing();
+        static void abandonRing(void *r);
+        static void wakeWriter();
+
+        /**
+         * \brief Write what is queued in all rings, oldest first. Called with drainLock_ held.
+         * @return number of messages written
+         */
+        int drain();
+        static bool older(const Entry *a, const Entry *b);
+        void write(const Entry *e);
+        void writeScreen(const Entry *e, const char *msg);
+        void writeRepeats(Ring *r);
 
         /**
          * \brief Verbosity threshold for files
@@ -207,6 +252,11 @@ class Logger
 
     void configure (const std::string&	outputFile,  const loggerConf configuration,  const int fileVerbosityLevel, const int	screenVerbosityLevel);
 
+    /**
+     * @brief Write the messages queued by all threads to the file and the client, and flush the file.
+     */
+    static void flush();
+
     static struct switchinit DebugLevelSInit[nlevels];
     static ISwitch DebugLevelS[nlevels];
     static ISwitchVectorProperty DebugLevelSP;
@@ -31,6 +31,8 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <stdarg.h>
+#include <limits.h>
+#include <time.h>
 #include <sys/param.h>
 
 #include <config.h>
@@ -47,6 +49,7 @@
 
 #ifndef _WIN32
 #include <termios.h>
+#include <poll.h>
 #define PARITY_NONE    0
 #define PARITY_EVEN    1
 #define PARITY_ODD     2
@@ -245,15 +248,139 @@ timestamp()
 	return (ts);
 }
 
+/* Bytes read past the delimiter of a section, kept for the next read of
+ * the same fd. Buffers are made on the first read of an fd and kept, a
+ * closed fd only has its buffer emptied. */
+#define TTY_BUFSIZE     4096
+#define TTY_MAXFDS      1024
+
+struct tty_buffer
+{
+    int start;
+    int end;
+    char data[TTY_BUFSIZE];
+};
+
+static struct tty_buffer *tty_buffers[TTY_MAXFDS];
+
+/* the read ahead buffer of fd, NULL if fd is too large to have one */
+static struct tty_buffer *tty_buffer_of(int fd)
+{
+    struct tty_buffer *b, *none = NULL;
+
+    if (fd < 0 || fd >= TTY_MAXFDS)
+        return NULL;
+
+    b = __atomic_load_n(&tty_buffers[fd], __ATOMIC_ACQUIRE);
+    if (b)
+        return b;
+
+    b = (struct tty_buffer *) calloc(1, sizeof(struct tty_buffer));
+    if (b == NULL)
+        return NULL;
+    if (!__atomic_compare_exchange_n(&tty_buffers[fd], &none, b, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+        /* another thread made it first */
+        free(b);
+        b = none;
+    }
+    return b;
+}
+
+/* the read ahead buffer of fd if it has one already */
+static struct tty_buffer *tty_buffer_peek(int fd)
+{
+    if (fd < 0 || fd >= TTY_MAXFDS)
+        return NULL;
+    return __atomic_load_n(&tty_buffers[fd], __ATOMIC_ACQUIRE);
+}
+
+static void tty_buffer_clear(int fd)
+{
+    struct tty_buffer *b = tty_buffer_peek(fd);
+
+    if (b)
+        b->start = b->end = 0;
+}
+
+static void tty_deadline(struct timespec *deadline, int timeout_ms)
+{
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += timeout_ms / 1000;
+    deadline->tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (deadline->tv_nsec >= 1000000000L)
+    {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+/* Wait until fd is readable or the deadline passes, then read at most max
+ * bytes to the end of b. A deadline already past still gets one look, as
+ * select() with a zero timeout did. */
+static int tty_fill(int fd, struct tty_buffer *b, int max, const struct timespec *deadline)
+{
+    struct timespec now;
+    struct pollfd pfd;
+    long ms;
+    int r;
+
+    if (max > TTY_BUFSIZE - b->end)
+        max = TTY_BUFSIZE - b->end;
+
+    for (;;)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        ms = (deadline->tv_sec - now.tv_sec) * 1000L + (deadline->tv_nsec - now.tv_nsec + 999999L) / 1000000L;
+        if (ms < 0)
+            ms = 0;
+
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        r = poll(&pfd, 1, (int) ms);
+        if (r < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return TTY_SELECT_ERROR;
+        }
+        if (r == 0)
+            return TTY_TIME_OUT;
+
+        r = read(fd, b->data + b->end, max);
+        if (r < 0)
+        {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            return TTY_READ_ERROR;
+        }
+        if (r == 0)
+        {
+            /* hung up */
+            errno = EIO;
+            return TTY_READ_ERROR;
+        }
+
+        b->end += r;
+        return TTY_OK;
+    }
+}
+
 int tty_timeout(int fd, int timeout)
 {
  if (fd == -1)
         return TTY_ERRNO;
 
+  struct tty_buffer *b;
   struct timeval tv;
   fd_set readout;
   int retval;
 
+  /* bytes read ahead are there already */
+  if ( (b = tty_buffer_peek(fd)) && b->start < b->end)
+   return TTY_OK;
+
   FD_ZERO(&readout);
   FD_SET(fd, &readout);
 
@@ -327,65 +454,212 @@ int tty_write_string(int fd, const char * buf, int *nbytes_written)
   return TTY_OK;
 }
 
+/* Read nbytes, or up to one of the stop characters if nstop > 0. With
+ * idle set the timeout restarts whenever bytes arrive, as tty_read() and
+ * tty_read_section() always had it; otherwise it covers the whole read. */
+static int tty_read_buffered(int fd, char *buf, int nbytes, const char *stop_chars, int nstop, int timeout_ms, int idle, int *nbytes_read)
+{
+    struct tty_buffer local, *b;
+    struct timespec deadline;
+    unsigned char stop[256];
+    int n = 0, err, max, i;
+
+    *nbytes_read = 0;
+
+    /* Fixed lengths never read past the frame, so drivers mixing in
+     * read() lose nothing. Without a buffer to keep them in, sections
+     * go a byte at a time as before. */
+    b = tty_buffer_of(fd);
+    if (b == NULL)
+    {
+        b = &local;
+        b->start = b->end = 0;
+    }
+
+    memset(stop, 0, sizeof(stop));
+    for (i = 0; i < nstop; i++)
+        stop[(unsigned char) stop_chars[i]] = 1;
+
+    tty_deadline(&deadline, timeout_ms);
+
+    for (;;)
+    {
+        int avail = b->end - b->start;
+        int room = nbytes - n;
+        const char *p = b->data + b->start;
+
+        if (avail > room)
+            avail = room;
+
+        if (nstop > 0)
+        {
+            const char *end = NULL;
+
+            if (nstop == 1)
+                end = memchr(p, stop_chars[0], avail);
+            else
+            {
+                for (i = 0; i < avail; i++)
+                    if (stop[(unsigned char) p[i]])
+                    {
+                        end = p + i;
+                        break;
+                    }
+            }
+            if (end)
+            {
+                avail = end - p + 1;
+                memcpy(buf + n, p, avail);
+                b->start += avail;
+                *nbytes_read = n + avail;
+                return TTY_OK;
+            }
+        }
+
+        memcpy(buf + n, p, avail);
+        b->start += avail;
+        n += avail;
+        *nbytes_read = n;
+
+        if (n == nbytes)
+            return nstop > 0 ? TTY_OVERFLOW : TTY_OK;
+
+        if (nstop == 0)
+            max = nbytes - n;
+        else if (b == &local)
+            max = 1;
+        else
+            max = TTY_BUFSIZE;
+
+        b->start = b->end = 0;
+        err = tty_fill(fd, b, max, &deadline);
+        if (err)
+            return err;
+        if (idle)
+            tty_deadline(&deadline, timeout_ms);
+    }
+}
+
 int tty_read(int fd, char *buf, int nbytes, int timeout, int *nbytes_read)
 {
     if (fd == -1)
            return TTY_ERRNO;
 
- int bytesRead = 0;
- int err = 0;
- *nbytes_read =0;
+  *nbytes_read = 0;
 
   if (nbytes <=0)
 	return TTY_PARAM_ERROR;
 
-  while (nbytes > 0)
-  {
-     if ( (err = tty_timeout(fd, timeout)) )
-      return err;
+  return tty_read_buffered(fd, buf, nbytes, NULL, 0, timeout * 1000, 1, nbytes_read);
+}
 
-     bytesRead = read(fd, buf, ((unsigned) nbytes));
+int tty_read_section(int fd, char *buf, char stop_char, int timeout, int *nbytes_read)
+{
+    if (fd == -1)
+           return TTY_ERRNO;
 
-     if (bytesRead < 0 )
-      return TTY_READ_ERROR;
+  *nbytes_read = 0;
 
-     buf += bytesRead;
-     *nbytes_read += bytesRead;
-     nbytes -= bytesRead;
-  }
+  /* the caller did not say how big buf is */
+  return tty_read_buffered(fd, buf, INT_MAX, &stop_char, 1, timeout * 1000, 1, nbytes_read);
+}
 
-  return TTY_OK;
+int tty_read_frame(int fd, char *buf, int nbytes, int timeout_ms, int *nbytes_read)
+{
+    if (fd == -1)
+           return TTY_ERRNO;
+
+  *nbytes_read = 0;
+
+  if (nbytes <= 0 || timeout_ms < 0)
+	return TTY_PARAM_ERROR;
+
+  return tty_read_buffered(fd, buf, nbytes, NULL, 0, timeout_ms, 0, nbytes_read);
 }
 
-int tty_read_section(int fd, char *buf, char stop_char, int timeout, int *nbytes_read)
+int tty_read_until(int fd, char *buf, int bufsize, const char *stop_chars, int nstop, int timeout_ms, int *nbytes_read)
 {
     if (fd == -1)
            return TTY_ERRNO;
 
- int bytesRead = 0;
- int err = TTY_OK;
- *nbytes_read = 0;
+  *nbytes_read = 0;
 
- for (;;)
- {
-         if ( (err = tty_timeout(fd, timeout)) )
-	   return err;
+  if (bufsize <= 0 || stop_chars == NULL || nstop <= 0 || timeout_ms < 0)
+	return TTY_PARAM_ERROR;
 
-         bytesRead = read(fd, buf, 1);
+  return tty_read_buffered(fd, buf, bufsize, stop_chars, nstop, timeout_ms, 0, nbytes_read);
+}
 
-         if (bytesRead < 0 )
-            return TTY_READ_ERROR;
+int tty_transact(int fd, tty_transaction *t, int count, int timeout_ms)
+{
+    char out[TTY_BUFSIZE];
+    int len = 0, i, n, nbytes_written, err = TTY_OK;
 
-        if (bytesRead)
-          (*nbytes_read)++;
+    if (fd == -1)
+           return TTY_ERRNO;
 
-        if (*buf == stop_char)
-	   return TTY_OK;
+    if (t == NULL || count <= 0 || timeout_ms < 0)
+	return TTY_PARAM_ERROR;
 
-        buf += bytesRead;
-  }
+    for (i = 0; i < count; i++)
+    {
+        t[i].nbytes_read = 0;
+        t[i].error = TTY_OK;
+    }
+
+    /* all the commands in as few writes as possible */
+    for (i = 0; i < count && err == TTY_OK; i++)
+    {
+        n = t[i].cmd_len > 0 ? t[i].cmd_len : (int) strlen(t[i].cmd);
+        if (len + n > TTY_BUFSIZE && len > 0)
+        {
+            err = tty_write(fd, out, len, &nbytes_written);
+            len = 0;
+        }
+        if (err == TTY_OK && n > TTY_BUFSIZE)
+            err = tty_write(fd, t[i].cmd, n, &nbytes_written);
+        else
+        {
+            memcpy(out + len, t[i].cmd, n);
+            len += n;
+        }
+    }
+    if (err == TTY_OK && len > 0)
+        err = tty_write(fd, out, len, &nbytes_written);
+
+    for (i = 0; i < count && err == TTY_OK; i++)
+    {
+        if (t[i].reply == NULL || t[i].reply_size <= 0)
+            continue;
+        if (t[i].stop_chars && t[i].nstop > 0)
+            err = tty_read_until(fd, t[i].reply, t[i].reply_size, t[i].stop_chars, t[i].nstop, timeout_ms, &t[i].nbytes_read);
+        else
+            err = tty_read_frame(fd, t[i].reply, t[i].reply_size, timeout_ms, &t[i].nbytes_read);
+        t[i].error = err;
+    }
+
+    if (err != TTY_OK)
+    {
+        for (; i < count; i++)
+            t[i].error = err;
+        tty_flush(fd, TCIFLUSH);
+    }
 
-  return TTY_TIME_OUT;
+    return err;
+}
+
+int tty_flush(int fd, int queue_selector)
+{
+    if (fd == -1)
+           return TTY_ERRNO;
+
+    if (queue_selector == TCIFLUSH || queue_selector == TCIOFLUSH)
+        tty_buffer_clear(fd);
+
+    if (tcflush(fd, queue_selector) != 0)
+        return TTY_ERRNO;
+
+    return TTY_OK;
 }
 
 #if defined(BSD) && !defined(__GNU__)
@@ -654,6 +928,7 @@ int tty_connect(const char *device, int bit_rate, int word_size, int parity, int
        }
 #endif
 
+   tty_buffer_clear(t_fd);
    *fd = t_fd;
   /* return success */
   return TTY_OK;
@@ -858,6 +1133,7 @@ int tty_connect(const char *device, int bit_rate, int word_size, int parity, int
     return TTY_PORT_FAILURE;
   }
   
+  tty_buffer_clear(t_fd);
   *fd = t_fd;
   /* return success */
   return TTY_OK;
@@ -877,7 +1153,7 @@ int tty_disconnect(int fd)
 	return TTY_ERRNO;
 #else
 	int err;
-	tcflush(fd, TCIOFLUSH);
+	tty_flush(fd, TCIOFLUSH);
 	err = close(fd);
 
 	if (err != 0)
@@ -929,6 +1205,10 @@ void tty_error_msg(int err_code, char *err_msg, int err_msg_len)
 		strncpy(err_msg, "Parameter error", err_msg_len);
 		break;
 
+	case TTY_OVERFLOW:
+		strncpy(err_msg, "Read buffer overflow", err_msg_len);
+		break;
+
 	case TTY_ERRNO:
 		snprintf(error_string, 512, "%s", strerror(errno));
 		strncpy(err_msg, error_string, err_msg_len);
@@ -54,7 +54,7 @@ extern const char * SolarSystem[];
 struct ln_date;
 
 /* TTY Error Codes */
-enum TTY_ERROR { TTY_OK=0, TTY_READ_ERROR=-1, TTY_WRITE_ERROR=-2, TTY_SELECT_ERROR=-3, TTY_TIME_OUT=-4, TTY_PORT_FAILURE=-5, TTY_PARAM_ERROR=-6, TTY_ERRNO = -7};
+enum TTY_ERROR { TTY_OK=0, TTY_READ_ERROR=-1, TTY_WRITE_ERROR=-2, TTY_SELECT_ERROR=-3, TTY_TIME_OUT=-4, TTY_PORT_FAILURE=-5, TTY_PARAM_ERROR=-6, TTY_ERRNO = -7, TTY_OVERFLOW=-8};
 
 #ifdef __cplusplus
 extern "C" {
@@ -66,6 +66,28 @@ extern "C" {
 
 /*@{*/
 
+/** \brief A command and the reply it expects, for tty_transact().
+*/
+typedef struct
+{
+    /** The command to send. */
+    const char *cmd;
+    /** Number of bytes of \e cmd to send, 0 to send it up to its null terminator. */
+    int cmd_len;
+    /** Where to store the reply, or NULL if the command has no reply. */
+    char *reply;
+    /** Size of \e reply. Without stop characters the reply is exactly this long. */
+    int reply_size;
+    /** The characters that may end the reply, or NULL for a fixed length reply. */
+    const char *stop_chars;
+    /** Number of characters in \e stop_chars. */
+    int nstop;
+    /** Set to the number of bytes stored in \e reply. */
+    int nbytes_read;
+    /** Set to TTY_OK, or the TTY_ERROR code that ended the reply. */
+    int error;
+} tty_transaction;
+
 /** \brief read buffer from terminal
     \param fd file descriptor
     \param buf pointer to store data. Must be initilized and big enough to hold data.
@@ -87,6 +109,52 @@ int tty_read(int fd, char *buf, int nbytes, int timeout, int *nbytes_read);
 
 int tty_read_section(int fd, char *buf, char stop_char, int timeout, int *nbytes_read);
 
+/** \brief read a fixed length frame from terminal
+    \param fd file descriptor
+    \param buf pointer to store data. Must be initilized and big enough to hold data.
+    \param nbytes number of bytes to read.
+    \param timeout_ms number of milliseconds the whole frame may take before a timeout error is issued.
+    \param nbytes_read the number of bytes read.
+    \return On success, it returns TTY_OK, otherwise, a TTY_ERROR code.
+*/
+int tty_read_frame(int fd, char *buf, int nbytes, int timeout_ms, int *nbytes_read);
+
+/** \brief read buffer from terminal up to any of several delimiters
+    \param fd file descriptor
+    \param buf pointer to store data, including the delimiter.
+    \param bufsize size of \e buf. TTY_OVERFLOW is returned if it fills up before a delimiter arrives.
+    \param stop_chars the characters that end the read.
+    \param nstop number of characters in \e stop_chars.
+    \param timeout_ms number of milliseconds the whole response may take before a timeout error is issued.
+    \param nbytes_read the number of bytes read.
+    \return On success, it returns TTY_OK, otherwise, a TTY_ERROR code.
+
+    Bytes received after the delimiter are kept for the next read of \e fd. Flush the
+    input with tty_flush() rather than tcflush() so they are dropped as well.
+*/
+int tty_read_until(int fd, char *buf, int bufsize, const char *stop_chars, int nstop, int timeout_ms, int *nbytes_read);
+
+/** \brief Send several commands at once and read their replies in order.
+    \param fd file descriptor
+    \param t the commands. The reply, nbytes_read and error of each are filled in.
+    \param count number of commands in \e t.
+    \param timeout_ms number of milliseconds each reply may take after the previous one.
+    \return On success, it returns TTY_OK, otherwise, the TTY_ERROR code of the first reply that failed.
+
+    All commands are written before the first reply is read, so a device answering a
+    batch of queries costs one round trip instead of one per query. After a failed reply
+    the remaining ones cannot be told apart, so they get the same error and the input is
+    flushed. Only batch as many commands as the device can buffer.
+*/
+int tty_transact(int fd, tty_transaction *t, int count, int timeout_ms);
+
+/** \brief Flush the terminal, and the bytes tty_read_until() read ahead.
+    \param fd file descriptor
+    \param queue_selector TCIFLUSH, TCOFLUSH or TCIOFLUSH, as for tcflush().
+    \return On success, it returns TTY_OK, otherwise, a TTY_ERROR code.
+*/
+int tty_flush(int fd, int queue_selector);
+
 
 /** \brief Writes a buffer to fd.
     \param fd file descriptor
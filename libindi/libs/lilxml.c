@@ -50,8 +50,11 @@ static XMLAtt *growAtt(XMLEle *e);
 static XMLEle *growEle(XMLEle *pe);
 static void freeAtt (XMLAtt *a);
 static int isTokenChar (int start, int c);
+static int isHeadTag (LilXML *lp);
 static void growString (String *sp, int c);
 static void appendString (String *sp, const char *str);
+static void appendBytes (String *sp, const char *str, int n);
+static size_t runXMLchars (LilXML *lp, const char *buf, size_t n);
 static void freeString (String *sp);
 static void newString (String *sp);
 static void *moremem (void *old, int n);
@@ -84,6 +87,8 @@ struct _LilXML {
     int delim;				/* attribute value delimiter */
     int lastc;				/* last char (just used wiht skipping)*/
     int skipping;			/* in comment or declaration */
+    char *headtag;			/* outter tag to return after opening */
+    int head;				/* 1 if just returned only a head */
 };
 
 /* internal representation of a (possibly nested) XML element */
@@ -145,9 +150,37 @@ delLilXML (LilXML *lp)
 {
         delXMLEle (lp->ce);
         freeString (&lp->endtag);
+        if (lp->headtag)
+            (*myfree) (lp->headtag);
         (*myfree) (lp);
 }
 
+/* arrange for an outter element with the given tag to be returned as soon as
+ * its opening tag is complete, with just its tag and attributes. the caller
+ * must then consume its content and closing tag itself before reading on.
+ * tag NULL returns to reading complete elements.
+ */
+void
+setHeadXMLEle (LilXML *lp, const char *tag)
+{
+        if (lp->headtag)
+            (*myfree) (lp->headtag);
+        lp->headtag = NULL;
+        if (tag) {
+            lp->headtag = (char *) moremem (NULL, strlen(tag)+1);
+            strcpy (lp->headtag, tag);
+        }
+}
+
+/* return 1 if the element last returned from lp is only the head of an element
+ * as arranged with setHeadXMLEle(), else 0.
+ */
+int
+gotHeadXMLEle (LilXML *lp)
+{
+        return (lp->head);
+}
+
 /* delete ep and all its children and remove from parent's list if known */
 void
 delXMLEle (XMLEle *ep)
@@ -202,10 +235,11 @@ XMLEle *
 readXMLEle (LilXML *lp, int newc, char ynot[])
 {
         XMLEle *root;
-        int s;
+        int s, head;
 
         /* start optimistic */
         ynot[0] = '\0';
+        lp->head = 0;
 
         /* EOF? */
         if (newc == 0) {
@@ -260,7 +294,48 @@ readXMLEle (LilXML *lp, int newc, char ynot[])
          */
         root = lp->ce;
         lp->ce = NULL;
+        head = (lp->cs == LOOK4CON);	/* closed any other way if complete */
         initParser(lp);
+        lp->head = head;
+        return (root);
+}
+
+/* process as much as possible of the len chars in buf.
+ * same as calling readXMLEle() for each char in turn, but runs of plain pcdata
+ * and attribute values are scanned and appended to the element in one go.
+ * *consumed is set to the number of chars used, which is less than len if a
+ * complete element was found or an error occurred. call again with the rest.
+ * when find closure with outter element return root of complete tree.
+ * when find error return NULL with reason in ynot[].
+ * when need more return NULL with ynot[0] = '\0'.
+ * N.B. it is up to the caller to delete any tree returned with delXMLEle().
+ */
+XMLEle *
+readXMLEleBuf (LilXML *lp, const char *buf, size_t len, size_t *consumed,
+char ynot[])
+{
+        const char *bp = buf, *end = buf + len;
+        XMLEle *root = NULL;
+
+        /* start optimistic */
+        ynot[0] = '\0';
+
+        while (bp < end) {
+            /* Strings count in ints, take at most 1 GB per run */
+            size_t n = (size_t)(end - bp) > 0x40000000 ? 0x40000000 : (size_t)(end - bp);
+
+            /* bulk copy plain chars if in the middle of pcdata or a value */
+            if ((n = runXMLchars (lp, bp, n)) > 0) {
+                bp += n;
+                continue;
+            }
+
+            root = readXMLEle (lp, *bp++, ynot);
+            if (root || ynot[0])
+                break;
+        }
+
+        *consumed = bp - buf;
         return (root);
 }
 
@@ -715,7 +790,7 @@ decodeEntity (char *ent, int *cp)
             {"&gt;",   '>'},
             {"&quot;", '"'},
         };
-        int i;
+        size_t i;
 
         for (i = 0; i < sizeof(enttable)/sizeof(enttable[0]); i++) {
             if (strcmp (ent, enttable[i].ent) == 0) {
@@ -757,18 +832,22 @@ oneXMLchar (LilXML *lp, int c, char ynot[])
         case INTAG:			/* reading tag */
             if (isTokenChar (0, c))
                 growString (&lp->ce->tag, c);
-            else if (c == '>')
+            else if (c == '>') {
                 lp->cs = LOOK4CON;
-            else if (c == '/')
+                if (isHeadTag (lp))
+                    return (1);		/* just the head was wanted */
+            } else if (c == '/')
                 lp->cs = SAWSLASH;
             else
                 lp->cs = LOOK4ATTRN;
             break;
 
         case LOOK4ATTRN:		/* looking for attr name, > or / */
-            if (c == '>')
+            if (c == '>') {
                 lp->cs = LOOK4CON;
-            else if (c == '/')
+                if (isHeadTag (lp))
+                    return (1);		/* just the head was wanted */
+            } else if (c == '/')
                 lp->cs = SAWSLASH;
             else if (isTokenChar (1, c)) {
                 XMLAtt *ap = growAtt(lp->ce);
@@ -928,13 +1007,70 @@ oneXMLchar (LilXML *lp, int c, char ynot[])
         return (0);
 }
 
+/* if lp is reading pcdata or an attribute value, append the longest run of
+ * chars from buf[n] that oneXMLchar() would just add one at a time.
+ * a run stops before '<', '&', '\0' or the attribute delimiter, these are
+ * left for readXMLEle() to handle the normal way.
+ * return number of chars used, 0 if not in such a state.
+ */
+static size_t
+runXMLchars (LilXML *lp, const char *buf, size_t n)
+{
+        const char *p, *q, *end;
+        String *sp;
+
+        /* only while inside content or a value and nothing is pending */
+        if (lp->skipping || lp->lastc == '<' || !lp->ce)
+            return (0);
+        if (lp->cs == INCON)
+            sp = &lp->ce->pcdata;
+        else if (lp->cs == INATTRV)
+            sp = &lp->ce->at[lp->ce->nat-1]->valu;
+        else
+            return (0);
+
+        /* find end of run */
+        if ((p = memchr (buf, '<', n)) != NULL)
+            n = p - buf;
+        if ((p = memchr (buf, '&', n)) != NULL)
+            n = p - buf;
+        if ((p = memchr (buf, '\0', n)) != NULL)
+            n = p - buf;
+        if (lp->cs == INATTRV && (p = memchr (buf, lp->delim, n)) != NULL)
+            n = p - buf;
+        if (n == 0)
+            return (0);
+        end = buf + n;
+
+        /* keep line count */
+        for (p = buf; (p = memchr (p, '\n', end - p)) != NULL; p++)
+            lp->ln++;
+
+        /* append, values silently drop control chars */
+        if (lp->cs == INCON)
+            appendBytes (sp, buf, n);
+        else {
+            for (p = buf; p < end; p = q + 1) {
+                for (q = p; q < end && !iscntrl(*q); q++)
+                    continue;
+                appendBytes (sp, p, q - p);
+            }
+        }
+
+        lp->lastc = end[-1];
+        return (n);
+}
+
 /* set up for a fresh start again */
 static void
 initParser(LilXML *lp)
 {
+        char *headtag = lp->headtag;
+
         delXMLEle (lp->ce);
         freeString (&lp->endtag);
         memset (lp, 0, sizeof(*lp));
+        lp->headtag = headtag;
         newString (&lp->endtag);
         lp->cs = LOOK4START;
         lp->ln = 1;
@@ -1017,6 +1153,13 @@ resetEndTag(LilXML *lp)
         newString (&lp->endtag);
 }
 
+/* 1 if ce is an outter element whose head is all that was asked for, else 0 */
+static int
+isHeadTag (LilXML *lp)
+{
+        return (lp->headtag && !lp->ce->pe && !strcmp (lp->ce->tag.s, lp->headtag));
+}
+
 /* 1 if c is a valid token character, else 0.
  * it can be alpha or '_' or numeric unless start.
  */
@@ -1060,6 +1203,26 @@ appendString (String *sp, const char *str)
         sp->sl += strl;
 }
 
+/* append n chars at str to the String storage at *sp */
+static void
+appendBytes (String *sp, const char *str, int n)
+{
+        int l = sp->sl + n + 1;		/* need room for '\0' */
+
+        if (n <= 0)
+            return;
+        if (l > sp->sm) {
+            if (!sp->s)
+                newString (sp);
+            while (l > sp->sm)
+                sp->sm *= 2;
+            sp->s = (char *) moremem (sp->s, sp->sm);
+        }
+        memcpy (&sp->s[sp->sl], str, n);
+        sp->sl += n;
+        sp->s[sp->sl] = '\0';
+}
+
 /* init a String with a malloced string containing just \0 */
 static void
 newString(String *sp)
@@ -1088,6 +1251,88 @@ moremem (void *old, int n)
         return (old ? (*myrealloc)(old, n) : (*mymalloc)(n));
 }
 
+#if defined(MAIN_BENCH)
+/* to build a stand-alone benchmark comparing readXMLEle() with readXMLEleBuf():
+ *   cc -O2 -DMAIN_BENCH -o lilxmlbench lilxml.c
+ * run ./lilxmlbench [MB] to parse one setBLOBVector of MB (default 50) MB of
+ * base64 both ways, fed in 4 KB reads like indiserver, and report MB/s.
+ */
+
+#include <sys/time.h>
+
+static double
+benchSecs (void)
+{
+        struct timeval tv;
+        gettimeofday (&tv, NULL);
+        return (tv.tv_sec + tv.tv_usec*1e-6);
+}
+
+/* parse all of msg[n], in reads of 4096, one way or the other */
+static double
+benchParse (const char *msg, int n, int bulk)
+{
+        LilXML *lp = newLilXML();
+        char ynot[1024];
+        XMLEle *root = NULL;
+        double t0 = benchSecs();
+        int i, j;
+
+        for (i = 0; i < n; i += 4096) {
+            int nr = n - i < 4096 ? n - i : 4096;
+            if (bulk) {
+                size_t off = 0, used;
+                while (off < nr) {
+                    root = readXMLEleBuf (lp, msg+i+off, nr-off, &used, ynot);
+                    off += used;
+                    if (root || ynot[0])
+                        break;
+                }
+            } else {
+                for (j = 0; j < nr; j++) {
+                    root = readXMLEle (lp, msg[i+j], ynot);
+                    if (root || ynot[0])
+                        break;
+                }
+            }
+            if (root || ynot[0])
+                break;
+        }
+
+        if (!root || pcdatalenXMLEle(nextXMLEle(root,1)) <= 0)
+            fprintf (stderr, "parse failed: %s\n", ynot);
+        delXMLEle (root);
+        delLilXML (lp);
+        return (benchSecs() - t0);
+}
+
+int
+main (int ac, char *av[])
+{
+        int mb = ac > 1 ? atoi(av[1]) : 50;
+        int nb64 = mb*1024*1024, n, i;
+        char *msg = malloc (nb64 + nb64/72 + 1024);
+        double t1, tn;
+
+        n = sprintf (msg, "<setBLOBVector device='CCD' name='CCD1' state='Ok'>\n"
+                "<oneBLOB name='CCD1' size='%d' format='.fits'>\n", nb64/4*3);
+        for (i = 0; i < nb64; i++) {
+            msg[n++] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/"[i%64];
+            if (i%72 == 71)
+                msg[n++] = '\n';
+        }
+        n += sprintf (msg+n, "\n</oneBLOB>\n</setBLOBVector>\n");
+
+        t1 = benchParse (msg, n, 0);
+        tn = benchParse (msg, n, 1);
+        printf ("readXMLEle:    %8.1f MB/s\n", n/t1/1024/1024);
+        printf ("readXMLEleBuf: %8.1f MB/s\n", n/tn/1024/1024);
+
+        free (msg);
+        return (0);
+}
+#endif
+
 #if defined(MAIN_TST)
 int
 main (int ac, char *av[])
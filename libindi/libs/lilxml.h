@@ -101,6 +101,29 @@ extern void delXMLEle (XMLEle *e);
  */
 extern XMLEle *readXMLEle (LilXML *lp, int c, char errmsg[]);
 
+/** \brief Process an XML buffer, scanning whole runs of pcdata and attribute values at once.
+    \param lp a pointer to a lilxml parser.
+    \param buf characters to process.
+    \param len number of characters in buf.
+    \param consumed set to the number of characters used. This is less than len if a complete element was found or a parsing error occured, call again with the remainder.
+    \param errmsg a buffer to store error messages if an error in parsing is encounterd.
+    \return Same as readXMLEle(), as if it had been called for each character used.
+ */
+extern XMLEle *readXMLEleBuf (LilXML *lp, const char *buf, size_t len, size_t *consumed, char errmsg[]);
+
+/** \brief Return outer elements with the given tag as soon as their opening tag is complete.
+    The element returned then has only its tag and attributes. The caller must consume its content and closing tag from the input itself before parsing on. This lets large elements be passed through without building a tree.
+    \param lp a pointer to a lilxml parser.
+    \param tag the outer element tag, or NULL to return to parsing complete elements.
+ */
+extern void setHeadXMLEle (LilXML *lp, const char *tag);
+
+/** \brief Check whether the element last returned is only the head of an element, as arranged with setHeadXMLEle().
+    \param lp a pointer to a lilxml parser.
+    \return 1 if only the opening tag was parsed, 0 if the element is complete.
+ */
+extern int gotHeadXMLEle (LilXML *lp);
+
 /* search functions */
 /** \brief Find an XML attribute within an XML element.
     \param e a pointer to the XML element to search.
@@ -47,6 +47,10 @@
 
 #define CLEAR(x) memset (&(x), 0, sizeof (x))
 
+/* Buffers requested from the device. One of them is held with the last
+   frame, the others are queued. */
+#define V4L2_NBUFFERS	5
+
 using namespace std;
 
 /*char *entityXML(char *src) {
@@ -71,13 +75,18 @@ V4L2_Base::V4L2_Base()
    xmax = xmin = 160;
    ymax = ymin = 120;
 
-   io		= IO_METHOD_MMAP;
+   /* Frames land in our own page aligned buffers when the device can do it,
+      init_device() falls back to mmap otherwise */
+   io		= IO_METHOD_USERPTR;
    fd           = -1;
    buffers      = NULL;
    n_buffers    = 0;
+   held         = -1;
 
 
    callback     = NULL;
+   recorder     = NULL;
+   dorecord     = false;
 
    cancrop=true;
    cansetrate=true;
@@ -85,6 +94,7 @@ V4L2_Base::V4L2_Base()
    v4l2_decode=new V4L2_Decode();
    decoder=v4l2_decode->getDefaultDecoder();
    decoder->init();
+   decoder->usezerocopy(true);
    dodecode=true;
    const std::vector<unsigned int> &vsuppformats=decoder->getsupportedformats();
    IDLog("Using default decoder '%s'\n  Supported V4L2 formats are:\n  ", decoder->getName());
@@ -123,6 +133,10 @@ void V4L2_Base::doDecode(bool d) {
   dodecode=d;
 }
 
+void V4L2_Base::setBayerEdge(bool e) {
+  decoder->usebayeredge(e);
+}
+
 void V4L2_Base::doRecord(bool d) {
   dorecord=d;
 }
@@ -204,11 +218,11 @@ int V4L2_Base::read_frame(char *errmsg) {
     break;
   
   case IO_METHOD_MMAP:
-    //cerr << "in read Frame method mmap" << endl;
+  case IO_METHOD_USERPTR:
     CLEAR (buf);
 
     buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    buf.memory = V4L2_MEMORY_MMAP;
+    buf.memory = (io == IO_METHOD_MMAP) ? V4L2_MEMORY_MMAP : V4L2_MEMORY_USERPTR;
     
     if (-1 == xioctl (fd, VIDIOC_DQBUF, &buf)) {
       switch (errno) {
@@ -219,14 +233,22 @@ int V4L2_Base::read_frame(char *errmsg) {
 	/* Could ignore EIO, see spec. */
 	/* fall through */
       default:
-	return errno_exit ("ReadFrame IO_METHOD_MMAP: VIDIOC_DQBUF", errmsg);
+	return errno_exit ("ReadFrame: VIDIOC_DQBUF", errmsg);
       }
     }
 
+    if (io == IO_METHOD_USERPTR) {
+      for (i = 0; i < n_buffers; ++i)
+	if (buf.m.userptr == (unsigned long) buffers[i].start)
+	  break;
+      assert (i < n_buffers);
+      buf.index = i;
+    }
+
     assert (buf.index < n_buffers);
     //IDLog("v4l2_base: dequeuing buffer %d, bytesused = %d, flags = 0x%X, field = %d, sequence = %d\n", buf.index, buf.bytesused, buf.flags, buf.field, buf.sequence);
-    //IDLog("v4l2_base: dequeuing buffer %d for fd=%d, cropset %c\n", buf.index, fd, (cropset?'Y':'N'));
     //IDLog("V4L2_base read_frame: calling decoder (@ %x) %c\n", decoder, (dodecode?'Y':'N'));
+    if (recorder) recorder->settimestamp(&buf);
     if (dodecode) decoder->decode((unsigned char *)(buffers[buf.index].start), &buf);
     //IDLog("V4L2_base read_frame: calling recorder(@ %x) %c\n", recorder, (dorecord?'Y':'N'));
     if (dorecord) recorder->writeFrame((unsigned char *)(buffers[buf.index].start));
@@ -237,8 +259,11 @@ int V4L2_Base::read_frame(char *errmsg) {
       return 0;
       } 
     */
-    if (-1 == xioctl (fd, VIDIOC_QBUF, &buf))
-      return errno_exit ("ReadFrame IO_METHOD_MMAP: VIDIOC_QBUF", errmsg);
+    /* The decoder may point into this frame: keep its buffer until the next
+       frame is read, and give the previous one back to the device instead */
+    if (held != -1 && queue_buffer(held, errmsg) == -1)
+      return -1;
+    held = buf.index;
 
     if( lxstate == LX_ACTIVE ) {
       /* Call provided callback function if any */
@@ -249,44 +274,40 @@ int V4L2_Base::read_frame(char *errmsg) {
     if( lxstate == LX_TRIGGERED )
       lxstate = LX_ACTIVE;
     break;
-    
-  case IO_METHOD_USERPTR:
-    cerr << "in read Frame method userptr" << endl;
-    CLEAR (buf);
-    
-    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    buf.memory = V4L2_MEMORY_USERPTR;
-    
-    if (-1 == xioctl (fd, VIDIOC_DQBUF, &buf)) {
-      switch (errno) {
-      case EAGAIN:
-	return 0;
-      case EIO:
-	/* Could ignore EIO, see spec. */
-	/* fall through */
-      default:
-	errno_exit ("VIDIOC_DQBUF", errmsg);
-      }
-    }
-    
-    for (i = 0; i < n_buffers; ++i)
-      if (buf.m.userptr == (unsigned long) buffers[i].start
-	  && buf.length == buffers[i].length)
-	break;
-    
-    assert (i < n_buffers);
-    
-    //process_image ((void *) buf.m.userptr);
-    
-    if (-1 == xioctl (fd, VIDIOC_QBUF, &buf))
-      errno_exit ("ReadFrame IO_METHOD_USERPTR: VIDIOC_QBUF", errmsg);
-    
-    break;
   }
   
   return 0;
 }
 
+int V4L2_Base::queue_buffer(unsigned int index, char *errmsg) {
+  struct v4l2_buffer qbuf;
+
+  CLEAR (qbuf);
+  qbuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  qbuf.index = index;
+  if (io == IO_METHOD_MMAP) {
+    qbuf.memory = V4L2_MEMORY_MMAP;
+  } else {
+    qbuf.memory = V4L2_MEMORY_USERPTR;
+    qbuf.m.userptr = (unsigned long) buffers[index].start;
+    qbuf.length = buffers[index].length;
+  }
+
+  if (-1 == xioctl (fd, VIDIOC_QBUF, &qbuf))
+    return errno_exit ("VIDIOC_QBUF", errmsg);
+  return 0;
+}
+
+unsigned char * V4L2_Base::getFrameBuffer() {
+  if (held == -1) return NULL;
+  return (unsigned char *) buffers[held].start;
+}
+
+int V4L2_Base::getFrameDmaBuf() {
+  if (held == -1) return -1;
+  return buffers[held].dmafd;
+}
+
 int V4L2_Base::stop_capturing(char *errmsg) {
   enum v4l2_buf_type type;
   unsigned int i;
@@ -309,6 +330,8 @@ int V4L2_Base::stop_capturing(char *errmsg) {
     
     IERmCallback(selectCallBackID);
     selectCallBackID = -1;
+    /* streamoff gives all buffers back, the last frame stays readable in its buffer */
+    held = -1;
     if (-1 == xioctl (fd, VIDIOC_STREAMOFF, &type))
       return errno_exit ("VIDIOC_STREAMOFF", errmsg);
     break;
@@ -320,10 +343,31 @@ int V4L2_Base::stop_capturing(char *errmsg) {
 }
 
 int V4L2_Base::start_capturing(char * errmsg) {
-  unsigned int i;
+  unsigned int i, first = 0;
   enum v4l2_buf_type type;
   
-  if (!streamedonce) init_device(errmsg);
+  if (!streamedonce && init_device(errmsg) == -1)
+    return -1;
+
+  /* Some devices only find out they can not capture to user memory when the
+     first buffer is queued */
+  if (io == IO_METHOD_USERPTR) {
+    if (queue_buffer(0, errmsg) == 0)
+      first = 1;
+    else {
+      struct v4l2_requestbuffers req;
+
+      IDLog("%s can not capture to user memory, using mmap i/o\n", dev_name);
+      uninit_device(errmsg);
+      CLEAR (req);
+      req.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+      req.memory = V4L2_MEMORY_USERPTR;
+      xioctl (fd, VIDIOC_REQBUFS, &req);
+      io = IO_METHOD_MMAP;
+      if (init_mmap(errmsg) == -1)
+	return -1;
+    }
+  }
   
   switch (io) {
   case IO_METHOD_READ:
@@ -331,19 +375,13 @@ int V4L2_Base::start_capturing(char * errmsg) {
     break;
     
   case IO_METHOD_MMAP:
-    for (i = 0; i < n_buffers; ++i) {
-      struct v4l2_buffer buf;
-      
-      CLEAR (buf);
-      
-      buf.type        = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-      buf.memory      = V4L2_MEMORY_MMAP;
-      buf.index       = i;
-      //IDLog("v4l2_start_capturing: enqueuing buffer %d for fd=%d\n", buf.index, fd);
-      /*if (-1 == xioctl (fd, VIDIOC_QBUF, &buf))
-	return errno_exit ("StartCapturing IO_METHOD_MMAP: VIDIOC_QBUF", errmsg);*/
-      xioctl (fd, VIDIOC_QBUF, &buf);
-      
+  case IO_METHOD_USERPTR:
+    held = -1;
+    for (i = first; i < n_buffers; ++i) {
+      //IDLog("v4l2_start_capturing: enqueuing buffer %d for fd=%d\n", i, fd);
+      /* mmap buffers may still be queued, see stop_capturing() */
+      if (queue_buffer(i, errmsg) == -1 && io == IO_METHOD_USERPTR)
+	return -1;
     }
     
     type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
@@ -354,29 +392,6 @@ int V4L2_Base::start_capturing(char * errmsg) {
     streamactive = true;
     
     break;
-
-  case IO_METHOD_USERPTR:
-    for (i = 0; i < n_buffers; ++i) {
-      struct v4l2_buffer buf;
-      
-      CLEAR (buf);
-      
-      buf.type        = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-      buf.memory      = V4L2_MEMORY_USERPTR;
-      buf.m.userptr	= (unsigned long) buffers[i].start;
-      buf.length      = buffers[i].length;
-      
-      if (-1 == xioctl (fd, VIDIOC_QBUF, &buf))
-	return errno_exit ("StartCapturing IO_METHOD_USERPTR: VIDIOC_QBUF", errmsg);
-    }
-    
-    
-    type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    
-    if (-1 == xioctl (fd, VIDIOC_STREAMON, &type))
-      return errno_exit ("VIDIOC_STREAMON", errmsg);
-    
-    break;
   }
   
   streamedonce=true;
@@ -398,9 +413,12 @@ int V4L2_Base::uninit_device(char *errmsg) {
     break;
     
   case IO_METHOD_MMAP:
-    for (unsigned int i = 0; i < n_buffers; ++i)
+    for (unsigned int i = 0; i < n_buffers; ++i) {
+      if (buffers[i].dmafd != -1)
+	close (buffers[i].dmafd);
       if (-1 == munmap (buffers[i].start, buffers[i].length))
 	return errno_exit ("munmap", errmsg);
+    }
     break;
     
   case IO_METHOD_USERPTR:
@@ -410,6 +428,9 @@ int V4L2_Base::uninit_device(char *errmsg) {
   }
   
   free (buffers);
+  buffers = NULL;
+  n_buffers = 0;
+  held = -1;
   
   return 0;
 }
@@ -436,7 +457,7 @@ int V4L2_Base::init_mmap(char *errmsg) {
   
   CLEAR (req);
   
-  req.count               = 4;
+  req.count               = V4L2_NBUFFERS;
   //req.count               = 1;
   req.type                = V4L2_BUF_TYPE_VIDEO_CAPTURE;
   req.memory              = V4L2_MEMORY_MMAP;
@@ -491,47 +512,63 @@ int V4L2_Base::init_mmap(char *errmsg) {
     
     if (MAP_FAILED == buffers[n_buffers].start)
       return errno_exit ("mmap", errmsg);
+
+    /* Export the buffer as DMABUF where the device supports it, so frames
+       can be handed on by descriptor */
+    buffers[n_buffers].dmafd = -1;
+#ifdef VIDIOC_EXPBUF
+    struct v4l2_exportbuffer expbuf;
+    CLEAR (expbuf);
+    expbuf.type  = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    expbuf.index = n_buffers;
+    expbuf.flags = O_RDONLY | O_CLOEXEC;
+    if (0 == xioctl (fd, VIDIOC_EXPBUF, &expbuf))
+      buffers[n_buffers].dmafd = expbuf.fd;
+#endif
   }
   
   return 0;
 }
 
-void V4L2_Base::init_userp(unsigned int buffer_size) {
+/* Capture to a pool of page aligned buffers of our own, falls back to mmap
+   when the device can not */
+int V4L2_Base::init_userp(unsigned int buffer_size, char *errmsg) {
   struct v4l2_requestbuffers req;
-  char errmsg[ERRMSGSIZ];
+  long pagesize = sysconf (_SC_PAGESIZE);
   
   CLEAR (req);
   
-  req.count               = 4;
+  req.count               = V4L2_NBUFFERS;
   req.type                = V4L2_BUF_TYPE_VIDEO_CAPTURE;
   req.memory              = V4L2_MEMORY_USERPTR;
   
   if (-1 == xioctl (fd, VIDIOC_REQBUFS, &req)) {
     if (EINVAL == errno) {
-      fprintf (stderr, "%s does not support "
-	       "user pointer i/o\n", dev_name);
-      exit (EXIT_FAILURE);
+      IDLog("%s does not support user pointer i/o, using mmap i/o\n", dev_name);
+      io = IO_METHOD_MMAP;
+      return init_mmap(errmsg);
     } else {
-      errno_exit ("VIDIOC_REQBUFS", errmsg);
+      return errno_exit ("VIDIOC_REQBUFS", errmsg);
     }
   }
 
-  buffers = (buffer *) calloc (4, sizeof (*buffers));
+  buffers = (buffer *) calloc (V4L2_NBUFFERS, sizeof (*buffers));
 
   if (!buffers) {
-    fprintf (stderr, "Out of memory\n");
-    exit (EXIT_FAILURE);
+    strncpy(errmsg, "buffers. Out of memory\n", ERRMSGSIZ);
+    return -1;
   }
   
-  for (n_buffers = 0; n_buffers < 4; ++n_buffers) {
+  buffer_size = (buffer_size + pagesize - 1) / pagesize * pagesize;
+  for (n_buffers = 0; n_buffers < V4L2_NBUFFERS; ++n_buffers) {
     buffers[n_buffers].length = buffer_size;
-    buffers[n_buffers].start = malloc (buffer_size);
-    
-    if (!buffers[n_buffers].start) {
-      fprintf (stderr, "Out of memory\n");
-      exit (EXIT_FAILURE);
+    buffers[n_buffers].dmafd = -1;
+    if (posix_memalign (&buffers[n_buffers].start, pagesize, buffer_size)) {
+      strncpy(errmsg, "buffers. Out of memory\n", ERRMSGSIZ);
+      return -1;
     }
   }
+  return 0;
 }
 
 int V4L2_Base::check_device(char *errmsg) {
@@ -840,7 +877,7 @@ int V4L2_Base::init_device(char *errmsg) {
     break;
     
   case IO_METHOD_USERPTR:
-    init_userp (fmt.fmt.pix.sizeimage);
+    return init_userp (fmt.fmt.pix.sizeimage, errmsg);
     break;
   }
   return 0;
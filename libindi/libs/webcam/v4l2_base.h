@@ -59,6 +59,7 @@ class V4L2_Base
    {
         void *                  start;
         size_t                  length;
+        int                     dmafd;  /* exported DMABUF, or -1 */
    };
 
   /* Connection */
@@ -122,9 +123,17 @@ class V4L2_Base
   bool isstreamactive() { return streamactive; }
 
   void doDecode(bool);
+  void setBayerEdge(bool e); // edge aware instead of bilinear demosaic
   void setRecorder(V4L2_Recorder *r);
   void doRecord(bool);
 
+  /* The last frame read stays in its buffer, which is only queued back to the
+     device when the next frame is read, so the decoder and the driver can use
+     it in place. These give that buffer, and its DMABUF descriptor when the
+     device exports one (-1 otherwise). */
+  unsigned char *getFrameBuffer();
+  int getFrameDmaBuf();
+
   protected:
 
   int xioctl(int fd, int request, void *arg);
@@ -137,7 +146,8 @@ class V4L2_Base
   int errno_exit(const char *s, char *errmsg);
   
   void close_device(void);
-  void init_userp(unsigned int buffer_size);
+  int init_userp(unsigned int buffer_size, char *errmsg);
+  int queue_buffer(unsigned int index, char *errmsg);
   void init_read(unsigned int buffer_size);
 
   void findMinMax();
@@ -174,6 +184,7 @@ class V4L2_Base
   int           fd;
   struct buffer *buffers;
   unsigned int  n_buffers;
+  int           held;   /* buffer of the last frame read, not queued, or -1 */
   bool reallocate_buffers;
   bool		dropFrame;
 
@@ -37,6 +37,7 @@
 #include <string.h> // memcpy
 //#include <stdio.h> // FILE *
 #include "../ccvt.h"
+#include "v4l2_convert.h"
 
 //#include <indilogger.h>
 
@@ -45,11 +46,16 @@ V4L2_Builtin_Decoder::V4L2_Builtin_Decoder() {
   name="Builtin decoder";
   useSoftCrop=false;
   doCrop=false;
+  useZeroCopy=false;
+  useBayerEdge=false;
   YBuf         = NULL;
   UBuf         = NULL;
   VBuf         = NULL;
   yuvBuffer    = NULL;
   yuyvBuffer    = NULL;
+  yuyvFrame     = NULL;
+  yuyvStride    = 0;
+  yuyvOrder     = V4L2_Convert::YUYV;
   colorBuffer  = NULL;
   rgb24_buffer = NULL;
   //cropbuf = NULL;
@@ -84,19 +90,19 @@ void V4L2_Builtin_Decoder::decode(unsigned char *frame, struct v4l2_buffer *buf)
     case V4L2_PIX_FMT_GREY:
       if (useSoftCrop && doCrop)
 	{
-	  unsigned char *src=frame + crop.c.left + (crop.c.top * fmt.fmt.pix.width);
-	  unsigned char *dest=YBuf;
-	  unsigned int i;
-	  for (i= 0; i < crop.c.height; i++)
-	    {
-	      memcpy(dest, src, crop.c.width);
-	      src += fmt.fmt.pix.width;
-	      dest += crop.c.width;
-	    }
+	  YBuf=yuvBuffer;
+	  V4L2_Convert::copy(frame + crop.c.left + (crop.c.top * fmt.fmt.pix.bytesperline), fmt.fmt.pix.bytesperline,
+			     crop.c.width, crop.c.height, YBuf);
+	}
+      else if (useZeroCopy && fmt.fmt.pix.bytesperline == bufwidth)
+	{
+	  // the frame is already what we want, point into it
+	  YBuf=frame;
 	}
       else
 	{
-	  memcpy(YBuf, frame, bufwidth * bufheight);
+	  YBuf=yuvBuffer;
+	  V4L2_Convert::copy(frame, fmt.fmt.pix.bytesperline, bufwidth, bufheight, YBuf);
 	}
       break;
       
@@ -104,34 +110,16 @@ void V4L2_Builtin_Decoder::decode(unsigned char *frame, struct v4l2_buffer *buf)
     case V4L2_PIX_FMT_YVU420:
       if (useSoftCrop && doCrop)
 	{
-	  unsigned char *src=frame + crop.c.left + (crop.c.top * fmt.fmt.pix.width);
-	  unsigned char *dest=YBuf;
-	  unsigned int i;
+	  unsigned char *src=frame + (fmt.fmt.pix.width * fmt.fmt.pix.height) + ((crop.c.left + (crop.c.top * fmt.fmt.pix.width) / 2) / 2);
+	  unsigned char *dest=UBuf, *destv=VBuf;
+	  YBuf=yuvBuffer;
 	  //IDLog("grabImage: src=%d dest=%d\n", src, dest);
-	  for (i= 0; i < crop.c.height; i++)
-	    {
-	      memcpy(dest, src, crop.c.width);
-	      src += fmt.fmt.pix.width;
-	      dest += crop.c.width;
-	    }
-	  
-	  dest=UBuf; src=frame + (fmt.fmt.pix.width * fmt.fmt.pix.height) + ((crop.c.left + (crop.c.top * fmt.fmt.pix.width) / 2) / 2);
-	  if (fmt.fmt.pix.pixelformat ==  V4L2_PIX_FMT_YVU420) { dest=VBuf;}
-	  for (i= 0; i < crop.c.height / 2; i++)
-	    {
-	      memcpy(dest, src, crop.c.width / 2);
-	      src += fmt.fmt.pix.width / 2;
-	      dest += crop.c.width / 2;
-	    }
-	  
-	  dest=VBuf; src=frame + (fmt.fmt.pix.width * fmt.fmt.pix.height) + ((fmt.fmt.pix.width * fmt.fmt.pix.height) / 4 )+ ((crop.c.left + (crop.c.top * fmt.fmt.pix.width) / 2) / 2);
-	  if (fmt.fmt.pix.pixelformat ==  V4L2_PIX_FMT_YVU420) { dest=UBuf;}
-	  for (i= 0; i < crop.c.height / 2; i++)
-	    {
-	      memcpy(dest, src, crop.c.width / 2);
-	      src += fmt.fmt.pix.width / 2;
-	      dest += crop.c.width / 2;
-	    }
+	  V4L2_Convert::copy(frame + crop.c.left + (crop.c.top * fmt.fmt.pix.width), fmt.fmt.pix.width,
+			     crop.c.width, crop.c.height, YBuf);
+	  if (fmt.fmt.pix.pixelformat ==  V4L2_PIX_FMT_YVU420) { dest=VBuf; destv=UBuf;}
+	  V4L2_Convert::copy(src, fmt.fmt.pix.width / 2, crop.c.width / 2, crop.c.height / 2, dest);
+	  V4L2_Convert::copy(src + ((fmt.fmt.pix.width * fmt.fmt.pix.height) / 4 ), fmt.fmt.pix.width / 2,
+			     crop.c.width / 2, crop.c.height / 2, destv);
 	}
       else
 	{
@@ -152,127 +140,64 @@ void V4L2_Builtin_Decoder::decode(unsigned char *frame, struct v4l2_buffer *buf)
      case V4L2_PIX_FMT_NV21:
       if (useSoftCrop && doCrop)
 	{
-	  unsigned char *src=frame + crop.c.left + (crop.c.top * fmt.fmt.pix.bytesperline);
-	  unsigned char *dest=YBuf, *destv;
-	  unsigned int i, j;
+	  // chroma lines hold pairs, so the crop starts left bytes into line top/2
+	  unsigned char *src=frame + (fmt.fmt.pix.bytesperline * fmt.fmt.pix.height) + crop.c.left + ((crop.c.top / 2) * fmt.fmt.pix.bytesperline);
+	  unsigned char *dest=UBuf, *destv=VBuf;
 	  //IDLog("grabImage: src=%d dest=%d\n", src, dest);
-	  for (i= 0; i < crop.c.height; i++)
-	    {
-	      memcpy(dest, src, crop.c.width);
-	      src += fmt.fmt.pix.bytesperline;
-	      dest += crop.c.width;
-	    }
-	  
-	  dest=UBuf; destv=VBuf;src=frame + (fmt.fmt.pix.bytesperline * fmt.fmt.pix.height) + ((crop.c.left + (crop.c.top * fmt.fmt.pix.bytesperline)/2) / 2);
+	  V4L2_Convert::copy(frame + crop.c.left + (crop.c.top * fmt.fmt.pix.bytesperline), fmt.fmt.pix.bytesperline,
+			     crop.c.width, crop.c.height, YBuf);
 	  if (fmt.fmt.pix.pixelformat ==  V4L2_PIX_FMT_NV21) { dest=VBuf; destv=UBuf;}
-	  for (i= 0; i < crop.c.height / 2; i++)
-	    {
-	      unsigned char *s = src;
-	      for (j=0; j < crop.c.width; j+=2) {
-		*(dest++)=*(s++);
-		*(destv++)=*(s++);
-	      }
-	      src += fmt.fmt.pix.bytesperline;
-	    }
+	  V4L2_Convert::nv12_to_uv(src, fmt.fmt.pix.bytesperline, crop.c.width, crop.c.height, dest, destv);
 	}
       else
 	{
-	  unsigned char *src=frame;
-	  unsigned char *dest=YBuf;
+	  unsigned char *dest=UBuf;
 	  unsigned char *destv=VBuf;
-	  unsigned int i, j;
-	  unsigned char *s;
 	  //FILE *f=fopen("/home/levaire/Images/indicvt.data","w");
 	  //FILE *fi=fopen("/home/levaire/Images/indifframe.data","w");
 	  //fwrite(frame, 1, (bufwidth*bufheight)+ ((bufwidth*bufheight) / 2), fi);
 	  //fwrite(frame, 1, buf->bytesused, fi);
 	  //fclose(fi);
-	  for (i=0; i< bufheight; i++) {
-	    memcpy(dest,src, bufwidth); src+=fmt.fmt.pix.bytesperline; dest+=bufwidth;
-	  }
-	  dest=UBuf; src=frame + (fmt.fmt.pix.bytesperline * bufheight);
+	  V4L2_Convert::copy(frame, fmt.fmt.pix.bytesperline, bufwidth, bufheight, YBuf);
 	  if (fmt.fmt.pix.pixelformat ==  V4L2_PIX_FMT_NV21) { dest=VBuf; destv=UBuf;}
-	  for (i= 0; i < bufheight / 2; i++)
-	    {
-	      s = src;
-	      //IDLog("NV12: converting UV line %d at %p, offset %d, pUbuf %p offset %d,  pVbuf %p offset %d\n", i, s, s- (frame + (fmt.fmt.pix.bytesperline * bufheight)), dest, dest-UBuf, destv, destv-VBuf);
-	      for (j=0; j < bufwidth; j+=2) {
-		*(dest++)=*(s++);
-		*(destv++)=*(s++);
-	      }
-	      src += fmt.fmt.pix.bytesperline; 
-	    }	  
+	  V4L2_Convert::nv12_to_uv(frame + (fmt.fmt.pix.bytesperline * bufheight), fmt.fmt.pix.bytesperline,
+				   bufwidth, bufheight, dest, destv);
 	  //fwrite(yuvBuffer, 1, (bufwidth*bufheight)+ ((bufwidth*bufheight) / 2), f);
 	  //fclose(f);
 	}
       break;
      
     case V4L2_PIX_FMT_YUYV:
-      if (useSoftCrop && doCrop) {
-	unsigned char *src=frame + 2*(crop.c.left) + (crop.c.top * fmt.fmt.pix.bytesperline);
-	unsigned char *dest=yuyvBuffer;
-	unsigned int i;
-	for (i= 0; i < crop.c.height; i++)
-	  {
-	    memcpy(dest, src, 2*crop.c.width);
-	    src += fmt.fmt.pix.bytesperline;
-	    dest += 2*crop.c.width;
-	  }
-      } else {
-	memcpy(yuyvBuffer, frame, 2*bufwidth*bufheight);
-      }
-      break;
-		
     case V4L2_PIX_FMT_UYVY: 
     case V4L2_PIX_FMT_VYUY: 
     case V4L2_PIX_FMT_YVYU: 
       {
-      unsigned char *src;
-      unsigned char *dest=yuyvBuffer;
-      unsigned char *s, *s1, *s2, *s3, *s4;	
-      int i, j;
-
+      // the conversions read any byte order and stride, keep the frame as it is
+      unsigned char *src=frame;
       if (useSoftCrop && doCrop) {
 	src=frame + 2*(crop.c.left) + (crop.c.top * fmt.fmt.pix.bytesperline);
 	//IDLog("Decoding UYVY with cropping %dx%d frame at %lx\n", width, height, src);
-      } else {
-	src=frame;
-	//IDLog("Decoding UYVY  %dx%d frame at %lx\n", width, height, src);
       }
-      for (i=0; i < bufheight; i++) { 
-	s=src;
-	switch (fmt.fmt.pix.pixelformat) {
-	case V4L2_PIX_FMT_UYVY: s1=(s+1);s2=(s);s3=(s+3);s4=(s+2); break;
-	case V4L2_PIX_FMT_VYUY: s1=(s+1);s2=(s+2);s3=(s+3);s4=(s); break;
-	case V4L2_PIX_FMT_YVYU: s1=(s);s2=(s+3);s3=(s+2);s4=(s+1); break;
-	}
-	for (j=0; j < (bufwidth / 2); j++) {
-	  *(dest++)=*(s1);
-	  *(dest++)=*(s2);
-	  *(dest++)=*(s3);
-	  *(dest++)=*(s4);
-	  s1+=4;s2+=4; s3+=4;s4+=4;
-	}
-	src+= fmt.fmt.pix.bytesperline;
+      if (useZeroCopy) {
+	yuyvFrame=src;
+	yuyvStride=fmt.fmt.pix.bytesperline;
+      } else {
+	yuyvFrame=yuyvBuffer;
+	yuyvStride=2*bufwidth;
+	V4L2_Convert::copy(src, fmt.fmt.pix.bytesperline, 2*bufwidth, bufheight, yuyvBuffer);
       }
       }
       break;
       
     case V4L2_PIX_FMT_RGB24:
       {
-	unsigned char *src, *dest=rgb24_buffer;
-	unsigned int i;
+	unsigned char *src;
 	if (useSoftCrop && doCrop) {
 	  src=frame + (3*(crop.c.left)) + (crop.c.top * fmt.fmt.pix.bytesperline);
 	} else {
 	  src=frame;
 	}
-	for (i= 0; i < bufheight; i++)
-	  {
-	    memcpy(dest, src, 3*bufwidth);
-	    src += fmt.fmt.pix.bytesperline;
-	    dest += 3*bufwidth;
-	  }
+	V4L2_Convert::copy(src, fmt.fmt.pix.bytesperline, 3*bufwidth, bufheight, rgb24_buffer);
 	//memcpy(rgb24_buffer,  frame, fmt.fmt.pix.width * fmt.fmt.pix.height * 3);
       }
       break;
@@ -324,11 +249,9 @@ void V4L2_Builtin_Decoder::decode(unsigned char *frame, struct v4l2_buffer *buf)
       break;
       
     case V4L2_PIX_FMT_SBGGR8:
-      bayer2rgb24(rgb24_buffer, frame, fmt.fmt.pix.width, fmt.fmt.pix.height);
-      break;
-
     case V4L2_PIX_FMT_SRGGB8:
-      bayer_rggb_2rgb24(rgb24_buffer, frame, fmt.fmt.pix.width, fmt.fmt.pix.height);
+      V4L2_Convert::bayer_to_rgb24(frame, fmt.fmt.pix.bytesperline, (fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_SRGGB8),
+				   useBayerEdge, fmt.fmt.pix.width, fmt.fmt.pix.height, rgb24_buffer);
       break;
       
     case V4L2_PIX_FMT_JPEG:
@@ -367,6 +290,16 @@ void V4L2_Builtin_Decoder::resetcrop() {
   allocBuffers();
 }
 
+void V4L2_Builtin_Decoder::usezerocopy(bool c) {
+  IDLog("Decoder usezerocopy %s\n", (c?"true":"false"));
+  useZeroCopy=c;
+}
+
+void V4L2_Builtin_Decoder::usebayeredge(bool c) {
+  IDLog("Decoder usebayeredge %s\n", (c?"true":"false"));
+  useBayerEdge=c;
+}
+
 void V4L2_Builtin_Decoder::usesoftcrop(bool c) {
   IDLog("Decoder usesoftcrop %s\n", (c?"true":"false"));
   useSoftCrop=c;
@@ -384,7 +317,7 @@ void V4L2_Builtin_Decoder::allocBuffers()
 {
   YBuf = NULL; UBuf = NULL; VBuf = NULL;
   if (yuvBuffer) delete [](yuvBuffer); yuvBuffer = NULL;
-  if (yuyvBuffer) delete [] (yuyvBuffer); yuyvBuffer = NULL;
+  if (yuyvBuffer) delete [] (yuyvBuffer); yuyvBuffer = NULL; yuyvFrame = NULL;
   if (colorBuffer) delete [] (colorBuffer); colorBuffer = NULL;
   if (rgb24_buffer) delete [] (rgb24_buffer); rgb24_buffer = NULL;
   //if (cropbuf) free(cropbuf); cropbuf=NULL;
@@ -414,6 +347,14 @@ void V4L2_Builtin_Decoder::allocBuffers()
   case V4L2_PIX_FMT_VYUY: 
   case V4L2_PIX_FMT_YVYU: 
     yuyvBuffer=new unsigned char[(bufwidth * bufheight) * 2];
+    yuyvFrame=yuyvBuffer;
+    yuyvStride=2 * bufwidth;
+    switch (fmt.fmt.pix.pixelformat) {
+    case V4L2_PIX_FMT_UYVY: yuyvOrder=V4L2_Convert::UYVY; break;
+    case V4L2_PIX_FMT_VYUY: yuyvOrder=V4L2_Convert::VYUY; break;
+    case V4L2_PIX_FMT_YVYU: yuyvOrder=V4L2_Convert::YVYU; break;
+    default: yuyvOrder=V4L2_Convert::YUYV; break;
+    }
     break;
   case V4L2_PIX_FMT_RGB24:
   case V4L2_PIX_FMT_RGB555:
@@ -447,7 +388,7 @@ unsigned char * V4L2_Builtin_Decoder::getY()
   case V4L2_PIX_FMT_UYVY:
   case V4L2_PIX_FMT_VYUY: 
   case V4L2_PIX_FMT_YVYU: 
-    ccvt_yuyv_420p(bufwidth, bufheight, yuyvBuffer, YBuf, UBuf, VBuf);
+    V4L2_Convert::packed422_to_420p(yuyvFrame, yuyvStride, yuyvOrder, bufwidth, bufheight, YBuf, UBuf, VBuf);
     break;
   }
   return YBuf;
@@ -476,23 +417,23 @@ unsigned char * V4L2_Builtin_Decoder::getColorBuffer()
   case V4L2_PIX_FMT_YVU420:
   case V4L2_PIX_FMT_NV12:
   case V4L2_PIX_FMT_NV21:
-    ccvt_420p_bgr32(bufwidth, bufheight, (void *)yuvBuffer, (void*)colorBuffer);
+    V4L2_Convert::yuv420p_to_bgr32(YBuf, UBuf, VBuf, bufwidth, bufheight, colorBuffer);
     break;
   case V4L2_PIX_FMT_YUYV:
   case V4L2_PIX_FMT_UYVY:
   case V4L2_PIX_FMT_VYUY: 
   case V4L2_PIX_FMT_YVYU: 
-    ccvt_yuyv_bgr32(bufwidth, bufheight, yuyvBuffer, (void*)colorBuffer);
+    V4L2_Convert::packed422_to_bgr32(yuyvFrame, yuyvStride, yuyvOrder, bufwidth, bufheight, colorBuffer);
     break;
   case V4L2_PIX_FMT_RGB24:
   case V4L2_PIX_FMT_RGB555:
   case V4L2_PIX_FMT_RGB565:
   case V4L2_PIX_FMT_SBGGR8:
   case V4L2_PIX_FMT_SRGGB8:
-    ccvt_rgb24_bgr32(bufwidth, bufheight,rgb24_buffer, (void*)colorBuffer);
+    V4L2_Convert::rgb24_to_bgr32(rgb24_buffer, bufwidth * bufheight, colorBuffer);
     break;
   default:
-    ccvt_420p_bgr32(bufwidth, bufheight, (void *)yuvBuffer, (void*)colorBuffer);
+    V4L2_Convert::yuv420p_to_bgr32(YBuf, UBuf, VBuf, bufwidth, bufheight, colorBuffer);
     break;
   }
   return colorBuffer;
@@ -511,18 +452,23 @@ unsigned char * V4L2_Builtin_Decoder::getRGBBuffer()
   case V4L2_PIX_FMT_YVU420:
   case V4L2_PIX_FMT_NV12:
   case V4L2_PIX_FMT_NV21:
-    ccvt_420p_rgb24(bufwidth, bufheight, (void *)yuvBuffer, (void*)rgb24_buffer);
+    V4L2_Convert::yuv420p_to_rgb24(YBuf, UBuf, VBuf, bufwidth, bufheight, rgb24_buffer);
     break;
   case V4L2_PIX_FMT_YUYV:
   case V4L2_PIX_FMT_UYVY:
   case V4L2_PIX_FMT_VYUY: 
   case V4L2_PIX_FMT_YVYU: 
-    if (!colorBuffer) colorBuffer = new unsigned char[(bufwidth * bufheight) * 4];
-    ccvt_yuyv_bgr32(bufwidth, bufheight, yuyvBuffer, (void*)colorBuffer);
-    ccvt_bgr32_rgb24(bufwidth, bufheight, colorBuffer, (void*)rgb24_buffer);
+    V4L2_Convert::packed422_to_rgb24(yuyvFrame, yuyvStride, yuyvOrder, bufwidth, bufheight, rgb24_buffer);
+    break;
+  case V4L2_PIX_FMT_RGB24:
+  case V4L2_PIX_FMT_RGB555:
+  case V4L2_PIX_FMT_RGB565:
+  case V4L2_PIX_FMT_SBGGR8:
+  case V4L2_PIX_FMT_SRGGB8:
+    // decoded there already
     break;
   default:
-    ccvt_420p_rgb24(bufwidth, bufheight, (void *)yuvBuffer, (void*)rgb24_buffer);
+    V4L2_Convert::yuv420p_to_rgb24(YBuf, UBuf, VBuf, bufwidth, bufheight, rgb24_buffer);
     break;
   }
   return rgb24_buffer;
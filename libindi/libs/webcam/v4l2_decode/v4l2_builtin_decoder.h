@@ -43,6 +43,8 @@ class V4L2_Builtin_Decoder: public V4L2_Decoder
   virtual bool setcrop(struct v4l2_crop c);
   virtual void resetcrop();
   virtual void usesoftcrop(bool c);
+  virtual void usezerocopy(bool c);
+  virtual void usebayeredge(bool c);
   virtual void setformat(struct v4l2_format f);
   virtual bool issupportedformat(unsigned int format);
   virtual const std::vector<unsigned int> &getsupportedformats();
@@ -62,12 +64,17 @@ class V4L2_Builtin_Decoder: public V4L2_Decoder
   struct v4l2_format fmt;
   bool useSoftCrop; // uses software cropping
   bool doCrop; // do software cropping when decoding frames
+  bool useZeroCopy; // frames stay valid until the next decode
+  bool useBayerEdge; // edge aware demosaic
   
   unsigned char *YBuf;
   unsigned char *UBuf;
   unsigned char *VBuf;
   unsigned char *yuvBuffer;
   unsigned char *yuyvBuffer;
+  unsigned char *yuyvFrame; // packed frame, yuyvBuffer or the frame itself
+  size_t yuyvStride;
+  int yuyvOrder; // V4L2_Convert::Packed422
   unsigned char *colorBuffer;
   unsigned char *rgb24_buffer;
   //unsigned char *cropbuf;
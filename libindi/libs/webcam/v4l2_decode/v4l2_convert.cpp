@@ -0,0 +1,1003 @@
+/*
+    V4L2 Convert
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Define V4L2_CONVERT_BENCH for a stand-alone program that checks the
+    conversions against the ccvt routines and times them on HD frames:
+    gcc -O2 -c ../ccvt_c2.c ../ccvt_misc.c ../jpegutils.c
+    g++ -O2 -DV4L2_CONVERT_BENCH v4l2_convert.cpp ccvt_c2.o ccvt_misc.o jpegutils.o -ljpeg
+*/
+
+#include "v4l2_convert.h"
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__clang__) || \
+	__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define V4L2_CONVERT_X86
+#include <immintrin.h>
+#endif
+
+/* Line kernels. The SIMD versions leave the last pixels of a line to the
+   scalar ones, and give the same results bit for bit. */
+typedef void (*Y422Func)(const unsigned char *src, int order, unsigned int width, unsigned char *y);
+typedef void (*UV422Func)(const unsigned char *s1, const unsigned char *s2, int order,
+                          unsigned int width, unsigned char *u, unsigned char *v);
+typedef void (*RGB422Func)(const unsigned char *src, int order, unsigned int width,
+                           unsigned char *dst, bool rgb24);
+typedef void (*RGB420Func)(const unsigned char *y, const unsigned char *u, const unsigned char *v,
+                           unsigned int width, unsigned char *dst, bool rgb24);
+typedef void (*SplitUVFunc)(const unsigned char *src, unsigned int n, unsigned char *u, unsigned char *v);
+/* Bayer pixels from up to to of line cur, from odd, with the lines around */
+typedef void (*BayerFunc)(const unsigned char *up, const unsigned char *cur, const unsigned char *down,
+                          unsigned int from, unsigned int to, bool oddline, bool rggb, bool edge,
+                          unsigned char *dst);
+typedef void (*ExpandFunc)(const unsigned char *src, size_t n, unsigned char *dst);
+
+static struct {
+  Y422Func y422;
+  UV422Func uv422;
+  RGB422Func rgb422;
+  RGB420Func rgb420;
+  SplitUVFunc splituv;
+  BayerFunc bayer;
+  ExpandFunc expand;
+} impl;
+
+/* offsets of Y0, U, Y1 and V in a macropixel of each Packed422 order */
+static const unsigned char layout422[4][4] = { {0, 1, 2, 3}, {0, 3, 2, 1}, {1, 0, 3, 2}, {1, 2, 3, 0} };
+
+static inline unsigned char sat(int c)
+{
+  if (c & (~255)) { if (c < 0) c = 0; else c = 255; }
+  return c;
+}
+
+/* one pixel from the ccvt chroma terms */
+static inline void putPixel(unsigned char *d, int y, int cb, int cg, int cr, bool rgb24)
+{
+  if (rgb24) {
+    d[0] = sat(y + cr);
+    d[1] = sat(y - cg);
+    d[2] = sat(y + cb);
+  } else {
+    d[0] = sat(y + cb);
+    d[1] = sat(y - cg);
+    d[2] = sat(y + cr);
+    d[3] = 0;
+  }
+}
+
+static void y422Scalar(const unsigned char *src, int order, unsigned int width, unsigned char *y)
+{
+  src += layout422[order][0];
+  for (unsigned int x = 0; x < width; x++, src += 2)
+    y[x] = *src;
+}
+
+static void uv422Scalar(const unsigned char *s1, const unsigned char *s2, int order,
+                        unsigned int width, unsigned char *u, unsigned char *v)
+{
+  const unsigned char *l = layout422[order];
+  for (unsigned int x = 0; x < width; x += 2, s1 += 4, s2 += 4) {
+    *(u++) = (s1[l[1]] + s2[l[1]]) / 2;
+    *(v++) = (s1[l[3]] + s2[l[3]]) / 2;
+  }
+}
+
+static void rgb422Scalar(const unsigned char *src, int order, unsigned int width,
+                         unsigned char *dst, bool rgb24)
+{
+  const unsigned char *l = layout422[order];
+  unsigned int bpp = (rgb24 ? 3 : 4);
+  for (unsigned int x = 0; x < width; x += 2, src += 4) {
+    int u = src[l[1]] - 128, v = src[l[3]] - 128;
+    int cb = (u * 454) >> 8, cr = (v * 359) >> 8, cg = (u * 88 + v * 183) >> 8;
+    putPixel(dst, src[l[0]], cb, cg, cr, rgb24);
+    dst += bpp;
+    putPixel(dst, src[l[2]], cb, cg, cr, rgb24);
+    dst += bpp;
+  }
+}
+
+static void rgb420Scalar(const unsigned char *y, const unsigned char *u, const unsigned char *v,
+                         unsigned int width, unsigned char *dst, bool rgb24)
+{
+  unsigned int bpp = (rgb24 ? 3 : 4);
+  for (unsigned int x = 0; x < width; x += 2) {
+    int cb = ((*u - 128) * 454) >> 8, cr = ((*v - 128) * 359) >> 8;
+    int cg = ((*v - 128) * 183 + (*u - 128) * 88) >> 8;
+    putPixel(dst, *(y++), cb, cg, cr, rgb24);
+    dst += bpp;
+    putPixel(dst, *(y++), cb, cg, cr, rgb24);
+    dst += bpp;
+    u++;
+    v++;
+  }
+}
+
+static void splituvScalar(const unsigned char *src, unsigned int n, unsigned char *u, unsigned char *v)
+{
+  for (unsigned int i = 0; i < n; i++, src += 2) {
+    u[i] = src[0];
+    v[i] = src[1];
+  }
+}
+
+/* green at a red or blue site */
+static inline int bayerGreen(int w, int e, int n, int s, bool edge)
+{
+  if (edge) {
+    int dh = (w > e ? w - e : e - w), dv = (n > s ? n - s : s - n);
+    if (dh < dv) return (w + e) / 2;
+    if (dv < dh) return (n + s) / 2;
+  }
+  return (w + e + n + s) / 4;
+}
+
+/* pixels inside the frame, with BGGR naming: blue on even lines and columns */
+static void bayerScalar(const unsigned char *up, const unsigned char *cur, const unsigned char *down,
+                        unsigned int from, unsigned int to, bool oddline, bool rggb, bool edge,
+                        unsigned char *dst)
+{
+  for (unsigned int x = from; x < to; x++, dst += 3) {
+    int c = cur[x], w = cur[x - 1], e = cur[x + 1], n = up[x], s = down[x];
+    int diag = (up[x - 1] + up[x + 1] + down[x - 1] + down[x + 1]) / 4;
+    int r, g, b;
+    if (!oddline) {
+      if (!(x & 1)) { r = diag; g = bayerGreen(w, e, n, s, edge); b = c; }
+      else { r = (n + s) / 2; g = c; b = (w + e) / 2; }
+    } else {
+      if (!(x & 1)) { r = (w + e) / 2; g = c; b = (n + s) / 2; }
+      else { r = c; g = bayerGreen(w, e, n, s, edge); b = diag; }
+    }
+    dst[0] = (rggb ? b : r);
+    dst[1] = g;
+    dst[2] = (rggb ? r : b);
+  }
+}
+
+/* first and last lines and columns, as bayer2rgb24 does them */
+static void bayerBorder(const unsigned char *p, size_t s, unsigned int x, bool oddline, bool rggb,
+                        unsigned char *dst)
+{
+  int r, g, b;
+  if (!oddline) {
+    if (!(x & 1)) { r = p[s + 1]; g = (p[1] + p[s]) / 2; b = p[0]; }
+    else { r = p[s]; g = p[0]; b = p[-1]; }
+  } else {
+    if (!(x & 1)) { r = p[1]; g = p[0]; b = p[-(long) s]; }
+    else { r = p[0]; g = (p[-1] + p[-(long) s]) / 2; b = p[-(long) s - 1]; }
+  }
+  dst[0] = (rggb ? b : r);
+  dst[1] = g;
+  dst[2] = (rggb ? r : b);
+}
+
+static void expandScalar(const unsigned char *src, size_t n, unsigned char *dst)
+{
+  for (size_t i = 0; i < n; i++, src += 3, dst += 4) {
+    dst[0] = src[2];
+    dst[1] = src[1];
+    dst[2] = src[0];
+    dst[3] = 0;
+  }
+}
+
+#ifdef V4L2_CONVERT_X86
+
+/* In the 4:2:2 kernels a 16 bit lane holds the Y of a pixel, and the chroma
+   lanes are pairs (first, second) per macropixel: (U, V) unless swapped.
+   ((d * k) >> 8) is the high half of ((d << 8) * k) for d in [-128, 127],
+   which keeps the ccvt rounding in 16 bits. */
+
+__attribute__((target("sse2")))
+static inline void split422SSE2(__m128i v, bool yodd, __m128i &y, __m128i &c)
+{
+  const __m128i lo = _mm_set1_epi16(0xff);
+  if (yodd) {
+    y = _mm_srli_epi16(v, 8);
+    c = _mm_and_si128(v, lo);
+  } else {
+    y = _mm_and_si128(v, lo);
+    c = _mm_srli_epi16(v, 8);
+  }
+}
+
+__attribute__((target("sse2")))
+static inline void chromaSSE2(__m128i c, bool swap, __m128i &cb, __m128i &cg, __m128i &cr)
+{
+  const __m128i m = _mm_set1_epi32(0xffff);
+  __m128i d = _mm_sub_epi16(c, _mm_set1_epi16(128));
+  __m128i t = _mm_mulhi_epi16(_mm_slli_epi16(d, 8),
+                              _mm_set1_epi32(swap ? ((454 << 16) | 359) : ((359 << 16) | 454)));
+  __m128i g = _mm_srai_epi32(_mm_madd_epi16(d, _mm_set1_epi32(swap ? ((88 << 16) | 183) : ((183 << 16) | 88))), 8);
+  __m128i first = _mm_or_si128(_mm_and_si128(t, m), _mm_slli_epi32(t, 16));
+  __m128i second = _mm_or_si128(_mm_andnot_si128(m, t), _mm_srli_epi32(t, 16));
+  cg = _mm_or_si128(_mm_and_si128(g, m), _mm_slli_epi32(g, 16));
+  cb = (swap ? second : first);
+  cr = (swap ? first : second);
+}
+
+/* 4 pixels of 4 bytes to 12 bytes */
+__attribute__((target("sse2")))
+static inline __m128i pack24SSE2(__m128i p)
+{
+  __m128i q = _mm_or_si128(_mm_and_si128(p, _mm_set_epi32(0, 0xffffff, 0, 0xffffff)),
+                           _mm_and_si128(_mm_srli_epi64(p, 8), _mm_set_epi32(0xffff, 0xff000000, 0xffff, 0xff000000)));
+  return _mm_or_si128(_mm_move_epi64(q), _mm_slli_si128(_mm_srli_si128(q, 8), 6));
+}
+
+__attribute__((target("sse2")))
+static inline void store12SSE2(unsigned char *d, __m128i v)
+{
+  int t = _mm_cvtsi128_si32(_mm_srli_si128(v, 8));
+  _mm_storel_epi64((__m128i *) d, v);
+  memcpy(d + 8, &t, 4);
+}
+
+/* 8 pixels of 16 bit channels a, b, c, stored as abc or abc0 */
+__attribute__((target("sse2")))
+static inline void store3SSE2(unsigned char *d, __m128i a, __m128i b, __m128i c, bool packed24)
+{
+  __m128i ac = _mm_packus_epi16(a, c), bz = _mm_packus_epi16(b, _mm_setzero_si128());
+  __m128i ab = _mm_unpacklo_epi8(ac, bz), cz = _mm_unpackhi_epi8(ac, bz);
+  __m128i p0 = _mm_unpacklo_epi16(ab, cz), p1 = _mm_unpackhi_epi16(ab, cz);
+  if (packed24) {
+    store12SSE2(d, pack24SSE2(p0));
+    store12SSE2(d + 12, pack24SSE2(p1));
+  } else {
+    _mm_storeu_si128((__m128i *) d, p0);
+    _mm_storeu_si128((__m128i *) (d + 16), p1);
+  }
+}
+
+__attribute__((target("sse2")))
+static inline void storeRGBSSE2(unsigned char *d, __m128i y, __m128i cb, __m128i cg, __m128i cr, bool rgb24)
+{
+  __m128i r = _mm_add_epi16(y, cr), g = _mm_sub_epi16(y, cg), b = _mm_add_epi16(y, cb);
+  if (rgb24)
+    store3SSE2(d, r, g, b, true);
+  else
+    store3SSE2(d, b, g, r, false);
+}
+
+__attribute__((target("sse2")))
+static void y422SSE2(const unsigned char *src, int order, unsigned int width, unsigned char *y)
+{
+  bool yodd = (order >= V4L2_Convert::UYVY);
+  unsigned int x = 0;
+  __m128i y0, y1, c;
+  for (; x + 16 <= width; x += 16) {
+    split422SSE2(_mm_loadu_si128((const __m128i *) (src + 2 * x)), yodd, y0, c);
+    split422SSE2(_mm_loadu_si128((const __m128i *) (src + 2 * x + 16)), yodd, y1, c);
+    _mm_storeu_si128((__m128i *) (y + x), _mm_packus_epi16(y0, y1));
+  }
+  y422Scalar(src + 2 * x, order, width - x, y + x);
+}
+
+__attribute__((target("sse2")))
+static void uv422SSE2(const unsigned char *s1, const unsigned char *s2, int order,
+                      unsigned int width, unsigned char *u, unsigned char *v)
+{
+  const __m128i m = _mm_set1_epi32(0xffff);
+  bool yodd = (order >= V4L2_Convert::UYVY), swap = (order == V4L2_Convert::YVYU || order == V4L2_Convert::VYUY);
+  unsigned int x = 0;
+  for (; x + 16 <= width; x += 16) {
+    __m128i y, c1, c2, a, b;
+    split422SSE2(_mm_loadu_si128((const __m128i *) (s1 + 2 * x)), yodd, y, c1);
+    split422SSE2(_mm_loadu_si128((const __m128i *) (s2 + 2 * x)), yodd, y, c2);
+    a = _mm_srli_epi16(_mm_add_epi16(c1, c2), 1);
+    split422SSE2(_mm_loadu_si128((const __m128i *) (s1 + 2 * x + 16)), yodd, y, c1);
+    split422SSE2(_mm_loadu_si128((const __m128i *) (s2 + 2 * x + 16)), yodd, y, c2);
+    b = _mm_srli_epi16(_mm_add_epi16(c1, c2), 1);
+    __m128i first = _mm_packs_epi32(_mm_and_si128(a, m), _mm_and_si128(b, m));
+    __m128i second = _mm_packs_epi32(_mm_srli_epi32(a, 16), _mm_srli_epi32(b, 16));
+    first = _mm_packus_epi16(first, first);
+    second = _mm_packus_epi16(second, second);
+    _mm_storel_epi64((__m128i *) (u + x / 2), swap ? second : first);
+    _mm_storel_epi64((__m128i *) (v + x / 2), swap ? first : second);
+  }
+  uv422Scalar(s1 + 2 * x, s2 + 2 * x, order, width - x, u + x / 2, v + x / 2);
+}
+
+__attribute__((target("sse2")))
+static void rgb422SSE2(const unsigned char *src, int order, unsigned int width,
+                       unsigned char *dst, bool rgb24)
+{
+  bool yodd = (order >= V4L2_Convert::UYVY), swap = (order == V4L2_Convert::YVYU || order == V4L2_Convert::VYUY);
+  unsigned int x = 0, bpp = (rgb24 ? 3 : 4);
+  for (; x + 8 <= width; x += 8) {
+    __m128i y, c, cb, cg, cr;
+    split422SSE2(_mm_loadu_si128((const __m128i *) (src + 2 * x)), yodd, y, c);
+    chromaSSE2(c, swap, cb, cg, cr);
+    storeRGBSSE2(dst + bpp * x, y, cb, cg, cr, rgb24);
+  }
+  rgb422Scalar(src + 2 * x, order, width - x, dst + bpp * x, rgb24);
+}
+
+__attribute__((target("sse2")))
+static void rgb420SSE2(const unsigned char *y, const unsigned char *u, const unsigned char *v,
+                       unsigned int width, unsigned char *dst, bool rgb24)
+{
+  const __m128i z = _mm_setzero_si128();
+  unsigned int x = 0, bpp = (rgb24 ? 3 : 4);
+  for (; x + 16 <= width; x += 16) {
+    __m128i yv = _mm_loadu_si128((const __m128i *) (y + x));
+    __m128i uv = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (u + x / 2)),
+                                   _mm_loadl_epi64((const __m128i *) (v + x / 2)));
+    __m128i cb, cg, cr;
+    chromaSSE2(_mm_unpacklo_epi8(uv, z), false, cb, cg, cr);
+    storeRGBSSE2(dst + bpp * x, _mm_unpacklo_epi8(yv, z), cb, cg, cr, rgb24);
+    chromaSSE2(_mm_unpackhi_epi8(uv, z), false, cb, cg, cr);
+    storeRGBSSE2(dst + bpp * (x + 8), _mm_unpackhi_epi8(yv, z), cb, cg, cr, rgb24);
+  }
+  rgb420Scalar(y + x, u + x / 2, v + x / 2, width - x, dst + bpp * x, rgb24);
+}
+
+__attribute__((target("sse2")))
+static void splituvSSE2(const unsigned char *src, unsigned int n, unsigned char *u, unsigned char *v)
+{
+  const __m128i lo = _mm_set1_epi16(0xff);
+  unsigned int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i a = _mm_loadu_si128((const __m128i *) (src + 2 * i));
+    __m128i b = _mm_loadu_si128((const __m128i *) (src + 2 * i + 16));
+    _mm_storeu_si128((__m128i *) (u + i), _mm_packus_epi16(_mm_and_si128(a, lo), _mm_and_si128(b, lo)));
+    _mm_storeu_si128((__m128i *) (v + i), _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8)));
+  }
+  splituvScalar(src + 2 * i, n - i, u + i, v + i);
+}
+
+__attribute__((target("sse2")))
+static inline __m128i selectSSE2(__m128i m, __m128i a, __m128i b)
+{
+  return _mm_or_si128(_mm_and_si128(m, a), _mm_andnot_si128(m, b));
+}
+
+/* 8 pixels from an odd column, whose 16 bit neighbours are given */
+__attribute__((target("sse2")))
+static inline void bayer8SSE2(__m128i c, __m128i w, __m128i e, __m128i n, __m128i s, __m128i nw,
+                              __m128i ne, __m128i sw, __m128i se, bool oddline, bool rggb, bool edge,
+                              unsigned char *dst)
+{
+  /* even lanes are odd columns */
+  const __m128i odd = _mm_set1_epi32(0xffff);
+  __m128i we = _mm_add_epi16(w, e), ns = _mm_add_epi16(n, s);
+  __m128i h = _mm_srli_epi16(we, 1), v = _mm_srli_epi16(ns, 1);
+  __m128i cross = _mm_srli_epi16(_mm_add_epi16(we, ns), 2);
+  __m128i diag = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(nw, ne), _mm_add_epi16(sw, se)), 2);
+  __m128i r, g, b;
+  if (edge) {
+    __m128i dh = _mm_sub_epi16(_mm_max_epi16(w, e), _mm_min_epi16(w, e));
+    __m128i dv = _mm_sub_epi16(_mm_max_epi16(n, s), _mm_min_epi16(n, s));
+    cross = selectSSE2(_mm_cmplt_epi16(dh, dv), h, selectSSE2(_mm_cmplt_epi16(dv, dh), v, cross));
+  }
+  if (!oddline) {
+    r = selectSSE2(odd, v, diag);
+    g = selectSSE2(odd, c, cross);
+    b = selectSSE2(odd, h, c);
+  } else {
+    r = selectSSE2(odd, c, h);
+    g = selectSSE2(odd, cross, c);
+    b = selectSSE2(odd, diag, v);
+  }
+  if (rggb)
+    store3SSE2(dst, b, g, r, true);
+  else
+    store3SSE2(dst, r, g, b, true);
+}
+
+__attribute__((target("sse2")))
+static void bayerSSE2(const unsigned char *up, const unsigned char *cur, const unsigned char *down,
+                      unsigned int from, unsigned int to, bool oddline, bool rggb, bool edge,
+                      unsigned char *dst)
+{
+  const __m128i z = _mm_setzero_si128();
+  unsigned int x = from;
+  for (; x + 16 <= to; x += 16, dst += 48) {
+    __m128i c = _mm_loadu_si128((const __m128i *) (cur + x));
+    __m128i w = _mm_loadu_si128((const __m128i *) (cur + x - 1));
+    __m128i e = _mm_loadu_si128((const __m128i *) (cur + x + 1));
+    __m128i n = _mm_loadu_si128((const __m128i *) (up + x));
+    __m128i nw = _mm_loadu_si128((const __m128i *) (up + x - 1));
+    __m128i ne = _mm_loadu_si128((const __m128i *) (up + x + 1));
+    __m128i s = _mm_loadu_si128((const __m128i *) (down + x));
+    __m128i sw = _mm_loadu_si128((const __m128i *) (down + x - 1));
+    __m128i se = _mm_loadu_si128((const __m128i *) (down + x + 1));
+    bayer8SSE2(_mm_unpacklo_epi8(c, z), _mm_unpacklo_epi8(w, z), _mm_unpacklo_epi8(e, z),
+               _mm_unpacklo_epi8(n, z), _mm_unpacklo_epi8(s, z), _mm_unpacklo_epi8(nw, z),
+               _mm_unpacklo_epi8(ne, z), _mm_unpacklo_epi8(sw, z), _mm_unpacklo_epi8(se, z),
+               oddline, rggb, edge, dst);
+    bayer8SSE2(_mm_unpackhi_epi8(c, z), _mm_unpackhi_epi8(w, z), _mm_unpackhi_epi8(e, z),
+               _mm_unpackhi_epi8(n, z), _mm_unpackhi_epi8(s, z), _mm_unpackhi_epi8(nw, z),
+               _mm_unpackhi_epi8(ne, z), _mm_unpackhi_epi8(sw, z), _mm_unpackhi_epi8(se, z),
+               oddline, rggb, edge, dst + 24);
+  }
+  bayerScalar(up, cur, down, x, to, oddline, rggb, edge, dst);
+}
+
+__attribute__((target("avx2")))
+static inline void split422AVX2(__m256i v, bool yodd, __m256i &y, __m256i &c)
+{
+  const __m256i lo = _mm256_set1_epi16(0xff);
+  if (yodd) {
+    y = _mm256_srli_epi16(v, 8);
+    c = _mm256_and_si256(v, lo);
+  } else {
+    y = _mm256_and_si256(v, lo);
+    c = _mm256_srli_epi16(v, 8);
+  }
+}
+
+__attribute__((target("avx2")))
+static inline void chromaAVX2(__m256i c, bool swap, __m256i &cb, __m256i &cg, __m256i &cr)
+{
+  const __m256i m = _mm256_set1_epi32(0xffff);
+  __m256i d = _mm256_sub_epi16(c, _mm256_set1_epi16(128));
+  __m256i t = _mm256_mulhi_epi16(_mm256_slli_epi16(d, 8),
+                                 _mm256_set1_epi32(swap ? ((454 << 16) | 359) : ((359 << 16) | 454)));
+  __m256i g = _mm256_srai_epi32(_mm256_madd_epi16(d, _mm256_set1_epi32(swap ? ((88 << 16) | 183) : ((183 << 16) | 88))), 8);
+  __m256i first = _mm256_or_si256(_mm256_and_si256(t, m), _mm256_slli_epi32(t, 16));
+  __m256i second = _mm256_or_si256(_mm256_andnot_si256(m, t), _mm256_srli_epi32(t, 16));
+  cg = _mm256_or_si256(_mm256_and_si256(g, m), _mm256_slli_epi32(g, 16));
+  cb = (swap ? second : first);
+  cr = (swap ? first : second);
+}
+
+/* 16 pixels of 16 bit channels a, b, c, stored as abc or abc0 */
+__attribute__((target("avx2")))
+static inline void store3AVX2(unsigned char *d, __m256i a, __m256i b, __m256i c, bool packed24)
+{
+  __m256i ac = _mm256_packus_epi16(a, c), bz = _mm256_packus_epi16(b, _mm256_setzero_si256());
+  __m256i ab = _mm256_unpacklo_epi8(ac, bz), cz = _mm256_unpackhi_epi8(ac, bz);
+  /* pixels 0-3 and 8-11, 4-7 and 12-15 */
+  __m256i p0 = _mm256_unpacklo_epi16(ab, cz), p1 = _mm256_unpackhi_epi16(ab, cz);
+  if (packed24) {
+    const __m256i k = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                       0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    p0 = _mm256_shuffle_epi8(p0, k);
+    p1 = _mm256_shuffle_epi8(p1, k);
+    store12SSE2(d, _mm256_castsi256_si128(p0));
+    store12SSE2(d + 12, _mm256_castsi256_si128(p1));
+    store12SSE2(d + 24, _mm256_extracti128_si256(p0, 1));
+    store12SSE2(d + 36, _mm256_extracti128_si256(p1, 1));
+  } else {
+    _mm256_storeu_si256((__m256i *) d, _mm256_permute2x128_si256(p0, p1, 0x20));
+    _mm256_storeu_si256((__m256i *) (d + 32), _mm256_permute2x128_si256(p0, p1, 0x31));
+  }
+}
+
+__attribute__((target("avx2")))
+static inline void storeRGBAVX2(unsigned char *d, __m256i y, __m256i cb, __m256i cg, __m256i cr, bool rgb24)
+{
+  __m256i r = _mm256_add_epi16(y, cr), g = _mm256_sub_epi16(y, cg), b = _mm256_add_epi16(y, cb);
+  if (rgb24)
+    store3AVX2(d, r, g, b, true);
+  else
+    store3AVX2(d, b, g, r, false);
+}
+
+__attribute__((target("avx2")))
+static void y422AVX2(const unsigned char *src, int order, unsigned int width, unsigned char *y)
+{
+  bool yodd = (order >= V4L2_Convert::UYVY);
+  unsigned int x = 0;
+  __m256i y0, y1, c;
+  for (; x + 32 <= width; x += 32) {
+    split422AVX2(_mm256_loadu_si256((const __m256i *) (src + 2 * x)), yodd, y0, c);
+    split422AVX2(_mm256_loadu_si256((const __m256i *) (src + 2 * x + 32)), yodd, y1, c);
+    _mm256_storeu_si256((__m256i *) (y + x), _mm256_permute4x64_epi64(_mm256_packus_epi16(y0, y1), 0xD8));
+  }
+  y422Scalar(src + 2 * x, order, width - x, y + x);
+}
+
+__attribute__((target("avx2")))
+static void uv422AVX2(const unsigned char *s1, const unsigned char *s2, int order,
+                      unsigned int width, unsigned char *u, unsigned char *v)
+{
+  const __m256i m = _mm256_set1_epi32(0xffff);
+  bool yodd = (order >= V4L2_Convert::UYVY), swap = (order == V4L2_Convert::YVYU || order == V4L2_Convert::VYUY);
+  unsigned int x = 0;
+  for (; x + 32 <= width; x += 32) {
+    __m256i y, c1, c2, a, b;
+    split422AVX2(_mm256_loadu_si256((const __m256i *) (s1 + 2 * x)), yodd, y, c1);
+    split422AVX2(_mm256_loadu_si256((const __m256i *) (s2 + 2 * x)), yodd, y, c2);
+    a = _mm256_srli_epi16(_mm256_add_epi16(c1, c2), 1);
+    split422AVX2(_mm256_loadu_si256((const __m256i *) (s1 + 2 * x + 32)), yodd, y, c1);
+    split422AVX2(_mm256_loadu_si256((const __m256i *) (s2 + 2 * x + 32)), yodd, y, c2);
+    b = _mm256_srli_epi16(_mm256_add_epi16(c1, c2), 1);
+    /* macropixels 0-7 in the low lane, 8-15 in the high one */
+    __m256i first = _mm256_permute4x64_epi64(_mm256_packs_epi32(_mm256_and_si256(a, m), _mm256_and_si256(b, m)), 0xD8);
+    __m256i second = _mm256_permute4x64_epi64(_mm256_packs_epi32(_mm256_srli_epi32(a, 16), _mm256_srli_epi32(b, 16)), 0xD8);
+    __m128i f = _mm_packus_epi16(_mm256_castsi256_si128(first), _mm256_extracti128_si256(first, 1));
+    __m128i s = _mm_packus_epi16(_mm256_castsi256_si128(second), _mm256_extracti128_si256(second, 1));
+    _mm_storeu_si128((__m128i *) (u + x / 2), swap ? s : f);
+    _mm_storeu_si128((__m128i *) (v + x / 2), swap ? f : s);
+  }
+  uv422Scalar(s1 + 2 * x, s2 + 2 * x, order, width - x, u + x / 2, v + x / 2);
+}
+
+__attribute__((target("avx2")))
+static void rgb422AVX2(const unsigned char *src, int order, unsigned int width,
+                       unsigned char *dst, bool rgb24)
+{
+  bool yodd = (order >= V4L2_Convert::UYVY), swap = (order == V4L2_Convert::YVYU || order == V4L2_Convert::VYUY);
+  unsigned int x = 0, bpp = (rgb24 ? 3 : 4);
+  for (; x + 16 <= width; x += 16) {
+    __m256i y, c, cb, cg, cr;
+    split422AVX2(_mm256_loadu_si256((const __m256i *) (src + 2 * x)), yodd, y, c);
+    chromaAVX2(c, swap, cb, cg, cr);
+    storeRGBAVX2(dst + bpp * x, y, cb, cg, cr, rgb24);
+  }
+  rgb422Scalar(src + 2 * x, order, width - x, dst + bpp * x, rgb24);
+}
+
+__attribute__((target("avx2")))
+static void rgb420AVX2(const unsigned char *y, const unsigned char *u, const unsigned char *v,
+                       unsigned int width, unsigned char *dst, bool rgb24)
+{
+  unsigned int x = 0, bpp = (rgb24 ? 3 : 4);
+  for (; x + 16 <= width; x += 16) {
+    __m128i uv = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (u + x / 2)),
+                                   _mm_loadl_epi64((const __m128i *) (v + x / 2)));
+    __m256i cb, cg, cr;
+    chromaAVX2(_mm256_cvtepu8_epi16(uv), false, cb, cg, cr);
+    storeRGBAVX2(dst + bpp * x, _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (y + x))),
+                 cb, cg, cr, rgb24);
+  }
+  rgb420Scalar(y + x, u + x / 2, v + x / 2, width - x, dst + bpp * x, rgb24);
+}
+
+__attribute__((target("avx2")))
+static void splituvAVX2(const unsigned char *src, unsigned int n, unsigned char *u, unsigned char *v)
+{
+  const __m256i lo = _mm256_set1_epi16(0xff);
+  unsigned int i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i a = _mm256_loadu_si256((const __m256i *) (src + 2 * i));
+    __m256i b = _mm256_loadu_si256((const __m256i *) (src + 2 * i + 32));
+    _mm256_storeu_si256((__m256i *) (u + i), _mm256_permute4x64_epi64(
+                          _mm256_packus_epi16(_mm256_and_si256(a, lo), _mm256_and_si256(b, lo)), 0xD8));
+    _mm256_storeu_si256((__m256i *) (v + i), _mm256_permute4x64_epi64(
+                          _mm256_packus_epi16(_mm256_srli_epi16(a, 8), _mm256_srli_epi16(b, 8)), 0xD8));
+  }
+  splituvScalar(src + 2 * i, n - i, u + i, v + i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i selectAVX2(__m256i m, __m256i a, __m256i b)
+{
+  return _mm256_or_si256(_mm256_and_si256(m, a), _mm256_andnot_si256(m, b));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i load16AVX2(const unsigned char *p)
+{
+  return _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) p));
+}
+
+__attribute__((target("avx2")))
+static void bayerAVX2(const unsigned char *up, const unsigned char *cur, const unsigned char *down,
+                      unsigned int from, unsigned int to, bool oddline, bool rggb, bool edge,
+                      unsigned char *dst)
+{
+  /* even lanes are odd columns */
+  const __m256i odd = _mm256_set1_epi32(0xffff);
+  unsigned int x = from;
+  for (; x + 16 <= to; x += 16, dst += 48) {
+    __m256i c = load16AVX2(cur + x), w = load16AVX2(cur + x - 1), e = load16AVX2(cur + x + 1);
+    __m256i n = load16AVX2(up + x), s = load16AVX2(down + x);
+    __m256i we = _mm256_add_epi16(w, e), ns = _mm256_add_epi16(n, s);
+    __m256i h = _mm256_srli_epi16(we, 1), v = _mm256_srli_epi16(ns, 1);
+    __m256i cross = _mm256_srli_epi16(_mm256_add_epi16(we, ns), 2);
+    __m256i diag = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(load16AVX2(up + x - 1), load16AVX2(up + x + 1)),
+                                                      _mm256_add_epi16(load16AVX2(down + x - 1), load16AVX2(down + x + 1))), 2);
+    __m256i r, g, b;
+    if (edge) {
+      __m256i dh = _mm256_sub_epi16(_mm256_max_epi16(w, e), _mm256_min_epi16(w, e));
+      __m256i dv = _mm256_sub_epi16(_mm256_max_epi16(n, s), _mm256_min_epi16(n, s));
+      cross = selectAVX2(_mm256_cmpgt_epi16(dv, dh), h, selectAVX2(_mm256_cmpgt_epi16(dh, dv), v, cross));
+    }
+    if (!oddline) {
+      r = selectAVX2(odd, v, diag);
+      g = selectAVX2(odd, c, cross);
+      b = selectAVX2(odd, h, c);
+    } else {
+      r = selectAVX2(odd, c, h);
+      g = selectAVX2(odd, cross, c);
+      b = selectAVX2(odd, diag, v);
+    }
+    if (rggb)
+      store3AVX2(dst, b, g, r, true);
+    else
+      store3AVX2(dst, r, g, b, true);
+  }
+  bayerScalar(up, cur, down, x, to, oddline, rggb, edge, dst);
+}
+
+__attribute__((target("avx2")))
+static void expandAVX2(const unsigned char *src, size_t n, unsigned char *dst)
+{
+  const __m128i k = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+  size_t i = 0;
+  /* 16 byte loads, 12 used */
+  for (; i + 6 <= n; i += 4)
+    _mm_storeu_si128((__m128i *) (dst + 4 * i), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (src + 3 * i)), k));
+  expandScalar(src + 3 * i, n - i, dst + 4 * i);
+}
+
+#endif /* V4L2_CONVERT_X86 */
+
+static void pickImpl()
+{
+  impl.y422 = y422Scalar;
+  impl.uv422 = uv422Scalar;
+  impl.rgb422 = rgb422Scalar;
+  impl.rgb420 = rgb420Scalar;
+  impl.splituv = splituvScalar;
+  impl.bayer = bayerScalar;
+  impl.expand = expandScalar;
+#ifdef V4L2_CONVERT_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    impl.y422 = y422AVX2;
+    impl.uv422 = uv422AVX2;
+    impl.rgb422 = rgb422AVX2;
+    impl.rgb420 = rgb420AVX2;
+    impl.splituv = splituvAVX2;
+    impl.bayer = bayerAVX2;
+    impl.expand = expandAVX2;
+  } else if (__builtin_cpu_supports("sse2")) {
+    impl.y422 = y422SSE2;
+    impl.uv422 = uv422SSE2;
+    impl.rgb422 = rgb422SSE2;
+    impl.rgb420 = rgb420SSE2;
+    impl.splituv = splituvSSE2;
+    impl.bayer = bayerSSE2;
+  }
+#endif
+}
+
+static inline void checkImpl()
+{
+  if (!impl.y422)
+    pickImpl();
+}
+
+void V4L2_Convert::copy(const unsigned char *src, size_t stride, size_t linebytes, unsigned int height,
+                        unsigned char *dst)
+{
+  if (stride == linebytes) {
+    memcpy(dst, src, linebytes * height);
+    return;
+  }
+  for (unsigned int i = 0; i < height; i++, src += stride, dst += linebytes)
+    memcpy(dst, src, linebytes);
+}
+
+void V4L2_Convert::packed422_to_420p(const unsigned char *src, size_t stride, int order,
+                                     unsigned int width, unsigned int height,
+                                     unsigned char *y, unsigned char *u, unsigned char *v)
+{
+  checkImpl();
+  for (unsigned int i = 0; i + 1 < height; i += 2, src += 2 * stride) {
+    impl.y422(src, order, width, y);
+    y += width;
+    impl.y422(src + stride, order, width, y);
+    y += width;
+    impl.uv422(src, src + stride, order, width, u, v);
+    u += width / 2;
+    v += width / 2;
+  }
+}
+
+void V4L2_Convert::packed422_to_bgr32(const unsigned char *src, size_t stride, int order,
+                                      unsigned int width, unsigned int height, unsigned char *dst)
+{
+  checkImpl();
+  for (unsigned int i = 0; i < height; i++, src += stride, dst += 4 * width)
+    impl.rgb422(src, order, width, dst, false);
+}
+
+void V4L2_Convert::packed422_to_rgb24(const unsigned char *src, size_t stride, int order,
+                                      unsigned int width, unsigned int height, unsigned char *dst)
+{
+  checkImpl();
+  for (unsigned int i = 0; i < height; i++, src += stride, dst += 3 * width)
+    impl.rgb422(src, order, width, dst, true);
+}
+
+void V4L2_Convert::yuv420p_to_bgr32(const unsigned char *y, const unsigned char *u, const unsigned char *v,
+                                    unsigned int width, unsigned int height, unsigned char *dst)
+{
+  checkImpl();
+  /* like ccvt_420p_bgr32 */
+  if ((width & 1) || (height & 1))
+    return;
+  for (unsigned int i = 0; i < height; i++, y += width, dst += 4 * width) {
+    impl.rgb420(y, u, v, width, dst, false);
+    if (i & 1) {
+      u += width / 2;
+      v += width / 2;
+    }
+  }
+}
+
+void V4L2_Convert::yuv420p_to_rgb24(const unsigned char *y, const unsigned char *u, const unsigned char *v,
+                                    unsigned int width, unsigned int height, unsigned char *dst)
+{
+  checkImpl();
+  if ((width & 1) || (height & 1))
+    return;
+  for (unsigned int i = 0; i < height; i++, y += width, dst += 3 * width) {
+    impl.rgb420(y, u, v, width, dst, true);
+    if (i & 1) {
+      u += width / 2;
+      v += width / 2;
+    }
+  }
+}
+
+void V4L2_Convert::nv12_to_uv(const unsigned char *src, size_t stride, unsigned int width,
+                              unsigned int height, unsigned char *u, unsigned char *v)
+{
+  checkImpl();
+  for (unsigned int i = 0; i < height / 2; i++, src += stride, u += width / 2, v += width / 2)
+    impl.splituv(src, width / 2, u, v);
+}
+
+void V4L2_Convert::bayer_to_rgb24(const unsigned char *src, size_t stride, bool rggb, bool edgeaware,
+                                  unsigned int width, unsigned int height, unsigned char *dst)
+{
+  /* an odd last line or column is left as is */
+  unsigned int w = width & ~1, h = height & ~1;
+
+  checkImpl();
+  for (unsigned int y = 0; y < h; y++, src += stride, dst += 3 * width) {
+    bool oddline = (y & 1);
+    if (y == 0 || y == h - 1 || w < 4) {
+      for (unsigned int x = 0; x < w; x++)
+        bayerBorder(src + x, stride, x, oddline, rggb, dst + 3 * x);
+      continue;
+    }
+    bayerBorder(src, stride, 0, oddline, rggb, dst);
+    impl.bayer(src - stride, src, src + stride, 1, w - 1, oddline, rggb, edgeaware, dst + 3);
+    bayerBorder(src + w - 1, stride, w - 1, oddline, rggb, dst + 3 * (w - 1));
+  }
+}
+
+void V4L2_Convert::rgb24_to_bgr32(const unsigned char *src, size_t npixels, unsigned char *dst)
+{
+  checkImpl();
+  impl.expand(src, npixels, dst);
+}
+
+#if defined(V4L2_CONVERT_BENCH)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include "../ccvt.h"
+
+static double now()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static int check(const char *what, const char *name, const unsigned char *a, const unsigned char *b, size_t n)
+{
+  if (memcmp(a, b, n)) {
+    size_t i = 0;
+    while (a[i] == b[i]) i++;
+    printf("  %s: %s differs at byte %lu (%d, expected %d)\n", name, what, (unsigned long) i, a[i], b[i]);
+    return 1;
+  }
+  return 0;
+}
+
+/* the byte reordering of the decoder for UYVY, VYUY and YVYU */
+static void toYUYV(const unsigned char *src, int order, size_t npixels, unsigned char *dst)
+{
+  const unsigned char *l = layout422[order];
+  for (size_t i = 0; i < npixels; i += 2, src += 4) {
+    *(dst++) = src[l[0]];
+    *(dst++) = src[l[1]];
+    *(dst++) = src[l[2]];
+    *(dst++) = src[l[3]];
+  }
+}
+
+static void bgr32ToRGB24(const unsigned char *src, size_t npixels, unsigned char *dst)
+{
+  for (size_t i = 0; i < npixels; i++, src += 4) {
+    *(dst++) = src[2];
+    *(dst++) = src[1];
+    *(dst++) = src[0];
+  }
+}
+
+/* compare every conversion to ccvt on a width x height frame, cropped out of a wider one */
+static int checkAll(const char *name, unsigned int width, unsigned int height, const unsigned char *noise)
+{
+  const unsigned int left = 6, top = 4, fw = width + 2 * left + 10;
+  const size_t npix = width * height, stride = 2 * fw;
+  unsigned char *packed = (unsigned char *) malloc(2 * npix), *yuv = (unsigned char *) malloc(npix * 3);
+  unsigned char *ref = (unsigned char *) calloc(npix * 4, 1), *ref2 = (unsigned char *) malloc(npix * 3);
+  unsigned char *out = (unsigned char *) calloc(npix * 4, 1);
+  const unsigned char *frame = noise + top * stride + 2 * left;
+  const char *orders[] = { "YUYV", "YVYU", "UYVY", "VYUY" };
+  char what[64];
+  int bad = 0;
+
+  for (int order = 0; order < 4; order++) {
+    for (unsigned int i = 0; i < height; i++)
+      toYUYV(frame + i * stride, order, width, packed + i * 2 * width);
+
+    ccvt_yuyv_420p(width, height, packed, ref, ref + npix, ref + npix + npix / 4);
+    V4L2_Convert::packed422_to_420p(frame, stride, order, width, height, out, out + npix, out + npix + npix / 4);
+    sprintf(what, "%s to 420p", orders[order]);
+    bad += check(what, name, out, ref, npix * 3 / 2);
+
+    memset(ref, 0, npix * 4); /* ccvt leaves the filler bytes */
+    ccvt_yuyv_bgr32(width, height, packed, ref);
+    V4L2_Convert::packed422_to_bgr32(frame, stride, order, width, height, out);
+    sprintf(what, "%s to bgr32", orders[order]);
+    bad += check(what, name, out, ref, npix * 4);
+
+    bgr32ToRGB24(ref, npix, ref2);
+    V4L2_Convert::packed422_to_rgb24(frame, stride, order, width, height, out);
+    sprintf(what, "%s to rgb24", orders[order]);
+    bad += check(what, name, out, ref2, npix * 3);
+  }
+
+  for (size_t i = 0; i < npix * 3; i++)
+    yuv[i] = noise[i % (2 * npix)];
+  memset(ref, 0, npix * 4);
+  ccvt_420p_bgr32(width, height, yuv, ref);
+  V4L2_Convert::yuv420p_to_bgr32(yuv, yuv + npix, yuv + npix + npix / 4, width, height, out);
+  bad += check("420p to bgr32", name, out, ref, npix * 4);
+  ccvt_420p_rgb24(width, height, yuv, ref);
+  V4L2_Convert::yuv420p_to_rgb24(yuv, yuv + npix, yuv + npix + npix / 4, width, height, out);
+  bad += check("420p to rgb24", name, out, ref, npix * 3);
+
+  /* NV12 chroma, against the decoder loop */
+  for (unsigned int i = 0; i < height / 2; i++)
+    for (unsigned int j = 0; j < width / 2; j++) {
+      ref[i * width / 2 + j] = frame[i * stride + 2 * j];
+      ref[npix + i * width / 2 + j] = frame[i * stride + 2 * j + 1];
+    }
+  V4L2_Convert::nv12_to_uv(frame, stride, width, height, out, out + npix);
+  bad += check("nv12 u", name, out, ref, npix / 4);
+  bad += check("nv12 v", name, out + npix, ref + npix, npix / 4);
+
+  bayer2rgb24(ref, yuv, width, height);
+  V4L2_Convert::bayer_to_rgb24(yuv, width, false, false, width, height, out);
+  bad += check("bggr to rgb24", name, out, ref, npix * 3);
+  bayer_rggb_2rgb24(ref, yuv, width, height);
+  V4L2_Convert::bayer_to_rgb24(yuv, width, true, false, width, height, out);
+  bad += check("rggb to rgb24", name, out, ref, npix * 3);
+
+  for (size_t i = 0; i < npix; i++) {
+    ref[4 * i] = yuv[3 * i + 2];
+    ref[4 * i + 1] = yuv[3 * i + 1];
+    ref[4 * i + 2] = yuv[3 * i];
+    ref[4 * i + 3] = 0;
+  }
+  V4L2_Convert::rgb24_to_bgr32(yuv, npix, out);
+  bad += check("rgb24 to bgr32", name, out, ref, npix * 4);
+
+  free(packed); free(yuv); free(ref); free(ref2); free(out);
+  return bad;
+}
+
+int main(int ac, char *av[])
+{
+  const unsigned int width = 1920, height = 1080, nf = 20;
+  const size_t npix = width * height, fsize = 2 * (width + 32) * (height + 8);
+  unsigned char *noise = (unsigned char *) malloc(fsize);
+  unsigned char *edge[3], *out = (unsigned char *) malloc(npix * 4);
+  unsigned char *y = (unsigned char *) malloc(npix * 3 / 2);
+  const char *names[] = { "scalar", "sse2", "avx2" };
+  int nimpls = 1, bad = 0;
+  double t;
+
+  srand(1);
+  /* a smooth picture with noise and saturated spots */
+  for (size_t i = 0; i < fsize; i++)
+    noise[i] = ((i / 7) % 200) + (rand() % 40) + ((i % 101) == 0 ? 15 : 0);
+  memset(out, 0, npix * 4);
+  memset(y, 0, npix * 3 / 2);
+
+  printf("1920x1080, ms per frame\n  ccvt      yuyv to 420p");
+  t = now();
+  for (unsigned int f = 0; f < nf; f++)
+    ccvt_yuyv_420p(width, height, noise, y, y + npix, y + npix + npix / 4);
+  printf(" %6.2f  yuyv to bgr32", (now() - t) * 1e3 / nf);
+  t = now();
+  for (unsigned int f = 0; f < nf; f++)
+    ccvt_yuyv_bgr32(width, height, noise, out);
+  printf(" %6.2f  420p to bgr32", (now() - t) * 1e3 / nf);
+  t = now();
+  for (unsigned int f = 0; f < nf; f++)
+    ccvt_420p_bgr32(width, height, noise, out);
+  printf(" %6.2f  bggr to rgb24", (now() - t) * 1e3 / nf);
+  t = now();
+  for (unsigned int f = 0; f < nf; f++)
+    bayer2rgb24(out, noise, width, height);
+  printf(" %6.2f\n", (now() - t) * 1e3 / nf);
+
+  pickImpl();
+#ifdef V4L2_CONVERT_X86
+  nimpls = (impl.y422 == y422AVX2 ? 3 : (impl.y422 == y422SSE2 ? 2 : 1));
+#endif
+  for (int k = 0; k < nimpls; k++) {
+    double t422, tuv, trgb, t420, tbayer, tedge;
+    if (k == 0) {
+      impl.y422 = y422Scalar; impl.uv422 = uv422Scalar; impl.rgb422 = rgb422Scalar; impl.rgb420 = rgb420Scalar;
+      impl.splituv = splituvScalar; impl.bayer = bayerScalar; impl.expand = expandScalar;
+#ifdef V4L2_CONVERT_X86
+    } else if (k == 1) {
+      impl.y422 = y422SSE2; impl.uv422 = uv422SSE2; impl.rgb422 = rgb422SSE2; impl.rgb420 = rgb420SSE2;
+      impl.splituv = splituvSSE2; impl.bayer = bayerSSE2; impl.expand = expandScalar;
+    } else {
+      impl.y422 = y422AVX2; impl.uv422 = uv422AVX2; impl.rgb422 = rgb422AVX2; impl.rgb420 = rgb420AVX2;
+      impl.splituv = splituvAVX2; impl.bayer = bayerAVX2; impl.expand = expandAVX2;
+#endif
+    }
+
+    t = now();
+    for (unsigned int f = 0; f < nf; f++)
+      V4L2_Convert::packed422_to_420p(noise, 2 * width, V4L2_Convert::YUYV, width, height, y, y + npix, y + npix + npix / 4);
+    t422 = (now() - t) * 1e3 / nf;
+    t = now();
+    for (unsigned int f = 0; f < nf; f++)
+      V4L2_Convert::packed422_to_420p(noise, 2 * (width + 32), V4L2_Convert::UYVY, width, height, y, y + npix, y + npix + npix / 4);
+    tuv = (now() - t) * 1e3 / nf;
+    t = now();
+    for (unsigned int f = 0; f < nf; f++)
+      V4L2_Convert::packed422_to_bgr32(noise, 2 * width, V4L2_Convert::YUYV, width, height, out);
+    trgb = (now() - t) * 1e3 / nf;
+    t = now();
+    for (unsigned int f = 0; f < nf; f++)
+      V4L2_Convert::yuv420p_to_bgr32(noise, noise + npix, noise + npix + npix / 4, width, height, out);
+    t420 = (now() - t) * 1e3 / nf;
+    t = now();
+    for (unsigned int f = 0; f < nf; f++)
+      V4L2_Convert::bayer_to_rgb24(noise, width, false, false, width, height, out);
+    tbayer = (now() - t) * 1e3 / nf;
+    edge[k] = (unsigned char *) malloc(npix * 3);
+    memset(edge[k], 0, npix * 3);
+    t = now();
+    for (unsigned int f = 0; f < nf; f++)
+      V4L2_Convert::bayer_to_rgb24(noise, width, false, true, width, height, edge[k]);
+    tedge = (now() - t) * 1e3 / nf;
+    printf("  %-9s yuyv to 420p %6.2f  (cropped uyvy %6.2f)  yuyv to bgr32 %6.2f  420p to bgr32 %6.2f"
+           "  bggr to rgb24 %6.2f  (edge aware %6.2f)\n", names[k], t422, tuv, trgb, t420, tbayer, tedge);
+
+    /* odd sizes exercise the scalar tails */
+    bad += checkAll(names[k], width, height, noise);
+    bad += checkAll(names[k], 646, 482, noise);
+    bad += checkAll(names[k], 38, 6, noise);
+    if (k > 0)
+      bad += check("edge aware bggr", names[k], edge[k], edge[0], npix * 3);
+  }
+
+  return (bad != 0);
+}
+
+#endif
@@ -0,0 +1,67 @@
+/*
+    V4L2 Convert
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#ifndef V4L2_CONVERT_H
+#define V4L2_CONVERT_H
+
+#include <stddef.h>
+
+/* Pixel format conversions of the builtin decoder.
+   A source is given by its first pixel and the bytes between two of its
+   lines, so a soft crop is only an offset into the captured frame and the
+   conversion does the copy. Results are packed, width pixels per line.
+   The arithmetic is the one of the ccvt routines (ccvt_yuyv_420p,
+   ccvt_yuyv_bgr32, ccvt_420p_bgr32, bayer2rgb24...) and the results are the
+   same bytes, except that BGR32 pixels get a 0 filler byte. 4:2:x and Bayer
+   frames have an even width and height.
+   The conversions use SSE2 or AVX2 when the processor has them. */
+
+class V4L2_Convert
+{
+ public:
+  // byte order of the packed 4:2:2 formats
+  enum Packed422 { YUYV=0, YVYU, UYVY, VYUY };
+
+  // height lines of linebytes bytes
+  static void copy(const unsigned char *src, size_t stride, size_t linebytes, unsigned int height,
+                   unsigned char *dst);
+  // packed 4:2:2 to 4:2:0 planar, chroma is the mean of two lines
+  static void packed422_to_420p(const unsigned char *src, size_t stride, int order,
+                                unsigned int width, unsigned int height,
+                                unsigned char *y, unsigned char *u, unsigned char *v);
+  static void packed422_to_bgr32(const unsigned char *src, size_t stride, int order,
+                                 unsigned int width, unsigned int height, unsigned char *dst);
+  static void packed422_to_rgb24(const unsigned char *src, size_t stride, int order,
+                                 unsigned int width, unsigned int height, unsigned char *dst);
+  // 4:2:0 planar to RGB, u and v are width/2 by height/2
+  static void yuv420p_to_bgr32(const unsigned char *y, const unsigned char *u, const unsigned char *v,
+                               unsigned int width, unsigned int height, unsigned char *dst);
+  static void yuv420p_to_rgb24(const unsigned char *y, const unsigned char *u, const unsigned char *v,
+                               unsigned int width, unsigned int height, unsigned char *dst);
+  // interleaved chroma plane of NV12 to separate u and v planes (swap them for NV21)
+  static void nv12_to_uv(const unsigned char *src, size_t stride, unsigned int width,
+                         unsigned int height, unsigned char *u, unsigned char *v);
+  // BGGR or RGGB mosaic to RGB. Bilinear is bayer2rgb24/bayer_rggb_2rgb24,
+  // edge aware interpolates green along the smaller gradient.
+  static void bayer_to_rgb24(const unsigned char *src, size_t stride, bool rggb, bool edgeaware,
+                             unsigned int width, unsigned int height, unsigned char *dst);
+  static void rgb24_to_bgr32(const unsigned char *src, size_t npixels, unsigned char *dst);
+};
+
+#endif
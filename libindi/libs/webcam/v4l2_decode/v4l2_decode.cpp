@@ -33,6 +33,12 @@ const char *V4L2_Decoder::getName() {
   return name;
 }
 
+void V4L2_Decoder::usezerocopy(bool c) {
+}
+
+void V4L2_Decoder::usebayeredge(bool c) {
+}
+
 V4L2_Decode::V4L2_Decode() {
   decoder_list.push_back(new V4L2_Builtin_Decoder());
   default_decoder=decoder_list.at(0);
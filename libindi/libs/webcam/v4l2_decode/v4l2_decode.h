@@ -41,6 +41,8 @@ virtual const char *getName();
 virtual bool setcrop(struct v4l2_crop c)=0;
 virtual void resetcrop()=0;
 virtual void usesoftcrop(bool c)=0;
+virtual void usezerocopy(bool c); // frames stay valid until the next decode, so they need not be copied
+virtual void usebayeredge(bool c); // edge aware Bayer demosaic instead of bilinear
 virtual void setformat(struct v4l2_format f)=0;
 virtual bool issupportedformat(unsigned int format)=0;
 virtual const std::vector<unsigned int> &getsupportedformats()=0;
@@ -28,9 +28,21 @@
 #include "ser_recorder.h"
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/time.h>
 
 #define ERRMSGSIZ	1024
 
+// SER timestamps count 100ns ticks from 0001-01-01 UTC
+#define SER_TICKS_PER_SEC 10000000ULL
+#define SER_UNIX_EPOCH    62135596800ULL // seconds from 0001-01-01 to 1970-01-01
+
+static uint64_t ser_ticks(const struct timeval *tv) {
+  return (SER_UNIX_EPOCH + tv->tv_sec) * SER_TICKS_PER_SEC + tv->tv_usec * 10ULL;
+}
+
 SER_Recorder::SER_Recorder() {
   useSER_V3=true;
   name="SER File Recorder";
@@ -44,10 +56,30 @@ SER_Recorder::SER_Recorder() {
   else
     serh.LittleEndian=SER_BIG_ENDIAN;
   streaming_active=false;
+  fd=-1;
+  frame_size=0;
+  number_of_planes=1;
+  ring=NULL;
+  ring_size=0;
+  head=tail=0;
+  closing=false;
+  write_error=0;
+  writer_running=false;
+  use_direct=false;
+  direct=false;
+  next_timestamp=0;
+  mono_offset=0;
+  dropped=0;
+  maxqueued=0;
+  pthread_mutex_init(&lock, NULL);
+  pthread_cond_init(&cond, NULL);
 }
 
 SER_Recorder::~SER_Recorder() {
-
+  if (streaming_active) close();
+  free(ring);
+  pthread_cond_destroy(&cond);
+  pthread_mutex_destroy(&lock);
 }
 
 bool SER_Recorder::is_little_endian() {
@@ -56,42 +88,33 @@ bool SER_Recorder::is_little_endian() {
   return black_magic == 0x01;
 }
  
-void SER_Recorder::write_int_le(unsigned int *i) {
-  if (is_little_endian())
-    fwrite((const void *)(i), sizeof(int), 1, f);
-  else {
-    unsigned char *c=(unsigned char *)i;
-    fwrite((const void *)(c+3), sizeof(char), 1, f);
-    fwrite((const void *)(c+2), sizeof(char), 1, f);
-    fwrite((const void *)(c+1), sizeof(char), 1, f);
-    fwrite((const void *)(c), sizeof(char), 1, f);
-  }
-}
-
-void SER_Recorder::write_long_int_le(unsigned long *i) {
-  if (is_little_endian()) {
-    fwrite((const void *)((unsigned int *)i), sizeof(int), 1, f);
-    fwrite((const void *)((unsigned int *)(i) + 1), sizeof(int), 1, f);
-  } else {
-    write_int_le((unsigned int *)(i) + 1);
-    write_int_le((unsigned int *)(i));
-  }
-}
-
-void SER_Recorder::write_header(ser_header *s) {
-  fwrite((const void *)(s->FileID), sizeof(char), 14, f);
-  write_int_le(&(s->LuID));
-  write_int_le(&(s->ColorID));
-  write_int_le(&(s->LittleEndian));
-  write_int_le(&(s->ImageWidth));
-  write_int_le(&(s->ImageHeight));
-  write_int_le(&(s->PixelDepth));
-  write_int_le(&(s->FrameCount));
-  fwrite((const void *)(s->Observer), sizeof(char), 40, f);
-  fwrite((const void *)(s->Instrume), sizeof(char), 40, f);
-  fwrite((const void *)(s->Telescope), sizeof(char), 40, f);
-  write_long_int_le(&(s->DateTime));
-  write_long_int_le(&(s->DateTime_UTC));
+unsigned char *SER_Recorder::write_int_le(unsigned char *p, unsigned int i) {
+  p[0]=i & 0xff;
+  p[1]=(i >> 8) & 0xff;
+  p[2]=(i >> 16) & 0xff;
+  p[3]=(i >> 24) & 0xff;
+  return p + 4;
+}
+
+unsigned char *SER_Recorder::write_long_int_le(unsigned char *p, uint64_t i) {
+  p=write_int_le(p, (unsigned int)(i & 0xffffffff));
+  return write_int_le(p, (unsigned int)(i >> 32));
+}
+
+void SER_Recorder::write_header(ser_header *s, unsigned char *p) {
+  memcpy(p, s->FileID, 14); p+=14;
+  p=write_int_le(p, s->LuID);
+  p=write_int_le(p, s->ColorID);
+  p=write_int_le(p, s->LittleEndian);
+  p=write_int_le(p, s->ImageWidth);
+  p=write_int_le(p, s->ImageHeight);
+  p=write_int_le(p, s->PixelDepth);
+  p=write_int_le(p, s->FrameCount);
+  memcpy(p, s->Observer, 40); p+=40;
+  memcpy(p, s->Instrume, 40); p+=40;
+  memcpy(p, s->Telescope, 40); p+=40;
+  p=write_long_int_le(p, s->DateTime);
+  write_long_int_le(p, s->DateTime_UTC);
 }
 
 void SER_Recorder::init() {
@@ -166,37 +189,245 @@ bool SER_Recorder::setsize(unsigned int width, unsigned int height) {
   return true;
 }
 
+void SER_Recorder::set_frame_size() {
+  frame_size=serh.ImageWidth * serh.ImageHeight * (serh.PixelDepth <= 8 ? 1 : 2) * number_of_planes;
+}
+
+void SER_Recorder::setdirectio(bool d) {
+  use_direct=d;
+}
+
 bool SER_Recorder::open(const char *filename, char *errmsg) {
+  struct timespec rt, mono;
+  int flags=O_WRONLY | O_CREAT | O_TRUNC;
+
   if (streaming_active) return false;
   serh.FrameCount = 0;
-  serh.DateTime=-1; // no timestamp
-  serh.DateTime_UTC=-1; // no timestamp
-  if ((f=fopen(filename, "w")) == NULL) {
+  serh.DateTime=0; // from the first frame
+  serh.DateTime_UTC=0;
+  fd=-1;
+  direct=false;
+#ifdef O_DIRECT
+  if (use_direct) {
+    if ((fd=::open(filename, flags | O_DIRECT, 0666)) >= 0)
+      direct=true;
+    else if (errno == EINVAL)
+      IDLog("recorder: %s does not support O_DIRECT, using buffered writes\n", filename);
+  }
+#endif
+  if (fd < 0 && (fd=::open(filename, flags, 0666)) < 0) {
     snprintf(errmsg, ERRMSGSIZ, "recorder open error %d, %s\n", errno, strerror (errno));
     return false;
   }
-  write_header(&serh);
-  frame_size=serh.ImageWidth * serh.ImageHeight * (serh.PixelDepth <= 8 ? 1 : 2) * number_of_planes;
+
+  // v4l2 buffers are usually stamped with the monotonic clock
+  clock_gettime(CLOCK_REALTIME, &rt);
+  clock_gettime(CLOCK_MONOTONIC, &mono);
+  mono_offset=((int64_t)rt.tv_sec - mono.tv_sec) * (int64_t)SER_TICKS_PER_SEC + (rt.tv_nsec - mono.tv_nsec) / 100;
+
+  set_frame_size();
+  head=tail=0;
+  closing=false;
+  write_error=0;
+  timestamps.clear();
+  next_timestamp=0;
+  dropped=0;
+  maxqueued=0;
   streaming_active = true;
   return true;
 }
 
+/* Called with the first frame, once its size is known: make room for the
+   header and SER_RING_FRAMES frames, in whole blocks, and start writing. */
+bool SER_Recorder::start_writer() {
+  size_t size=SER_HEADER_SIZE + (size_t)SER_RING_FRAMES * frame_size;
+
+  if (size < SER_RING_MIN) size=SER_RING_MIN;
+  size=(size + SER_WRITE_BLOCK - 1) / SER_WRITE_BLOCK * SER_WRITE_BLOCK;
+  if (size != ring_size) {
+    free(ring);
+    ring_size=0;
+    if (posix_memalign((void **)&ring, 4096, size)) {
+      ring=NULL;
+      write_error=ENOMEM;
+      IDLog("recorder: can not allocate %lu bytes of buffers\n", (unsigned long)size);
+      return false;
+    }
+    ring_size=size;
+  }
+
+  // the header goes first so that blocks fall at aligned file offsets, it is rewritten on close
+  write_header(&serh, ring);
+  head=SER_HEADER_SIZE;
+  if (pthread_create(&thread, NULL, writer_thread, this)) {
+    write_error=errno;
+    return false;
+  }
+  writer_running=true;
+  return true;
+}
+
+void *SER_Recorder::writer_thread(void *arg) {
+  ((SER_Recorder *)arg)->writer();
+  return NULL;
+}
+
+// write whole blocks as they fill, close() writes what is left
+void SER_Recorder::writer() {
+  pthread_mutex_lock(&lock);
+  for (;;) {
+    while (!closing && !write_error && head - tail < SER_WRITE_BLOCK)
+      pthread_cond_wait(&cond, &lock);
+    uint64_t avail=head - tail;
+    if (write_error || avail < SER_WRITE_BLOCK) break;
+
+    size_t at=tail % ring_size;
+    size_t n=avail / SER_WRITE_BLOCK * SER_WRITE_BLOCK;
+    if (n > ring_size - at) n=ring_size - at;
+    uint64_t offset=tail;
+    pthread_mutex_unlock(&lock);
+    int err=write_all(ring + at, n, offset);
+    pthread_mutex_lock(&lock);
+    if (err) write_error=err;
+    else tail+=n;
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+int SER_Recorder::write_all(const unsigned char *p, size_t n, uint64_t offset) {
+  while (n > 0) {
+    ssize_t w=pwrite(fd, p, n, offset);
+    if (w < 0) {
+      if (errno == EINTR) continue;
+      return errno;
+    }
+    p+=w;
+    n-=w;
+    offset+=w;
+  }
+  return 0;
+}
+
+// frames queued but not yet on disk, with lock held
+unsigned int SER_Recorder::queued() {
+  uint64_t written=0;
+  if (frame_size && tail > SER_HEADER_SIZE)
+    written=(tail - SER_HEADER_SIZE) / frame_size;
+  return serh.FrameCount - (unsigned int)written;
+}
+
 bool SER_Recorder::close() {
-  fseek(f, 0L, SEEK_SET);
-  write_header(&serh);
-  fclose(f);
+  unsigned char h[SER_HEADER_SIZE];
+  int err;
+
+  if (!streaming_active) return false;
+  if (writer_running) {
+    pthread_mutex_lock(&lock);
+    closing=true;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&lock);
+    pthread_join(thread, NULL);
+    writer_running=false;
+  }
+
+  // the rest is not a whole block
+#ifdef O_DIRECT
+  if (direct) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+#endif
+  if (!write_error && head > tail) {
+    size_t at=tail % ring_size, n=head - tail;
+    size_t n1=(n > ring_size - at) ? ring_size - at : n;
+    write_error=write_all(ring + at, n1, tail);
+    if (!write_error && n > n1)
+      write_error=write_all(ring, n - n1, tail + n1);
+  }
+
+  // SER V3 trailer: the UTC timestamp of each frame
+  if (!write_error && useSER_V3 && !timestamps.empty()) {
+    std::vector<unsigned char> trailer(timestamps.size() * 8);
+    for (size_t i = 0; i < timestamps.size(); i++)
+      write_long_int_le(&trailer[i * 8], timestamps[i]);
+    write_error=write_all(&trailer[0], trailer.size(), head);
+  }
+
+  write_header(&serh, h);
+  err=write_all(h, SER_HEADER_SIZE, 0);
+  if (!write_error) write_error=err;
+  if (write_error)
+    IDLog("recorder: write error %d, %s\n", write_error, strerror(write_error));
+  if (dropped)
+    IDLog("recorder: %lu frames dropped, the disk could not keep up\n", dropped);
+  ::close(fd);
+  fd=-1;
   streaming_active = false;
-  return true;
+  return (write_error == 0);
+}
+
+void SER_Recorder::settimestamp(const struct v4l2_buffer *buf) {
+  if (buf->timestamp.tv_sec == 0 && buf->timestamp.tv_usec == 0) {
+    next_timestamp=0;
+    return;
+  }
+  next_timestamp=ser_ticks(&buf->timestamp);
+#ifdef V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC
+  if ((buf->flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC)
+    next_timestamp+=mono_offset;
+#endif
 }
 
 bool SER_Recorder::writeFrame(unsigned char *frame) {
-  if (!streaming_active) return false;
-  //IDLog("recorder: writeFrame @ %p\n", frame);
-  fwrite(frame, frame_size, 1, f);
+  uint64_t ts=next_timestamp;
+  bool full;
+
+  if (!streaming_active || frame_size == 0) return false;
+  next_timestamp=0;
+  if (ts == 0) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    ts=ser_ticks(&tv);
+  }
+  if (!writer_running && (write_error || !start_writer())) return false;
+
+  pthread_mutex_lock(&lock);
+  full=(write_error != 0) || (head + frame_size - tail > ring_size);
+  if (full) dropped++;
+  pthread_mutex_unlock(&lock);
+  if (full) return false;
+
+  // only this thread moves head, and the writer stays behind it
+  size_t at=head % ring_size, n=frame_size;
+  if (n > ring_size - at) n=ring_size - at;
+  memcpy(ring + at, frame, n);
+  memcpy(ring, frame + n, frame_size - n);
+
+  pthread_mutex_lock(&lock);
+  head+=frame_size;
   serh.FrameCount+=1;
+  unsigned int q=queued();
+  if (q > maxqueued) maxqueued=q;
+  if (head - tail >= SER_WRITE_BLOCK) pthread_cond_signal(&cond);
+  pthread_mutex_unlock(&lock);
+
+  if (timestamps.empty()) {
+    time_t t=ts / SER_TICKS_PER_SEC - SER_UNIX_EPOCH;
+    struct tm tm;
+    localtime_r(&t, &tm);
+    serh.DateTime_UTC=ts;
+    serh.DateTime=ts + tm.tm_gmtoff * (int64_t)SER_TICKS_PER_SEC;
+  }
+  timestamps.push_back(ts);
   return true;
 }
 
+void SER_Recorder::getstats(V4L2_Recorder_Stats *stats) {
+  pthread_mutex_lock(&lock);
+  stats->frames=serh.FrameCount;
+  stats->dropped=dropped;
+  stats->queued=streaming_active ? queued() : 0;
+  stats->maxqueued=maxqueued;
+  pthread_mutex_unlock(&lock);
+}
+
 
 // ajouter une gestion plus fine du mode par defaut
 // setMono/setColor appelee par ImageTypeSP
@@ -214,10 +445,118 @@ void SER_Recorder::setDefaultMono() {
   number_of_planes=1;
   serh.PixelDepth =8;
   serh.ColorID=SER_MONO; 
+  set_frame_size();
 } 
 
 void SER_Recorder::setDefaultColor() {
   number_of_planes=3;
   serh.PixelDepth =8;
   serh.ColorID=SER_RGB;
+  set_frame_size();
+}
+
+#if defined(SER_RECORDER_BENCH)
+
+/* Record frames from a synthetic source, as fast as possible or at a given
+   rate, buffered and with O_DIRECT, and compare with one fwrite per frame.
+   ser_recorder_bench [file] [frames] [fps] */
+
+#include <stdarg.h>
+#include <sys/stat.h>
+
+void IDLog(const char *fmt, ...)
+{
+  va_list ap;
+  va_start(ap, fmt);
+  vfprintf(stderr, fmt, ap);
+  va_end(ap);
+}
+
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
 }
+
+int main(int argc, char *argv[])
+{
+  const char *file = argc > 1 ? argv[1] : "/tmp/ser_recorder_bench.ser";
+  unsigned int nframes = argc > 2 ? atoi(argv[2]) : 500;
+  double fps = argc > 3 ? atof(argv[3]) : 0;
+  const unsigned int w = 1280, h = 960, fs = w * h, nsrc = 4;
+  unsigned char *src[nsrc];
+  char errmsg[ERRMSGSIZ];
+
+  for (unsigned int i = 0; i < nsrc; i++) {
+    src[i] = (unsigned char *) malloc(fs);
+    for (unsigned int j = 0; j < fs; j++)
+      src[i][j] = (j * 7 + i * 31) & 0xff;
+  }
+  printf("%u frames of %ux%u GREY to %s, %s\n", nframes, w, h, file,
+         fps > 0 ? "paced" : "unpaced");
+
+  /* what the recorder used to do: one fwrite per frame in the capture thread */
+  {
+    FILE *f = fopen(file, "w");
+    double t0 = now(), maxcall = 0;
+    for (unsigned int i = 0; i < nframes; i++) {
+      double t = now();
+      fwrite(src[i % nsrc], fs, 1, f);
+      t = now() - t;
+      if (t > maxcall) maxcall = t;
+    }
+    fclose(f);
+    double t = now() - t0;
+    printf("  fwrite      %7.1f MB/s  longest call %6.2f ms\n", nframes * (double) fs / t / 1e6, maxcall * 1e3);
+  }
+
+  for (int d = 0; d < 2; d++) {
+    SER_Recorder r;
+    V4L2_Recorder_Stats st;
+    struct v4l2_buffer buf;
+    double t0, maxcall = 0, sumcall = 0;
+
+    r.setdirectio(d);
+    r.setpixelformat(V4L2_PIX_FMT_GREY);
+    r.setsize(w, h);
+    if (!r.open(file, errmsg)) {
+      printf("%s", errmsg);
+      return 1;
+    }
+    memset(&buf, 0, sizeof(buf));
+    t0 = now();
+    for (unsigned int i = 0; i < nframes; i++) {
+      struct timespec ts;
+      if (fps > 0)
+        while (now() - t0 < i / fps)
+          usleep(100);
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      buf.timestamp.tv_sec = ts.tv_sec;
+      buf.timestamp.tv_usec = ts.tv_nsec / 1000;
+#ifdef V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC
+      buf.flags = V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+#endif
+      double t = now();
+      r.settimestamp(&buf);
+      r.writeFrame(src[i % nsrc]);
+      t = now() - t;
+      sumcall += t;
+      if (t > maxcall) maxcall = t;
+    }
+    r.getstats(&st);
+    r.close();
+    double t = now() - t0;
+
+    struct stat sb;
+    stat(file, &sb);
+    bool ok = (unsigned long long) sb.st_size == SER_HEADER_SIZE + (unsigned long long) st.frames * (fs + 8);
+    printf("  ring%-7s %7.1f MB/s  longest call %6.2f ms  mean call %6.3f ms  frames %lu  dropped %lu  max queue %u  size %s\n",
+           d ? "+direct" : "", st.frames * (double) fs / t / 1e6, maxcall * 1e3, sumcall / nframes * 1e3,
+           st.frames, st.dropped, st.maxqueued, ok ? "ok" : "WRONG");
+  }
+  unlink(file);
+  return 0;
+}
+
+#endif
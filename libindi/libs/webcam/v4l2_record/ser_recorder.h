@@ -25,6 +25,9 @@
 #include "v4l2_record.h"
 #include <linux/videodev2.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <vector>
 
 typedef struct ser_header {
   char FileID[14];
@@ -38,10 +41,12 @@ typedef struct ser_header {
   char Observer[40];
   char Instrume[40];
   char Telescope[40];
-  unsigned long int DateTime;
-  unsigned long int DateTime_UTC;
+  uint64_t DateTime;
+  uint64_t DateTime_UTC;
 } ser_header;
 
+#define SER_HEADER_SIZE 178
+
 enum ser_color_id {
   SER_MONO = 0,
   SER_BAYER_RGGB = 8,
@@ -59,6 +64,16 @@ enum ser_color_id {
 #define SER_BIG_ENDIAN 0
 #define SER_LITTLE_ENDIAN 1
 
+/* Frames are copied into a ring of preallocated, page aligned memory and
+   written by a thread in SER_WRITE_BLOCK chunks at block aligned file
+   offsets, so the capture thread never waits on the disk and the file can
+   be opened with O_DIRECT. When the ring is full, frames are dropped and
+   counted rather than holding the V4L2 buffer. Each frame gets a timestamp
+   from its v4l2_buffer, written in the SER V3 trailer. */
+#define SER_WRITE_BLOCK (1024 * 1024)   // bytes per write, a multiple of the page size
+#define SER_RING_MIN    (64 * SER_WRITE_BLOCK) // smallest ring
+#define SER_RING_FRAMES 16              // ring holds at least this many frames
+
 class SER_Recorder: public V4L2_Recorder
 {
  public:
@@ -77,19 +92,51 @@ class SER_Recorder: public V4L2_Recorder
   virtual bool writeFrameColor(unsigned char *frame); // default way to write a RGB3 frame
   virtual void setDefaultMono(); // prepare to write GREY frame
   virtual void setDefaultColor(); // prepare to write RGB24 frame
+  virtual void settimestamp(const struct v4l2_buffer *buf);
+  virtual void setdirectio(bool direct);
+  virtual void getstats(V4L2_Recorder_Stats *stats);
 
 
  protected:
   bool is_little_endian();
-  void write_int_le(unsigned int *i);
-  void write_long_int_le(unsigned long *i);
-  void write_header(ser_header *s);
+  unsigned char *write_int_le(unsigned char *p, unsigned int i);
+  unsigned char *write_long_int_le(unsigned char *p, uint64_t i);
+  void write_header(ser_header *s, unsigned char *p);
+  void set_frame_size();
+  int write_all(const unsigned char *p, size_t n, uint64_t offset);
+  bool start_writer();
+  static void *writer_thread(void *arg);
+  void writer();
+  unsigned int queued();
   ser_header serh;
   bool streaming_active;
   bool useSER_V3;
-  FILE *f;
+  int fd;
   unsigned int frame_size;
   unsigned int number_of_planes;
+
+  // ring of frames waiting to be written, head and tail count bytes since the start of the file
+  unsigned char *ring;
+  size_t ring_size;
+  uint64_t head;                // end of the last frame queued
+  uint64_t tail;                // bytes written to the file
+  bool closing;
+  int write_error;              // errno of the first failed write
+  bool writer_running;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+
+  bool use_direct;              // open with O_DIRECT
+  bool direct;                  // file is open with O_DIRECT
+
+  // frame timestamps, 100ns ticks since 0001-01-01 UTC
+  std::vector<uint64_t> timestamps;
+  uint64_t next_timestamp;      // from settimestamp, 0 when none
+  int64_t mono_offset;          // realtime minus monotonic clock, in ticks
+
+  unsigned long dropped;
+  unsigned int maxqueued;
 };
 
 #endif // SER_RECORDER_H
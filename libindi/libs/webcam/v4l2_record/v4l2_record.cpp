@@ -32,6 +32,19 @@ const char *V4L2_Recorder::getName() {
   return name;
 }
 
+void V4L2_Recorder::settimestamp(const struct v4l2_buffer *buf) {
+}
+
+void V4L2_Recorder::setdirectio(bool direct) {
+}
+
+void V4L2_Recorder::getstats(V4L2_Recorder_Stats *stats) {
+  stats->frames=0;
+  stats->dropped=0;
+  stats->queued=0;
+  stats->maxqueued=0;
+}
+
 V4L2_Record::V4L2_Record() {
   recorder_list.push_back(new SER_Recorder());
   default_recorder=recorder_list.at(0);
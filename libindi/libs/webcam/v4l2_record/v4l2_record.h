@@ -29,6 +29,13 @@
 
 #include <vector>
 
+struct V4L2_Recorder_Stats {
+  unsigned long frames;   // frames recorded
+  unsigned long dropped;  // frames dropped because the disk could not keep up
+  unsigned int queued;    // frames waiting to be written
+  unsigned int maxqueued; // most frames waiting since open
+};
+
 class V4L2_Recorder
 {
 public:
@@ -46,6 +53,9 @@ virtual bool writeFrameMono(unsigned char *frame)=0; // default way to write a G
 virtual bool writeFrameColor(unsigned char *frame)=0; // default way to write a RGB24 frame
 virtual void setDefaultMono()=0; // prepare to write GREY frame
 virtual void setDefaultColor()=0; // prepare to write RGB24 frame
+virtual void settimestamp(const struct v4l2_buffer *buf); // buffer of the next frame written, for its timestamp
+virtual void setdirectio(bool direct); // bypass the page cache when writing
+virtual void getstats(V4L2_Recorder_Stats *stats);
 
 protected:
 const char *name;
@@ -0,0 +1,650 @@
+/*
+    V4L2 Stack
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Define V4L2_STACK_BENCH for a stand-alone program that checks the SIMD
+    kernels against the scalar ones and times them on HD frames.
+*/
+
+#include "v4l2_stack.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__clang__) || \
+	__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define V4L2_STACK_X86
+#include <immintrin.h>
+#endif
+
+/* Kernels. Each works on n samples; frames of a batch are stride bytes apart.
+   The SIMD versions leave the last few samples to the scalar ones, and give
+   the same results bit for bit. */
+typedef void (*AddFunc)(unsigned int *sum, const unsigned char *src, size_t n);
+typedef void (*SplitFunc)(const unsigned char *src, unsigned char *red, unsigned char *green,
+                          unsigned char *blue, size_t n);
+typedef void (*MedianFunc)(const unsigned char *frames, size_t stride, unsigned int nf,
+                           unsigned int *sum, size_t n);
+typedef void (*SigmaFunc)(const unsigned char *frames, size_t stride, unsigned int nf, float k2,
+                          unsigned int *sum, size_t n);
+
+static struct {
+  AddFunc add;
+  SplitFunc split;
+  MedianFunc median;
+  SigmaFunc sigma;
+} impl;
+
+static void addScalar(unsigned int *sum, const unsigned char *src, size_t n)
+{
+  for (size_t i = 0; i < n; i++)
+    sum[i] += src[i];
+}
+
+static void splitScalar(const unsigned char *src, unsigned char *red, unsigned char *green,
+                        unsigned char *blue, size_t n)
+{
+  for (size_t i = 0; i < n; i++, src += 4) {
+    blue[i] = src[0];
+    green[i] = src[1];
+    red[i] = src[2];
+  }
+}
+
+/* add the median of each sample, the mean of the middle two when nf is even, scaled by 256 */
+static void medianScalar(const unsigned char *frames, size_t stride, unsigned int nf,
+                         unsigned int *sum, size_t n)
+{
+  unsigned char v[V4L2_STACK_MAXBATCH];
+
+  for (size_t i = 0; i < n; i++) {
+    for (unsigned int f = 0; f < nf; f++) {
+      unsigned char x = frames[f * stride + i];
+      unsigned int j = f;
+      for (; j > 0 && v[j - 1] > x; j--)
+        v[j] = v[j - 1];
+      v[j] = x;
+    }
+    sum[i] += (v[(nf - 1) / 2] + v[nf / 2]) * 128;
+  }
+}
+
+/* add the mean of the values of each sample whose square distance to their
+   mean is at most k2 times their variance, or of all if none are, scaled by 256 */
+static void sigmaScalar(const unsigned char *frames, size_t stride, unsigned int nf, float k2,
+                        unsigned int *sum, size_t n)
+{
+  float fn = (float) nf;
+
+  for (size_t i = 0; i < n; i++) {
+    float s = 0, q = 0, ks = 0, kn = 0;
+    for (unsigned int f = 0; f < nf; f++) {
+      float x = frames[f * stride + i];
+      s = s + x;
+      q = q + x * x;
+    }
+    float m = s / fn;
+    float t = k2 * (q / fn - m * m);
+    for (unsigned int f = 0; f < nf; f++) {
+      float x = frames[f * stride + i];
+      float d = x - m;
+      if (d * d <= t) {
+        ks = ks + x;
+        kn = kn + 1;
+      }
+    }
+    if (kn == 0) {
+      ks = s;
+      kn = fn;
+    }
+    sum[i] += (unsigned int) (ks * 256.0f / kn + 0.5f);
+  }
+}
+
+#ifdef V4L2_STACK_X86
+
+__attribute__((target("sse2")))
+static void addSSE2(unsigned int *sum, const unsigned char *src, size_t n)
+{
+  const __m128i z = _mm_setzero_si128();
+  size_t i;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i *) (src + i));
+    __m128i lo = _mm_unpacklo_epi8(x, z), hi = _mm_unpackhi_epi8(x, z);
+    __m128i *s = (__m128i *) (sum + i);
+    _mm_storeu_si128(s, _mm_add_epi32(_mm_loadu_si128(s), _mm_unpacklo_epi16(lo, z)));
+    _mm_storeu_si128(s + 1, _mm_add_epi32(_mm_loadu_si128(s + 1), _mm_unpackhi_epi16(lo, z)));
+    _mm_storeu_si128(s + 2, _mm_add_epi32(_mm_loadu_si128(s + 2), _mm_unpacklo_epi16(hi, z)));
+    _mm_storeu_si128(s + 3, _mm_add_epi32(_mm_loadu_si128(s + 3), _mm_unpackhi_epi16(hi, z)));
+  }
+  addScalar(sum + i, src + i, n - i);
+}
+
+/* the low byte of each of 16 pixels in p, after shifting them right by shift bits */
+__attribute__((target("sse2")))
+static inline __m128i pickSSE2(const __m128i *p, int shift)
+{
+  const __m128i m = _mm_set1_epi32(0xff);
+  __m128i a = _mm_and_si128(_mm_srli_epi32(p[0], shift), m);
+  __m128i b = _mm_and_si128(_mm_srli_epi32(p[1], shift), m);
+  __m128i c = _mm_and_si128(_mm_srli_epi32(p[2], shift), m);
+  __m128i d = _mm_and_si128(_mm_srli_epi32(p[3], shift), m);
+  return _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+}
+
+__attribute__((target("sse2")))
+static void splitSSE2(const unsigned char *src, unsigned char *red, unsigned char *green,
+                      unsigned char *blue, size_t n)
+{
+  size_t i;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    __m128i p[4];
+    for (int k = 0; k < 4; k++)
+      p[k] = _mm_loadu_si128((const __m128i *) (src + 4 * i) + k);
+    _mm_storeu_si128((__m128i *) (blue + i), pickSSE2(p, 0));
+    _mm_storeu_si128((__m128i *) (green + i), pickSSE2(p, 8));
+    _mm_storeu_si128((__m128i *) (red + i), pickSSE2(p, 16));
+  }
+  splitScalar(src + 4 * i, red + i, green + i, blue + i, n - i);
+}
+
+/* odd-even transposition sort of 16 or 32 samples at a time across the frames */
+__attribute__((target("sse2")))
+static void medianSSE2(const unsigned char *frames, size_t stride, unsigned int nf,
+                       unsigned int *sum, size_t n)
+{
+  const __m128i z = _mm_setzero_si128();
+  __m128i v[V4L2_STACK_MAXBATCH];
+  size_t i;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    for (unsigned int f = 0; f < nf; f++)
+      v[f] = _mm_loadu_si128((const __m128i *) (frames + f * stride + i));
+    for (unsigned int r = 0; r < nf; r++)
+      for (unsigned int j = r & 1; j + 1 < nf; j += 2) {
+        __m128i lo = _mm_min_epu8(v[j], v[j + 1]);
+        v[j + 1] = _mm_max_epu8(v[j], v[j + 1]);
+        v[j] = lo;
+      }
+    __m128i a = v[(nf - 1) / 2], b = v[nf / 2];
+    __m128i lo = _mm_slli_epi16(_mm_add_epi16(_mm_unpacklo_epi8(a, z), _mm_unpacklo_epi8(b, z)), 7);
+    __m128i hi = _mm_slli_epi16(_mm_add_epi16(_mm_unpackhi_epi8(a, z), _mm_unpackhi_epi8(b, z)), 7);
+    __m128i *s = (__m128i *) (sum + i);
+    _mm_storeu_si128(s, _mm_add_epi32(_mm_loadu_si128(s), _mm_unpacklo_epi16(lo, z)));
+    _mm_storeu_si128(s + 1, _mm_add_epi32(_mm_loadu_si128(s + 1), _mm_unpackhi_epi16(lo, z)));
+    _mm_storeu_si128(s + 2, _mm_add_epi32(_mm_loadu_si128(s + 2), _mm_unpacklo_epi16(hi, z)));
+    _mm_storeu_si128(s + 3, _mm_add_epi32(_mm_loadu_si128(s + 3), _mm_unpackhi_epi16(hi, z)));
+  }
+  medianScalar(frames + i, stride, nf, sum + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static inline __m128 load4SSE2(const unsigned char *p)
+{
+  const __m128i z = _mm_setzero_si128();
+  int v;
+  memcpy(&v, p, sizeof(v));
+  __m128i x = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(v), z), z);
+  return _mm_cvtepi32_ps(x);
+}
+
+__attribute__((target("sse2")))
+static void sigmaSSE2(const unsigned char *frames, size_t stride, unsigned int nf, float k2,
+                      unsigned int *sum, size_t n)
+{
+  const __m128 fn = _mm_set1_ps((float) nf), kk = _mm_set1_ps(k2), one = _mm_set1_ps(1.0f);
+  const __m128 c256 = _mm_set1_ps(256.0f), half = _mm_set1_ps(0.5f), z = _mm_setzero_ps();
+  size_t i;
+
+  for (i = 0; i + 4 <= n; i += 4) {
+    __m128 s = z, q = z, ks = z, kn = z;
+    for (unsigned int f = 0; f < nf; f++) {
+      __m128 x = load4SSE2(frames + f * stride + i);
+      s = _mm_add_ps(s, x);
+      q = _mm_add_ps(q, _mm_mul_ps(x, x));
+    }
+    __m128 m = _mm_div_ps(s, fn);
+    __m128 t = _mm_mul_ps(kk, _mm_sub_ps(_mm_div_ps(q, fn), _mm_mul_ps(m, m)));
+    for (unsigned int f = 0; f < nf; f++) {
+      __m128 x = load4SSE2(frames + f * stride + i);
+      __m128 d = _mm_sub_ps(x, m);
+      __m128 keep = _mm_cmple_ps(_mm_mul_ps(d, d), t);
+      ks = _mm_add_ps(ks, _mm_and_ps(keep, x));
+      kn = _mm_add_ps(kn, _mm_and_ps(keep, one));
+    }
+    __m128 none = _mm_cmpeq_ps(kn, z);
+    ks = _mm_or_ps(_mm_and_ps(none, s), _mm_andnot_ps(none, ks));
+    kn = _mm_or_ps(_mm_and_ps(none, fn), _mm_andnot_ps(none, kn));
+    __m128i r = _mm_cvttps_epi32(_mm_add_ps(_mm_div_ps(_mm_mul_ps(ks, c256), kn), half));
+    __m128i *p = (__m128i *) (sum + i);
+    _mm_storeu_si128(p, _mm_add_epi32(_mm_loadu_si128(p), r));
+  }
+  sigmaScalar(frames + i, stride, nf, k2, sum + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void addAVX2(unsigned int *sum, const unsigned char *src, size_t n)
+{
+  size_t i;
+
+  for (i = 0; i + 32 <= n; i += 32)
+    for (int k = 0; k < 4; k++) {
+      __m256i x = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (src + i + 8 * k)));
+      __m256i *s = (__m256i *) (sum + i + 8 * k);
+      _mm256_storeu_si256(s, _mm256_add_epi32(_mm256_loadu_si256(s), x));
+    }
+  addScalar(sum + i, src + i, n - i);
+}
+
+/* as pickSSE2() for 32 pixels. the packs work within 128 bit lanes, so put
+   the 4 byte groups back in order after */
+__attribute__((target("avx2")))
+static inline __m256i pickAVX2(const __m256i *p, int shift)
+{
+  const __m256i m = _mm256_set1_epi32(0xff);
+  const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+  __m256i a = _mm256_and_si256(_mm256_srli_epi32(p[0], shift), m);
+  __m256i b = _mm256_and_si256(_mm256_srli_epi32(p[1], shift), m);
+  __m256i c = _mm256_and_si256(_mm256_srli_epi32(p[2], shift), m);
+  __m256i d = _mm256_and_si256(_mm256_srli_epi32(p[3], shift), m);
+  __m256i x = _mm256_packus_epi16(_mm256_packs_epi32(a, b), _mm256_packs_epi32(c, d));
+  return _mm256_permutevar8x32_epi32(x, order);
+}
+
+__attribute__((target("avx2")))
+static void splitAVX2(const unsigned char *src, unsigned char *red, unsigned char *green,
+                      unsigned char *blue, size_t n)
+{
+  size_t i;
+
+  for (i = 0; i + 32 <= n; i += 32) {
+    __m256i p[4];
+    for (int k = 0; k < 4; k++)
+      p[k] = _mm256_loadu_si256((const __m256i *) (src + 4 * i) + k);
+    _mm256_storeu_si256((__m256i *) (blue + i), pickAVX2(p, 0));
+    _mm256_storeu_si256((__m256i *) (green + i), pickAVX2(p, 8));
+    _mm256_storeu_si256((__m256i *) (red + i), pickAVX2(p, 16));
+  }
+  splitScalar(src + 4 * i, red + i, green + i, blue + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static inline void addMidAVX2(unsigned int *sum, __m128i a, __m128i b)
+{
+  __m256i m = _mm256_slli_epi16(_mm256_add_epi16(_mm256_cvtepu8_epi16(a), _mm256_cvtepu8_epi16(b)), 7);
+  __m256i *s = (__m256i *) sum;
+  _mm256_storeu_si256(s, _mm256_add_epi32(_mm256_loadu_si256(s),
+                      _mm256_cvtepu16_epi32(_mm256_castsi256_si128(m))));
+  _mm256_storeu_si256(s + 1, _mm256_add_epi32(_mm256_loadu_si256(s + 1),
+                      _mm256_cvtepu16_epi32(_mm256_extracti128_si256(m, 1))));
+}
+
+__attribute__((target("avx2")))
+static void medianAVX2(const unsigned char *frames, size_t stride, unsigned int nf,
+                       unsigned int *sum, size_t n)
+{
+  __m256i v[V4L2_STACK_MAXBATCH];
+  size_t i;
+
+  for (i = 0; i + 32 <= n; i += 32) {
+    for (unsigned int f = 0; f < nf; f++)
+      v[f] = _mm256_loadu_si256((const __m256i *) (frames + f * stride + i));
+    for (unsigned int r = 0; r < nf; r++)
+      for (unsigned int j = r & 1; j + 1 < nf; j += 2) {
+        __m256i lo = _mm256_min_epu8(v[j], v[j + 1]);
+        v[j + 1] = _mm256_max_epu8(v[j], v[j + 1]);
+        v[j] = lo;
+      }
+    __m256i a = v[(nf - 1) / 2], b = v[nf / 2];
+    addMidAVX2(sum + i, _mm256_castsi256_si128(a), _mm256_castsi256_si128(b));
+    addMidAVX2(sum + i + 16, _mm256_extracti128_si256(a, 1), _mm256_extracti128_si256(b, 1));
+  }
+  medianScalar(frames + i, stride, nf, sum + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256 load8AVX2(const unsigned char *p)
+{
+  return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) p)));
+}
+
+__attribute__((target("avx2")))
+static void sigmaAVX2(const unsigned char *frames, size_t stride, unsigned int nf, float k2,
+                      unsigned int *sum, size_t n)
+{
+  const __m256 fn = _mm256_set1_ps((float) nf), kk = _mm256_set1_ps(k2), one = _mm256_set1_ps(1.0f);
+  const __m256 c256 = _mm256_set1_ps(256.0f), half = _mm256_set1_ps(0.5f), z = _mm256_setzero_ps();
+  size_t i;
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    __m256 s = z, q = z, ks = z, kn = z;
+    for (unsigned int f = 0; f < nf; f++) {
+      __m256 x = load8AVX2(frames + f * stride + i);
+      s = _mm256_add_ps(s, x);
+      q = _mm256_add_ps(q, _mm256_mul_ps(x, x));
+    }
+    __m256 m = _mm256_div_ps(s, fn);
+    __m256 t = _mm256_mul_ps(kk, _mm256_sub_ps(_mm256_div_ps(q, fn), _mm256_mul_ps(m, m)));
+    for (unsigned int f = 0; f < nf; f++) {
+      __m256 x = load8AVX2(frames + f * stride + i);
+      __m256 d = _mm256_sub_ps(x, m);
+      __m256 keep = _mm256_cmp_ps(_mm256_mul_ps(d, d), t, _CMP_LE_OQ);
+      ks = _mm256_add_ps(ks, _mm256_and_ps(keep, x));
+      kn = _mm256_add_ps(kn, _mm256_and_ps(keep, one));
+    }
+    __m256 none = _mm256_cmp_ps(kn, z, _CMP_EQ_OQ);
+    ks = _mm256_blendv_ps(ks, s, none);
+    kn = _mm256_blendv_ps(kn, fn, none);
+    __m256i r = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_div_ps(_mm256_mul_ps(ks, c256), kn), half));
+    __m256i *p = (__m256i *) (sum + i);
+    _mm256_storeu_si256(p, _mm256_add_epi32(_mm256_loadu_si256(p), r));
+  }
+  sigmaScalar(frames + i, stride, nf, k2, sum + i, n - i);
+}
+
+#endif /* V4L2_STACK_X86 */
+
+/* choose the fastest kernels this cpu supports */
+static void pickImpl()
+{
+  impl.add = addScalar;
+  impl.split = splitScalar;
+  impl.median = medianScalar;
+  impl.sigma = sigmaScalar;
+#ifdef V4L2_STACK_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    impl.add = addAVX2;
+    impl.split = splitAVX2;
+    impl.median = medianAVX2;
+    impl.sigma = sigmaAVX2;
+  } else if (__builtin_cpu_supports("sse2")) {
+    impl.add = addSSE2;
+    impl.split = splitSSE2;
+    impl.median = medianSSE2;
+    impl.sigma = sigmaSSE2;
+  }
+#endif
+}
+
+V4L2_Stacker::V4L2_Stacker() {
+  mode=STACK_NONE;
+  npixels=0;
+  nplanes=0;
+  nsamples=0;
+  count=0;
+  sum=NULL;
+  batch=NULL;
+  batchsize=8;
+  nbatch=0;
+  nbatches=0;
+  planar=NULL;
+  sigma=2.5;
+  if (!impl.add)
+    pickImpl();
+}
+
+V4L2_Stacker::~V4L2_Stacker() {
+  free(sum);
+  free(batch);
+  free(planar);
+}
+
+void V4L2_Stacker::setMode(int m) {
+  if (m == mode) return;
+  mode=m;
+  reset();
+}
+
+void V4L2_Stacker::setBatch(unsigned int n) {
+  if (n < 2) n=2;
+  if (n > V4L2_STACK_MAXBATCH) n=V4L2_STACK_MAXBATCH;
+  if (n == batchsize) return;
+  batchsize=n;
+  free(batch);
+  batch=NULL;
+  reset();
+}
+
+void V4L2_Stacker::setSigma(double k) {
+  sigma=(float)k;
+}
+
+bool V4L2_Stacker::setsize(unsigned int npix, unsigned int npl) {
+  if (sum && npix == npixels && npl == nplanes) {
+    reset();
+    return true;
+  }
+
+  free(sum);
+  free(batch);
+  free(planar);
+  batch=NULL;
+  planar=NULL;
+  npixels=npix;
+  nplanes=npl;
+  nsamples=(size_t)npix * npl;
+  sum=(unsigned int *)malloc(nsamples * sizeof(unsigned int));
+  if (npl == 3)
+    planar=(unsigned char *)malloc(nsamples);
+  if (!sum || (npl == 3 && !planar)) {
+    free(sum);
+    sum=NULL;
+    return false;
+  }
+  reset();
+  return true;
+}
+
+void V4L2_Stacker::reset() {
+  count=0;
+  nbatch=0;
+  nbatches=0;
+  if (sum)
+    memset(sum, 0, nsamples * sizeof(unsigned int));
+}
+
+void V4L2_Stacker::splitBGRA(const unsigned char *src, unsigned char *red, unsigned char *green,
+                             unsigned char *blue, size_t npixels) {
+  if (!impl.split)
+    pickImpl();
+  impl.split(src, red, green, blue, npixels);
+}
+
+void V4L2_Stacker::addFrameGrey(const unsigned char *frame) {
+  addPlanes(frame);
+}
+
+void V4L2_Stacker::addFrameBGRA(const unsigned char *frame) {
+  if (!planar) return;
+  impl.split(frame, planar, planar + npixels, planar + 2 * npixels, npixels);
+  addPlanes(planar);
+}
+
+void V4L2_Stacker::addPlanes(const unsigned char *frame) {
+  if (!sum) return;
+
+  if (mode == STACK_SIGMA || mode == STACK_MEDIAN) {
+    if (!batch)
+      batch=(unsigned char *)malloc(batchsize * nsamples);
+    if (batch) {
+      memcpy(batch + nbatch * nsamples, frame, nsamples);
+      count++;
+      if (++nbatch == batchsize)
+        flushBatch();
+      return;
+    }
+    // no room for a batch, stack the mean instead
+    mode=STACK_MEAN;
+    reset();
+  }
+
+  impl.add(sum, frame, nsamples);
+  count++;
+}
+
+void V4L2_Stacker::flushBatch() {
+  if (nbatch == 0) return;
+  if (mode == STACK_MEDIAN)
+    impl.median(batch, nsamples, nbatch, sum, nsamples);
+  else
+    impl.sigma(batch, nsamples, nbatch, sigma * sigma, sum, nsamples);
+  nbatches++;
+  nbatch=0;
+}
+
+unsigned int V4L2_Stacker::getBPP() {
+  switch (mode) {
+  case STACK_NONE: return 8;
+  case STACK_ADD: return 32;
+  default: return 16;
+  }
+}
+
+void V4L2_Stacker::getResult(void *dest) {
+  if (!sum) return;
+
+  switch (mode) {
+  case STACK_NONE:
+    memset(dest, 0, nsamples);
+    break;
+  case STACK_ADD:
+    memcpy(dest, sum, nsamples * sizeof(unsigned int));
+    break;
+  case STACK_MEAN: {
+    unsigned short *out=(unsigned short *)dest;
+    unsigned long long n=count ? count : 1;
+    for (size_t i = 0; i < nsamples; i++)
+      out[i]=(unsigned short)((sum[i] * 256ULL + n / 2) / n);
+    break;
+  }
+  default: {
+    unsigned short *out=(unsigned short *)dest;
+    flushBatch();
+    unsigned int n=nbatches ? nbatches : 1;
+    for (size_t i = 0; i < nsamples; i++)
+      out[i]=(unsigned short)((sum[i] + n / 2) / n);
+    break;
+  }
+  }
+}
+
+#if defined(V4L2_STACK_BENCH)
+
+#include <stdio.h>
+#include <sys/time.h>
+
+static double now()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+int main(int ac, char *av[])
+{
+  const size_t npix = 1920 * 1080, nf = 8;
+  unsigned char *frames = (unsigned char *) malloc(nf * npix * 4);
+  unsigned char *planes[3][3];
+  unsigned int *sums[3];
+  struct {
+    const char *name;
+    AddFunc add;
+    SplitFunc split;
+    MedianFunc median;
+    SigmaFunc sigma;
+  } impls[] = {
+    {"scalar", addScalar, splitScalar, medianScalar, sigmaScalar},
+#ifdef V4L2_STACK_X86
+    {"sse2", addSSE2, splitSSE2, medianSSE2, sigmaSSE2},
+    {"avx2", addAVX2, splitAVX2, medianAVX2, sigmaAVX2},
+#endif
+  };
+  int nimpls = sizeof(impls) / sizeof(impls[0]), bad = 0;
+  double t;
+
+  srand(1);
+  for (size_t i = 0; i < nf * npix * 4; i++)
+    frames[i] = (rand() % 40) + ((i % 97) == 0 ? rand() % 200 : 100);
+
+  /* the byte loop this replaces */
+  unsigned char *dest = (unsigned char *) malloc(npix);
+  memset(dest, 0, npix);
+  t = now();
+  for (size_t f = 0; f < nf; f++) {
+    unsigned char *d = dest, *s = frames + f * npix;
+    for (size_t i = 0; i < npix; i++)
+      *(d++) += *(s++);
+  }
+  printf("1920x1080 grey, ms per frame\n  byte loop %6.2f\n", (now() - t) * 1e3 / nf);
+  free(dest);
+
+  for (int k = 0; k < nimpls; k++) {
+    /* touch every page now so the timings leave out page faults */
+    for (int p = 0; p < 3; p++) {
+      planes[k][p] = (unsigned char *) malloc(npix);
+      memset(planes[k][p], 0, npix);
+    }
+    sums[k] = (unsigned int *) malloc(npix * sizeof(unsigned int));
+    memset(sums[k], 0, npix * sizeof(unsigned int));
+  }
+
+  for (int k = 0; k < nimpls; k++) {
+    double tadd, tsplit, tmed, tsig;
+
+    t = now();
+    for (size_t f = 0; f < nf; f++)
+      impls[k].add(sums[k], frames + f * npix, npix);
+    tadd = (now() - t) / nf;
+
+    t = now();
+    for (size_t f = 0; f < nf; f++)
+      impls[k].split(frames + f * npix * 4, planes[k][0], planes[k][1], planes[k][2], npix);
+    tsplit = (now() - t) / nf;
+
+    t = now();
+    impls[k].median(frames, npix, nf, sums[k], npix);
+    tmed = (now() - t) / nf;
+
+    t = now();
+    impls[k].sigma(frames, npix, nf, 2.5f * 2.5f, sums[k], npix);
+    tsig = (now() - t) / nf;
+
+    /* odd sizes exercise the scalar tails */
+    impls[k].median(frames + 3, npix, 5, sums[k], npix - 7);
+    impls[k].sigma(frames + 5, npix, 3, 1.0f, sums[k], npix - 11);
+
+    printf("  %-9s add %6.2f  split BGRA %6.2f  median of %d %6.2f  sigma clip %6.2f\n",
+           impls[k].name, tadd * 1e3, tsplit * 1e3, (int) nf, tmed * 1e3, tsig * 1e3);
+
+    if (k > 0) {
+      if (memcmp(sums[k], sums[0], npix * sizeof(unsigned int))) {
+        printf("  %s sums differ from scalar\n", impls[k].name);
+        bad++;
+      }
+      for (int p = 0; p < 3; p++)
+        if (memcmp(planes[k][p], planes[0][p], npix)) {
+          printf("  %s plane %d differs from scalar\n", impls[k].name, p);
+          bad++;
+        }
+    }
+  }
+
+  return (bad != 0);
+}
+
+#endif
@@ -0,0 +1,81 @@
+/*
+    V4L2 Stack
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#ifndef V4L2_STACK_H
+#define V4L2_STACK_H
+
+#include <stddef.h>
+
+/* Stacks 8 bit video frames into one deeper image.
+   Frames are given as planes of samples: a GREY frame is one plane, a BGRA
+   frame is split into red, green and blue planes first. Sums are kept in
+   32 bits so they never overflow.
+   - Additive: the result is the sum of all frames, 32 bits per sample.
+   - Mean: the result is the mean of all frames scaled by 256, 16 bits.
+   - Sigma clip and median: frames are taken in batches. Each sample of a
+     batch is combined to the mean of the values within sigma standard
+     deviations of the batch mean, or to the median of the batch. The result
+     is the mean of the batches scaled by 256, 16 bits.
+   Additions use SSE2 or AVX2 when the processor has them. */
+
+#define V4L2_STACK_MAXBATCH 32
+
+class V4L2_Stacker
+{
+ public:
+  enum StackMode { STACK_NONE=0, STACK_ADD, STACK_MEAN, STACK_SIGMA, STACK_MEDIAN };
+
+  V4L2_Stacker();
+  ~V4L2_Stacker();
+
+  void setMode(int m);
+  int getMode() { return mode; }
+  void setBatch(unsigned int n); // frames per batch for sigma clip and median
+  void setSigma(double k); // clip beyond k standard deviations
+  bool setsize(unsigned int npixels, unsigned int nplanes); // frame size, restarts the stack
+  void reset(); // forget frames stacked so far
+  void addFrameGrey(const unsigned char *frame); // npixels samples
+  void addFrameBGRA(const unsigned char *frame); // npixels 4 byte pixels, for 3 planes
+  unsigned int getCount() { return count; }
+  unsigned int getBPP(); // bits per sample of the result
+  void getResult(void *dest); // npixels*nplanes samples of getBPP() bits, planes in turn
+
+  // de-interleave BGRA pixels into separate red, green and blue planes
+  static void splitBGRA(const unsigned char *src, unsigned char *red, unsigned char *green,
+                        unsigned char *blue, size_t npixels);
+
+ protected:
+  void addPlanes(const unsigned char *frame);
+  void flushBatch();
+
+  int mode;
+  unsigned int npixels;
+  unsigned int nplanes;
+  size_t nsamples;          // npixels*nplanes
+  unsigned int count;       // frames stacked
+  unsigned int *sum;        // per sample sums, or sums of batch results
+  unsigned char *batch;     // frames of the current batch, one after the other
+  unsigned int batchsize;
+  unsigned int nbatch;      // frames in the current batch
+  unsigned int nbatches;    // batches added to sum
+  unsigned char *planar;    // BGRA frame split in planes
+  float sigma;
+};
+
+#endif // V4L2_STACK_H